@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include "bench.h"
+
+std::vector<bench::suite> bench::suites{};
+
+namespace {
+	volatile const void * sink{};
+
+	double elapsed_ms(const bench::clock::time_point &start, const bench::clock::time_point &end) {
+		const std::chrono::nanoseconds time = end - start;
+
+		return ((double)time.count()) / 1'000'000;
+	}
+}
+
+void bench::describe(const std::string &title, const callback &cb) {
+	suites.push_back({
+		.title = title,
+		.body = cb
+	});
+}
+
+bench::timing bench::measure(const std::string &title, size_t iterations, const callback &body) {
+	return measure(title, iterations, nullptr, body);
+}
+
+bench::timing bench::measure(const std::string &title, size_t iterations, const callback &setup, const callback &body) {
+	timing out{};
+	double total_ms = 0.0;
+
+	out.iterations = iterations;
+	out.min_ms = std::numeric_limits<double>::max();
+
+	for (size_t i = 0; i < iterations; i++) {
+		if (setup) {
+			setup();
+		}
+
+		const clock::time_point start = clock::now();
+		body();
+		const clock::time_point end = clock::now();
+		const double ms = elapsed_ms(start, end);
+
+		total_ms += ms;
+		out.min_ms = std::min(out.min_ms, ms);
+		out.max_ms = std::max(out.max_ms, ms);
+	}
+
+	out.avg_ms = iterations ? total_ms / iterations : 0.0;
+
+	std::cout
+		<< "\t" << title
+		<< ": min " << out.min_ms << "ms"
+		<< ", avg " << out.avg_ms << "ms"
+		<< ", max " << out.max_ms << "ms"
+		<< " (" << iterations << " iterations)"
+		<< std::endl;
+
+	return out;
+}
+
+void bench::report(const std::string &title, double value) {
+	std::cout << "\t" << title << ": " << value << std::endl;
+}
+
+void bench::run(const std::string &filter) {
+	std::cout << std::fixed << std::setprecision(3);
+
+	for (const suite &s : suites) {
+		if (s.title.find(filter) == std::string::npos) {
+			continue;
+		}
+
+		std::cout << s.title << std::endl;
+
+		const clock::time_point start = clock::now();
+		s.body();
+		const clock::time_point end = clock::now();
+
+		std::cout << "(" << elapsed_ms(start, end) << "ms)" << std::endl;
+	}
+}
+
+void bench::detail::escape(const void * p) {
+	sink = p;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace bench {
+	using callback = std::function<void(void)>;
+	using clock = std::chrono::steady_clock;
+
+	struct suite {
+		std::string title{};
+		callback body{};
+	};
+
+	struct timing {
+		size_t iterations{};
+		double min_ms{};
+		double avg_ms{};
+		double max_ms{};
+	};
+
+	extern std::vector<suite> suites;
+
+	// Registers a group of benchmarks. The callback is run by `run()`, and it should
+	// call `measure()` and `report()` to produce results.
+	void describe(const std::string &title, const callback &cb);
+
+	// Runs `setup` and then times `body` once per iteration. Setup time is not
+	// counted. Results are printed immediately and returned.
+	timing measure(const std::string &title, size_t iterations, const callback &body);
+	timing measure(const std::string &title, size_t iterations, const callback &setup, const callback &body);
+
+	// Prints a named value alongside the timings, for benchmarks that need to report
+	// something other than time (e.g. tree quality or iteration counts).
+	void report(const std::string &title, double value);
+
+	// Runs every registered suite whose title contains `filter`
+	void run(const std::string &filter = "");
+
+	// Forces the compiler to assume that `val` is used, so that the computation
+	// producing it is not optimized away.
+	template <typename T>
+	void keep(const T &val);
+
+	namespace detail {
+		void escape(const void * p);
+	}
+}
+
+template <typename T>
+void bench::keep(const T &val) {
+	detail::escape(&val);
+}
@@ -0,0 +1,117 @@
+#include <random>
+#include <vector>
+#include "../shared/physics/collision/spatial_hash.h"
+#include "../shared/physics/constraints.h"
+#include "../shared/physics/particle.h"
+#include "../shared/physics/particle_store.h"
+#include "bench.h"
+
+using namespace phys::literals;
+
+namespace {
+	constexpr phys::real radius = 0.1_r;
+
+	struct scene {
+		phys::particle_store particles{};
+
+		// Spreads the particles out so that each one overlaps a few of its neighbors on
+		// average, regardless of the particle count
+		scene(size_t n) {
+			std::mt19937 gen(12345);
+			const phys::real side = std::cbrt((phys::real)n) * 4.0_r * radius;
+			std::uniform_real_distribution<phys::real> coord_distrib(0.0_r, side);
+
+			for (size_t i = 0; i < n; i++) {
+				phys::particle p{};
+				p.pos = phys::vec3(coord_distrib(gen), coord_distrib(gen), coord_distrib(gen));
+				p.radius = radius;
+
+				particles.add(p);
+			}
+		}
+	};
+
+	size_t brute_force(scene &s) {
+		size_t num_constraints = 0;
+
+		for (size_t i = 0; i < s.particles.size(); i++) {
+			for (size_t j = i + 1; j < s.particles.size(); j++) {
+				phys::particle_collision_constraint c(
+					s.particles,
+					phys::particle_handle((uint32_t)i),
+					phys::particle_handle((uint32_t)j),
+					0.9_r,
+					0.1_r
+				);
+
+				if (c.eval_constraint(s.particles) < 0.0_r) {
+					num_constraints++;
+				}
+			}
+		}
+
+		return num_constraints;
+	}
+
+	size_t spatial_hash(
+		scene &s,
+		phys::spatial_hash<size_t> &grid,
+		std::vector<phys::spatial_hash<size_t>::collision_pair> &pairs
+	) {
+		size_t num_constraints = 0;
+
+		grid.clear();
+		pairs.clear();
+
+		for (size_t i = 0; i < s.particles.size(); i++) {
+			grid.insert(i, s.particles.p[i], s.particles.radius[i]);
+		}
+
+		grid.generate_collision_pairs(pairs);
+
+		for (const auto &pair : pairs) {
+			phys::particle_collision_constraint c(
+				s.particles,
+				phys::particle_handle((uint32_t)pair.id1),
+				phys::particle_handle((uint32_t)pair.id2),
+				0.9_r,
+				0.1_r
+			);
+
+			if (c.eval_constraint(s.particles) < 0.0_r) {
+				num_constraints++;
+			}
+		}
+
+		return num_constraints;
+	}
+
+	void compare(size_t n, size_t brute_force_iterations, size_t grid_iterations) {
+		scene s(n);
+		phys::spatial_hash<size_t> grid(2.0_r * radius);
+		std::vector<phys::spatial_hash<size_t>::collision_pair> pairs{};
+		size_t brute_force_count = 0;
+		size_t grid_count = 0;
+
+		const std::string suffix = ", " + std::to_string(n) + " particles";
+
+		bench::measure("brute force" + suffix, brute_force_iterations, [&]() {
+			brute_force_count = brute_force(s);
+		});
+
+		bench::measure("spatial hash" + suffix, grid_iterations, [&]() {
+			grid_count = spatial_hash(s, grid, pairs);
+		});
+
+		bench::report("collision constraints (brute force)" + suffix, (double)brute_force_count);
+		bench::report("collision constraints (spatial hash)" + suffix, (double)grid_count);
+	}
+}
+
+void setup_broadphase_benchmarks() {
+	bench::describe("Particle collision broadphase", []() {
+		compare(1'000, 20, 200);
+		compare(10'000, 3, 50);
+		compare(100'000, 1, 10);
+	});
+}
@@ -0,0 +1,439 @@
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "../shared/physics/collision/bvh.h"
+#include "../shared/physics/collision/wide_bvh.h"
+#include "../shared/physics/thread_pool.h"
+#include "bench.h"
+
+using namespace phys::literals;
+
+namespace {
+	using sphere_bvh = phys::bvh<phys::bounding_sphere, int>;
+	using aabb_bvh = phys::bvh<phys::aabb, int>;
+
+	constexpr phys::real dt = 1.0_r / 60.0_r;
+	constexpr phys::real radius = 0.5_r;
+
+	// Spheres bouncing around inside a box, a few meters per second each
+	struct scene {
+		std::vector<phys::bounding_sphere> volumes{};
+		std::vector<phys::vec3> velocities{};
+		std::vector<sphere_bvh::volume_update> updates{};
+		phys::real side{};
+
+		scene(size_t n) :
+			side(std::cbrt((phys::real)n) * 4.0_r * radius)
+		{
+			std::mt19937 gen(12345);
+			std::uniform_real_distribution<phys::real> coord_distrib(0.0_r, side);
+			std::uniform_real_distribution<phys::real> vel_distrib(-3.0_r, 3.0_r);
+
+			for (size_t i = 0; i < n; i++) {
+				volumes.emplace_back(phys::vec3(coord_distrib(gen), coord_distrib(gen), coord_distrib(gen)), radius);
+				velocities.emplace_back(vel_distrib(gen), vel_distrib(gen), vel_distrib(gen));
+			}
+		}
+
+		void insert_into(sphere_bvh &tree) const {
+			for (size_t i = 0; i < volumes.size(); i++) {
+				tree.insert((int)i + 1, volumes[i]);
+			}
+		}
+
+		void step() {
+			updates.clear();
+
+			for (size_t i = 0; i < volumes.size(); i++) {
+				phys::vec3 &c = volumes[i].center;
+				phys::vec3 &v = velocities[i];
+
+				c += v * dt;
+
+				for (int axis = 0; axis < 3; axis++) {
+					if ((c[axis] < 0.0_r && v[axis] < 0.0_r) || (c[axis] > side && v[axis] > 0.0_r)) {
+						v[axis] = -v[axis];
+					}
+				}
+
+				updates.push_back({ (int)i + 1, volumes[i] });
+			}
+		}
+	};
+
+	void compare(size_t n, size_t frames) {
+		const std::string suffix = ", " + std::to_string(n) + " spheres";
+		const phys::real margin = 0.2_r;
+
+		scene s1(n);
+		sphere_bvh t1{};
+		s1.insert_into(t1);
+
+		// What `update` used to do
+		const bench::timing remove_insert_timing = bench::measure("remove and insert" + suffix, frames, [&]() {
+			s1.step();
+
+			for (const sphere_bvh::volume_update &u : s1.updates) {
+				t1.remove(u.id);
+				t1.insert(u.id, u.vol);
+			}
+		});
+
+		scene s2(n);
+		sphere_bvh t2{};
+		s2.insert_into(t2);
+
+		const bench::timing tight_timing = bench::measure("update, no margin" + suffix, frames, [&]() {
+			s2.step();
+
+			for (const sphere_bvh::volume_update &u : s2.updates) {
+				t2.update(u.id, u.vol);
+			}
+		});
+
+		scene s3(n);
+		sphere_bvh t3(margin);
+		s3.insert_into(t3);
+
+		const bench::timing fat_timing = bench::measure("update, fat volumes" + suffix, frames, [&]() {
+			s3.step();
+
+			for (const sphere_bvh::volume_update &u : s3.updates) {
+				t3.update(u.id, u.vol);
+			}
+		});
+
+		scene s4(n);
+		sphere_bvh t4(margin);
+		s4.insert_into(t4);
+
+		const bench::timing many_timing = bench::measure("update_many, fat volumes" + suffix, frames, [&]() {
+			s4.step();
+			t4.update_many(s4.updates);
+		});
+
+		bench::report("speedup, no margin" + suffix, remove_insert_timing.avg_ms / tight_timing.avg_ms);
+		bench::report("speedup, fat volumes" + suffix, remove_insert_timing.avg_ms / fat_timing.avg_ms);
+		bench::report("speedup, update_many" + suffix, remove_insert_timing.avg_ms / many_timing.avg_ms);
+	}
+
+	// Times a query for every overlapping pair of leaves
+	template <typename Tree>
+	bench::timing measure_pairs(const std::string &title, const Tree &tree, size_t iterations) {
+		std::vector<typename Tree::coarse_collision_pair> pairs{};
+
+		return bench::measure(title, iterations, [&]() {
+			pairs.clear();
+			tree.generate_coarse_collisions(pairs);
+			bench::keep(pairs.size());
+		});
+	}
+
+	void compare_build(size_t n, size_t iterations) {
+		const std::string suffix = ", " + std::to_string(n) + " spheres";
+		const phys::real margin = 0.2_r;
+
+		scene s(n);
+		std::vector<sphere_bvh::volume_update> objects{};
+
+		for (size_t i = 0; i < n; i++) {
+			objects.push_back({ (int)i + 1, s.volumes[i] });
+		}
+
+		std::unique_ptr<sphere_bvh> inserted{};
+		std::unique_ptr<sphere_bvh> built{};
+
+		const bench::timing insert_timing = bench::measure("insert one at a time" + suffix, iterations, [&]() {
+			inserted = std::make_unique<sphere_bvh>(margin);
+		}, [&]() {
+			s.insert_into(*inserted);
+		});
+
+		const bench::timing build_timing = bench::measure("build" + suffix, iterations, [&]() {
+			built = std::make_unique<sphere_bvh>(margin);
+		}, [&]() {
+			built->build(objects);
+		});
+
+		bench::report("build speedup" + suffix, insert_timing.avg_ms / build_timing.avg_ms);
+		bench::report("SAH cost (insert)" + suffix, inserted->sah_cost());
+		bench::report("SAH cost (build)" + suffix, built->sah_cost());
+
+		const bench::timing inserted_pairs = measure_pairs("coarse collisions (insert)" + suffix, *inserted, iterations);
+		const bench::timing built_pairs = measure_pairs("coarse collisions (build)" + suffix, *built, iterations);
+
+		bench::report("coarse collision speedup" + suffix, inserted_pairs.avg_ms / built_pairs.avg_ms);
+
+		// Objects that move around for a while end up far from where `build` placed them
+		for (size_t i = 0; i < 600; i++) {
+			s.step();
+			built->update_many(s.updates);
+		}
+
+		bench::report("SAH cost (build, after 600 frames)" + suffix, built->sah_cost());
+
+		const bench::timing degraded_pairs = measure_pairs("coarse collisions (after 600 frames)" + suffix, *built, iterations);
+
+		bench::measure("rebuild" + suffix, iterations, [&]() {
+			built->rebuild();
+		});
+
+		bench::report("SAH cost (rebuild)" + suffix, built->sah_cost());
+
+		const bench::timing rebuilt_pairs = measure_pairs("coarse collisions (rebuild)" + suffix, *built, iterations);
+
+		bench::report("coarse collision speedup (rebuild)" + suffix, degraded_pairs.avg_ms / rebuilt_pairs.avg_ms);
+	}
+
+	// Inserts and removes random objects, keeping around `n` of them in the tree
+	void churn(size_t n, size_t ops, size_t checkpoints) {
+		const std::string suffix = ", " + std::to_string(n) + " spheres";
+		std::mt19937 gen(12345);
+		std::uniform_real_distribution<phys::real> coord_distrib(-100.0_r, 100.0_r);
+		std::uniform_real_distribution<phys::real> radius_distrib(0.1_r, 2.0_r);
+		std::vector<int> live{};
+		sphere_bvh tree{};
+		int next_id = 1;
+
+		for (size_t c = 1; c <= checkpoints; c++) {
+			const std::string after = " after " + std::to_string(c * ops) + " operations" + suffix;
+
+			bench::measure(std::to_string(ops) + " operations" + suffix, 1, [&]() {
+				for (size_t op = 0; op < ops; op++) {
+					if (live.size() < n || (live.size() < n + n / 10 && gen() % 2)) {
+						const phys::vec3 center(coord_distrib(gen), coord_distrib(gen), coord_distrib(gen));
+
+						tree.insert(next_id, phys::bounding_sphere(center, radius_distrib(gen)));
+						live.push_back(next_id++);
+					} else {
+						const size_t i = gen() % live.size();
+
+						tree.remove(live[i]);
+						live[i] = live.back();
+						live.pop_back();
+					}
+				}
+			});
+
+			sphere_bvh rebuilt = tree;
+			rebuilt.rebuild();
+
+			bench::report("depth" + after, (double)tree.depth());
+			bench::report("depth of a fresh build" + after, (double)rebuilt.depth());
+			bench::report("SAH cost relative to a fresh build" + after, tree.sah_cost() / rebuilt.sah_cost());
+		}
+	}
+
+	// The same spheres in a tree of spheres and in a tree of boxes
+	void compare_volumes(size_t n, size_t iterations) {
+		const std::string suffix = ", " + std::to_string(n) + " objects";
+		const scene s(n);
+		std::vector<sphere_bvh::volume_update> spheres{};
+		std::vector<aabb_bvh::volume_update> boxes{};
+
+		for (size_t i = 0; i < n; i++) {
+			spheres.push_back({ (int)i + 1, s.volumes[i] });
+			boxes.push_back({ (int)i + 1, phys::aabb(s.volumes[i]) });
+		}
+
+		std::unique_ptr<sphere_bvh> sphere_tree{};
+		std::unique_ptr<aabb_bvh> aabb_tree{};
+
+		const bench::timing sphere_insert = bench::measure("insert spheres" + suffix, iterations, [&]() {
+			sphere_tree = std::make_unique<sphere_bvh>();
+		}, [&]() {
+			for (const auto &obj : spheres) {
+				sphere_tree->insert(obj.id, obj.vol);
+			}
+		});
+
+		const bench::timing aabb_insert = bench::measure("insert AABBs" + suffix, iterations, [&]() {
+			aabb_tree = std::make_unique<aabb_bvh>();
+		}, [&]() {
+			for (const auto &obj : boxes) {
+				aabb_tree->insert(obj.id, obj.vol);
+			}
+		});
+
+		bench::report("insert speedup" + suffix, sphere_insert.avg_ms / aabb_insert.avg_ms);
+
+		const bench::timing sphere_pairs = measure_pairs("coarse collisions, spheres (insert)" + suffix, *sphere_tree, iterations);
+		const bench::timing aabb_pairs = measure_pairs("coarse collisions, AABBs (insert)" + suffix, *aabb_tree, iterations);
+
+		bench::report("coarse collision speedup (insert)" + suffix, sphere_pairs.avg_ms / aabb_pairs.avg_ms);
+
+		sphere_tree->build(spheres);
+		aabb_tree->build(boxes);
+
+		const phys::wide_bvh<int> wide_tree(*aabb_tree);
+
+		const bench::timing built_sphere_pairs = measure_pairs("coarse collisions, spheres (build)" + suffix, *sphere_tree, iterations);
+		const bench::timing built_aabb_pairs = measure_pairs("coarse collisions, AABBs (build)" + suffix, *aabb_tree, iterations);
+		const bench::timing wide_pairs = measure_pairs("coarse collisions, 4-wide AABBs (build)" + suffix, wide_tree, iterations);
+
+		bench::report("coarse collision speedup (build)" + suffix, built_sphere_pairs.avg_ms / built_aabb_pairs.avg_ms);
+		bench::report("coarse collision speedup (build, 4-wide)" + suffix, built_sphere_pairs.avg_ms / wide_pairs.avg_ms);
+
+		std::vector<sphere_bvh::coarse_collision_pair> sphere_out{};
+		std::vector<aabb_bvh::coarse_collision_pair> aabb_out{};
+
+		sphere_tree->generate_coarse_collisions(sphere_out);
+		aabb_tree->generate_coarse_collisions(aabb_out);
+
+		bench::report("coarse collision pairs (spheres)" + suffix, (double)sphere_out.size());
+		bench::report("coarse collision pairs (AABBs)" + suffix, (double)aabb_out.size());
+	}
+
+	void compare_parallel_pairs(size_t n, size_t iterations) {
+		const std::string suffix = ", " + std::to_string(n) + " objects";
+		const scene s(n);
+		std::vector<aabb_bvh::volume_update> boxes{};
+
+		for (size_t i = 0; i < n; i++) {
+			boxes.push_back({ (int)i + 1, phys::aabb(s.volumes[i]) });
+		}
+
+		aabb_bvh tree{};
+		tree.build(boxes);
+
+		std::vector<aabb_bvh::coarse_collision_pair> pairs{};
+
+		const bench::timing serial_timing = measure_pairs("serial" + suffix, tree, iterations);
+
+		for (size_t num_threads = 2; num_threads <= 16; num_threads *= 2) {
+			phys::thread_pool pool(num_threads);
+
+			const bench::timing parallel_timing = bench::measure(std::to_string(num_threads) + " threads" + suffix, iterations, [&]() {
+				pairs.clear();
+				tree.generate_coarse_collisions(pairs, pool);
+				bench::keep(pairs.size());
+			});
+
+			bench::report("speedup, " + std::to_string(num_threads) + " threads" + suffix, serial_timing.avg_ms / parallel_timing.avg_ms);
+		}
+	}
+
+	// Picking from a camera outside the scene and culling from cameras inside it, by testing
+	// every sphere and by querying a tree
+	void compare_queries(size_t n, size_t queries, size_t iterations) {
+		const std::string suffix = ", " + std::to_string(n) + " spheres";
+
+		scene s(n);
+		std::vector<sphere_bvh::volume_update> objects{};
+
+		for (size_t i = 0; i < s.volumes.size(); i++) {
+			objects.push_back({ (int)i + 1, s.volumes[i] });
+		}
+
+		sphere_bvh tree{};
+		tree.build(objects);
+
+		std::mt19937 gen(54321);
+		std::uniform_real_distribution<phys::real> coord_distrib(0.0_r, s.side);
+		std::vector<phys::ray> rays{};
+		std::vector<phys::frustum> frustums{};
+		// A camera in the middle of the scene that sees about as far as a fog would let it
+		const glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 0.25f * s.side);
+
+		for (size_t i = 0; i < queries; i++) {
+			const phys::vec3 eye(-s.side * 0.5_r, s.side * 1.5_r, coord_distrib(gen));
+			const phys::vec3 inside(coord_distrib(gen), coord_distrib(gen), coord_distrib(gen));
+			const phys::vec3 target(coord_distrib(gen), coord_distrib(gen), coord_distrib(gen));
+
+			rays.emplace_back(eye, target - eye);
+			frustums.emplace_back(proj * glm::lookAt(inside, target, phys::vec3(0.0_r, 1.0_r, 0.0_r)));
+		}
+
+		const bench::timing brute_ray_timing = bench::measure("closest hit, every sphere" + suffix, iterations, [&]() {
+			for (const phys::ray &r : rays) {
+				int closest_id = 0;
+				phys::real closest = phys::infinity;
+
+				for (size_t i = 0; i < s.volumes.size(); i++) {
+					const phys::real t = r.intersect(s.volumes[i]);
+
+					if (t >= 0.0_r && t < closest) {
+						closest = t;
+						closest_id = (int)i + 1;
+					}
+				}
+
+				bench::keep(closest_id);
+			}
+		});
+
+		const bench::timing bvh_ray_timing = bench::measure("closest hit, bvh" + suffix, iterations, [&]() {
+			for (const phys::ray &r : rays) {
+				const sphere_bvh::ray_hit hit = tree.raycast(r, [&](int id) {
+					return r.intersect(s.volumes[(size_t)id - 1]);
+				});
+
+				bench::keep(hit.id);
+			}
+		});
+
+		bench::report("closest hit speedup" + suffix, brute_ray_timing.avg_ms / bvh_ray_timing.avg_ms);
+
+		size_t brute_visible = 0;
+
+		const bench::timing brute_cull_timing = bench::measure("frustum, every sphere" + suffix, iterations, [&]() {
+			brute_visible = 0;
+
+			for (const phys::frustum &fr : frustums) {
+				for (const phys::bounding_sphere &vol : s.volumes) {
+					brute_visible += fr.classify(vol) != phys::frustum::containment::outside;
+				}
+			}
+
+			bench::keep(brute_visible);
+		});
+
+		size_t bvh_visible = 0;
+
+		const bench::timing bvh_cull_timing = bench::measure("frustum, bvh" + suffix, iterations, [&]() {
+			bvh_visible = 0;
+
+			for (const phys::frustum &fr : frustums) {
+				tree.query_frustum(fr, [&](int) {
+					bvh_visible++;
+				});
+			}
+
+			bench::keep(bvh_visible);
+		});
+
+		bench::report("visible spheres per frustum, every sphere" + suffix, (double)brute_visible / (double)queries);
+		bench::report("visible spheres per frustum, bvh" + suffix, (double)bvh_visible / (double)queries);
+		bench::report("frustum speedup" + suffix, brute_cull_timing.avg_ms / bvh_cull_timing.avg_ms);
+	}
+}
+
+void setup_bvh_benchmarks() {
+	bench::describe("BVH updates", []() {
+		compare(10'000, 100);
+	});
+
+	bench::describe("BVH construction", []() {
+		compare_build(10'000, 20);
+	});
+
+	bench::describe("BVH churn", []() {
+		churn(10'000, 250'000, 4);
+	});
+
+	bench::describe("Bounding spheres vs AABBs", []() {
+		compare_volumes(10'000, 10);
+	});
+
+	bench::describe("Parallel coarse collisions", []() {
+		compare_parallel_pairs(100'000, 20);
+	});
+
+	bench::describe("BVH queries", []() {
+		compare_queries(10'000, 1'000, 5);
+		compare_queries(100'000, 1'000, 5);
+	});
+}
\ No newline at end of file
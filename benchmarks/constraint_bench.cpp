@@ -0,0 +1,175 @@
+#include <memory>
+#include <random>
+#include <vector>
+#include "../shared/physics/constraints.h"
+#include "../shared/physics/particle_store.h"
+#include "../shared/physics/simd.h"
+#include "bench.h"
+
+using namespace phys::literals;
+
+namespace {
+	// A square grid of particles in random positions, with a distance constraint between
+	// each pair of neighbors
+	struct grid {
+		phys::particle_store store{};
+		std::vector<phys::vec3> start{};
+		std::vector<phys::distance_constraint> links{};
+
+		grid(size_t width) {
+			std::mt19937 gen(12345);
+			std::uniform_real_distribution<phys::real> jitter(-0.05_r, 0.05_r);
+			std::vector<phys::particle_handle> particles{};
+
+			for (size_t i = 0; i < width * width; i++) {
+				phys::particle p{};
+				p.pos = phys::vec3((i % width) * 0.1_r + jitter(gen), jitter(gen), (i / width) * 0.1_r + jitter(gen));
+
+				particles.push_back(store.add(p));
+				start.push_back(p.pos);
+			}
+
+			for (size_t y = 0; y < width; y++) {
+				for (size_t x = 0; x < width; x++) {
+					const phys::particle_handle p = particles[y * width + x];
+
+					if (x + 1 < width) {
+						links.emplace_back(p, particles[y * width + x + 1], 0.1_r, 1.0_r);
+					}
+
+					if (y + 1 < width) {
+						links.emplace_back(p, particles[(y + 1) * width + x], 0.1_r, 1.0_r);
+					}
+				}
+			}
+		}
+
+		void reset() {
+			std::copy(std::begin(start), std::end(start), store.p.data());
+		}
+	};
+
+	void compare_projection(size_t width, size_t iterations) {
+		grid g(width);
+		const std::string suffix = ", " + std::to_string(g.links.size()) + " distance constraints";
+		const phys::projection_params params{
+			.model = phys::stiffness_model::PBD,
+			.inv_solver_iterations = 1.0_r,
+			.inv_dt_sqr = 3600.0_r
+		};
+
+		std::vector<phys::constraint *> pointers{};
+		phys::constraint_arena<phys::distance_constraint> arena{};
+		phys::distance_constraint_batch batch{};
+
+		for (phys::distance_constraint &link : g.links) {
+			pointers.push_back(&link);
+			arena.emplace(link);
+			batch.add(link, params.inv_solver_iterations);
+		}
+
+		const auto reset = [&]() {
+			g.reset();
+		};
+
+		// How the solver projected fixed constraints before they were batched by type
+		const bench::timing virtual_timing = bench::measure("virtual calls" + suffix, iterations, reset, [&]() {
+			for (phys::constraint * c : pointers) {
+				if (! c->is_satisfied(g.store)) {
+					c->project(g.store, params);
+				}
+			}
+
+			bench::keep(g.store.p[0]);
+		});
+
+		const bench::timing arena_timing = bench::measure("typed arena" + suffix, iterations, reset, [&]() {
+			bench::keep(arena.project(g.store, params, 0, arena.size(), true));
+		});
+
+		const bench::timing batch_timing = bench::measure("distance_constraint_batch" + suffix, iterations, reset, [&]() {
+			bench::keep(batch.project(g.store, params, 0, batch.size(), true));
+		});
+
+		bench::report("speedup, typed arena" + suffix, virtual_timing.avg_ms / arena_timing.avg_ms);
+		bench::report("speedup, distance_constraint_batch" + suffix, virtual_timing.avg_ms / batch_timing.avg_ms);
+	}
+	// A long cable, split into the even and the odd links so that the links in each half
+	// don't share any particles
+	struct cable {
+		phys::particle_store store{};
+		std::vector<phys::vec3> start{};
+		std::vector<phys::distance_constraint> links{};
+		phys::distance_constraint_batch batch{};
+		size_t num_even{};
+
+		cable(size_t num_links, const phys::projection_params &params) {
+			std::mt19937 gen(12345);
+			std::uniform_real_distribution<phys::real> jitter(-0.02_r, 0.02_r);
+			std::vector<phys::particle_handle> particles{};
+
+			for (size_t i = 0; i <= num_links; i++) {
+				phys::particle p{};
+				p.pos = phys::vec3(i * 0.1_r + jitter(gen), jitter(gen), jitter(gen));
+
+				particles.push_back(store.add(p));
+				start.push_back(p.pos);
+			}
+
+			links.reserve(num_links);
+
+			for (size_t i = 0; i < num_links; i++) {
+				links.emplace_back(particles[i], particles[i + 1], 0.1_r, 1.0_r);
+			}
+
+			for (size_t parity = 0; parity < 2; parity++) {
+				for (size_t i = parity; i < num_links; i += 2) {
+					batch.add(links[i], params.inv_solver_iterations);
+				}
+			}
+
+			num_even = (num_links + 1) / 2;
+		}
+
+		void reset() {
+			std::copy(std::begin(start), std::end(start), store.p.data());
+		}
+	};
+
+	void compare_simd(size_t num_links, size_t iterations) {
+		const std::string suffix = ", " + std::to_string(num_links) + " distance constraints";
+		const phys::projection_params params{
+			.model = phys::stiffness_model::PBD,
+			.inv_solver_iterations = 1.0_r,
+			.inv_dt_sqr = 3600.0_r
+		};
+
+		cable c(num_links, params);
+
+		const auto reset = [&]() {
+			c.reset();
+		};
+
+		const bench::timing scalar_timing = bench::measure("scalar" + suffix, iterations, reset, [&]() {
+			bench::keep(c.batch.project(c.store, params, 0, c.num_even, true));
+			bench::keep(c.batch.project(c.store, params, c.num_even, c.batch.size(), true));
+		});
+
+		const bench::timing simd_timing = bench::measure(std::to_string(phys::simd::width) + " wide" + suffix, iterations, reset, [&]() {
+			bench::keep(c.batch.project_independent(c.store, params, 0, c.num_even));
+			bench::keep(c.batch.project_independent(c.store, params, c.num_even, c.batch.size()));
+		});
+
+		bench::report("speedup" + suffix, scalar_timing.avg_ms / simd_timing.avg_ms);
+	}
+}
+
+void setup_constraint_benchmarks() {
+	bench::describe("Type-batched constraint projection", []() {
+		compare_projection(224, 200);
+	});
+
+	bench::describe("SIMD distance constraint kernel", []() {
+		compare_simd(100'000, 200);
+	});
+}
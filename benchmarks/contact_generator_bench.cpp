@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../shared/physics/collision/algorithms.h"
+#include "../shared/physics/collision/contact_generator.h"
+#include "../shared/physics/collision/primitives.h"
+#include "bench.h"
+
+using namespace phys::literals;
+
+namespace {
+	// The contact generator as it was before the dispatch table: type-erased algorithms,
+	// bounds checks, and shape types sorted on every call
+	class function_contact_generator {
+	public:
+		using algorithm_func = std::function<void(phys::primitive&, phys::primitive&, phys::contact_container&)>;
+
+		function_contact_generator() {
+			algs[0][0] = phys::algorithms::sphere_sphere_collision;
+			algs[0][1] = phys::algorithms::sphere_plane_collision;
+		}
+
+		void generate_contacts(phys::primitive &a, phys::primitive &b, phys::contact_container &contacts) const {
+			if (a.type >= max_shapes || b.type >= max_shapes) {
+				throw std::invalid_argument("Invalid shape type");
+			}
+
+			const algorithm_func &alg = algs[std::min(a.type, b.type)][std::max(a.type, b.type)];
+
+			if (! alg) {
+				throw std::invalid_argument("No collision algorithm");
+			}
+
+			alg(a, b, contacts);
+		}
+
+	private:
+		static constexpr int max_shapes = 16;
+
+		algorithm_func algs[max_shapes][max_shapes]{};
+	};
+
+	// Random sphere-sphere pairs, about a quarter of them touching, mixed with sphere-plane
+	// pairs
+	struct pair_scene {
+		std::vector<phys::rigid_body> bodies{};
+		std::vector<phys::sphere> spheres{};
+		phys::rigid_body ground_body{};
+		phys::plane ground;
+		std::vector<phys::primitive_pair> pairs{};
+
+		pair_scene(size_t num_spheres, size_t num_pairs) :
+			bodies(num_spheres),
+			ground(&ground_body, phys::vec3(0.0_r, 1.0_r, 0.0_r), 0.0_r)
+		{
+			std::mt19937 gen(2024);
+			std::uniform_real_distribution<phys::real> coord_distrib(0.0_r, 1.0_r);
+			std::uniform_int_distribution<size_t> sphere_distrib(0, num_spheres - 1);
+			std::uniform_int_distribution<int> kind_distrib(0, 3);
+
+			spheres.reserve(num_spheres);
+
+			for (phys::rigid_body &body : bodies) {
+				body.pos = phys::vec3(coord_distrib(gen), coord_distrib(gen), coord_distrib(gen)) * 4.0_r;
+				spheres.emplace_back(&body, phys::identity<phys::mat4>(), 0.5_r);
+			}
+
+			for (size_t i = 0; i < num_pairs; i++) {
+				const size_t s_index = sphere_distrib(gen);
+				phys::sphere * s = &spheres[s_index];
+
+				switch (kind_distrib(gen)) {
+					case 0:
+						pairs.push_back({ s, &ground });
+						break;
+					case 1:
+						pairs.push_back({ &ground, s });
+						break;
+					default:
+						// Never a sphere with itself
+						pairs.push_back({ s, &spheres[(s_index + 1 + sphere_distrib(gen) % (num_spheres - 1)) % num_spheres] });
+						break;
+				}
+			}
+		}
+	};
+
+	void compare_dispatch(size_t num_pairs, size_t iterations) {
+		const std::string suffix = ", " + std::to_string(num_pairs) + " pairs";
+		const function_contact_generator function_collider{};
+		const phys::contact_generator collider{};
+		pair_scene scene(num_pairs / 4, num_pairs);
+		std::vector<phys::primitive_pair> pairs{};
+		phys::contact_container contacts{};
+		size_t total = 0;
+
+		contacts.reserve(num_pairs);
+
+		const bench::timing function_timing = bench::measure("std::function dispatch" + suffix, iterations, [&]() {
+			contacts.clear();
+
+			for (const phys::primitive_pair &pair : scene.pairs) {
+				function_collider.generate_contacts(*pair.a, *pair.b, contacts);
+			}
+
+			total += contacts.size();
+		});
+
+		const bench::timing table_timing = bench::measure("table dispatch" + suffix, iterations, [&]() {
+			contacts.clear();
+
+			for (const phys::primitive_pair &pair : scene.pairs) {
+				collider.generate_contacts(*pair.a, *pair.b, contacts);
+			}
+
+			total += contacts.size();
+		});
+
+		// The batch is sorted in place, so it starts from the original order each time
+		const bench::timing batch_timing = bench::measure("batched, including the sort" + suffix, iterations, [&]() {
+			pairs = scene.pairs;
+		}, [&]() {
+			contacts.clear();
+			collider.generate_contacts(pairs, contacts);
+			total += contacts.size();
+		});
+
+		const bench::timing sorted_timing = bench::measure("batched, already sorted" + suffix, iterations, [&]() {
+			contacts.clear();
+			collider.generate_contacts(pairs, contacts);
+			total += contacts.size();
+		});
+
+		bench::keep(total);
+		bench::report("contacts" + suffix, (double)contacts.size());
+		bench::report("speedup of table dispatch" + suffix, function_timing.avg_ms / table_timing.avg_ms);
+		bench::report("speedup of batches" + suffix, function_timing.avg_ms / batch_timing.avg_ms);
+		bench::report("speedup of sorted batches" + suffix, function_timing.avg_ms / sorted_timing.avg_ms);
+	}
+
+	using primitive_factory = std::function<std::unique_ptr<phys::primitive>(phys::rigid_body *)>;
+
+	// Pairs of primitives on their own bodies, at random orientations and up to `2 * reach`
+	// apart, so that about half of the pairs of compact shapes touch
+	struct algorithm_scene {
+		std::vector<phys::rigid_body> bodies{};
+		std::vector<std::unique_ptr<phys::primitive>> primitives{};
+		std::vector<phys::primitive_pair> pairs{};
+
+		algorithm_scene(size_t num_pairs, phys::real reach, const primitive_factory &make_a, const primitive_factory &make_b) :
+			bodies(2 * num_pairs)
+		{
+			std::mt19937 gen(31);
+			std::uniform_real_distribution<phys::real> unit_distrib(-1.0_r, 1.0_r);
+			std::uniform_real_distribution<phys::real> dist_distrib(0.0_r, 2.0_r * reach);
+
+			const auto random_unit = [&]() {
+				phys::vec3 out{};
+
+				do {
+					out = phys::vec3(unit_distrib(gen), unit_distrib(gen), unit_distrib(gen));
+				} while (phys::dot(out, out) > 1.0_r || phys::dot(out, out) < 0.01_r);
+
+				return phys::normalize(out);
+			};
+
+			for (size_t i = 0; i < num_pairs; i++) {
+				phys::rigid_body &a = bodies[2 * i];
+				phys::rigid_body &b = bodies[2 * i + 1];
+
+				a.pos = phys::vec3(unit_distrib(gen), unit_distrib(gen), unit_distrib(gen)) * 100.0_r;
+				a.rot = glm::angleAxis(unit_distrib(gen) * glm::pi<phys::real>(), random_unit());
+				b.pos = a.pos + random_unit() * dist_distrib(gen);
+				b.rot = glm::angleAxis(unit_distrib(gen) * glm::pi<phys::real>(), random_unit());
+
+				primitives.push_back(make_a(&a));
+				primitives.push_back(make_b(&b));
+				pairs.push_back({ primitives[2 * i].get(), primitives[2 * i + 1].get() });
+			}
+		}
+	};
+
+	std::unique_ptr<phys::primitive> make_sphere(phys::rigid_body * body) {
+		return std::make_unique<phys::sphere>(body, phys::identity<phys::mat4>(), 0.5_r);
+	}
+
+	std::unique_ptr<phys::primitive> make_box(phys::rigid_body * body) {
+		return std::make_unique<phys::box>(body, phys::identity<phys::mat4>(), phys::vec3(0.5_r, 0.4_r, 0.3_r));
+	}
+
+	std::unique_ptr<phys::primitive> make_capsule(phys::rigid_body * body) {
+		return std::make_unique<phys::capsule>(body, phys::identity<phys::mat4>(), 0.3_r, 0.5_r);
+	}
+
+	// A horizontal plane through the body, whose transform the plane ignores
+	std::unique_ptr<phys::primitive> make_plane(phys::rigid_body * body) {
+		return std::make_unique<phys::plane>(body, phys::vec3(0.0_r, 1.0_r, 0.0_r), body->pos.y);
+	}
+
+	void measure_algorithm(
+		const std::string &title,
+		phys::collision_algorithm_func algorithm,
+		phys::real reach,
+		const primitive_factory &make_a,
+		const primitive_factory &make_b,
+		size_t num_pairs,
+		size_t iterations
+	) {
+		const algorithm_scene scene(num_pairs, reach, make_a, make_b);
+		phys::contact_container contacts{};
+		size_t total = 0;
+
+		contacts.reserve(4 * num_pairs);
+
+		const bench::timing timing = bench::measure(title + ", " + std::to_string(num_pairs) + " pairs", iterations, [&]() {
+			contacts.clear();
+
+			for (const phys::primitive_pair &pair : scene.pairs) {
+				algorithm(*pair.a, *pair.b, contacts);
+			}
+
+			total += contacts.size();
+		});
+
+		bench::keep(total);
+		bench::report(title + ", ns per pair", timing.avg_ms * 1e6 / (double)num_pairs);
+		bench::report(title + ", contacts per pair", (double)contacts.size() / (double)num_pairs);
+	}
+
+	void compare_algorithms(size_t num_pairs, size_t iterations) {
+		using namespace phys::algorithms;
+
+		measure_algorithm("sphere-sphere", sphere_sphere_collision, 1.0_r, make_sphere, make_sphere, num_pairs, iterations);
+		measure_algorithm("sphere-plane", sphere_plane_collision, 0.5_r, make_sphere, make_plane, num_pairs, iterations);
+		measure_algorithm("box-plane", box_plane_collision, 0.5_r, make_box, make_plane, num_pairs, iterations);
+		measure_algorithm("capsule-plane", capsule_plane_collision, 0.5_r, make_capsule, make_plane, num_pairs, iterations);
+		measure_algorithm("sphere-box", sphere_box_collision, 1.0_r, make_sphere, make_box, num_pairs, iterations);
+		measure_algorithm("sphere-capsule", sphere_capsule_collision, 1.0_r, make_sphere, make_capsule, num_pairs, iterations);
+		measure_algorithm("capsule-capsule", capsule_capsule_collision, 1.0_r, make_capsule, make_capsule, num_pairs, iterations);
+		measure_algorithm("box-box (GJK)", gjk_epa_collision, 1.0_r, make_box, make_box, num_pairs, iterations);
+		measure_algorithm("box-capsule (GJK)", gjk_epa_collision, 1.0_r, make_box, make_capsule, num_pairs, iterations);
+		measure_algorithm("sphere-box (GJK)", gjk_epa_collision, 1.0_r, make_sphere, make_box, num_pairs, iterations);
+		measure_algorithm("capsule-capsule (GJK)", gjk_epa_collision, 1.0_r, make_capsule, make_capsule, num_pairs, iterations);
+	}
+}
+
+void setup_contact_generator_benchmarks() {
+	bench::describe("Contact generator dispatch", []() {
+		compare_dispatch(10000, 200);
+		compare_dispatch(1000000, 10);
+	});
+
+	bench::describe("Collision algorithms", []() {
+		compare_algorithms(100000, 20);
+	});
+}
\ No newline at end of file
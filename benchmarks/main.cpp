@@ -0,0 +1,23 @@
+#include "bench.h"
+
+extern void setup_broadphase_benchmarks();
+extern void setup_particle_world_benchmarks();
+extern void setup_constraint_benchmarks();
+extern void setup_bvh_benchmarks();
+extern void setup_rigid_body_world_benchmarks();
+extern void setup_contact_generator_benchmarks();
+extern void setup_particle_emitter_benchmarks();
+
+int main(int argc, const char * const * const argv) {
+	setup_broadphase_benchmarks();
+	setup_particle_world_benchmarks();
+	setup_constraint_benchmarks();
+	setup_bvh_benchmarks();
+	setup_rigid_body_world_benchmarks();
+	setup_contact_generator_benchmarks();
+	setup_particle_emitter_benchmarks();
+
+	bench::run(argc > 1 ? argv[1] : "");
+
+	return 0;
+}
@@ -0,0 +1,365 @@
+#include <glad/glad.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+#include "../shared/physical_particle_emitter.h"
+#include "../shared/physics/particle.h"
+#include "bench.h"
+
+using namespace phys::literals;
+using namespace std::literals::chrono_literals;
+
+namespace {
+	using time_point = physical_particle_emitter::time_point;
+	using duration = physical_particle_emitter::duration;
+
+	constexpr float frame_millis = 16.0f;
+	constexpr duration frame_time(16);
+	const phys::vec3 gravity_vec(0.0_r, -9.8_r, 0.0_r);
+	const glm::vec4 start_color(1.0f, 0.73f, 0.0f, 1.0f);
+	const glm::vec4 end_color(0.75f, 0.27f, 0.0f, 0.0f);
+
+	// How `physical_particle_emitter` stored a particle before it kept one array per
+	// component
+	struct particle {
+		phys::particle physics;
+		time_point created_at;
+
+		duration age(const time_point &now) const {
+			return std::chrono::duration_cast<duration>(now - created_at);
+		}
+	};
+
+	float lerp(float a, float b, float s) {
+		return a + (b - a) * s;
+	}
+
+	// How `physical_particle_emitter` found free slots before it kept its particles in a
+	// ring buffer: every new particle goes in the first dead slot after the last one, found
+	// with a linear scan that reads the clock again, and every slot is checked for life
+	// when the particles are integrated.
+	namespace scan {
+		struct emitter {
+			std::vector<particle> particles{};
+			std::vector<glm::vec3> pos_buf{};
+			std::vector<glm::vec4> color_buf{};
+			size_t new_particles_per_frame{};
+			duration expiry_time{};
+			std::mt19937 gen{};
+			std::uniform_real_distribution<phys::real> distrib{ -0.5_r, 0.5_r };
+
+			bool is_particle_dead(const particle &p, const time_point &now) const {
+				return (now - p.created_at) > expiry_time;
+			}
+
+			int64_t next_dead_particle_pos(size_t start, const time_point &now) const {
+				// The emitter read the clock here. The time that was read is thrown away
+				// so that both emitters see the same frames.
+				bench::keep(physical_particle_emitter::clock::now());
+
+				for (size_t i = start; i < particles.size(); i++) {
+					if (is_particle_dead(particles[i], now)) {
+						return (int64_t)i;
+					}
+				}
+
+				return -1;
+			}
+
+			void start(size_t max_particles) {
+				for (size_t i = 0; i < max_particles; i++) {
+					phys::particle physics{};
+					physics.force = gravity_vec;
+					physics.set_mass(1.0_r);
+
+					particles.push_back({
+						.physics = physics,
+						.created_at = time_point(0ms)
+					});
+				}
+			}
+
+			void update(float millis, const time_point &now) {
+				float dt = millis / 1000;
+				int64_t dead_particle_pos = 0;
+
+				for (size_t i = 0; i < new_particles_per_frame; i++) {
+					dead_particle_pos = next_dead_particle_pos((size_t)dead_particle_pos, now);
+
+					if (dead_particle_pos == -1) {
+						break;
+					}
+
+					particle &p = particles[(size_t)dead_particle_pos];
+					p.physics.pos = phys::vec3(distrib(gen), distrib(gen), distrib(gen));
+					p.physics.vel = phys::vec3(distrib(gen), 1.0_r, distrib(gen));
+					p.physics.acc = phys::vec3(0.0_r);
+					p.physics.force = gravity_vec;
+					p.physics.damping = 0.9_r;
+					p.physics.set_mass(1.0_r);
+					p.created_at = now;
+				}
+
+				pos_buf.clear();
+				color_buf.clear();
+
+				for (particle &p : particles) {
+					p.physics.acc = phys::vec3(0.0_r);
+
+					if (! is_particle_dead(p, now)) {
+						p.physics.integrate(dt);
+						pos_buf.push_back(phys::to_glm<glm::vec3>(p.physics.pos));
+						color_buf.push_back(glm::mix(start_color, end_color, (float)p.age(now).count() / (float)expiry_time.count()));
+					}
+				}
+			}
+
+			void stop() {
+				for (particle &p : particles) {
+					p.created_at = time_point(0ms);
+				}
+			}
+
+			bool is_done(const time_point &now) const {
+				for (const particle &p : particles) {
+					if (! is_particle_dead(p, now)) {
+						return false;
+					}
+				}
+
+				return true;
+			}
+		};
+	}
+
+	// How `physical_particle_emitter` stepped its particles before it kept one array per
+	// component: a ring buffer of whole particles, each integrated by `phys::particle`,
+	// appended to the buffers and colored one component at a time
+	namespace aos {
+		struct emitter {
+			std::vector<particle> particles{};
+			std::vector<glm::vec3> pos_buf{};
+			std::vector<glm::vec4> color_buf{};
+			size_t new_particles_per_frame{};
+			duration expiry_time{};
+			phys::vec3 base_vel{};
+			phys::vec3 gravity{};
+			size_t oldest{};
+			size_t num_alive{};
+			std::mt19937 gen{};
+			std::uniform_real_distribution<phys::real> distrib{ -0.5_r, 0.5_r };
+
+			bool is_particle_dead(const particle &p, const time_point &now) const {
+				return (now - p.created_at) > expiry_time;
+			}
+
+			glm::vec4 particle_color(const particle &p, const time_point &now) const {
+				long long curr_age = p.age(now).count();
+				long long max_age = expiry_time.count();
+				float age_f = ((float)curr_age) / max_age;
+
+				if (age_f > 1.0) {
+					return end_color;
+				}
+
+				return glm::vec4(
+					lerp(start_color.r, end_color.r, age_f),
+					lerp(start_color.g, end_color.g, age_f),
+					lerp(start_color.b, end_color.b, age_f),
+					lerp(start_color.a, end_color.a, age_f)
+				);
+			}
+
+			void start(size_t max_particles) {
+				particles.assign(max_particles, particle{});
+			}
+
+			void update(float millis, const time_point &now) {
+				float dt = millis / 1000;
+
+				while (num_alive && is_particle_dead(particles[oldest], now)) {
+					oldest = (oldest + 1) % particles.size();
+					num_alive--;
+				}
+
+				for (size_t i = 0; i < new_particles_per_frame && num_alive < particles.size(); i++) {
+					particle &p = particles[(oldest + num_alive) % particles.size()];
+					p.physics.pos = phys::vec3(distrib(gen), distrib(gen), distrib(gen)) * 0.002_r;
+					p.physics.vel = base_vel + phys::vec3(distrib(gen), distrib(gen), distrib(gen)) * 0.05_r;
+					p.physics.acc = phys::vec3(0.0_r);
+					p.physics.force = gravity;
+					p.physics.damping = 0.4_r;
+					p.physics.set_mass(0.7_r);
+					p.created_at = now;
+					num_alive++;
+				}
+
+				pos_buf.clear();
+				color_buf.clear();
+
+				const auto integrate = [&](size_t begin, size_t end) {
+					for (size_t i = begin; i < end; i++) {
+						particle &p = particles[i];
+						p.physics.acc = phys::vec3(0.0_r);
+						p.physics.integrate(dt);
+						pos_buf.push_back(phys::to_glm<glm::vec3>(p.physics.pos));
+						color_buf.push_back(particle_color(p, now));
+					}
+				};
+
+				const size_t first_end = std::min(oldest + num_alive, particles.size());
+
+				integrate(oldest, first_end);
+				integrate(0, num_alive - (first_end - oldest));
+			}
+		};
+	}
+
+	// Runs both emitters for enough frames to reach a steady state, in which as many
+	// particles expire each frame as are spawned, and then times one frame at a time.
+	void compare(size_t max_particles, size_t new_particles_per_frame, duration expiry_time, size_t iterations) {
+		const std::string suffix = " (" + std::to_string(new_particles_per_frame) + " per frame, " + std::to_string(expiry_time.count()) + " ms)";
+		const size_t warmup_frames = (size_t)(expiry_time / frame_time) + 1;
+		time_point before_now = physical_particle_emitter::clock::now();
+		time_point after_now = before_now;
+
+		scan::emitter before{};
+		before.new_particles_per_frame = new_particles_per_frame;
+		before.expiry_time = expiry_time;
+		before.start(max_particles);
+
+		physical_particle_emitter after(
+			phys::vec3(0.0_r),
+			phys::vec3(0.0_r, 1.0_r, 0.0_r),
+			1.0_r,
+			1.0_r,
+			max_particles,
+			new_particles_per_frame,
+			0,
+			1.0_r,
+			0.9_r,
+			gravity_vec,
+			expiry_time,
+			start_color,
+			end_color,
+			8.0f
+		);
+		after.start_simulation(after_now);
+
+		for (size_t i = 0; i < warmup_frames; i++) {
+			before_now += frame_time;
+			before.update(frame_millis, before_now);
+			after_now += frame_time;
+			after.simulate(frame_millis, after_now);
+		}
+
+		bench::report("particles alive" + suffix, (double)after.get_num_alive());
+
+		const bench::timing scan_timing = bench::measure("linear scan" + suffix, iterations, [&]() {
+			before_now += frame_time;
+			before.update(frame_millis, before_now);
+			bench::keep(before.pos_buf[0]);
+		});
+
+		const bench::timing ring_timing = bench::measure("ring buffer" + suffix, iterations, [&]() {
+			after_now += frame_time;
+			after.simulate(frame_millis, after_now);
+			bench::keep(after.get_num_alive());
+		});
+
+		bench::report("speedup" + suffix, scan_timing.avg_ms / ring_timing.avg_ms);
+
+		// Once every particle has died, the old emitter had to look at all of them to find
+		// out
+		before.stop();
+		after.stop();
+
+		const bench::timing scan_done_timing = bench::measure("linear scan, is_done" + suffix, iterations, [&]() {
+			bench::keep(before.is_done(before_now));
+		});
+
+		const bench::timing ring_done_timing = bench::measure("ring buffer, is_done" + suffix, iterations, [&]() {
+			bench::keep(after.is_done());
+		});
+
+		bench::report("is_done speedup" + suffix, scan_done_timing.avg_ms / ring_done_timing.avg_ms);
+	}
+	// The candle flame from the materials demo, with enough particles to be a bonfire. New
+	// particles replace the ones that die, so every frame steps all of them.
+	void compare_fire(size_t max_particles, size_t iterations) {
+		const std::string suffix = " (" + std::to_string(max_particles) + " particles)";
+		const duration expiry_time = 1400ms;
+		const phys::vec3 base_vel(0.0_r, 0.03_r, 0.0_r);
+		const phys::vec3 flame_gravity(0.0_r, 0.01_r, 0.0_r);
+		// Enough to replace every particle within its lifetime
+		const size_t new_particles_per_frame = max_particles / (size_t)(expiry_time / frame_time) + 1;
+		const size_t warmup_frames = (size_t)(expiry_time / frame_time) + 1;
+		time_point before_now = physical_particle_emitter::clock::now();
+		time_point after_now = before_now;
+
+		aos::emitter before{};
+		before.new_particles_per_frame = new_particles_per_frame;
+		before.expiry_time = expiry_time;
+		before.base_vel = base_vel;
+		before.gravity = flame_gravity;
+		before.start(max_particles);
+
+		physical_particle_emitter after(
+			phys::vec3(0.0_r),
+			base_vel,
+			0.002_r,
+			0.05_r,
+			max_particles,
+			new_particles_per_frame,
+			0,
+			0.7_r,
+			0.4_r,
+			flame_gravity,
+			expiry_time,
+			start_color,
+			end_color,
+			8.0f
+		);
+		after.start_simulation(after_now);
+
+		for (size_t i = 0; i < warmup_frames; i++) {
+			before_now += frame_time;
+			before.update(frame_millis, before_now);
+			after_now += frame_time;
+			after.simulate(frame_millis, after_now);
+		}
+
+		bench::report("particles alive" + suffix, (double)after.get_num_alive());
+
+		const bench::timing aos_timing = bench::measure("array of structures" + suffix, iterations, [&]() {
+			before_now += frame_time;
+			before.update(frame_millis, before_now);
+			bench::keep(before.pos_buf[0]);
+		});
+
+		const bench::timing soa_timing = bench::measure("structure of arrays" + suffix, iterations, [&]() {
+			after_now += frame_time;
+			after.simulate(frame_millis, after_now);
+			bench::keep(after.get_num_alive());
+		});
+
+		bench::report("speedup" + suffix, aos_timing.avg_ms / soa_timing.avg_ms);
+	}
+}
+
+void setup_particle_emitter_benchmarks() {
+	bench::describe("Particle emitter", []() {
+		// A short burst in a large emitter: most slots are free
+		compare(1'000'000, 1'000, 200ms, 50);
+		// A busy emitter: most slots are in use, and every frame frees and refills a slice of
+		// the ring
+		compare(1'000'000, 16'000, 800ms, 20);
+	});
+
+	bench::describe("Particle emitter fire effect", []() {
+		compare_fire(500'000, 50);
+	});
+}
@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+#include "../physics_demo/particle_collision_constraint_generator.h"
+#include "../shared/physics/constraints.h"
+#include "../shared/physics/particle.h"
+#include "../shared/physics/particle_force_generators.h"
+#include "../shared/physics/particle_world.h"
+#include "../shared/physics/thread_pool.h"
+#include "bench.h"
+
+using namespace phys::literals;
+
+namespace {
+	constexpr phys::real dt = 1.0_r / 60.0_r;
+	constexpr phys::real min_pos_change_sqr = 0.00005_r * 0.00005_r;
+	const phys::vec3 gravity_vec(0.0_r, -9.8_r, 0.0_r);
+
+	// The array-of-structures layout that `particle_world` used before particles moved into a
+	// `particle_store`: every particle is a separate heap object, the world holds pointers to
+	// them, and forces are applied through a virtual call per registration.
+	namespace aos {
+		class force_generator {
+		public:
+			virtual ~force_generator() = default;
+
+			virtual void update_force(phys::particle &p, phys::real duration) = 0;
+		};
+
+		class gravity : public force_generator {
+		public:
+			void update_force(phys::particle &p, phys::real duration) override {
+				if (! p.has_finite_mass()) {
+					return;
+				}
+
+				p.force += gravity_vec * p.get_mass();
+			}
+		};
+
+		struct registration {
+			phys::particle * p;
+			force_generator * fg;
+		};
+
+		struct world {
+			std::vector<std::unique_ptr<phys::particle>> storage{};
+			std::vector<phys::particle *> particles{};
+			std::vector<registration> registrations{};
+			gravity g{};
+
+			void prepare_frame() {
+				for (phys::particle * p : particles) {
+					p->force = phys::vec3(0.0_r);
+					p->acc = phys::vec3(0.0_r);
+				}
+			}
+
+			void run_physics(phys::real dt) {
+				for (registration &r : registrations) {
+					r.fg->update_force(*r.p, dt);
+				}
+
+				for (phys::particle * p : particles) {
+					p->vel += (dt * p->get_inv_mass() * p->force * p->damping);
+				}
+
+				for (phys::particle * p : particles) {
+					p->p = p->pos + dt * p->vel;
+				}
+
+				for (phys::particle * p : particles) {
+					const phys::vec3 dp = p->pos - p->p;
+
+					if (phys::dot(dp, dp) <= min_pos_change_sqr) {
+						p->p = p->pos;
+					}
+
+					p->vel = (p->p - p->pos) / dt;
+					p->pos = p->p;
+				}
+			}
+		};
+	}
+
+	std::vector<phys::particle> make_particles(size_t n) {
+		std::mt19937 gen(12345);
+		std::uniform_real_distribution<phys::real> coord_distrib(-100.0_r, 100.0_r);
+		std::vector<phys::particle> out(n);
+
+		for (phys::particle &p : out) {
+			p.pos = phys::vec3(coord_distrib(gen), coord_distrib(gen), coord_distrib(gen));
+			p.p = p.pos;
+			p.radius = 0.1_r;
+		}
+
+		return out;
+	}
+
+	void compare(size_t n, size_t iterations) {
+		const std::vector<phys::particle> init = make_particles(n);
+		const std::string suffix = ", " + std::to_string(n) + " particles";
+
+		aos::world before{};
+
+		for (const phys::particle &p : init) {
+			before.storage.push_back(std::make_unique<phys::particle>(p));
+		}
+
+		// Particles that were spawned over the lifetime of a scene are not laid out in
+		// memory in the order that the world visits them
+		std::mt19937 gen(6789);
+		std::shuffle(std::begin(before.storage), std::end(before.storage), gen);
+
+		for (std::unique_ptr<phys::particle> &p : before.storage) {
+			before.particles.push_back(p.get());
+			before.registrations.push_back({
+				.p = p.get(),
+				.fg = &before.g
+			});
+		}
+
+		phys::particle_world after(16);
+		phys::particle_gravity gravity(gravity_vec);
+
+		for (const phys::particle &p : init) {
+			after.force_registry.add(after.add_particle(p), &gravity);
+		}
+
+		const bench::timing aos_timing = bench::measure("array of structures" + suffix, iterations, [&]() {
+			before.prepare_frame();
+			before.run_physics(dt);
+			bench::keep(before.particles[0]->pos);
+		});
+
+		const bench::timing soa_timing = bench::measure("particle_store" + suffix, iterations, [&]() {
+			after.prepare_frame();
+			after.run_physics(dt);
+			bench::keep(after.particles.pos[0]);
+		});
+
+		bench::report("speedup" + suffix, aos_timing.avg_ms / soa_timing.avg_ms);
+	}
+
+	// A square of cloth pinned along one edge, with a distance constraint between each pair
+	// of neighboring particles
+	struct cloth {
+		std::vector<phys::particle_handle> particles{};
+		std::vector<phys::distance_constraint> links{};
+		phys::particle_gravity gravity{ gravity_vec };
+		phys::particle_world world;
+
+		cloth(size_t width, size_t solver_iterations = 16) :
+			world(solver_iterations)
+		{
+			for (size_t i = 0; i < width * width; i++) {
+				phys::particle p{};
+				p.pos = phys::vec3((i % width) * 0.1_r, 0.0_r, (i / width) * 0.1_r);
+
+				if (i < width) {
+					p.set_mass(phys::infinity);
+				}
+
+				particles.push_back(world.add_particle(p));
+				world.force_registry.add(particles.back(), &gravity);
+			}
+
+			links.reserve(2 * width * width);
+
+			for (size_t y = 0; y < width; y++) {
+				for (size_t x = 0; x < width; x++) {
+					const phys::particle_handle p = particles[y * width + x];
+
+					if (x + 1 < width) {
+						links.emplace_back(p, particles[y * width + x + 1], 0.1_r, 1.0_r);
+						world.add_fixed_constraint(&links.back());
+					}
+
+					if (y + 1 < width) {
+						links.emplace_back(p, particles[(y + 1) * width + x], 0.1_r, 1.0_r);
+						world.add_fixed_constraint(&links.back());
+					}
+				}
+			}
+		}
+
+		void step() {
+			world.prepare_frame();
+			world.run_physics(dt);
+		}
+
+		// Average relative stretch of the links; zero if every constraint is satisfied
+		phys::real residual() const {
+			phys::real total = 0.0_r;
+
+			for (const phys::distance_constraint &link : links) {
+				total += std::abs(link.eval_constraint(world.particles)) / link.distance;
+			}
+
+			return total / (phys::real)links.size();
+		}
+	};
+
+	void compare_solvers(size_t width, size_t iterations) {
+		const std::string suffix = ", " + std::to_string(2 * width * (width - 1)) + " constraints";
+		std::unique_ptr<cloth> c = std::make_unique<cloth>(width);
+
+		const bench::timing serial_timing = bench::measure("serial" + suffix, iterations, [&]() {
+			c->step();
+		});
+
+		for (size_t num_threads = 2; num_threads <= 16; num_threads *= 2) {
+			phys::thread_pool pool(num_threads);
+			c = std::make_unique<cloth>(width);
+			c->world.set_thread_pool(&pool);
+
+			const bench::timing parallel_timing = bench::measure(
+				std::to_string(num_threads) + " threads" + suffix,
+				iterations,
+				[&]() {
+					c->step();
+				}
+			);
+
+			bench::report("speedup, " + std::to_string(num_threads) + " threads" + suffix, serial_timing.avg_ms / parallel_timing.avg_ms);
+			c->world.set_thread_pool(nullptr);
+		}
+	}
+
+	void compare_solver_modes(size_t width, size_t steps) {
+		const std::string suffix = ", " + std::to_string(2 * width * (width - 1)) + " constraints";
+
+		for (size_t solver_iterations : { (size_t)4, (size_t)16, (size_t)64 }) {
+			for (phys::solver_mode mode : { phys::solver_mode::GaussSeidel, phys::solver_mode::Jacobi }) {
+				const std::string name = (mode == phys::solver_mode::GaussSeidel ? "Gauss-Seidel, " : "Jacobi, ") +
+					std::to_string(solver_iterations) + " iterations" + suffix;
+
+				std::unique_ptr<cloth> c = std::make_unique<cloth>(width, solver_iterations);
+				c->world.set_solver_mode(mode);
+
+				bench::measure(name, steps, [&]() {
+					c->step();
+				});
+
+				bench::report("residual stretch (" + name + ")", c->residual());
+			}
+		}
+	}
+
+	// Spends the same total number of solver iterations per frame in different ways
+	void compare_substeps(size_t width, size_t steps) {
+		const std::string suffix = ", " + std::to_string(2 * width * (width - 1)) + " constraints";
+
+		for (size_t substeps = 1; substeps <= 16; substeps *= 2) {
+			const size_t solver_iterations = 16 / substeps;
+			const std::string name = std::to_string(substeps) + " substeps x " +
+				std::to_string(solver_iterations) + " iterations" + suffix;
+
+			std::unique_ptr<cloth> c = std::make_unique<cloth>(width, solver_iterations);
+			c->world.set_stiffness_model(phys::stiffness_model::XPBD);
+			c->world.set_substeps(substeps);
+
+			bench::measure(name, steps, [&]() {
+				c->step();
+			});
+
+			bench::report("residual stretch (" + name + ")", c->residual());
+		}
+	}
+
+	constexpr size_t pile_width = 50;
+	constexpr size_t pile_size = pile_width * pile_width * 4;
+	constexpr phys::real pile_radius = 0.1_r;
+
+	// A few layers of particles dropped onto a floor, which spread out and come to rest
+	struct pile {
+		std::array<phys::particle_handle, pile_size> particles{};
+		std::bitset<pile_size> active{};
+		phys::particle_gravity gravity{ gravity_vec };
+		phys::plane_collision_constraint_generator<std::array<phys::particle_handle, pile_size>> floor;
+		particle_collision_constraint_generator<pile_size> collisions;
+		phys::particle_world world{ 8 };
+
+		pile() :
+			floor(particles, phys::vec3(0.0_r, 1.0_r, 0.0_r), phys::vec3(0.0_r, pile_radius, 0.0_r), 0.5_r, 0.6_r),
+			collisions(particles, active, 2.0_r * pile_radius)
+		{
+			std::mt19937 gen(12345);
+			std::uniform_real_distribution<phys::real> jitter(-0.02_r, 0.02_r);
+			const phys::real center = (pile_width - 1) * 0.5_r;
+
+			for (size_t i = 0; i < pile_size; i++) {
+				const size_t x = i % pile_width;
+				const size_t z = (i / pile_width) % pile_width;
+				const size_t y = i / (pile_width * pile_width);
+
+				phys::particle p{};
+				p.pos = phys::vec3(
+					(x - center) * 0.22_r + jitter(gen),
+					pile_radius + y * 0.22_r,
+					(z - center) * 0.22_r + jitter(gen)
+				);
+				p.radius = pile_radius;
+
+				particles[i] = world.add_particle(p);
+				active[i] = true;
+
+				world.force_registry.add(particles[i], &gravity);
+			}
+
+			world.add_constraint_generator(&floor);
+			world.add_constraint_generator(&collisions);
+		}
+
+		void step() {
+			world.prepare_frame();
+			world.run_physics(dt);
+		}
+	};
+
+	void compare_sleeping(size_t iterations) {
+		const std::string suffix = ", " + std::to_string(pile_size) + " particles";
+		std::unique_ptr<pile> scene = std::make_unique<pile>();
+		scene->world.set_sleeping(true);
+		// Without this, the resting particles keep bouncing and never fall asleep
+		scene->floor.min_restitution_speed = 0.5_r;
+		scene->collisions.min_restitution_speed = 0.5_r;
+
+		// Long enough for every particle to come to rest
+		for (size_t i = 0; i < 1200; i++) {
+			scene->step();
+		}
+
+		bench::report("particles asleep" + suffix, (double)scene->world.get_num_asleep());
+
+		const bench::timing sleeping_timing = bench::measure("settled pile, sleeping" + suffix, iterations, [&]() {
+			scene->step();
+		});
+
+		scene->world.set_sleeping(false);
+
+		const bench::timing awake_timing = bench::measure("settled pile, awake" + suffix, iterations, [&]() {
+			scene->step();
+		});
+
+		bench::report("speedup" + suffix, awake_timing.avg_ms / sleeping_timing.avg_ms);
+	}
+}
+
+void setup_particle_world_benchmarks() {
+	bench::describe("Particle world step", []() {
+		compare(10'000, 200);
+		compare(100'000, 50);
+	});
+
+	bench::describe("Parallel constraint solver", []() {
+		compare_solvers(32, 100);
+		compare_solvers(128, 20);
+	});
+
+	bench::describe("Gauss-Seidel vs Jacobi solver", []() {
+		compare_solver_modes(64, 120);
+	});
+
+	bench::describe("XPBD substeps vs iterations", []() {
+		compare_substeps(64, 120);
+	});
+
+	bench::describe("Sleeping islands", []() {
+		compare_sleeping(100);
+	});
+}
@@ -0,0 +1,461 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../shared/physics/collision/contact_manifold.h"
+#include "../shared/physics/collision/primitives.h"
+#include "../shared/physics/contact_resolvers.h"
+#include "../shared/physics/rigid_body_batch.h"
+#include "../shared/physics/rigid_body_force_generators.h"
+#include "../shared/physics/rigid_body_world.h"
+#include "../shared/physics/thread_pool.h"
+#include "bench.h"
+
+using namespace phys::literals;
+
+namespace {
+	constexpr phys::real dt = 1.0_r / 60.0_r;
+	constexpr phys::real radius = 0.5_r;
+	// Nothing else stops a sphere from rolling on a flat plane
+	constexpr phys::real rolling_damping = 0.2_r;
+
+	// Layers of spheres dropped onto a static plane at y = 0, `spacing` radii apart and a
+	// little out of line so that they don't land in perfect columns. Friction and rolling
+	// damping bring them to rest. A `boxed` pile sets every other layer in the pockets of
+	// the layer below and is walled in, so that the bottom layer can't be pushed apart and
+	// the whole pile comes to rest.
+	struct settling_scene {
+		phys::rigid_body ground_body{};
+		phys::plane ground;
+		std::vector<phys::plane> walls{};
+		phys::rigid_body_gravity gravity;
+		phys::sequential_impulse_resolver resolver;
+		std::vector<phys::rigid_body> bodies{};
+		std::vector<phys::sphere> spheres{};
+		phys::rigid_body_world world{};
+
+		settling_scene(size_t side, size_t layers, phys::real spacing = 2.2_r, bool boxed = false) :
+			ground(&ground_body, phys::vec3(0.0_r, 1.0_r, 0.0_r), 0.0_r),
+			gravity(phys::vec3(0.0_r, -9.8_r, 0.0_r)),
+			resolver(10)
+		{
+			std::mt19937 gen(777);
+			std::uniform_real_distribution<phys::real> jitter(-0.05_r, 0.05_r);
+
+			ground_body.set_mass(phys::infinity);
+			world.add_body(&ground_body);
+			world.add_primitive(&ground);
+			world.set_contact_resolver(&resolver);
+
+			if (boxed) {
+				// Half a gap and the largest jitter away from the outermost spheres
+				const phys::real margin = radius + (spacing - 2.0_r) * radius * 0.5_r + 0.06_r;
+				const phys::real far_side = (side - 1) * spacing * radius + margin;
+
+				walls.reserve(4);
+				walls.emplace_back(&ground_body, phys::vec3(1.0_r, 0.0_r, 0.0_r), -margin);
+				walls.emplace_back(&ground_body, phys::vec3(-1.0_r, 0.0_r, 0.0_r), -far_side);
+				walls.emplace_back(&ground_body, phys::vec3(0.0_r, 0.0_r, 1.0_r), -margin);
+				walls.emplace_back(&ground_body, phys::vec3(0.0_r, 0.0_r, -1.0_r), -far_side);
+
+				for (phys::plane &wall : walls) {
+					world.add_primitive(&wall);
+				}
+			}
+
+			// Reserved so that the pointers held by the spheres and the world stay valid
+			bodies.reserve(side * side * layers);
+			spheres.reserve(side * side * layers);
+
+			for (size_t y = 0; y < layers; y++) {
+				const bool in_pockets = boxed && (y % 2) == 1;
+				const size_t layer_side = in_pockets ? side - 1 : side;
+				const phys::real offset = in_pockets ? spacing * radius * 0.5_r : 0.0_r;
+
+				for (size_t x = 0; x < layer_side; x++) {
+					for (size_t z = 0; z < layer_side; z++) {
+						phys::rigid_body &body = bodies.emplace_back();
+
+						body.pos = phys::vec3(x * spacing * radius + offset + jitter(gen), (y * 2.2_r + 1.5_r) * radius, z * spacing * radius + offset + jitter(gen));
+						body.set_inertia_tensor(phys::mat3(0.4_r * radius * radius));
+						body.angular_damping = rolling_damping;
+						spheres.emplace_back(&body, phys::identity<phys::mat4>(), radius);
+					}
+				}
+			}
+
+			for (size_t i = 0; i < bodies.size(); i++) {
+				world.add_body(&bodies[i]);
+				world.add_primitive(&spheres[i]);
+				world.add_force_generator(&bodies[i], &gravity);
+			}
+		}
+
+		void report(const std::string &suffix) const {
+			phys::real max_penetration = 0.0_r;
+			phys::real max_speed = 0.0_r;
+			phys::real total_speed = 0.0_r;
+
+			for (const phys::contact &c : world.get_contacts()) {
+				max_penetration = std::max(max_penetration, c.penetration);
+			}
+
+			for (const phys::rigid_body &body : bodies) {
+				const phys::real speed = std::sqrt(phys::dot(body.vel, body.vel));
+
+				max_speed = std::max(max_speed, speed);
+				total_speed += speed;
+			}
+
+			bench::report("contacts after settling" + suffix, (double)world.get_contacts().size());
+			bench::report("max penetration after settling" + suffix, max_penetration);
+			bench::report("mean speed after settling" + suffix, total_speed / (phys::real)bodies.size());
+			bench::report("max speed after settling" + suffix, max_speed);
+		}
+	};
+
+	// Times the steps in which a boxed pile of spheres lands and comes to rest, and then the
+	// steps of the resting pile
+	void settle(size_t side, size_t layers, size_t settling_frames, size_t rest_frames) {
+		double settling_ms = 0.0;
+		double rest_ms = 0.0;
+
+		for (size_t num_threads = 1; num_threads <= 8; num_threads *= 2) {
+			const std::string threads = num_threads == 1 ? "" : ", " + std::to_string(num_threads) + " threads";
+			std::unique_ptr<phys::thread_pool> pool = num_threads == 1 ? nullptr : std::make_unique<phys::thread_pool>(num_threads);
+			settling_scene scene(side, layers, 2.2_r, true);
+			const std::string suffix = ", " + std::to_string(scene.bodies.size()) + " spheres";
+
+			scene.world.set_thread_pool(pool.get());
+
+			const bench::timing settling_timing = bench::measure("step while settling" + threads + suffix, settling_frames, [&]() {
+				scene.world.run_physics(dt);
+			});
+
+			if (num_threads == 1) {
+				scene.report(suffix);
+			}
+
+			const bench::timing rest_timing = bench::measure("step at rest" + threads + suffix, rest_frames, [&]() {
+				scene.world.run_physics(dt);
+			});
+
+			if (num_threads == 1) {
+				settling_ms = settling_timing.avg_ms;
+				rest_ms = rest_timing.avg_ms;
+			} else {
+				bench::report("speedup while settling" + threads + suffix, settling_ms / settling_timing.avg_ms);
+				bench::report("speedup at rest" + threads + suffix, rest_ms / rest_timing.avg_ms);
+			}
+		}
+	}
+
+	// Steps a settled scene on 1, 4, 16 and 32 threads. The small islands are solved in
+	// parallel, and the largest one is solved one color at a time. Spheres that start
+	// closer together overlap their neighbours and land in fewer, larger islands.
+	void scale_islands(size_t side, size_t layers, phys::real spacing, size_t frames) {
+		const std::string suffix = ", " + std::to_string(side * side * layers) + " spheres " + (spacing > 2.0_r ? "apart" : "overlapping");
+		constexpr size_t thread_counts[] = { 1, 4, 16, 32 };
+		double one_thread_ms = 0.0;
+
+		for (size_t num_threads : thread_counts) {
+			const std::string threads = ", " + std::to_string(num_threads) + (num_threads == 1 ? " thread" : " threads");
+			phys::thread_pool pool(num_threads);
+			settling_scene scene(side, layers, spacing);
+
+			scene.world.set_thread_pool(&pool);
+
+			// Lets the spheres land, so that the islands have formed
+			for (size_t i = 0; i < 60; i++) {
+				scene.world.run_physics(dt);
+			}
+
+			const bench::timing timing = bench::measure("step" + threads + suffix, frames, [&]() {
+				scene.world.run_physics(dt);
+			});
+
+			if (num_threads == 1) {
+				const phys::contact_partition &partition = scene.world.get_contact_partition();
+				const size_t split = partition.split_island;
+
+				one_thread_ms = timing.avg_ms;
+				bench::report("islands" + suffix, (double)partition.num_islands());
+				bench::report("contacts in the largest island" + suffix, (double)(partition.island_offsets[split + 1] - partition.island_offsets[split]));
+			} else {
+				bench::report("speedup" + threads + suffix, one_thread_ms / timing.avg_ms);
+			}
+		}
+	}
+
+	// A column of spheres standing on a static plane at y = 0
+	struct stack_scene {
+		phys::rigid_body ground_body{};
+		phys::plane ground;
+		std::vector<phys::plane> walls{};
+		phys::rigid_body_gravity gravity;
+		std::vector<phys::rigid_body> bodies{};
+		std::vector<phys::sphere> spheres{};
+		phys::rigid_body_world world{};
+
+		stack_scene(size_t height, phys::contact_resolver &resolver) :
+			ground(&ground_body, phys::vec3(0.0_r, 1.0_r, 0.0_r), 0.0_r),
+			gravity(phys::vec3(0.0_r, -9.8_r, 0.0_r))
+		{
+			ground_body.set_mass(phys::infinity);
+			world.add_body(&ground_body);
+			world.add_primitive(&ground);
+			world.set_contact_resolver(&resolver);
+
+			bodies.reserve(height);
+			spheres.reserve(height);
+
+			for (size_t i = 0; i < height; i++) {
+				phys::rigid_body &body = bodies.emplace_back();
+
+				body.pos = phys::vec3(0.0_r, (2 * i + 1) * radius, 0.0_r);
+				body.set_inertia_tensor(phys::mat3(0.4_r * radius * radius));
+				spheres.emplace_back(&body, phys::identity<phys::mat4>(), radius);
+
+				world.add_body(&body);
+				world.add_primitive(&spheres.back());
+				world.add_force_generator(&body, &gravity);
+			}
+		}
+
+		// How far the top of the stack has sunk
+		phys::real sag() const {
+			return (2 * bodies.size() - 1) * radius - bodies.back().pos.y;
+		}
+	};
+
+	// Steps a stack until it rests, then measures the iterations that each step takes to
+	// converge with and without warm starting
+	void compare_warm_starting(size_t height, size_t frames) {
+		const std::string suffix = ", " + std::to_string(height) + " sphere stack";
+
+		for (const bool warm : { false, true }) {
+			const std::string mode = warm ? "warm started" : "cold";
+			phys::sequential_impulse_resolver resolver(200);
+			stack_scene scene(height, resolver);
+
+			resolver.warm_starting = warm;
+
+			for (size_t i = 0; i < frames; i++) {
+				scene.world.run_physics(dt);
+			}
+
+			size_t iterations = 0;
+			size_t max_iterations = 0;
+
+			bench::measure("step, " + mode + suffix, frames, [&]() {
+				scene.world.run_physics(dt);
+				iterations += resolver.get_last_iterations();
+				max_iterations = std::max(max_iterations, resolver.get_last_iterations());
+			});
+
+			bench::report("mean iterations, " + mode + suffix, (double)iterations / (double)frames);
+			bench::report("max iterations, " + mode + suffix, (double)max_iterations);
+			bench::report("sag of the top sphere, " + mode + suffix, scene.sag());
+		}
+	}
+
+	// Bodies spinning and tumbling in every direction, with a force at an off-center
+	// point on each of them every step
+	std::vector<phys::rigid_body> tumbling_bodies(size_t count) {
+		std::mt19937 gen(31);
+		std::uniform_real_distribution<phys::real> unit(-1.0_r, 1.0_r);
+		std::uniform_real_distribution<phys::real> positive(0.5_r, 2.0_r);
+		std::vector<phys::rigid_body> out(count);
+
+		for (phys::rigid_body &body : out) {
+			body.pos = phys::vec3(unit(gen), unit(gen), unit(gen)) * 100.0_r;
+			body.vel = phys::vec3(unit(gen), unit(gen), unit(gen));
+			body.ang_vel = phys::vec3(unit(gen), unit(gen), unit(gen));
+			body.rot = phys::normalize(phys::quat::wxyz(unit(gen), unit(gen), unit(gen), unit(gen)));
+			body.set_mass(positive(gen));
+			body.set_inertia_tensor(phys::mat3(positive(gen)));
+			body.calculate_derived_data();
+		}
+
+		return out;
+	}
+
+	void push(std::vector<phys::rigid_body> &bodies) {
+		for (phys::rigid_body &body : bodies) {
+			body.add_force_at_world(phys::vec3(0.0_r, 1.0_r, 0.0_r), body.pos + phys::vec3(0.1_r, 0.0_r, 0.0_r));
+		}
+	}
+
+	// Integrates bodies one at a time, and then all together in a batch
+	void compare_integration(size_t count, size_t frames) {
+		const std::string suffix = ", " + std::to_string(count) + " bodies";
+		std::vector<phys::rigid_body> single = tumbling_bodies(count);
+		std::vector<phys::rigid_body> batched = tumbling_bodies(count);
+		std::vector<phys::rigid_body *> pointers{};
+		phys::rigid_body_batch batch{};
+
+		for (phys::rigid_body &body : batched) {
+			pointers.push_back(&body);
+		}
+
+		const bench::timing single_timing = bench::measure("integrate one at a time" + suffix, frames, [&]() {
+			push(single);
+		}, [&]() {
+			for (phys::rigid_body &body : single) {
+				body.integrate(dt);
+			}
+
+			for (phys::rigid_body &body : single) {
+				body.integrate_position(dt);
+			}
+		});
+
+		const bench::timing batch_timing = bench::measure("integrate in a batch" + suffix, frames, [&]() {
+			push(batched);
+		}, [&]() {
+			batch.integrate(pointers, dt, 0, count);
+			batch.integrate_position(pointers, dt, 0, count);
+		});
+
+		phys::real max_error = 0.0_r;
+
+		for (size_t i = 0; i < count; i++) {
+			const phys::vec3 d = single[i].pos - batched[i].pos;
+
+			max_error = std::max({ max_error, std::abs(d.x), std::abs(d.y), std::abs(d.z) });
+		}
+
+		bench::report("speedup" + suffix, single_timing.avg_ms / batch_timing.avg_ms);
+		bench::report("max position difference" + suffix, max_error);
+	}
+
+	// A lattice of boxes and spheres that overlap their neighbours, each swaying around
+	// its place. The pairs of neighbours are found once, since the bodies never move far.
+	struct swaying_scene {
+		static constexpr phys::real spacing = 0.95_r;
+		static constexpr phys::real amplitude = 0.02_r;
+
+		std::vector<phys::rigid_body> bodies{};
+		std::vector<std::unique_ptr<phys::primitive>> primitives{};
+		std::vector<phys::vec3> homes{};
+		std::vector<phys::vec3> directions{};
+		std::vector<phys::real> phases{};
+		std::vector<phys::primitive_pair> pairs{};
+
+		explicit swaying_scene(size_t side) {
+			std::mt19937 gen(2024);
+			std::uniform_real_distribution<phys::real> unit(-1.0_r, 1.0_r);
+			std::uniform_real_distribution<phys::real> phase(0.0_r, 6.28_r);
+
+			// Reserved so that the pointers held by the primitives and the pairs stay valid
+			bodies.reserve(side * side * side);
+
+			for (size_t x = 0; x < side; x++) {
+				for (size_t y = 0; y < side; y++) {
+					for (size_t z = 0; z < side; z++) {
+						phys::rigid_body &body = bodies.emplace_back();
+
+						homes.emplace_back(x * spacing, y * spacing, z * spacing);
+						directions.push_back(phys::normalize(phys::vec3(unit(gen), unit(gen), unit(gen))));
+						phases.push_back(phase(gen));
+
+						if ((x + y + z) % 2) {
+							primitives.push_back(std::make_unique<phys::box>(&body, phys::identity<phys::mat4>(), phys::vec3(0.5_r)));
+						} else {
+							primitives.push_back(std::make_unique<phys::sphere>(&body, phys::identity<phys::mat4>(), 0.5_r));
+						}
+					}
+				}
+			}
+
+			// Every neighbour, including the diagonal ones. Bodies are stored in order, so
+			// the pairs of each pair of bodies come out sorted by address.
+			for (size_t i = 0; i < bodies.size(); i++) {
+				for (size_t j = i + 1; j < bodies.size(); j++) {
+					const phys::vec3 d = homes[j] - homes[i];
+
+					if (std::max({ std::abs(d.x), std::abs(d.y), std::abs(d.z) }) < 1.5_r * spacing) {
+						pairs.push_back({ primitives[i].get(), primitives[j].get() });
+					}
+				}
+			}
+		}
+
+		// Moves every body to where it is at time `t`, swaying with a top speed of `speed`
+		void move(phys::real t, phys::real speed) {
+			const phys::real rate = speed / amplitude;
+
+			for (size_t i = 0; i < bodies.size(); i++) {
+				const phys::real s = std::sin(t * rate + phases[i]);
+
+				bodies[i].pos = homes[i] + directions[i] * (amplitude * s);
+				bodies[i].rot = glm::angleAxis(amplitude * s, directions[i]);
+			}
+		}
+	};
+
+	// Steps the manifolds of a swaying scene, and measures only the manifold update and
+	// the narrowphase that it runs
+	void compare_manifold_cache(size_t side, size_t frames) {
+		const std::string suffix = ", " + std::to_string(side * side * side) + " bodies";
+		phys::contact_generator collider{};
+
+		for (const phys::real speed : { 0.01_r, 0.1_r, 1.0_r }) {
+			const std::string speed_suffix = ", top speed " + std::to_string(speed).substr(0, 4) + suffix;
+
+			for (const bool skip : { false, true }) {
+				const std::string mode = skip ? "cached" : "uncached";
+				swaying_scene scene(side);
+				phys::contact_manifold_cache cache{};
+				phys::contact_container scratch{};
+				phys::contact_container contacts{};
+				size_t frame = 0;
+				size_t hits = 0;
+				size_t body_pairs = 0;
+
+				cache.skip_narrowphase = skip;
+
+				bench::measure("narrowphase, " + mode + speed_suffix, frames, [&]() {
+					scene.move((phys::real)frame++ * dt, speed);
+				}, [&]() {
+					contacts.clear();
+					cache.update(0, cache.begin_step(scene.pairs), collider, scratch);
+					cache.end_step(contacts);
+
+					hits += cache.get_last_hits();
+					body_pairs += cache.get_last_hits() + cache.get_last_misses();
+				});
+
+				bench::report("cache hit rate, " + mode + speed_suffix, (double)hits / (double)body_pairs);
+				bench::report("contacts, " + mode + speed_suffix, (double)contacts.size());
+			}
+		}
+	}
+}
+
+void setup_rigid_body_world_benchmarks() {
+	bench::describe("Rigid body world step", []() {
+		settle(50, 4, 300, 60);
+	});
+
+	bench::describe("Contact islands", []() {
+		bench::report("hardware threads", (double)std::thread::hardware_concurrency());
+		scale_islands(30, 4, 2.2_r, 60);
+		scale_islands(30, 4, 1.9_r, 60);
+	});
+
+	bench::describe("Sequential impulses with warm starting", []() {
+		compare_warm_starting(20, 300);
+	});
+
+	bench::describe("Rigid body integration", []() {
+		compare_integration(50000, 100);
+	});
+
+	bench::describe("Contact manifold cache", []() {
+		compare_manifold_cache(12, 120);
+	});
+}
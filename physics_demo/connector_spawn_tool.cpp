@@ -76,8 +76,8 @@ void connector_spawn_tool::deactivate() {
 		mesh_world.remove_mesh(selected_a_mesh.get());
 	}
 
-	particle_a = nullptr;
-	particle_b = nullptr;
+	particle_a = {};
+	particle_b = {};
 
 	event_listener<pre_render_pass_event>::unsubscribe();
 	event_listener<mousedown_event>::unsubscribe();
@@ -89,7 +89,7 @@ bool connector_spawn_tool::is_active() const {
 
 int connector_spawn_tool::handle(pre_render_pass_event &event) {
 	if (particle_a) {
-		move_mesh_to_particle(selected_a_mesh.get(), particle_a);
+		move_mesh_to_particle(selected_a_mesh.get(), *particles, particle_a);
 		hide_particle(particle_mesh, particle_a_index);
 	}
 
@@ -105,9 +105,9 @@ int connector_spawn_tool::handle(mousedown_event &event) {
 			mesh_world.remove_mesh(selected_a_mesh.get());
 		}
 
-		particle_a = nullptr;
+		particle_a = {};
 		particle_a_index = -1;
-		particle_b = nullptr;
+		particle_b = {};
 		particle_b_index = -1;
 
 		return 0;
@@ -120,7 +120,7 @@ int connector_spawn_tool::handle(mousedown_event &event) {
 			particle_a_index = selected_particle_index;
 			particle_a = selected_particle;
 
-			move_mesh_to_particle(selected_a_mesh.get(), particle_a);
+			move_mesh_to_particle(selected_a_mesh.get(), *particles, particle_a);
 			mesh_world.add_mesh(selected_a_mesh.get());
 		} else if (particle_b_index == -1) {
 			if (particle_a_index == selected_particle_index) {
@@ -145,8 +145,8 @@ int connector_spawn_tool::handle(mousedown_event &event) {
 
 			particle_a_index = -1;
 			particle_b_index = -1;
-			particle_a = nullptr;
-			particle_b = nullptr;
+			particle_a = {};
+			particle_b = {};
 
 			mesh_world.remove_mesh(selected_a_mesh.get());
 		}
@@ -156,7 +156,8 @@ int connector_spawn_tool::handle(mousedown_event &event) {
 }
 
 int connector_spawn_tool::handle(particle_select_event &event) {
-	selected_particle = &event.p;
+	particles = &event.particles;
+	selected_particle = event.p;
 	selected_particle_index = event.particle_index;
 	particle_mesh = &event.particle_mesh;
 
@@ -164,7 +165,7 @@ int connector_spawn_tool::handle(particle_select_event &event) {
 }
 
 int connector_spawn_tool::handle(particle_deselect_event &event) {
-	selected_particle = nullptr;
+	selected_particle = {};
 	selected_particle_index = -1;
 
 	return 0;
@@ -2,7 +2,7 @@
 #include <memory>
 #include "../shared/events.h"
 #include "../shared/instanced_mesh.h"
-#include "../shared/physics/particle.h"
+#include "../shared/physics/particle_store.h"
 #include "custom_events.h"
 #include "tools.h"
 
@@ -41,10 +41,11 @@ private:
 	custom_event_bus &custom_bus;
 	world &mesh_world;
 	connector_type type;
-	const phys::particle * selected_particle{ nullptr };
+	const phys::particle_store * particles{ nullptr };
+	phys::particle_handle selected_particle{};
 	int64_t selected_particle_index{ -1 };
-	const phys::particle * particle_a{ nullptr };
-	const phys::particle * particle_b{ nullptr };
+	phys::particle_handle particle_a{};
+	phys::particle_handle particle_b{};
 	int64_t particle_a_index{ -1 };
 	int64_t particle_b_index{ -1 };
 	std::unique_ptr<mesh> selected_a_mesh;
@@ -2,7 +2,7 @@
 #include <glm/glm.hpp>
 #include "../shared/event.h"
 #include "../shared/instanced_mesh.h"
-#include "../shared/physics/particle.h"
+#include "../shared/physics/particle_store.h"
 
 class tool;
 
@@ -52,15 +52,18 @@ struct cable_spawn_event {
 
 struct particle_select_event {
 	instanced_mesh &particle_mesh;
-	phys::particle &p;
+	phys::particle_store &particles;
+	phys::particle_handle p;
 	size_t particle_index;
 
 	particle_select_event(
 		instanced_mesh &_particle_mesh,
-		phys::particle &_p,
+		phys::particle_store &_particles,
+		phys::particle_handle _p,
 		size_t _particle_index
 	) :
 		particle_mesh(_particle_mesh),
+		particles(_particles),
 		p(_p),
 		particle_index(_particle_index)
 	{}
@@ -6,10 +6,12 @@
 #include "../shared/events.h"
 #include "../shared/instanced_mesh.h"
 #include "../shared/phong_color_material.h"
+#include "../shared/physics/collision/bvh.h"
 #include "../shared/physics/constraints.h"
 #include "../shared/physics/particle.h"
 #include "../shared/physics/particle_force_generators.h"
 #include "../shared/physics/particle_world.h"
+#include "../shared/physics/thread_pool.h"
 #include "../shared/shapes.h"
 #include "../shared/world.h"
 #include "constants.h"
@@ -56,11 +58,13 @@ namespace {
 
 	constexpr phys::real cable_segment_length = 0.1_r;
 	constexpr float cable_radius = 0.01f;
+	// Slow collisions don't bounce, so that resting particles can fall asleep
+	constexpr phys::real min_restitution_speed = 0.5_r;
 
 	struct cable {
-		std::vector<phys::particle> particles{};
+		std::vector<phys::particle_handle> particles{};
 		std::vector<phys::distance_constraint> pieces{};
-		phys::plane_collision_constraint_generator<std::vector<phys::particle>> floor_constraint_generator;
+		phys::plane_collision_constraint_generator<std::vector<phys::particle_handle>> floor_constraint_generator;
 		size_t cable_mesh_offset{};
 
 		cable();
@@ -73,7 +77,7 @@ namespace {
 		instanced_mesh rod_meshes;
 		instanced_mesh cable_meshes;
 
-		std::array<phys::particle, N> particles{};
+		std::array<phys::particle_handle, N> particles{};
 		std::bitset<N> active{};
 		// These won't be moved, because we reserve N of them on construction
 		std::vector<phys::distance_constraint> rods{};
@@ -82,6 +86,7 @@ namespace {
 
 		world_state(
 			world &_mesh_world,
+			phys::particle_world &_phys_world,
 			geometry _rod_geom,
 			const glm::vec3 &_hiding_pos
 		);
@@ -106,18 +111,13 @@ namespace {
 		glm::mat4 hiding_transform;
 		int64_t selected_particle{ -1 };
 		world &mesh_world;
+		phys::particle_world &phys_world;
 
 		glm::mat4 particle_transform_mat(size_t i) const;
 
 		size_t used_cable_segments() const;
 		size_t next_cable_mesh_offset() const;
 	};
-
-	// A raycast hit result
-	struct hit_result {
-		size_t i{ 0 };
-		phys::real t{ -1.0_r };
-	};
 }
 
 template <const size_t N>
@@ -150,15 +150,16 @@ public:
 	int handle(player_look_event &event) override;
 
 private:
-	std::unique_ptr<world_state<N>> state;
 	world &mesh_world;
+	phys::thread_pool solver_threads;
 	phys::particle_world phys_world;
+	std::unique_ptr<world_state<N>> state;
 	custom_event_bus &custom_bus;
 
 	std::unique_ptr<directional_light> light{};
 	std::unique_ptr<mesh> floor{};
 
-	std::unique_ptr<phys::plane_collision_constraint_generator<std::array<phys::particle, N>>> floor_constraint_generator;
+	std::unique_ptr<phys::plane_collision_constraint_generator<std::array<phys::particle_handle, N>>> floor_constraint_generator;
 	std::unique_ptr<particle_collision_constraint_generator<N>> particle_collision_generator;
 	std::unique_ptr<phys::particle_gravity> gravity_generator;
 	size_t phys_iter_per_s;
@@ -168,7 +169,12 @@ private:
 
 	glm::vec3 player_pos{};
 	glm::vec3 player_dir{};
-	std::vector<hit_result> hit_results{};
+
+	// Bounding spheres of the active particles, for picking
+	using particle_bvh = phys::bvh<phys::bounding_sphere, size_t>;
+
+	particle_bvh pick_tree;
+	std::vector<typename particle_bvh::volume_update> pick_updates{};
 
 	short pause_key;
 	short step_key;
@@ -182,6 +188,7 @@ private:
 template <const size_t N>
 world_state<N>::world_state(
 	world &_mesh_world,
+	phys::particle_world &_phys_world,
 	geometry _rod_geom,
 	const glm::vec3 &_hiding_pos
 ) :
@@ -190,7 +197,8 @@ world_state<N>::world_state(
 	rod_meshes(&rod_geom, &rod_mtl, N),
 	cable_meshes(&rod_geom, &cable_mtl, max_cable_segments),
 	hiding_transform(glm::translate(glm::identity<glm::mat4>(), _hiding_pos)),
-	mesh_world(_mesh_world)
+	mesh_world(_mesh_world),
+	phys_world(_phys_world)
 {
 	for (size_t i = 0; i < N; i++) {
 		hide_object(sphere_meshes, i);
@@ -217,10 +225,12 @@ void world_state<N>::update_meshes() {
 		}
 	}
 
+	const phys::particle_store &store = phys_world.particles;
+
 	for (size_t i = 0; i < rods.size(); i++) {
 		phys::distance_constraint &rod = rods[i];
 
-		glm::vec3 dr = phys::to_glm<glm::vec3>(rod.a()->pos - rod.b()->pos);
+		glm::vec3 dr = phys::to_glm<glm::vec3>(store.pos[rod.a()] - store.pos[rod.b()]);
 		float r = glm::length(dr);
 
 		glm::mat4 scale_mat = glm::scale(
@@ -244,7 +254,7 @@ void world_state<N>::update_meshes() {
 
 		glm::mat4 trans_mat = glm::translate(
 			glm::identity<glm::mat4>(),
-			(rod.a()->pos + rod.b()->pos) / 2.0f
+			(store.pos[rod.a()] + store.pos[rod.b()]) / 2.0f
 		);
 
 		rod_meshes.set_model(i, trans_mat * rot_mat * scale_mat);
@@ -256,7 +266,7 @@ void world_state<N>::update_meshes() {
 		for (size_t j = 0; j < c.pieces.size(); j++) {
 			phys::distance_constraint &cable = c.pieces[j];
 
-			glm::vec3 dr = phys::to_glm<glm::vec3>(cable.a()->pos - cable.b()->pos);
+			glm::vec3 dr = phys::to_glm<glm::vec3>(store.pos[cable.a()] - store.pos[cable.b()]);
 			float r = glm::length(dr);
 
 			glm::mat4 scale_mat = glm::scale(
@@ -280,7 +290,7 @@ void world_state<N>::update_meshes() {
 
 			glm::mat4 trans_mat = glm::translate(
 				glm::identity<glm::mat4>(),
-				(cable.a()->pos + cable.b()->pos) / 2.0f
+				(store.pos[cable.a()] + store.pos[cable.b()]) / 2.0f
 			);
 
 			cable_meshes.set_model(j + c.cable_mesh_offset, trans_mat * rot_mat * scale_mat);
@@ -308,15 +318,16 @@ template <const size_t N>
 glm::mat4 world_state<N>::particle_transform_mat(size_t i) const {
 	return glm::translate(
 		glm::identity<glm::mat4>(),
-		phys::to_glm<glm::vec3>(particles[i].pos)
+		phys::to_glm<glm::vec3>(phys_world.particles.pos[particles[i]])
 	) * sphere_scale;
 }
 
 template <const size_t N>
 phys::distance_constraint * world_state<N>::create_rod(size_t particle_a_index, size_t particle_b_index) {
-	phys::particle * a = &particles[particle_a_index];
-	phys::particle * b = &particles[particle_b_index];
-	phys::real length = std::sqrt(phys::dot(a->pos - b->pos, a->pos - b->pos));
+	const phys::particle_handle a = particles[particle_a_index];
+	const phys::particle_handle b = particles[particle_b_index];
+	const phys::vec3 r = phys_world.particles.pos[a] - phys_world.particles.pos[b];
+	phys::real length = std::sqrt(phys::dot(r, r));
 
 	phys::distance_constraint rod(a, b, length, 1.0_r);
 	rods.push_back(rod);
@@ -332,14 +343,17 @@ cable::cable() :
 		0.9_r,
 		0.6_r
 	)
-{}
+{
+	floor_constraint_generator.min_restitution_speed = min_restitution_speed;
+}
 
 template <const size_t N>
 cable * world_state<N>::create_cable(size_t particle_a_index, size_t particle_b_index) {
-	phys::particle * a = &particles[particle_a_index];
-	phys::particle * b = &particles[particle_b_index];
+	const phys::particle_handle a = particles[particle_a_index];
+	const phys::particle_handle b = particles[particle_b_index];
+	const phys::vec3 a_pos = phys_world.particles.pos[a];
 
-	phys::vec3 r = b->pos - a->pos;
+	phys::vec3 r = phys_world.particles.pos[b] - a_pos;
 	phys::real d = std::sqrt(phys::dot(r, r));
 
 	size_t segments_needed = (size_t) std::ceil(d / cable_segment_length);
@@ -369,23 +383,23 @@ cable * world_state<N>::create_cable(size_t particle_a_index, size_t particle_b_
 
 	for (size_t i = 0; i < segments_needed - 1; i++) {
 		phys::particle p{};
-		p.pos = a->pos + (((i + 1) / (phys::real)segments_needed) * r);
+		p.pos = a_pos + (((i + 1) / (phys::real)segments_needed) * r);
 		p.vel = phys::vec3(0.0_r);
 		p.acc = phys::vec3(0.0_r);
 		p.force = phys::vec3(0.0_r);
 		p.damping = 0.995_r;
 		p.set_mass(mass);
 
-		out->particles.push_back(p);
+		out->particles.push_back(phys_world.add_particle(p));
 	}
 
-	phys::distance_constraint first_piece(a, &out->particles[0], step, 1.0_r);
-	phys::distance_constraint last_piece(&out->particles[out->particles.size() - 1], b, step, 1.0_r);
+	phys::distance_constraint first_piece(a, out->particles[0], step, 1.0_r);
+	phys::distance_constraint last_piece(out->particles[out->particles.size() - 1], b, step, 1.0_r);
 
 	out->pieces.push_back(first_piece);
 
 	for (size_t i = 0; i < out->particles.size() - 1; i++) {
-		phys::distance_constraint piece(&out->particles[i], &out->particles[i + 1], step, 1.0_r);
+		phys::distance_constraint piece(out->particles[i], out->particles[i + 1], step, 1.0_r);
 		out->pieces.push_back(piece);
 	}
 
@@ -435,15 +449,17 @@ object_world<N>::object_world(
 	event_listener<player_spawn_event>(&_buses.player),
 	event_listener<player_move_event>(&_buses.player),
 	event_listener<player_look_event>(&_buses.player),
+	mesh_world(_mesh_world),
+	solver_threads(),
+	phys_world(16),
 	state(std::make_unique<world_state<N>>(
 		_mesh_world,
+		phys_world,
 		shapes::make_cylinder(20, true),
 		glm::vec3(0.0f, -10000.0f, 0.0f)
 	)),
-	mesh_world(_mesh_world),
-	phys_world(16),
 	custom_bus(_custom_bus),
-	floor_constraint_generator(std::make_unique<phys::plane_collision_constraint_generator<std::array<phys::particle, N>>>(
+	floor_constraint_generator(std::make_unique<phys::plane_collision_constraint_generator<std::array<phys::particle_handle, N>>>(
 		state->particles,
 		phys::vec3(0.0_r, 1.0_r, 0.0_r),
 		phys::vec3(0.0_r, floor_y + sphere_radius, 0.0_r),
@@ -452,7 +468,8 @@ object_world<N>::object_world(
 	)),
 	particle_collision_generator(std::make_unique<particle_collision_constraint_generator<N>>(
 		state->particles,
-		state->active
+		state->active,
+		2.0_r * sphere_radius
 	)),
 	gravity_generator(std::make_unique<phys::particle_gravity>(
 		phys::vec3(0.0_r, -9.8_r, 0.0_r)
@@ -460,6 +477,7 @@ object_world<N>::object_world(
 	phys_iter_per_s(60),
 	timestep_ms(1000 / phys_iter_per_s),
 	timestep_s(timestep_ms / 1000.0_r),
+	pick_tree(0.5_r * sphere_radius),
 	pause_key(_pause_key),
 	step_key(_step_key)
 {
@@ -500,6 +518,10 @@ object_world<N>::object_world(
 
 	mesh_world.add_mesh(floor.get());
 
+	phys_world.set_thread_pool(&solver_threads);
+	phys_world.set_sleeping(true);
+	floor_constraint_generator->min_restitution_speed = min_restitution_speed;
+	particle_collision_generator->min_restitution_speed = min_restitution_speed;
 	phys_world.add_constraint_generator(floor_constraint_generator.get());
 	phys_world.add_constraint_generator(particle_collision_generator.get());
 }
@@ -550,17 +572,37 @@ int object_world<N>::handle(particle_spawn_event &event) {
 		return 1;
 	}
 
-	state->particles[i].pos = event.pos;
-	state->particles[i].radius = sphere_radius;
+	phys::particle p{};
+	p.pos = event.pos;
+	p.radius = sphere_radius;
+
+	// A particle spawned inside a sleeping pile has to push it apart
+	for (size_t j = 0; j < N; j++) {
+		if (! state->active[j]) {
+			continue;
+		}
+
+		const phys::vec3 d = phys_world.particles.pos[state->particles[j]] - p.pos;
+		const phys::real r = phys_world.particles.radius[state->particles[j]] + p.radius;
+
+		if (phys::dot(d, d) <= r * r) {
+			phys_world.wake(state->particles[j]);
+		}
+	}
+
+	state->particles[i] = phys_world.add_particle(p);
 	state->active[i] = true;
-	phys_world.add_particle(&state->particles[i]);
-	phys_world.force_registry.add(&state->particles[i], gravity_generator.get());
+	phys_world.force_registry.add(state->particles[i], gravity_generator.get());
+	pick_tree.insert((size_t)i, phys::bounding_sphere(p.pos, p.radius));
 
 	return 0;
 }
 
 template <const size_t N>
 int object_world<N>::handle(rod_spawn_event &event) {
+	phys_world.wake(state->particles[event.particle_a_index]);
+	phys_world.wake(state->particles[event.particle_b_index]);
+
 	phys::distance_constraint * rod = state->create_rod(event.particle_a_index, event.particle_b_index);
 	phys_world.add_fixed_constraint(rod);
 
@@ -569,11 +611,13 @@ int object_world<N>::handle(rod_spawn_event &event) {
 
 template <const size_t N>
 int object_world<N>::handle(cable_spawn_event &event) {
+	phys_world.wake(state->particles[event.particle_a_index]);
+	phys_world.wake(state->particles[event.particle_b_index]);
+
 	cable * c = state->create_cable(event.particle_a_index, event.particle_b_index);
 
-	for (phys::particle &p : c->particles) {
-		phys_world.add_particle(&p);
-		phys_world.force_registry.add(&p, gravity_generator.get());
+	for (phys::particle_handle p : c->particles) {
+		phys_world.force_registry.add(p, gravity_generator.get());
 	}
 
 	for (phys::distance_constraint &rod : c->pieces) {
@@ -637,24 +681,28 @@ int64_t object_world<N>::next_inactive_particle() const {
 
 template <const size_t N>
 void object_world<N>::do_raycast_and_update() {
-	hit_results.clear();
+	const phys::particle_store &store = phys_world.particles;
 
-	for (size_t i = 0; i < N; i++) {
-		if (! state->active[i]) {
-			continue;
-		}
+	// Sleeping particles haven't moved, so their leaves are already up to date
+	pick_updates.clear();
 
-		phys::real t = raycast_sphere_test(player_pos, player_dir, state->particles[i].pos, state->particles[i].radius);
+	for (size_t i = 0; i < N; i++) {
+		if (state->active[i] && ! store.asleep[state->particles[i]]) {
+			const phys::particle_handle p = state->particles[i];
 
-		if (t >= 0.0_r) {
-			hit_results.push_back({
-				.i = i,
-				.t = t
-			});
+			pick_updates.push_back({ i, phys::bounding_sphere(store.pos[p], store.radius[p]) });
 		}
 	}
 
-	if (! hit_results.size()) {
+	pick_tree.update_many(pick_updates);
+
+	const typename particle_bvh::ray_hit hit = pick_tree.raycast(phys::ray(player_pos, player_dir), [&](size_t i) {
+		const phys::particle_handle p = state->particles[i];
+
+		return raycast_sphere_test(player_pos, player_dir, store.pos[p], store.radius[p]);
+	});
+
+	if (hit.t < 0.0_r) {
 		bool was_selected = state->select_particle(-1);
 
 		if (was_selected) {
@@ -665,20 +713,15 @@ void object_world<N>::do_raycast_and_update() {
 		return;
 	}
 
-	phys::real min_t = hit_results[0].t;
-	size_t min_i = hit_results[0].i;
-
-	for (size_t i = 1; i < hit_results.size(); i++) {
-		if (hit_results[i].t < min_t) {
-			min_t = hit_results[i].t;
-			min_i = hit_results[i].i;
-		}
-	}
+	const size_t min_i = hit.id;
 
 	bool was_selected = state->select_particle(min_i);
 
 	if (was_selected) {
-		particle_select_event select_event(state->sphere_meshes, state->particles[min_i], min_i);
+		// The selected particle is about to be moved or inspected, so it should be simulated
+		phys_world.wake(state->particles[min_i]);
+
+		particle_select_event select_event(state->sphere_meshes, phys_world.particles, state->particles[min_i], min_i);
 		custom_bus.fire(select_event);
 	}
 }
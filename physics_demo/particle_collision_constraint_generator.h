@@ -1,58 +1,86 @@
 #pragma once
 #include <array>
 #include <bitset>
+#include "../shared/physics/collision/spatial_hash.h"
 #include "../shared/physics/constraints.h"
-#include "../shared/physics/particle.h"
+#include "../shared/physics/particle_store.h"
 
 template <const size_t N>
 class particle_collision_constraint_generator : public phys::constraint_generator {
 public:
-	std::array<phys::particle, N> &particles;
+	std::array<phys::particle_handle, N> &particles;
 	std::bitset<N> &active;
+	// Collisions that close more slowly than this don't bounce. Without it, particles resting
+	// on each other bounce apart every step and never fall asleep.
+	phys::real min_restitution_speed{};
 
 	particle_collision_constraint_generator(
-		std::array<phys::particle, N> &_particles,
-		std::bitset<N> &_active
+		std::array<phys::particle_handle, N> &_particles,
+		std::bitset<N> &_active,
+		phys::real _cell_size
 	);
 
-	void generate_constraints(phys::real dt, std::vector<std::unique_ptr<phys::constraint>> &constraints) override;
+	void generate_constraints(const phys::particle_store &store, phys::real dt, phys::constraint_pool &constraints) override;
+
+private:
+	using broadphase = phys::spatial_hash<size_t>;
+
+	broadphase grid;
+	std::vector<typename broadphase::collision_pair> pairs{};
 };
 
 template <const size_t N>
 particle_collision_constraint_generator<N>::particle_collision_constraint_generator(
-	std::array<phys::particle, N> &_particles,
-	std::bitset<N> &_active
+	std::array<phys::particle_handle, N> &_particles,
+	std::bitset<N> &_active,
+	phys::real _cell_size
 ) :
 	constraint_generator(),
 	particles(_particles),
-	active(_active)
+	active(_active),
+	grid(_cell_size)
 {}
 
 template <const size_t N>
 void particle_collision_constraint_generator<N>::generate_constraints(
+	const phys::particle_store &store,
 	phys::real dt,
-	std::vector<std::unique_ptr<phys::constraint>> &constraints
+	phys::constraint_pool &constraints
 ) {
 	using namespace phys::literals;
 
-	std::vector<size_t> active_particles{};
+	grid.clear();
+	pairs.clear();
+
+	size_t num_awake = 0;
 
 	for (size_t i = 0; i < N; i++) {
 		if (active[i]) {
-			active_particles.push_back(i);
+			grid.insert(i, store.p[particles[i]], store.radius[particles[i]]);
+			num_awake += ! store.asleep[particles[i]];
 		}
 	}
 
-	for (size_t i = 0; i < active_particles.size(); i++) {
-		for (size_t j = i + 1; j < active_particles.size(); j++) {
-			phys::particle &a = particles[active_particles[i]];
-			phys::particle &b = particles[active_particles[j]];
+	// Sleeping particles can't collide with each other
+	if (! num_awake) {
+		return;
+	}
+
+	grid.generate_collision_pairs(pairs);
+
+	for (const typename broadphase::collision_pair &pair : pairs) {
+		const phys::particle_handle a = particles[pair.id1];
+		const phys::particle_handle b = particles[pair.id2];
+
+		if (store.asleep[a] && store.asleep[b]) {
+			continue;
+		}
 
-			phys::particle_collision_constraint c(&a, &b, 0.9_r, 0.1_r);
+		phys::particle_collision_constraint c(store, a, b, 0.9_r, 0.1_r);
+		c.min_restitution_speed = min_restitution_speed;
 
-			if (c.eval_constraint() < 0.0_r) {
-				constraints.push_back(std::make_unique<phys::particle_collision_constraint>(c));
-			}
+		if (c.eval_constraint(store) < 0.0_r) {
+			constraints.emplace<phys::particle_collision_constraint>(c);
 		}
 	}
 }
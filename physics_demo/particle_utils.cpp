@@ -1,10 +1,10 @@
 #include "constants.h"
 #include "particle_utils.h"
 
-void move_mesh_to_particle(mesh * m, const phys::particle * p) {
+void move_mesh_to_particle(mesh * m, const phys::particle_store &particles, phys::particle_handle p) {
 	m->set_model(glm::translate(
 		glm::identity<glm::mat4>(),
-		phys::to_glm<glm::vec3>(p->pos)
+		phys::to_glm<glm::vec3>(particles.pos[p])
 	) * sphere_scale);
 }
 
@@ -1,7 +1,7 @@
 #pragma once
 #include "../shared/instanced_mesh.h"
 #include "../shared/mesh.h"
-#include "../shared/physics/particle.h"
+#include "../shared/physics/particle_store.h"
 
-extern void move_mesh_to_particle(mesh * m, const phys::particle * p);
+extern void move_mesh_to_particle(mesh * m, const phys::particle_store &particles, phys::particle_handle p);
 extern void hide_particle(instanced_mesh * particles, size_t i);
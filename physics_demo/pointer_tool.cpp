@@ -22,7 +22,7 @@ pointer_tool::mesh_updater::mesh_updater(event_buses &_buses) :
 
 int pointer_tool::mesh_updater::handle(pre_render_pass_event &event) {
 	if (selected_particle) {
-		move_mesh_to_particle(selected_particle_mesh, selected_particle);
+		move_mesh_to_particle(selected_particle_mesh, *particles, selected_particle);
 		hide_particle(particle_mesh, particle_index);
 	}
 
@@ -82,8 +82,8 @@ void pointer_tool::deactivate() {
 	}
 
 	if (held_particle) {
-		held_particle->set_mass(held_particle_mass);
-		held_particle = nullptr;
+		particles->set_mass(held_particle, held_particle_mass);
+		held_particle = {};
 	}
 
 	event_listener<mouseup_event>::unsubscribe();
@@ -105,9 +105,10 @@ int pointer_tool::handle(program_start_event &event) {
 
 int pointer_tool::handle(pre_render_pass_event &event) {
 	if (held_particle) {
-		held_particle->pos = phys::vec3(player_pos + (held_particle_dist * player_dir));
+		particles->pos[held_particle] = phys::vec3(player_pos + (held_particle_dist * player_dir));
 	}
 
+	meshes.particles = particles;
 	meshes.selected_particle = selected_particle;
 	meshes.particle_mesh = particle_mesh;
 	meshes.selected_particle_mesh = selected_particle_mesh.get();
@@ -144,12 +145,11 @@ int pointer_tool::handle(post_processing_event &event) {
 	std::stringstream ss{};
 	ss << std::setprecision(5);
 
-	write_vec3(ss, "force", selected_particle->force);
-	write_vec3(ss, "pos", selected_particle->pos);
-	write_vec3(ss, "vel", selected_particle->vel);
-	write_vec3(ss, "acc", selected_particle->acc);
-	write_real(ss, "mass", selected_particle->get_mass());
-	write_real(ss, "radius", selected_particle->radius);
+	write_vec3(ss, "force", particles->force[selected_particle]);
+	write_vec3(ss, "pos", particles->pos[selected_particle]);
+	write_vec3(ss, "vel", particles->vel[selected_particle]);
+	write_real(ss, "mass", particles->get_mass(selected_particle));
+	write_real(ss, "radius", particles->radius[selected_particle]);
 
 	event.draw2d.draw_text(
 		ss.str(),
@@ -167,11 +167,12 @@ int pointer_tool::handle(post_processing_event &event) {
 }
 
 int pointer_tool::handle(particle_select_event &event) {
-	selected_particle = &event.p;
+	particles = &event.particles;
+	selected_particle = event.p;
 	particle_index = event.particle_index;
 	particle_mesh = &event.particle_mesh;
 
-	move_mesh_to_particle(selected_particle_mesh.get(), selected_particle);
+	move_mesh_to_particle(selected_particle_mesh.get(), *particles, selected_particle);
 
 	if (is_active()) {
 		mesh_world.add_mesh(selected_particle_mesh.get());
@@ -181,7 +182,7 @@ int pointer_tool::handle(particle_select_event &event) {
 }
 
 int pointer_tool::handle(particle_deselect_event &event) {
-	selected_particle = nullptr;
+	selected_particle = {};
 
 	if (is_active()) {
 		mesh_world.remove_mesh(selected_particle_mesh.get());
@@ -195,24 +196,24 @@ int pointer_tool::handle(mousedown_event &event) {
 		if (selected_particle) {
 			held_particle = selected_particle;
 
-			phys::vec3 dx = held_particle->pos - player_pos;
+			phys::vec3 dx = particles->pos[held_particle] - player_pos;
 			held_particle_dist = std::sqrt(phys::dot(dx, dx));
-			held_particle_mass = held_particle->get_mass();
-			held_particle->set_mass(phys::infinity);
+			held_particle_mass = particles->get_mass(held_particle);
+			particles->set_mass(held_particle, phys::infinity);
 		}
 	} else if (event.button == GLFW_MOUSE_BUTTON_RIGHT) {
 		if (held_particle) {
 			if (frozen_particles.find(held_particle) != std::end(frozen_particles)) {
-				held_particle->set_mass(frozen_particles.at(held_particle));
+				particles->set_mass(held_particle, frozen_particles.at(held_particle));
 				frozen_particles.erase(held_particle);
 			} else {
 				frozen_particles[held_particle] = held_particle_mass;
 				held_particle_mass = phys::infinity;
-				held_particle->vel = phys::vec3(0.0_r);
+				particles->vel[held_particle] = phys::vec3(0.0_r);
 			}
 		} else if (selected_particle) {
 			if (frozen_particles.find(selected_particle) != std::end(frozen_particles)) {
-				selected_particle->set_mass(frozen_particles.at(selected_particle));
+				particles->set_mass(selected_particle, frozen_particles.at(selected_particle));
 				frozen_particles.erase(selected_particle);
 			}
 		}
@@ -224,10 +225,10 @@ int pointer_tool::handle(mousedown_event &event) {
 int pointer_tool::handle(mouseup_event &event) {
 	if (event.button == GLFW_MOUSE_BUTTON_LEFT) {
 		if (held_particle) {
-			held_particle->set_mass(held_particle_mass);
+			particles->set_mass(held_particle, held_particle_mass);
 		}
 
-		held_particle = nullptr;
+		held_particle = {};
 	}
 
 	return 0;
@@ -45,7 +45,8 @@ private:
 		public event_listener<pre_render_pass_event>
 	{
 	public:
-		phys::particle * selected_particle{};
+		const phys::particle_store * particles{};
+		phys::particle_handle selected_particle{};
 		instanced_mesh * particle_mesh{};
 		mesh * selected_particle_mesh{};
 		size_t particle_index{};
@@ -55,7 +56,8 @@ private:
 		int handle(pre_render_pass_event &event) override;
 	};
 
-	phys::particle * selected_particle{};
+	phys::particle_store * particles{};
+	phys::particle_handle selected_particle{};
 	size_t particle_index{};
 	instanced_mesh * particle_mesh{};
 	world &mesh_world;
@@ -64,9 +66,9 @@ private:
 
 	glm::vec3 player_pos{};
 	glm::vec3 player_dir{};
-	phys::particle * held_particle{};
+	phys::particle_handle held_particle{};
 	phys::real held_particle_dist{};
 	phys::real held_particle_mass{};
-	std::unordered_map<phys::particle *, phys::real> frozen_particles{};
+	std::unordered_map<phys::particle_handle, phys::real> frozen_particles{};
 	mesh_updater meshes;
 };
@@ -22,8 +22,8 @@ real raycast_sphere_test(const vec3 &p, const vec3 &d, const vec3 &s, real r) {
 	}
 
 	real sqrt_discrim = std::sqrt(discrim);
-	real t0 = (-b + discrim) / (2 * a);
-	real t1 = (-b - discrim) / (2 * a);
+	real t0 = (-b + sqrt_discrim) / (2 * a);
+	real t1 = (-b - sqrt_discrim) / (2 * a);
 
 	real min_t = std::min(t0, t1);
 
@@ -1,11 +1,14 @@
 #include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
 #include <random>
+#include <type_traits>
 #include "physical_particle_emitter.h"
+#include "physics/simd.h"
 #include "shader_constants.h"
 #include "util.h"
 
 using namespace phys::literals;
-using namespace std::literals::chrono_literals;
 
 namespace {
 	std::random_device rng;
@@ -14,15 +17,11 @@ namespace {
 
 	const std::string emitter_shader_name = "particle_color";
 
-	float lerp(float a, float b, float s) {
-		return a + (b - a) * s;
+	float millis_between(const physical_particle_emitter::time_point &from, const physical_particle_emitter::time_point &to) {
+		return std::chrono::duration<float, std::milli>(to - from).count();
 	}
 }
 
-particle::duration particle::age(const particle::time_point &now) const {
-	return std::chrono::duration_cast<particle::duration>(now - created_at);
-}
-
 physical_particle_emitter::physical_particle_emitter(
 	phys::vec3 _pos,
 	phys::vec3 _base_vel,
@@ -34,7 +33,7 @@ physical_particle_emitter::physical_particle_emitter(
 	phys::real _particle_mass,
 	phys::real _damping,
 	phys::vec3 _gravity,
-	particle::duration _expiry_time,
+	duration _expiry_time,
 	glm::vec4 _start_color,
 	glm::vec4 _end_color,
 	float _max_particle_size
@@ -61,58 +60,54 @@ physical_particle_emitter::physical_particle_emitter(
 	color_vbo(0, [](unsigned int handle) {
 		glDeleteBuffers(1, &handle);
 	}),
-	particles{},
+	pos_x{},
+	pos_y{},
+	pos_z{},
+	vel_x{},
+	vel_y{},
+	vel_z{},
+	age{},
 	pos_buf{},
 	color_buf{},
 	max_particles(_max_particles),
-	starting_particles(_starting_particles)
+	starting_particles(_starting_particles),
+	oldest(0),
+	num_alive(0),
+	last_frame{}
 {}
 
 void physical_particle_emitter::update(float millis) {
-	float dt = millis / 1000;
-	const particle::time_point now = particle::clock::now();
+	simulate(millis, clock::now());
 
-	int64_t dead_particle_pos = 0;
-
-	for (size_t i = 0; i < new_particles_per_frame; i++) {
-		dead_particle_pos = next_dead_particle_pos((size_t)dead_particle_pos);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, pos_vbo);
+	glBufferData(GL_ARRAY_BUFFER, pos_buf.size() * sizeof(glm::vec3), pos_buf.data(), GL_STREAM_DRAW);
 
-		if (dead_particle_pos == -1) {
-			break;
-		}
+	glBindBuffer(GL_ARRAY_BUFFER, color_vbo);
+	glBufferData(GL_ARRAY_BUFFER, color_buf.size() * sizeof(glm::vec4), color_buf.data(), GL_STREAM_DRAW);
+}
 
-		particle &p = particles[dead_particle_pos];
-		p.physics.pos = random_particle_pos();
-		p.physics.vel = random_particle_vel();
-		p.physics.acc = phys::vec3(0.0_r);
-		p.physics.force = gravity;
-		p.physics.damping = damping;
-		p.physics.set_mass(particle_mass);
-		p.created_at = now;
-	}
+void physical_particle_emitter::simulate(float millis, const time_point &now) {
+	const float elapsed = millis_between(last_frame, now);
+	last_frame = now;
 
-	pos_buf.clear();
-	color_buf.clear();
+	expire_particles(elapsed);
 
-	for (size_t i = 0; i < particles.size(); i++) {
-		particle &p = particles[i];
-		p.physics.acc = phys::vec3(0.0_r);
+	// The particles that were already alive age by `elapsed`, and the ones spawned in this
+	// frame start at 0
+	const size_t survivors = num_alive;
 
-		if (! is_particle_dead(p, now)) {
-			p.physics.integrate(dt);
-			pos_buf.push_back(phys::to_glm<glm::vec3>(p.physics.pos));
-			color_buf.push_back(particle_color(p, now));
+	for (size_t i = 0; i < new_particles_per_frame; i++) {
+		if (! spawn_particle()) {
+			break;
 		}
 	}
 
-	assert(pos_buf.size() == color_buf.size());
-
-	glBindVertexArray(vao);
-	glBindBuffer(GL_ARRAY_BUFFER, pos_vbo);
-	glBufferData(GL_ARRAY_BUFFER, pos_buf.size() * sizeof(glm::vec3), pos_buf.data(), GL_STREAM_DRAW);
+	pos_buf.resize(num_alive);
+	color_buf.resize(num_alive);
 
-	glBindBuffer(GL_ARRAY_BUFFER, color_vbo);
-	glBufferData(GL_ARRAY_BUFFER, color_buf.size() * sizeof(glm::vec4), color_buf.data(), GL_STREAM_DRAW);
+	step_particles(0, survivors, make_step(millis, elapsed));
+	step_particles(survivors, num_alive - survivors, make_step(millis, 0.0f));
 }
 
 void physical_particle_emitter::prepare_draw(draw_event &event, const shader_program &shader) const {
@@ -128,41 +123,7 @@ void physical_particle_emitter::draw() const {
 }
 
 void physical_particle_emitter::start() {
-	particle::time_point now = particle::clock::now();
-
-	for (size_t i = 0; i < starting_particles; i++) {
-		phys::particle physics{};
-		physics.pos = random_particle_pos();
-		physics.vel = random_particle_vel();
-		physics.force = gravity;
-		physics.set_mass(particle_mass);
-		physics.damping = damping;
-
-		particle p = {
-			.physics = physics,
-			.created_at = now
-		};
-
-		particles.push_back(p);
-
-		pos_buf.push_back(phys::to_glm<glm::vec3>(physics.pos));
-		color_buf.push_back(particle_color(p, now));
-	}
-
-	for (size_t i = starting_particles; i < max_particles; i++) {
-		phys::particle physics{};
-		physics.force = gravity;
-		physics.set_mass(particle_mass);
-
-		particle p = {
-			.physics = physics,
-			.created_at = particle::time_point(0ms)
-		};
-
-		particles.push_back(p);
-	}
-
-	assert(pos_buf.size() == color_buf.size());
+	start_simulation(clock::now());
 
 	glGenVertexArrays(1, &vao);
 	glBindVertexArray(vao);
@@ -181,27 +142,55 @@ void physical_particle_emitter::start() {
 }
 
 bool physical_particle_emitter::is_done() const {
-	const particle::time_point now = particle::clock::now();
-
-	for (const particle &p : particles) {
-		if (! is_particle_dead(p, now)) {
-			return false;
-		}
+	if (! num_alive) {
+		return true;
 	}
 
-	return true;
+	// The newest particle dies last
+	const float newest_age = age[(oldest + num_alive - 1) % age.size()];
+
+	return is_particle_dead(newest_age + millis_between(last_frame, clock::now()));
 }
 
 void physical_particle_emitter::stop() {
-	for (particle &p : particles) {
-		p.created_at = particle::time_point(0ms);
-	}
+	num_alive = 0;
 }
 
 const std::string& physical_particle_emitter::shader_name() const {
 	return emitter_shader_name;
 }
 
+void physical_particle_emitter::start_simulation(const time_point &now) {
+	for (std::vector<phys::real> * component : { &pos_x, &pos_y, &pos_z, &vel_x, &vel_y, &vel_z }) {
+		component->assign(max_particles, 0.0_r);
+	}
+
+	age.assign(max_particles, 0.0f);
+	oldest = 0;
+	num_alive = 0;
+	last_frame = now;
+
+	for (size_t i = 0; i < starting_particles && spawn_particle(); i++) {}
+
+	pos_buf.resize(num_alive);
+	color_buf.resize(num_alive);
+
+	// A step of no time only fills the buffers
+	step_particles(0, num_alive, make_step(0.0f, 0.0f));
+}
+
+size_t physical_particle_emitter::get_num_alive() const {
+	return num_alive;
+}
+
+const std::vector<glm::vec3>& physical_particle_emitter::get_positions() const {
+	return pos_buf;
+}
+
+const std::vector<glm::vec4>& physical_particle_emitter::get_colors() const {
+	return color_buf;
+}
+
 phys::vec3 physical_particle_emitter::random_particle_pos() const {
 	phys::vec3 offset(
 		distrib(gen),
@@ -222,35 +211,128 @@ phys::vec3 physical_particle_emitter::random_particle_vel() const {
 	return base_vel + (offset * rand_vel_scale);
 }
 
-int64_t physical_particle_emitter::next_dead_particle_pos(size_t start) const {
-	const particle::time_point now = particle::clock::now();
+bool physical_particle_emitter::spawn_particle() {
+	if (num_alive == age.size()) {
+		return false;
+	}
+
+	const size_t i = (oldest + num_alive) % age.size();
+	const phys::vec3 p = random_particle_pos();
+	const phys::vec3 v = random_particle_vel();
 
-	for (size_t i = start; i < particles.size(); i++) {
-		if (is_particle_dead(particles[i], now)) {
-			return i;
-		}
+	pos_x[i] = p.x;
+	pos_y[i] = p.y;
+	pos_z[i] = p.z;
+	vel_x[i] = v.x;
+	vel_y[i] = v.y;
+	vel_z[i] = v.z;
+	age[i] = 0.0f;
+
+	num_alive++;
+
+	return true;
+}
+
+void physical_particle_emitter::expire_particles(float elapsed) {
+	while (num_alive && is_particle_dead(age[oldest] + elapsed)) {
+		oldest = (oldest + 1) % age.size();
+		num_alive--;
 	}
+}
 
-	return -1;
+bool physical_particle_emitter::is_particle_dead(float particle_age) const {
+	return particle_age > (float)expiry_time.count();
 }
 
-glm::vec4 physical_particle_emitter::particle_color(const particle &p, const particle::time_point &now) const {
-	long long curr_age = p.age(now).count();
-	long long max_age = expiry_time.count();
-	float age_f = ((float)curr_age) / max_age;
+physical_particle_emitter::frame_step physical_particle_emitter::make_step(float millis, float elapsed) const {
+	const phys::real dt = millis / 1000;
+
+	return {
+		.dt = dt,
+		.dvel = gravity * (1.0_r / particle_mass) * dt,
+		.decay = std::pow(damping, dt),
+		.elapsed = elapsed,
+		.expiry = (float)expiry_time.count(),
+		.color_change = end_color - start_color
+	};
+}
 
-	if (age_f > 1.0) {
-		return end_color;
+void physical_particle_emitter::step_particles(size_t first, size_t count, const frame_step &step) {
+	if (! count) {
+		return;
 	}
 
-	return glm::vec4(
-		lerp(start_color.r, end_color.r, age_f),
-		lerp(start_color.g, end_color.g, age_f),
-		lerp(start_color.b, end_color.b, age_f),
-		lerp(start_color.a, end_color.a, age_f)
-	);
+	const size_t begin = (oldest + first) % age.size();
+	const size_t run = std::min(count, age.size() - begin);
+
+	step_run(begin, begin + run, first, step);
+	step_run(0, count - run, first + run, step);
 }
 
-bool physical_particle_emitter::is_particle_dead(const particle &p, const particle::time_point &now) const {
-	return (now - p.created_at) > expiry_time;
+void physical_particle_emitter::step_run(size_t begin, size_t end, size_t out, const frame_step &step) {
+	size_t i = begin;
+
+#ifdef PHYS_SIMD
+	static_assert(std::is_same_v<phys::real, float>);
+
+	namespace simd = phys::simd;
+
+	constexpr size_t width = simd::width;
+
+	const simd::floats dt = simd::set1(step.dt);
+	const simd::floats dvel_x = simd::set1(step.dvel.x);
+	const simd::floats dvel_y = simd::set1(step.dvel.y);
+	const simd::floats dvel_z = simd::set1(step.dvel.z);
+	const simd::floats decay = simd::set1(step.decay);
+	const simd::floats elapsed = simd::set1(step.elapsed);
+	const simd::floats expiry = simd::set1(step.expiry);
+
+	// The buffers hold whole positions and colors, so each lane is copied into them on its
+	// own
+	alignas(32) float x[width];
+	alignas(32) float y[width];
+	alignas(32) float z[width];
+	alignas(32) float t[width];
+
+	for (; i + width <= end; i += width, out += width) {
+		const simd::floats vx = simd::loadu(&vel_x[i]);
+		const simd::floats vy = simd::loadu(&vel_y[i]);
+		const simd::floats vz = simd::loadu(&vel_z[i]);
+		const simd::floats px = simd::add(simd::loadu(&pos_x[i]), simd::mul(vx, dt));
+		const simd::floats py = simd::add(simd::loadu(&pos_y[i]), simd::mul(vy, dt));
+		const simd::floats pz = simd::add(simd::loadu(&pos_z[i]), simd::mul(vz, dt));
+		const simd::floats a = simd::add(simd::loadu(&age[i]), elapsed);
+
+		simd::storeu(&pos_x[i], px);
+		simd::storeu(&pos_y[i], py);
+		simd::storeu(&pos_z[i], pz);
+		simd::storeu(&vel_x[i], simd::mul(simd::add(vx, dvel_x), decay));
+		simd::storeu(&vel_y[i], simd::mul(simd::add(vy, dvel_y), decay));
+		simd::storeu(&vel_z[i], simd::mul(simd::add(vz, dvel_z), decay));
+		simd::storeu(&age[i], a);
+
+		simd::store(x, px);
+		simd::store(y, py);
+		simd::store(z, pz);
+		simd::store(t, simd::div(a, expiry));
+
+		for (size_t j = 0; j < width; j++) {
+			pos_buf[out + j] = glm::vec3(x[j], y[j], z[j]);
+			color_buf[out + j] = start_color + step.color_change * t[j];
+		}
+	}
+#endif
+
+	for (; i < end; i++, out++) {
+		pos_x[i] += vel_x[i] * step.dt;
+		pos_y[i] += vel_y[i] * step.dt;
+		pos_z[i] += vel_z[i] * step.dt;
+		vel_x[i] = (vel_x[i] + step.dvel.x) * step.decay;
+		vel_y[i] = (vel_y[i] + step.dvel.y) * step.decay;
+		vel_z[i] = (vel_z[i] + step.dvel.z) * step.decay;
+		age[i] += step.elapsed;
+
+		pos_buf[out] = glm::vec3(pos_x[i], pos_y[i], pos_z[i]);
+		color_buf[out] = start_color + step.color_change * (age[i] / step.expiry);
+	}
 }
\ No newline at end of file
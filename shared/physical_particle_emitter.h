@@ -1,21 +1,15 @@
 #pragma once
+#include <chrono>
 #include <vector>
 #include "particle_emitter.h"
-#include "physics/particle.h"
+#include "physics/math.h"
 
-struct particle {
+class physical_particle_emitter : public particle_emitter {
+public:
 	using clock = std::chrono::steady_clock;
 	using time_point = std::chrono::time_point<clock>;
 	using duration = std::chrono::milliseconds;
 
-	phys::particle physics;
-	time_point created_at;
-
-	duration age(const time_point &now) const;
-};
-
-class physical_particle_emitter : public particle_emitter {
-public:
 	phys::vec3 pos;
 	phys::vec3 base_vel;
 	phys::real rand_pos_scale;
@@ -24,7 +18,7 @@ public:
 	phys::real particle_mass;
 	phys::real damping;
 	phys::vec3 gravity;
-	particle::duration expiry_time;
+	duration expiry_time;
 	glm::vec4 start_color;
 	glm::vec4 end_color;
 	float max_particle_size;
@@ -40,7 +34,7 @@ public:
 		phys::real _particle_mass,
 		phys::real _damping,
 		phys::vec3 _gravity,
-		particle::duration _expiry_time,
+		duration _expiry_time,
 		glm::vec4 _start_color,
 		glm::vec4 _end_color,
 		float _max_particle_size
@@ -56,22 +50,69 @@ public:
 
 	const std::string& shader_name() const override;
 
+	// The parts of `start` and `update` that don't touch OpenGL: spawning, expiring and
+	// integrating the particles, and filling the buffers that are uploaded
+	void start_simulation(const time_point &now);
+	void simulate(float millis, const time_point &now);
+
+	size_t get_num_alive() const;
+	// The positions and colors of the live particles as of the last frame, from oldest to
+	// newest
+	const std::vector<glm::vec3>& get_positions() const;
+	const std::vector<glm::vec4>& get_colors() const;
+
 private:
 	unique_handle<unsigned int> vao;
 	unique_handle<unsigned int> pos_vbo;
 	unique_handle<unsigned int> color_vbo;
 
-	std::vector<particle> particles;
+	// The particles, one array per component, as a ring buffer from oldest to newest. Every
+	// particle lives for the same time, so they die in the order they were spawned: the live
+	// particles are the `num_alive` after `oldest`, and the rest are free. Ages are in
+	// milliseconds, as of the last frame.
+	std::vector<phys::real> pos_x;
+	std::vector<phys::real> pos_y;
+	std::vector<phys::real> pos_z;
+	std::vector<phys::real> vel_x;
+	std::vector<phys::real> vel_y;
+	std::vector<phys::real> vel_z;
+	std::vector<float> age;
+	// The positions and colors of the live particles, from oldest to newest, ready to be
+	// uploaded
 	std::vector<glm::vec3> pos_buf;
 	std::vector<glm::vec4> color_buf;
 
 	size_t max_particles;
 	size_t starting_particles;
+	size_t oldest;
+	size_t num_alive;
+	time_point last_frame;
+
+	// What happens to every particle in one frame. All particles have the same mass,
+	// damping and gravity, so the change in velocity is the same for all of them.
+	struct frame_step {
+		phys::real dt;
+		phys::vec3 dvel;
+		phys::real decay;
+		float elapsed;
+		float expiry;
+		glm::vec4 color_change;
+	};
 
 	phys::vec3 random_particle_pos() const;
 	phys::vec3 random_particle_vel() const;
-	int64_t next_dead_particle_pos(size_t start) const;
+	// Spawns a particle in the next free slot, if there is one
+	bool spawn_particle();
+	// Frees the particles that are older than `expiry_time` after `elapsed` more
+	// milliseconds
+	void expire_particles(float elapsed);
+	bool is_particle_dead(float particle_age) const;
 
-	bool is_particle_dead(const particle &p, const particle::time_point &now) const;
-	glm::vec4 particle_color(const particle &p, const particle::time_point &now) const;
+	frame_step make_step(float millis, float elapsed) const;
+	// Steps `count` live particles starting `first` places after `oldest`, and writes them
+	// to the buffers starting at the same place
+	void step_particles(size_t first, size_t count, const frame_step &step);
+	// Steps particles [begin, end) of the arrays, which don't wrap, and writes them to the
+	// buffers starting at `out`
+	void step_run(size_t begin, size_t end, size_t out, const frame_step &step);
 };
\ No newline at end of file
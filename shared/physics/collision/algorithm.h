@@ -1,10 +1,20 @@
 #pragma once
-#include <functional>
+#include <span>
 #include <vector>
 #include "contact.h"
 #include "primitive.h"
 
 namespace phys {
 	using contact_container = std::vector<contact>;
-	using collision_algorithm_func = std::function<void(primitive&, primitive&, contact_container&)>;
+
+	struct primitive_pair {
+		primitive * a{};
+		primitive * b{};
+	};
+
+	// An algorithm registered for shape types (x, y) is also called with primitives of
+	// types (y, x), in that order, so it must handle both
+	using collision_algorithm_func = void (*)(primitive&, primitive&, contact_container&);
+	// Runs an algorithm over pairs that all have the same shape types
+	using collision_batch_func = void (*)(std::span<const primitive_pair>, contact_container&);
 }
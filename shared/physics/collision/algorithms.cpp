@@ -1,30 +1,357 @@
+#include <algorithm>
+#include <cmath>
 #include "algorithms.h"
+#include "gjk.h"
 #include "primitives.h"
 
 using namespace phys::literals;
 
-phys::collision_algorithm_func phys::algorithms::sphere_sphere_collision =
-	[](primitive &_a, primitive &_b, contact_container &contacts) {
-		sphere &a = static_cast<sphere&>(_a);
-		sphere &b = static_cast<sphere&>(_b);
+namespace {
+	// Calls `Algorithm` directly rather than through a pointer, so that it can be inlined
+	// into the loop
+	template <phys::collision_algorithm_func Algorithm>
+	void for_each_pair(std::span<const phys::primitive_pair> pairs, phys::contact_container &contacts) {
+		for (const phys::primitive_pair &pair : pairs) {
+			Algorithm(*pair.a, *pair.b, contacts);
+		}
+	}
+
+	// Adds a contact whose normal points from `first` to `second`, or the reverse of it if
+	// the algorithm was called with the primitives the other way around
+	void add_contact(
+		phys::rigid_body * first,
+		phys::rigid_body * second,
+		const phys::vec3 &point,
+		const phys::vec3 &normal,
+		phys::real penetration,
+		bool flipped,
+		phys::contact_container &contacts
+	) {
+		if (flipped) {
+			contacts.insert(std::end(contacts), phys::contact(second, first, point, -normal, penetration));
+		} else {
+			contacts.insert(std::end(contacts), phys::contact(first, second, point, normal, penetration));
+		}
+	}
+
+	// Adds a contact if a sphere sinks into a plane. The contact's point is on the
+	// plane's surface.
+	void sphere_plane_contact(
+		phys::rigid_body * body,
+		const phys::vec3 &center,
+		phys::real radius,
+		const phys::plane &p,
+		bool flipped,
+		phys::contact_container &contacts
+	) {
+		const phys::real d = phys::dot(p.normal, center) - p.distance;
+
+		if (d >= radius) {
+			return;
+		}
+
+		add_contact(body, p.body, center - p.normal * d, -p.normal, radius - d, flipped, contacts);
+	}
+
+	// Adds a contact if two spheres overlap. The contact's point is halfway through the
+	// overlap. Spheres with the same center are pushed apart along `fallback`.
+	void sphere_sphere_contact(
+		phys::rigid_body * body_a,
+		const phys::vec3 &center_a,
+		phys::real radius_a,
+		phys::rigid_body * body_b,
+		const phys::vec3 &center_b,
+		phys::real radius_b,
+		const phys::vec3 &fallback,
+		phys::contact_container &contacts
+	) {
+		const phys::vec3 d_vec = center_b - center_a;
+		const phys::real d_sq = phys::dot(d_vec, d_vec);
+		const phys::real min_radius = radius_a + radius_b;
+
+		if (d_sq >= min_radius * min_radius) {
+			return;
+		}
+
+		const phys::real d = std::sqrt(d_sq);
+		const phys::vec3 normal = d > 0.0_r ? d_vec / d : fallback;
+		const phys::real penetration = min_radius - d;
+
+		contacts.insert(std::end(contacts), phys::contact(body_a, body_b, center_a + normal * (radius_a - penetration * 0.5_r), normal, penetration));
+	}
+
+	phys::vec3 closest_on_segment(const phys::vec3 &p, const phys::vec3 &start, const phys::vec3 &end) {
+		const phys::vec3 d = end - start;
+		const phys::real len_sq = phys::dot(d, d);
+
+		if (len_sq == 0.0_r) {
+			return start;
+		}
+
+		return start + d * std::clamp(phys::dot(p - start, d) / len_sq, 0.0_r, 1.0_r);
+	}
+
+	// A unit vector perpendicular to `v`, or any unit vector if `v` is zero
+	phys::vec3 any_perpendicular(const phys::vec3 &v) {
+		const phys::vec3 p = std::abs(v.x) < std::abs(v.y) ? phys::vec3(0.0_r, -v.z, v.y) : phys::vec3(-v.z, 0.0_r, v.x);
+		const phys::real len_sq = phys::dot(p, p);
+
+		return len_sq > 0.0_r ? p / std::sqrt(len_sq) : phys::vec3(0.0_r, 1.0_r, 0.0_r);
+	}
+
+	struct capsule_segment {
+		phys::vec3 start{};
+		phys::vec3 end{};
+
+		explicit capsule_segment(const phys::capsule &c) {
+			const phys::mat4 t = c.world_transform();
+			const phys::vec3 center = phys::truncate(t[3]);
+			const phys::vec3 axis = phys::truncate(t[1]) * c.half_height;
+
+			start = center - axis;
+			end = center + axis;
+		}
+	};
+}
+
+void phys::algorithms::sphere_sphere_collision(primitive &_a, primitive &_b, contact_container &contacts) {
+	sphere &a = static_cast<sphere&>(_a);
+	sphere &b = static_cast<sphere&>(_b);
+
+	vec3 pos_a = a.body->pos + truncate(a.offset[3]);
+	vec3 pos_b = b.body->pos + truncate(b.offset[3]);
+	vec3 d_vec = pos_b - pos_a;
+	real d = std::sqrt(dot(d_vec, d_vec));
+	real min_radius = a.radius + b.radius;
+
+	if (d >= min_radius) {
+		return;
+	}
+
+	contact c(
+		a.body,
+		b.body,
+		pos_a + d_vec / 2.0_r,
+		d_vec / d,
+		min_radius - d
+	);
+
+	contacts.insert(std::end(contacts), c);
+}
+
+// The contact's normal points from the sphere into the plane, and its point is on the
+// plane's surface
+void phys::algorithms::sphere_plane_collision(primitive &_a, primitive &_b, contact_container &contacts) {
+	const bool flipped = _a.type == static_cast<int>(shape_type::Plane);
+	sphere &s = static_cast<sphere&>(flipped ? _b : _a);
+	plane &p = static_cast<plane&>(flipped ? _a : _b);
+
+	sphere_plane_contact(s.body, s.center(), s.radius, p, flipped, contacts);
+}
+
+void phys::algorithms::sphere_box_collision(primitive &_a, primitive &_b, contact_container &contacts) {
+	const bool flipped = _a.type == static_cast<int>(shape_type::Box);
+	sphere &s = static_cast<sphere&>(flipped ? _b : _a);
+	box &b = static_cast<box&>(flipped ? _a : _b);
+
+	const mat4 t = b.world_transform();
+	const mat3 rot = truncate(t);
+	const vec3 rel = s.center() - truncate(t[3]);
+	// The sphere's center in the box's frame, where the box is axis-aligned
+	const vec3 local = transpose(rot) * rel;
+	vec3 closest = glm::clamp(local, -b.half_size, b.half_size);
+	const vec3 outside = local - closest;
+	const real d_sq = dot(outside, outside);
+
+	if (d_sq >= s.radius * s.radius) {
+		return;
+	}
+
+	// Points out of the box, towards the sphere
+	vec3 normal_local(0.0_r);
+	real penetration = 0.0_r;
+
+	if (d_sq > 0.0_r) {
+		const real d = std::sqrt(d_sq);
 
-		vec3 pos_a = a.body->pos + truncate(a.offset[3]);
-		vec3 pos_b = b.body->pos + truncate(b.offset[3]);
-		vec3 d_vec = pos_b - pos_a;
-		real d = std::sqrt(dot(d_vec, d_vec));
-		real min_radius = a.radius + b.radius;
+		normal_local = outside / d;
+		penetration = s.radius - d;
+	} else {
+		// The center is inside the box, so the sphere is pushed out through the nearest face
+		int axis = 0;
+
+		for (int i = 1; i < 3; i++) {
+			if (b.half_size[i] - std::abs(local[i]) < b.half_size[axis] - std::abs(local[axis])) {
+				axis = i;
+			}
+		}
+
+		normal_local[axis] = local[axis] >= 0.0_r ? 1.0_r : -1.0_r;
+		penetration = s.radius + b.half_size[axis] - std::abs(local[axis]);
+		closest[axis] = normal_local[axis] * b.half_size[axis];
+	}
+
+	add_contact(s.body, b.body, truncate(t[3]) + rot * closest, -(rot * normal_local), penetration, flipped, contacts);
+}
+
+void phys::algorithms::sphere_capsule_collision(primitive &_a, primitive &_b, contact_container &contacts) {
+	const bool flipped = _a.type == static_cast<int>(shape_type::Capsule);
+	sphere &s = static_cast<sphere&>(flipped ? _b : _a);
+	capsule &c = static_cast<capsule&>(flipped ? _a : _b);
+
+	const capsule_segment seg(c);
+	const vec3 center = s.center();
+	const vec3 on_segment = closest_on_segment(center, seg.start, seg.end);
+	const vec3 fallback = any_perpendicular(seg.end - seg.start);
+
+	if (flipped) {
+		sphere_sphere_contact(c.body, on_segment, c.radius, s.body, center, s.radius, fallback, contacts);
+	} else {
+		sphere_sphere_contact(s.body, center, s.radius, c.body, on_segment, c.radius, fallback, contacts);
+	}
+}
+
+void phys::algorithms::box_plane_collision(primitive &_a, primitive &_b, contact_container &contacts) {
+	const bool flipped = _a.type == static_cast<int>(shape_type::Plane);
+	box &b = static_cast<box&>(flipped ? _b : _a);
+	plane &p = static_cast<plane&>(flipped ? _a : _b);
+
+	const mat4 t = b.world_transform();
+	const vec3 center = truncate(t[3]);
+	const vec3 x = truncate(t[0]) * b.half_size.x;
+	const vec3 y = truncate(t[1]) * b.half_size.y;
+	const vec3 z = truncate(t[2]) * b.half_size.z;
+	const real reach = std::abs(dot(p.normal, x)) + std::abs(dot(p.normal, y)) + std::abs(dot(p.normal, z));
+
+	if (dot(p.normal, center) - p.distance >= reach) {
+		return;
+	}
+
+	for (int i = 0; i < 8; i++) {
+		const vec3 corner = center + ((i & 1) ? x : -x) + ((i & 2) ? y : -y) + ((i & 4) ? z : -z);
+
+		sphere_plane_contact(b.body, corner, 0.0_r, p, flipped, contacts);
+	}
+}
+
+void phys::algorithms::capsule_capsule_collision(primitive &_a, primitive &_b, contact_container &contacts) {
+	capsule &a = static_cast<capsule&>(_a);
+	capsule &b = static_cast<capsule&>(_b);
+
+	const capsule_segment seg_a(a);
+	const capsule_segment seg_b(b);
+	const vec3 d_a = seg_a.end - seg_a.start;
+	const vec3 d_b = seg_b.end - seg_b.start;
+	const vec3 r = seg_a.start - seg_b.start;
+	const real len_sq_a = dot(d_a, d_a);
+	const real len_sq_b = dot(d_b, d_b);
+	const real dot_ab = dot(d_a, d_b);
+	const real denom = len_sq_a * len_sq_b - dot_ab * dot_ab;
+	const vec3 fallback = any_perpendicular(d_a);
+
+	// Parallel capsules that lie side by side touch along a line, so both ends of the
+	// line get a contact
+	if (len_sq_a > 0.0_r && len_sq_b > 0.0_r && denom <= 1e-6_r * len_sq_a * len_sq_b) {
+		const real s_start = dot(seg_b.start - seg_a.start, d_a) / len_sq_a;
+		const real s_end = dot(seg_b.end - seg_a.start, d_a) / len_sq_a;
+		const real lo = std::max(0.0_r, std::min(s_start, s_end));
+		const real hi = std::min(1.0_r, std::max(s_start, s_end));
+
+		if (lo <= hi) {
+			for (const real s : { lo, hi }) {
+				const vec3 on_a = seg_a.start + d_a * s;
+
+				sphere_sphere_contact(a.body, on_a, a.radius, b.body, closest_on_segment(on_a, seg_b.start, seg_b.end), b.radius, fallback, contacts);
+
+				if (lo == hi) {
+					break;
+				}
+			}
 
-		if (d >= min_radius) {
 			return;
 		}
+	}
+
+	// The closest points of two segments, from Ericson's "Real-Time Collision Detection"
+	real s = 0.0_r;
+	real t = 0.0_r;
+
+	if (len_sq_a == 0.0_r && len_sq_b == 0.0_r) {
+		s = 0.0_r;
+		t = 0.0_r;
+	} else if (len_sq_a == 0.0_r) {
+		t = std::clamp(dot(d_b, r) / len_sq_b, 0.0_r, 1.0_r);
+	} else if (len_sq_b == 0.0_r) {
+		s = std::clamp(-dot(d_a, r) / len_sq_a, 0.0_r, 1.0_r);
+	} else {
+		const real c = dot(d_a, r);
+		const real f = dot(d_b, r);
+
+		s = denom > 1e-6_r * len_sq_a * len_sq_b ? std::clamp((dot_ab * f - c * len_sq_b) / denom, 0.0_r, 1.0_r) : 0.0_r;
+		t = (dot_ab * s + f) / len_sq_b;
+
+		if (t < 0.0_r) {
+			t = 0.0_r;
+			s = std::clamp(-c / len_sq_a, 0.0_r, 1.0_r);
+		} else if (t > 1.0_r) {
+			t = 1.0_r;
+			s = std::clamp((dot_ab - c) / len_sq_a, 0.0_r, 1.0_r);
+		}
+	}
+
+	sphere_sphere_contact(a.body, seg_a.start + d_a * s, a.radius, b.body, seg_b.start + d_b * t, b.radius, fallback, contacts);
+}
+
+void phys::algorithms::capsule_plane_collision(primitive &_a, primitive &_b, contact_container &contacts) {
+	const bool flipped = _a.type == static_cast<int>(shape_type::Plane);
+	capsule &c = static_cast<capsule&>(flipped ? _b : _a);
+	plane &p = static_cast<plane&>(flipped ? _a : _b);
+
+	const capsule_segment seg(c);
+
+	sphere_plane_contact(c.body, seg.start, c.radius, p, flipped, contacts);
+	sphere_plane_contact(c.body, seg.end, c.radius, p, flipped, contacts);
+}
+
+// The contact's point is halfway between the deepest points of the two primitives
+void phys::algorithms::gjk_epa_collision(primitive &_a, primitive &_b, contact_container &contacts) {
+	const std::optional<penetration> result = gjk_epa(static_cast<convex_primitive&>(_a), static_cast<convex_primitive&>(_b));
+
+	if (! result) {
+		return;
+	}
+
+	contacts.insert(std::end(contacts), contact(_a.body, _b.body, (result->point_a + result->point_b) * 0.5_r, result->normal, result->depth));
+}
+
+void phys::algorithms::sphere_sphere_collisions(std::span<const primitive_pair> pairs, contact_container &contacts) {
+	for_each_pair<sphere_sphere_collision>(pairs, contacts);
+}
+
+void phys::algorithms::sphere_plane_collisions(std::span<const primitive_pair> pairs, contact_container &contacts) {
+	for_each_pair<sphere_plane_collision>(pairs, contacts);
+}
+
+void phys::algorithms::sphere_box_collisions(std::span<const primitive_pair> pairs, contact_container &contacts) {
+	for_each_pair<sphere_box_collision>(pairs, contacts);
+}
+
+void phys::algorithms::sphere_capsule_collisions(std::span<const primitive_pair> pairs, contact_container &contacts) {
+	for_each_pair<sphere_capsule_collision>(pairs, contacts);
+}
+
+void phys::algorithms::box_plane_collisions(std::span<const primitive_pair> pairs, contact_container &contacts) {
+	for_each_pair<box_plane_collision>(pairs, contacts);
+}
+
+void phys::algorithms::capsule_capsule_collisions(std::span<const primitive_pair> pairs, contact_container &contacts) {
+	for_each_pair<capsule_capsule_collision>(pairs, contacts);
+}
 
-		contact c(
-			a.body,
-			b.body,
-			pos_a + d_vec / 2.0_r,
-			d_vec / d,
-			min_radius - d
-		);
+void phys::algorithms::capsule_plane_collisions(std::span<const primitive_pair> pairs, contact_container &contacts) {
+	for_each_pair<capsule_plane_collision>(pairs, contacts);
+}
 
-		contacts.insert(std::end(contacts), c);
-	};
\ No newline at end of file
+void phys::algorithms::gjk_epa_collisions(std::span<const primitive_pair> pairs, contact_container &contacts) {
+	for_each_pair<gjk_epa_collision>(pairs, contacts);
+}
\ No newline at end of file
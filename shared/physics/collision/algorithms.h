@@ -1,6 +1,27 @@
 #pragma once
 #include "algorithm.h"
 
+// Each algorithm takes its primitives in either order. The contacts' normals point from
+// the body of the first primitive to the body of the second.
 namespace phys::algorithms {
-	extern collision_algorithm_func sphere_sphere_collision;
+	void sphere_sphere_collision(primitive &a, primitive &b, contact_container &contacts);
+	void sphere_plane_collision(primitive &a, primitive &b, contact_container &contacts);
+	void sphere_box_collision(primitive &a, primitive &b, contact_container &contacts);
+	void sphere_capsule_collision(primitive &a, primitive &b, contact_container &contacts);
+	// One contact for each corner of the box behind the plane
+	void box_plane_collision(primitive &a, primitive &b, contact_container &contacts);
+	void capsule_capsule_collision(primitive &a, primitive &b, contact_container &contacts);
+	// One contact for each end of the capsule that is behind the plane
+	void capsule_plane_collision(primitive &a, primitive &b, contact_container &contacts);
+	// Any two `convex_primitive`s, through GJK and EPA. Generates at most one contact.
+	void gjk_epa_collision(primitive &a, primitive &b, contact_container &contacts);
+
+	void sphere_sphere_collisions(std::span<const primitive_pair> pairs, contact_container &contacts);
+	void sphere_plane_collisions(std::span<const primitive_pair> pairs, contact_container &contacts);
+	void sphere_box_collisions(std::span<const primitive_pair> pairs, contact_container &contacts);
+	void sphere_capsule_collisions(std::span<const primitive_pair> pairs, contact_container &contacts);
+	void box_plane_collisions(std::span<const primitive_pair> pairs, contact_container &contacts);
+	void capsule_capsule_collisions(std::span<const primitive_pair> pairs, contact_container &contacts);
+	void capsule_plane_collisions(std::span<const primitive_pair> pairs, contact_container &contacts);
+	void gjk_epa_collisions(std::span<const primitive_pair> pairs, contact_container &contacts);
 }
\ No newline at end of file
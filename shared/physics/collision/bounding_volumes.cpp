@@ -1,6 +1,8 @@
 #define _USE_MATH_DEFINES
+#include <algorithm>
 #include <cmath>
 #include <tuple>
+#include "../simd.h"
 #include "bounding_volumes.h"
 
 using namespace phys::literals;
@@ -11,6 +13,17 @@ phys::bounding_sphere::bounding_sphere(const vec3 &_center, real _radius) :
 {}
 
 phys::bounding_sphere::bounding_sphere(const bounding_sphere &a, const bounding_sphere &b) {
+	// Also covers spheres with the same center, which would otherwise divide by zero
+	if (a.contains(b)) {
+		*this = a;
+		return;
+	}
+
+	if (b.contains(a)) {
+		*this = b;
+		return;
+	}
+
 	vec3 d_vec = b.center - a.center;
 	real d_len = std::sqrt(dot(d_vec, d_vec));
 
@@ -35,10 +48,246 @@ phys::real phys::bounding_sphere::growth(const bounding_sphere &other) const {
 	return overlap.volume() - volume();
 }
 
+bool phys::bounding_sphere::contains(const bounding_sphere &other) const {
+	if (other.radius > radius) {
+		return false;
+	}
+
+	const vec3 d_vec = other.center - center;
+	const real r = radius - other.radius;
+
+	return dot(d_vec, d_vec) <= r * r;
+}
+
+phys::bounding_sphere phys::bounding_sphere::enlarged(real margin) const {
+	return bounding_sphere(center, radius + margin);
+}
+
+phys::real phys::bounding_sphere::surface_area() const {
+	return 4.0_r * (real)M_PI * radius * radius;
+}
+
+phys::vec3 phys::bounding_sphere::centroid() const {
+	return center;
+}
+
 phys::real phys::bounding_sphere::volume() const {
 	return 4.0_r * (real)M_PI * radius * radius * radius / 3.0_r;
 }
 
 bool phys::operator==(const bounding_sphere &a, const bounding_sphere &b) {
 	return std::tie(a.center, a.radius) == std::tie(b.center, b.radius);
+}
+
+phys::aabb::aabb(const vec3 &_min, const vec3 &_max) :
+	min(_min),
+	max(_max)
+{}
+
+phys::aabb::aabb(const aabb &a, const aabb &b) :
+	min(glm::min(a.min, b.min)),
+	max(glm::max(a.max, b.max))
+{}
+
+phys::aabb::aabb(const bounding_sphere &sphere) :
+	min(sphere.center - vec3(sphere.radius)),
+	max(sphere.center + vec3(sphere.radius))
+{}
+
+bool phys::aabb::overlaps(const aabb &other) const {
+	// No branches, so that the compiler is free to compare every axis at once
+	return (min.x <= other.max.x) & (other.min.x <= max.x) &
+		(min.y <= other.max.y) & (other.min.y <= max.y) &
+		(min.z <= other.max.z) & (other.min.z <= max.z);
+}
+
+phys::real phys::aabb::growth(const aabb &other) const {
+	return aabb(*this, other).surface_area() - surface_area();
+}
+
+bool phys::aabb::contains(const aabb &other) const {
+	return (min.x <= other.min.x) & (other.max.x <= max.x) &
+		(min.y <= other.min.y) & (other.max.y <= max.y) &
+		(min.z <= other.min.z) & (other.max.z <= max.z);
+}
+
+phys::aabb phys::aabb::enlarged(real margin) const {
+	return aabb(min - vec3(margin), max + vec3(margin));
+}
+
+phys::real phys::aabb::surface_area() const {
+	const vec3 d = max - min;
+
+	return 2.0_r * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+phys::vec3 phys::aabb::centroid() const {
+	return (min + max) * 0.5_r;
+}
+
+bool phys::operator==(const aabb &a, const aabb &b) {
+	return std::tie(a.min, a.max) == std::tie(b.min, b.max);
+}
+
+phys::aabb4::aabb4() {
+	min_x.fill(infinity);
+	min_y.fill(infinity);
+	min_z.fill(infinity);
+	max_x.fill(-infinity);
+	max_y.fill(-infinity);
+	max_z.fill(-infinity);
+}
+
+void phys::aabb4::set(size_t i, const aabb &box) {
+	min_x[i] = box.min.x;
+	min_y[i] = box.min.y;
+	min_z[i] = box.min.z;
+	max_x[i] = box.max.x;
+	max_y[i] = box.max.y;
+	max_z[i] = box.max.z;
+}
+
+uint32_t phys::aabb4::overlaps(const aabb &box) const {
+#ifdef PHYS_SIMD
+	using namespace simd;
+
+	const floats4 x = bit_and(le(load4(min_x.data()), set4(box.max.x)), le(set4(box.min.x), load4(max_x.data())));
+	const floats4 y = bit_and(le(load4(min_y.data()), set4(box.max.y)), le(set4(box.min.y), load4(max_y.data())));
+	const floats4 z = bit_and(le(load4(min_z.data()), set4(box.max.z)), le(set4(box.min.z), load4(max_z.data())));
+
+	return bits(bit_and(x, bit_and(y, z)));
+#else
+	uint32_t out = 0;
+
+	for (size_t i = 0; i < 4; i++) {
+		const bool hit = (min_x[i] <= box.max.x) & (box.min.x <= max_x[i]) &
+			(min_y[i] <= box.max.y) & (box.min.y <= max_y[i]) &
+			(min_z[i] <= box.max.z) & (box.min.z <= max_z[i]);
+
+		out |= (uint32_t)hit << i;
+	}
+
+	return out;
+#endif
+}
+
+phys::ray::ray(const vec3 &_origin, const vec3 &_dir) :
+	origin(_origin),
+	dir(_dir)
+{
+	for (int i = 0; i < 3; i++) {
+		if (dir[i] != 0.0_r) {
+			inv_dir[i] = 1.0_r / dir[i];
+		}
+	}
+}
+
+phys::real phys::ray::intersect(const bounding_sphere &vol) const {
+	const vec3 n = origin - vol.center;
+	const real c = dot(n, n) - vol.radius * vol.radius;
+
+	if (c <= 0.0_r) {
+		return 0.0_r;
+	}
+
+	// Starts outside and points away from the sphere
+	const real b = dot(n, dir);
+
+	if (b >= 0.0_r) {
+		return -1.0_r;
+	}
+
+	const real a = dot(dir, dir);
+	const real discrim = b * b - a * c;
+
+	if (discrim < 0.0_r) {
+		return -1.0_r;
+	}
+
+	return (-b - std::sqrt(discrim)) / a;
+}
+
+// Clips the ray to the slab between the two planes of the box on each axis. The ray hits
+// the box if what is left of it is not empty.
+phys::real phys::ray::intersect(const aabb &vol) const {
+	real t_min = 0.0_r;
+	real t_max = infinity;
+
+	for (int i = 0; i < 3; i++) {
+		if (dir[i] == 0.0_r) {
+			// Parallel to the slab, so it is either always or never inside it
+			if (origin[i] < vol.min[i] || origin[i] > vol.max[i]) {
+				return -1.0_r;
+			}
+
+			continue;
+		}
+
+		const real t0 = (vol.min[i] - origin[i]) * inv_dir[i];
+		const real t1 = (vol.max[i] - origin[i]) * inv_dir[i];
+
+		t_min = std::max(t_min, std::min(t0, t1));
+		t_max = std::min(t_max, std::max(t0, t1));
+
+		if (t_min > t_max) {
+			return -1.0_r;
+		}
+	}
+
+	return t_min;
+}
+
+phys::frustum::frustum(const mat4 &view_proj) {
+	const mat4 m = transpose(view_proj);
+
+	planes[0] = m[3] + m[0];
+	planes[1] = m[3] - m[0];
+	planes[2] = m[3] + m[1];
+	planes[3] = m[3] - m[1];
+	planes[4] = m[3] + m[2];
+	planes[5] = m[3] - m[2];
+
+	// Normalized so that the distance to a plane can be compared with a sphere's radius
+	for (vec4 &plane : planes) {
+		plane /= std::sqrt(dot(truncate(plane), truncate(plane)));
+	}
+}
+
+phys::frustum::containment phys::frustum::classify(const bounding_sphere &vol) const {
+	containment out = containment::inside;
+
+	for (const vec4 &plane : planes) {
+		const real d = dot(truncate(plane), vol.center) + plane.w;
+
+		if (d < -vol.radius) {
+			return containment::outside;
+		}
+
+		if (d < vol.radius) {
+			out = containment::intersects;
+		}
+	}
+
+	return out;
+}
+
+phys::frustum::containment phys::frustum::classify(const aabb &vol) const {
+	containment out = containment::inside;
+
+	for (const vec4 &plane : planes) {
+		const vec3 n = truncate(plane);
+		// The corners of the box furthest along and furthest against the plane's normal
+		const vec3 far_corner = glm::mix(vol.min, vol.max, glm::greaterThanEqual(n, vec3(0.0_r)));
+		const vec3 near_corner = glm::mix(vol.max, vol.min, glm::greaterThanEqual(n, vec3(0.0_r)));
+
+		if (dot(n, far_corner) + plane.w < 0.0_r) {
+			return containment::outside;
+		}
+
+		if (dot(n, near_corner) + plane.w < 0.0_r) {
+			out = containment::intersects;
+		}
+	}
+
+	return out;
 }
\ No newline at end of file
@@ -1,4 +1,6 @@
 #pragma once
+#include <array>
+#include <cstdint>
 #include "../math.h"
 
 namespace phys {
@@ -7,6 +9,10 @@ namespace phys {
 		{ T(ct, ct) } -> std::convertible_to<T>;
 		{ ct.overlaps(ct) } -> std::convertible_to<bool>;
 		{ ct.growth(ct) } -> std::convertible_to<real>;
+		{ ct.contains(ct) } -> std::convertible_to<bool>;
+		{ ct.enlarged(real{}) } -> std::convertible_to<T>;
+		{ ct.surface_area() } -> std::convertible_to<real>;
+		{ ct.centroid() } -> std::convertible_to<vec3>;
 		{ ct == ct } -> std::convertible_to<bool>;
 	} && std::default_initializable<T>;
 
@@ -20,6 +26,12 @@ namespace phys {
 
 		bool overlaps(const bounding_sphere &other) const;
 		real growth(const bounding_sphere &other) const;
+		// True if `other` is entirely inside this sphere
+		bool contains(const bounding_sphere &other) const;
+		// A sphere with the same center and a radius that is larger by `margin`
+		bounding_sphere enlarged(real margin) const;
+		real surface_area() const;
+		vec3 centroid() const;
 
 		friend bool operator==(const bounding_sphere &a, const bounding_sphere &b);
 
@@ -28,4 +40,87 @@ namespace phys {
 	};
 
 	static_assert(bounding_volume<bounding_sphere>);
+
+	// Axis-aligned bounding box. Merging and overlap tests only need comparisons, and
+	// growth is measured by surface area, which is what a query's cost depends on.
+	struct aabb {
+		vec3 min{};
+		vec3 max{};
+
+		aabb() = default;
+		aabb(const vec3 &_min, const vec3 &_max);
+		aabb(const aabb &a, const aabb &b);
+		// The smallest box around `sphere`
+		explicit aabb(const bounding_sphere &sphere);
+
+		bool overlaps(const aabb &other) const;
+		real growth(const aabb &other) const;
+		// True if `other` is entirely inside this box
+		bool contains(const aabb &other) const;
+		// A box with the same center that extends `margin` further along each axis
+		aabb enlarged(real margin) const;
+		real surface_area() const;
+		vec3 centroid() const;
+
+		friend bool operator==(const aabb &a, const aabb &b);
+	};
+
+	static_assert(bounding_volume<aabb>);
+
+	// Four boxes with their coordinates stored by axis, so that a box can be tested against
+	// all four at once
+	struct aabb4 {
+		alignas(16) std::array<real, 4> min_x{};
+		alignas(16) std::array<real, 4> min_y{};
+		alignas(16) std::array<real, 4> min_z{};
+		alignas(16) std::array<real, 4> max_x{};
+		alignas(16) std::array<real, 4> max_y{};
+		alignas(16) std::array<real, 4> max_z{};
+
+		// Starts out with four empty boxes, which don't overlap anything
+		aabb4();
+
+		void set(size_t i, const aabb &box);
+		// Bit `i` is set if box `i` overlaps `box`
+		uint32_t overlaps(const aabb &box) const;
+	};
+
+	// A ray that starts at `origin` and continues in the direction of `dir`. Points on the
+	// ray are `origin + t * dir` for `t >= 0`.
+	struct ray {
+		vec3 origin{};
+		vec3 dir{};
+
+		ray() = default;
+		ray(const vec3 &_origin, const vec3 &_dir);
+
+		// Where the ray enters `vol`, or -1 if it misses. If the ray starts inside `vol`,
+		// the return value is 0.
+		real intersect(const bounding_sphere &vol) const;
+		real intersect(const aabb &vol) const;
+
+	private:
+		// Reciprocal of each nonzero component of `dir`
+		vec3 inv_dir{};
+	};
+
+	// Six planes that face inward. A point `p` is on the inner side of a plane if
+	// `dot(plane.xyz, p) + plane.w >= 0`.
+	struct frustum {
+		enum class containment {
+			outside,
+			intersects,
+			inside
+		};
+
+		std::array<vec4, 6> planes{};
+
+		frustum() = default;
+		// Extracts the planes of a view-projection matrix (Gribb and Hartmann, "Fast
+		// Extraction of Viewing Frustum Planes from the World-View-Projection Matrix", 2001)
+		explicit frustum(const mat4 &view_proj);
+
+		containment classify(const bounding_sphere &vol) const;
+		containment classify(const aabb &vol) const;
+	};
 }
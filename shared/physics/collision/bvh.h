@@ -1,10 +1,38 @@
 #pragma once
-#include <memory>
-#include <stack>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <utility>
 #include <vector>
+#include "../thread_pool.h"
 #include "bounding_volumes.h"
 
 namespace phys {
+	template <typename Identifier>
+	class wide_bvh;
+
+	// Leaves hold "fat" volumes: the volume of the object enlarged by a margin. `update` does
+	// nothing while the object's new volume fits inside its fat volume, so objects that move
+	// a little every frame only need to be reinserted once they have moved by about the
+	// margin. Coarse collisions are generated with the fat volumes.
+	//
+	// Nodes live in one contiguous pool and refer to each other by 32-bit index. Slots of
+	// removed nodes are kept on a free list and reused, so a tree that stays about the same
+	// size stops allocating.
+	//
+	// `insert` places each object next to the node that adds the least surface area to the
+	// tree, found with branch and bound (Bittner et al., "Fast Insertion-Based Optimization
+	// of Bounding Volume Hierarchies", 2013). `update` runs every frame, so it moves objects
+	// with a cheaper greedy descent instead. Inserts, removes and updates rotate the nodes
+	// along the path that they change to keep the tree from degrading over time (Kensler,
+	// "Tree Rotations for Improving Bounding Volume Hierarchies", 2008). `build` and
+	// `rebuild` construct the whole tree at once with the surface area heuristic, and lay
+	// the nodes out in depth-first order. A tree built by inserts can beat a fresh build,
+	// so `rebuild` only replaces it with a cheaper one.
 	template <bounding_volume Volume, typename Identifier>
 	class bvh {
 	public:
@@ -22,39 +50,107 @@ namespace phys {
 			);
 		};
 
+		struct volume_update {
+			Identifier id;
+			Volume vol;
+		};
+
+		// `t` is -1 if the ray didn't hit anything
+		struct ray_hit {
+			Identifier id{};
+			real t{ -1 };
+		};
+
+		bvh() = default;
+		// `_margin` is how far the volumes of the leaves extend past the volumes of
+		// their objects
+		explicit bvh(real _margin);
+
 		void insert(Identifier id, const Volume &vol);
 		bool remove(Identifier id);
 		void update(Identifier id, const Volume &vol);
+		// Same as calling `update` for each object, but only recalculates the volume of
+		// each internal node once
+		void update_many(std::span<const volume_update> updates);
+		// Replaces the contents of the tree with `objects`, whose elements must have `id`
+		// and `vol` members (like `volume_update`). If an id appears more than once, only
+		// its first volume is used.
+		template <typename Range>
+		void build(const Range &objects);
+		// Builds the tree again from its current leaves, and keeps whichever of the old and
+		// new trees has the lower SAH cost. Either way, the nodes end up in depth-first
+		// order with no free slots. Use this when many updates have left the tree in worse
+		// shape than a fresh build would be.
+		void rebuild();
 		bool has(Identifier id) const;
 		size_t size() const;
+		// Expected cost of a query that visits every node it overlaps: the summed surface
+		// areas of the internal nodes, relative to the root. Lower is better.
+		real sah_cost() const;
+		// Number of nodes on the longest path from the root to a leaf
+		size_t depth() const;
 
 		template <typename Container>
 		void generate_coarse_collisions(Container &pairs) const;
+		// Finds the same pairs as `generate_coarse_collisions`, in a different order. The
+		// self-test is split into independent tasks that each thread takes from a shared
+		// counter, and each thread collects its pairs in its own buffer.
+		template <typename Container>
+		void generate_coarse_collisions(Container &pairs, thread_pool &pool) const;
+
+		// The queries below test the fat volumes of the leaves, so they can find objects
+		// that are up to the margin away from what is being queried. They don't allocate
+		// unless the tree is deeper than `query_stack_size`.
+		//
+		// Finds the closest object that `r` hits. `hit_test(id)` is called for each object
+		// whose leaf the ray enters before the closest hit found so far, and returns the
+		// parameter where the ray hits the object itself, or a negative value if it misses.
+		// Children are visited nearest first, so most of the tree is never entered.
+		template <typename HitTest>
+		ray_hit raycast(const ray &r, HitTest &&hit_test) const;
+		// Appends a `ray_hit` to `hits` for every object that `r` hits, in no particular order
+		template <typename HitTest, typename Container>
+		void raycast_all(const ray &r, HitTest &&hit_test, Container &hits) const;
+		// Calls `f(id)` for each object whose leaf overlaps `vol`
+		template <typename F>
+		void query_volume(const Volume &vol, F &&f) const;
+		// Calls `f(id)` for each object whose leaf is at least partly inside `fr`. The leaves
+		// under a node that is entirely inside are reported without being tested.
+		template <typename F>
+		void query_frustum(const frustum &fr, F &&f) const;
 
 	private:
+		template <typename>
+		friend class wide_bvh;
+
 #ifdef DEBUG
 	public:
 #endif
+		using node_index = uint32_t;
+
+		static constexpr node_index null_node = std::numeric_limits<node_index>::max();
+
 		struct node {
 			Volume vol{};
 			Identifier id{};
 
-			node * parent{};
-			std::unique_ptr<node> left{};
-			std::unique_ptr<node> right{};
+			node_index parent{ null_node };
+			node_index left{ null_node };
+			node_index right{ null_node };
+			// Set on internal nodes whose volume needs to be recalculated
+			bool dirty{ false };
 
 			node(const Volume &_vol, Identifier _id);
 
 			bool is_leaf() const;
-			void recalculate_parent_volumes();
 		};
 
 		struct id_node {
 			Identifier id{};
-			node * n{};
+			node_index n{ null_node };
 
 			id_node(Identifier _id);
-			id_node(Identifier _id, node * _n);
+			id_node(Identifier _id, node_index _n);
 
 			friend bool operator<(const id_node &a, const id_node &b) {
 				return a.id < b.id;
@@ -65,11 +161,123 @@ namespace phys {
 			}
 		};
 
+		struct build_item {
+			Volume vol{};
+			vec3 centroid{};
+			Identifier id{};
+		};
+
+		// Number of buckets that objects are sorted into along an axis when choosing
+		// where to split them
+		static constexpr size_t num_bins = 16;
+
+		// A node that `find_best_sibling` could pick for a new leaf, and how much the
+		// node's ancestors would grow to fit the leaf
+		struct insert_candidate {
+			node_index n{};
+			real inherited_cost{};
+		};
+
 		std::vector<id_node> ids{};
-		std::unique_ptr<node> root{};
+		std::vector<node> nodes{};
+		std::vector<node_index> free_nodes{};
+		// Nodes that `find_best_sibling` has yet to consider, kept between calls so that
+		// inserting doesn't allocate once the tree stops growing
+		std::vector<insert_candidate> insert_candidates{};
+		node_index root{ null_node };
+		real margin{};
+
+		node_index alloc_node(const Volume &vol, Identifier id);
+		void free_node(node_index n);
+
+		// Returns the index that refers to `n`, either in its parent or `root`
+		node_index& owner(node_index n);
+		// Finds the node that adds the least surface area to the tree when `vol` is made its
+		// sibling. The tree must not be empty.
+		node_index find_best_sibling(const Volume &vol);
+		// Finds a sibling for `vol` by descending into the child that grows the least. The
+		// tree must not be empty.
+		node_index find_sibling(const Volume &vol) const;
+		// Adds a leaf to the tree as the sibling of `sibling` and returns its new parent, or
+		// `null_node` if it became the root. The volumes of the leaf's ancestors are not
+		// updated.
+		node_index attach(node_index leaf, node_index sibling);
+		// Takes a leaf out of the tree and returns the node that took the place of its
+		// parent. The volumes of the leaf's old ancestors are not updated.
+		node_index detach(node_index leaf);
+		// Moves a leaf to where its new volume fits best and marks the internal nodes
+		// that need to be recalculated
+		void reinsert(node_index leaf, const Volume &vol);
+		// Recalculates the volumes of `n` and its ancestors, and rotates them
+		void recalculate_parent_volumes(node_index n);
+		// Recalculates the volumes of the dirty nodes under `n`, children first, and
+		// rotates them
+		void refit(node_index n);
+		// Swaps a child of `n` with a grandchild if that shrinks the grandchild's new
+		// parent. The volumes of `n`'s children must be up to date.
+		void rotate(node_index n);
+		void mark_dirty(node_index n);
+
+		// Replaces the tree with leaves for `items`, whose volumes are already fat
+		void build_from(std::vector<build_item> &items);
+		// Copies the subtree of `old_nodes` under `old` into `nodes`, parents before
+		// children, and returns where its root went
+		node_index copy_node(const std::vector<node> &old_nodes, node_index old, node_index parent);
+		node_index build_node(std::vector<build_item> &items, size_t begin, size_t end, node_index parent);
+		// Partitions [begin, end) into two nonempty halves and returns where the second
+		// one starts
+		static size_t split(std::vector<build_item> &items, size_t begin, size_t end);
+
+		// Tests the leaves under `a` against each other if `a == b`, or against the leaves
+		// under `b` otherwise. The volumes of `a` and `b` overlap.
+		struct collision_task {
+			node_index a{};
+			node_index b{};
+		};
+
+		// Tasks per thread that the parallel self-test is split into, so that threads that
+		// finish early have more to take
+		static constexpr size_t tasks_per_thread = 16;
 
 		template <typename Container>
-		void generate_coarse_collisions_with(Container &pairs, node * n, node * tree) const;
+		void generate_self_collisions(Container &pairs, node_index n, std::vector<node_index> &pending, std::vector<node_index> &stack) const;
+		template <typename Container>
+		void generate_coarse_collisions_with(Container &pairs, node_index n, node_index tree, std::vector<node_index> &stack) const;
+		// Splits the self-test of the whole tree into at least `count` tasks, unless it
+		// runs out of internal nodes to split
+		std::vector<collision_task> split_collision_tasks(size_t count) const;
+
+		// Entries that fit in a query's stack before it starts to allocate. A tree needs
+		// about one entry per level, and one built or kept balanced by rotations is far
+		// shallower than this.
+		static constexpr size_t query_stack_size = 64;
+
+		// Nodes that a query still has to visit. The first `query_stack_size` entries
+		// are stored in place, and only deeper trees spill into `overflow`.
+		template <typename T>
+		class query_stack {
+		public:
+			void push(const T &item);
+			T pop();
+			bool empty() const;
+
+		private:
+			std::array<T, query_stack_size> items{};
+			size_t count{ 0 };
+			std::vector<T> overflow{};
+		};
+
+		struct ray_entry {
+			node_index n{};
+			real t{};
+		};
+
+		struct frustum_entry {
+			node_index n{};
+			// Set if the node is known to be inside the frustum, so its descendants don't
+			// need to be tested
+			bool inside{};
+		};
 	};
 }
 
@@ -92,242 +300,1027 @@ phys::bvh<Volume, Identifier>::node::node(const Volume &_vol, Identifier _id) :
 
 template <phys::bounding_volume Volume, typename Identifier>
 bool phys::bvh<Volume, Identifier>::node::is_leaf() const {
-	return (! left.get()) && (! right.get());
+	return left == null_node && right == null_node;
 }
 
 template <phys::bounding_volume Volume, typename Identifier>
-void phys::bvh<Volume, Identifier>::node::recalculate_parent_volumes() {
-	assert(!! left.get() == !! right.get());
+phys::bvh<Volume, Identifier>::id_node::id_node(Identifier _id) :
+	id(_id), n(null_node) {}
+
+template <phys::bounding_volume Volume, typename Identifier>
+phys::bvh<Volume, Identifier>::id_node::id_node(Identifier _id, node_index _n) :
+	id(_id), n(_n) {}
 
-	if (left.get()) {
-		vol = Volume(left->vol, right->vol);
-	}
+template <phys::bounding_volume Volume, typename Identifier>
+phys::bvh<Volume, Identifier>::bvh(real _margin) :
+	margin(_margin)
+{}
 
-	if (parent) {
-		parent->recalculate_parent_volumes();
+template <phys::bounding_volume Volume, typename Identifier>
+void phys::bvh<Volume, Identifier>::insert(Identifier id, const Volume &vol) {
+	auto id_i = std::lower_bound(std::begin(ids), std::end(ids), id);
+
+	if (id_i != std::end(ids) && id_i->id == id) {
+		return;
 	}
+
+	const node_index leaf = alloc_node(vol.enlarged(margin), id);
+
+	ids.insert(id_i, id_node(id, leaf));
+	recalculate_parent_volumes(attach(leaf, root == null_node ? null_node : find_best_sibling(nodes[leaf].vol)));
 }
 
 template <phys::bounding_volume Volume, typename Identifier>
-phys::bvh<Volume, Identifier>::id_node::id_node(Identifier _id) :
-	id(_id), n(nullptr) {}
+bool phys::bvh<Volume, Identifier>::remove(Identifier id) {
+	auto id_i = std::lower_bound(std::begin(ids), std::end(ids), id);
 
-template <phys::bounding_volume Volume, typename Identifier>
-phys::bvh<Volume, Identifier>::id_node::id_node(Identifier _id, phys::bvh<Volume, Identifier>::node * _n) :
-	id(_id), n(_n) {}
+	if (id_i == std::end(ids) || id_i->id != id) {
+		return false;
+	}
+
+	const node_index n = id_i->n;
+
+	ids.erase(id_i);
+
+	const node_index replacement = detach(n);
+
+	free_node(n);
+
+	if (replacement != null_node) {
+		recalculate_parent_volumes(nodes[replacement].parent);
+	}
+
+	return true;
+}
 
 template <phys::bounding_volume Volume, typename Identifier>
-void phys::bvh<Volume, Identifier>::insert(Identifier id, const Volume &vol) {
+void phys::bvh<Volume, Identifier>::update(Identifier id, const Volume &vol) {
 	auto id_i = std::lower_bound(std::begin(ids), std::end(ids), id);
 
-	if (id_i != std::end(ids) && id_i->id == id) {
+	if (id_i == std::end(ids) || id_i->id != id) {
 		return;
 	}
 
-	if (! root.get()) {
-		root = std::make_unique<node>(vol, id);
-		ids.insert(id_i, id_node(id, root.get()));
+	if (nodes[id_i->n].vol.contains(vol)) {
 		return;
 	}
 
-	node * n = root.get();
+	reinsert(id_i->n, vol);
+	refit(root);
+}
 
-	while (! n->is_leaf()) {
-		real left_growth = n->left->vol.growth(vol);
-		real right_growth = n->right->vol.growth(vol);
+template <phys::bounding_volume Volume, typename Identifier>
+void phys::bvh<Volume, Identifier>::update_many(std::span<const volume_update> updates) {
+	bool moved = false;
 
-		if (left_growth < right_growth) {
-			n = n->left.get();
-		} else {
-			n = n->right.get();
+	for (const volume_update &u : updates) {
+		auto id_i = std::lower_bound(std::begin(ids), std::end(ids), u.id);
+
+		if (id_i == std::end(ids) || id_i->id != u.id) {
+			continue;
 		}
+
+		if (nodes[id_i->n].vol.contains(u.vol)) {
+			continue;
+		}
+
+		reinsert(id_i->n, u.vol);
+		moved = true;
 	}
 
-	Identifier old_id = n->id;
+	if (moved) {
+		refit(root);
+	}
+}
 
-	n->left = std::make_unique<node>(n->vol, old_id);
-	n->right = std::make_unique<node>(vol, id);
-	n->id = 0;
-	n->left->parent = n;
-	n->right->parent = n;
+template <phys::bounding_volume Volume, typename Identifier>
+template <typename Range>
+void phys::bvh<Volume, Identifier>::build(const Range &objects) {
+	std::vector<build_item> items{};
 
-	ids.insert(id_i, id_node(id, n->right.get()));
+	for (const auto &obj : objects) {
+		items.push_back({ obj.vol.enlarged(margin), obj.vol.centroid(), obj.id });
+	}
 
-	id_i = std::lower_bound(std::begin(ids), std::end(ids), old_id);
-	assert(id_i != std::end(ids));
-	assert(id_i->id == old_id);
-	id_i->n = n->left.get();
+	build_from(items);
+}
 
-	n->recalculate_parent_volumes();
+template <phys::bounding_volume Volume, typename Identifier>
+void phys::bvh<Volume, Identifier>::rebuild() {
+	std::vector<build_item> items{};
+	items.reserve(ids.size());
+
+	for (const id_node &id_n : ids) {
+		const Volume &vol = nodes[id_n.n].vol;
+
+		items.push_back({ vol, vol.centroid(), id_n.id });
+	}
+
+	const real old_cost = sah_cost();
+	const node_index old_root = root;
+	std::vector<node> old_nodes = std::move(nodes);
+
+	build_from(items);
+
+	if (sah_cost() <= old_cost) {
+		return;
+	}
+
+	// The old tree was better, so it's laid out again instead
+	ids.clear();
+	nodes.clear();
+	root = copy_node(old_nodes, old_root, null_node);
+
+	std::sort(std::begin(ids), std::end(ids));
 }
 
 template <phys::bounding_volume Volume, typename Identifier>
-bool phys::bvh<Volume, Identifier>::remove(Identifier id) {
-	auto id_i = std::lower_bound(std::begin(ids), std::end(ids), id);
+bool phys::bvh<Volume, Identifier>::has(Identifier id) const {
+	id_node n(id);
 
-	if (id_i == std::end(ids) || id_i->id != id) {
-		return false;
+	auto id_i = std::lower_bound(std::begin(ids), std::end(ids), n);
+
+	return (id_i != std::end(ids)) && id_i->id == id;
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+size_t phys::bvh<Volume, Identifier>::size() const {
+	return ids.size();
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+phys::real phys::bvh<Volume, Identifier>::sah_cost() const {
+	using namespace phys::literals;
+
+	if (root == null_node || nodes[root].is_leaf()) {
+		return 0.0_r;
 	}
 
-	node * n = id_i->n;
+	const real root_area = nodes[root].vol.surface_area();
+	real total = 0.0_r;
+	std::vector<node_index> stack{ root };
 
-	ids.erase(id_i);
+	while (! stack.empty()) {
+		const node &n = nodes[stack.back()];
+		stack.pop_back();
 
-	if (n == root.get()) {
-		assert(! n->parent);
-		root.reset();
-		return true;
+		if (n.is_leaf()) {
+			continue;
+		}
+
+		total += n.vol.surface_area();
+		stack.push_back(n.left);
+		stack.push_back(n.right);
 	}
 
-	assert(n->parent);
-	assert(!! n->parent->left.get() == !! n->parent->right.get());
+	return total / root_area;
+}
 
-	node * parent = n->parent;
+template <phys::bounding_volume Volume, typename Identifier>
+size_t phys::bvh<Volume, Identifier>::depth() const {
+	if (root == null_node) {
+		return 0;
+	}
+
+	size_t max_depth = 0;
+	std::vector<std::pair<node_index, size_t>> stack{ { root, 1 } };
 
-	if (n == parent->left.get()) {
-		if (parent == root.get()) {
-			root = std::move(parent->right);
-			root->parent = nullptr;
+	while (! stack.empty()) {
+		const auto [i, d] = stack.back();
+		const node &n = nodes[i];
+		stack.pop_back();
+
+		if (n.is_leaf()) {
+			max_depth = std::max(max_depth, d);
 		} else {
-			assert(parent->parent);
+			stack.push_back({ n.left, d + 1 });
+			stack.push_back({ n.right, d + 1 });
+		}
+	}
 
-			node * grandparent = parent->parent;
+	return max_depth;
+}
 
-			if (parent == grandparent->left.get()) {
-				grandparent->left = std::move(parent->right);
-				grandparent->left->parent = grandparent;
-				grandparent->left->recalculate_parent_volumes();
-			} else {
-				grandparent->right = std::move(parent->right);
-				grandparent->right->parent = grandparent;
-				grandparent->right->recalculate_parent_volumes();
-			}
+template <phys::bounding_volume Volume, typename Identifier>
+typename phys::bvh<Volume, Identifier>::node_index phys::bvh<Volume, Identifier>::alloc_node(const Volume &vol, Identifier id) {
+	if (free_nodes.empty()) {
+		nodes.emplace_back(vol, id);
+		return (node_index)(nodes.size() - 1);
+	}
+
+	const node_index n = free_nodes.back();
+	free_nodes.pop_back();
+	nodes[n] = node(vol, id);
+
+	return n;
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+void phys::bvh<Volume, Identifier>::free_node(node_index n) {
+	nodes[n] = node(Volume{}, Identifier{});
+	free_nodes.push_back(n);
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+typename phys::bvh<Volume, Identifier>::node_index& phys::bvh<Volume, Identifier>::owner(node_index n) {
+	const node_index parent = nodes[n].parent;
+
+	if (parent == null_node) {
+		assert(n == root);
+		return root;
+	}
+
+	if (n == nodes[parent].left) {
+		return nodes[parent].left;
+	}
+
+	assert(n == nodes[parent].right);
+	return nodes[parent].right;
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+typename phys::bvh<Volume, Identifier>::node_index phys::bvh<Volume, Identifier>::find_best_sibling(const Volume &vol) {
+	// The cost of making a node the sibling is the area of their new parent, plus how much
+	// every ancestor of the node grows to fit `vol`. Every node under a candidate costs at
+	// least the area of `vol` plus the growth of the candidate and its ancestors, so the
+	// candidates are visited cheapest first, and the search stops once none of them can
+	// beat the best sibling found so far.
+	const real area = vol.surface_area();
+	const auto costlier = [](const insert_candidate &a, const insert_candidate &b) {
+		return a.inherited_cost > b.inherited_cost;
+	};
+
+	node_index best = root;
+	real best_cost = std::numeric_limits<real>::infinity();
+
+	insert_candidates.clear();
+	insert_candidates.push_back({ root, 0 });
+
+	while (! insert_candidates.empty()) {
+		std::pop_heap(std::begin(insert_candidates), std::end(insert_candidates), costlier);
+		const insert_candidate c = insert_candidates.back();
+		insert_candidates.pop_back();
+
+		if (area + c.inherited_cost >= best_cost) {
+			break;
 		}
-	} else {
-		assert(n == parent->right.get());
 
-		if (parent == root.get()) {
-			root = std::move(parent->left);
-			root->parent = nullptr;
+		const node &curr = nodes[c.n];
+		const real combined_area = Volume(curr.vol, vol).surface_area();
+
+		if (combined_area + c.inherited_cost < best_cost) {
+			best_cost = combined_area + c.inherited_cost;
+			best = c.n;
+		}
+
+		if (curr.is_leaf()) {
+			continue;
+		}
+
+		const real inherited_cost = c.inherited_cost + combined_area - curr.vol.surface_area();
+
+		if (area + inherited_cost < best_cost) {
+			insert_candidates.push_back({ curr.left, inherited_cost });
+			std::push_heap(std::begin(insert_candidates), std::end(insert_candidates), costlier);
+			insert_candidates.push_back({ curr.right, inherited_cost });
+			std::push_heap(std::begin(insert_candidates), std::end(insert_candidates), costlier);
+		}
+	}
+
+	return best;
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+typename phys::bvh<Volume, Identifier>::node_index phys::bvh<Volume, Identifier>::find_sibling(const Volume &vol) const {
+	node_index n = root;
+
+	while (! nodes[n].is_leaf()) {
+		const node &curr = nodes[n];
+		real left_growth = nodes[curr.left].vol.growth(vol);
+		real right_growth = nodes[curr.right].vol.growth(vol);
+
+		if (left_growth < right_growth) {
+			n = curr.left;
 		} else {
-			assert(parent->parent);
+			n = curr.right;
+		}
+	}
 
-			node * grandparent = parent->parent;
+	return n;
+}
 
-			if (parent == grandparent->left.get()) {
-				grandparent->left = std::move(parent->left);
-				grandparent->left->parent = grandparent;
-				grandparent->left->recalculate_parent_volumes();
-			} else {
-				grandparent->right = std::move(parent->left);
-				grandparent->right->parent = grandparent;
-				grandparent->right->recalculate_parent_volumes();
+template <phys::bounding_volume Volume, typename Identifier>
+typename phys::bvh<Volume, Identifier>::node_index phys::bvh<Volume, Identifier>::attach(node_index leaf, node_index sibling) {
+	if (root == null_node) {
+		nodes[leaf].parent = null_node;
+		root = leaf;
+		return null_node;
+	}
+
+	// The new parent takes the place of the sibling, so that leaves keep their slots and
+	// `ids` stays valid. Allocating can move the pool, so no references to nodes are held
+	// across it.
+	const node_index p = alloc_node(nodes[sibling].vol, Identifier{});
+
+	owner(sibling) = p;
+	nodes[p].parent = nodes[sibling].parent;
+	nodes[p].left = sibling;
+	nodes[p].right = leaf;
+	nodes[sibling].parent = p;
+	nodes[leaf].parent = p;
+
+	return p;
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+typename phys::bvh<Volume, Identifier>::node_index phys::bvh<Volume, Identifier>::detach(node_index leaf) {
+	if (leaf == root) {
+		assert(nodes[leaf].parent == null_node);
+		root = null_node;
+		return null_node;
+	}
+
+	const node_index parent = nodes[leaf].parent;
+
+	assert(parent != null_node);
+	assert((nodes[parent].left == null_node) == (nodes[parent].right == null_node));
+
+	node_index sibling = null_node;
+
+	if (leaf == nodes[parent].left) {
+		sibling = nodes[parent].right;
+	} else {
+		assert(leaf == nodes[parent].right);
+		sibling = nodes[parent].left;
+	}
+
+	// The sibling takes the place of the parent, which is freed
+	owner(parent) = sibling;
+	nodes[sibling].parent = nodes[parent].parent;
+	nodes[leaf].parent = null_node;
+	free_node(parent);
+
+	return sibling;
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+void phys::bvh<Volume, Identifier>::reinsert(node_index leaf, const Volume &vol) {
+	const node_index replacement = detach(leaf);
+
+	if (replacement != null_node) {
+		mark_dirty(nodes[replacement].parent);
+	}
+
+	nodes[leaf].vol = vol.enlarged(margin);
+	mark_dirty(attach(leaf, root == null_node ? null_node : find_sibling(nodes[leaf].vol)));
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+void phys::bvh<Volume, Identifier>::recalculate_parent_volumes(node_index n) {
+	while (n != null_node) {
+		node &curr = nodes[n];
+
+		assert((curr.left == null_node) == (curr.right == null_node));
+
+		if (curr.left != null_node) {
+			curr.vol = Volume(nodes[curr.left].vol, nodes[curr.right].vol);
+			rotate(n);
+		}
+
+		n = nodes[n].parent;
+	}
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+void phys::bvh<Volume, Identifier>::refit(node_index n) {
+	if (n == null_node || ! nodes[n].dirty) {
+		return;
+	}
+
+	refit(nodes[n].left);
+	refit(nodes[n].right);
+
+	node &curr = nodes[n];
+
+	curr.vol = Volume(nodes[curr.left].vol, nodes[curr.right].vol);
+	curr.dirty = false;
+
+	rotate(n);
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+void phys::bvh<Volume, Identifier>::rotate(node_index n) {
+	using namespace phys::literals;
+
+	const node &curr = nodes[n];
+
+	if (curr.is_leaf()) {
+		return;
+	}
+
+	real best_benefit = 0.0_r;
+	node_index best_child = null_node;
+	node_index best_grandchild = null_node;
+
+	// Moving child `c` under its sibling `b` in place of grandchild `g` moves `g` up a level
+	// and leaves `b` with `c` and its other child
+	for (const auto &[b, c] : { std::pair(curr.left, curr.right), std::pair(curr.right, curr.left) }) {
+		const node &sibling = nodes[b];
+
+		if (sibling.is_leaf()) {
+			continue;
+		}
+
+		const real area = sibling.vol.surface_area();
+
+		for (const auto &[g, other] : { std::pair(sibling.left, sibling.right), std::pair(sibling.right, sibling.left) }) {
+			const real benefit = area - Volume(nodes[c].vol, nodes[other].vol).surface_area();
+
+			if (benefit > best_benefit) {
+				best_benefit = benefit;
+				best_child = c;
+				best_grandchild = g;
 			}
 		}
 	}
 
-	return true;
+	if (best_child == null_node) {
+		return;
+	}
+
+	const node_index new_parent = nodes[best_grandchild].parent;
+
+	owner(best_child) = best_grandchild;
+	owner(best_grandchild) = best_child;
+	nodes[best_grandchild].parent = n;
+	nodes[best_child].parent = new_parent;
+
+	nodes[new_parent].vol = Volume(nodes[nodes[new_parent].left].vol, nodes[nodes[new_parent].right].vol);
+	nodes[n].vol = Volume(nodes[nodes[n].left].vol, nodes[nodes[n].right].vol);
 }
 
 template <phys::bounding_volume Volume, typename Identifier>
-void phys::bvh<Volume, Identifier>::update(Identifier id, const Volume &vol) {
-	bool was_present = remove(id);
+void phys::bvh<Volume, Identifier>::mark_dirty(node_index n) {
+	// Every ancestor of a dirty node is dirty, so this can stop at the first one
+	while (n != null_node && ! nodes[n].dirty) {
+		nodes[n].dirty = true;
+		n = nodes[n].parent;
+	}
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+void phys::bvh<Volume, Identifier>::build_from(std::vector<build_item> &items) {
+	std::stable_sort(std::begin(items), std::end(items), [](const build_item &a, const build_item &b) {
+		return a.id < b.id;
+	});
+
+	auto last = std::unique(std::begin(items), std::end(items), [](const build_item &a, const build_item &b) {
+		return a.id == b.id;
+	});
+
+	items.erase(last, std::end(items));
 
-	if (was_present) {
-		insert(id, vol);
+	ids.clear();
+	nodes.clear();
+	free_nodes.clear();
+	root = null_node;
+
+	if (items.empty()) {
+		return;
 	}
+
+	ids.reserve(items.size());
+	nodes.reserve(2 * items.size() - 1);
+
+	root = build_node(items, 0, items.size(), null_node);
+
+	std::sort(std::begin(ids), std::end(ids));
 }
 
 template <phys::bounding_volume Volume, typename Identifier>
-bool phys::bvh<Volume, Identifier>::has(Identifier id) const {
-	id_node n(id, 0);
+typename phys::bvh<Volume, Identifier>::node_index phys::bvh<Volume, Identifier>::build_node(
+	std::vector<build_item> &items,
+	size_t begin,
+	size_t end,
+	node_index parent
+) {
+	// Parents are allocated before their children, so that a traversal mostly moves
+	// forward through the pool
+	const node_index n = alloc_node(items[begin].vol, items[begin].id);
+
+	nodes[n].parent = parent;
+
+	if (end - begin == 1) {
+		ids.push_back(id_node(items[begin].id, n));
+		return n;
+	}
 
-	auto id_i = std::lower_bound(std::begin(ids), std::end(ids), n);
+	const size_t mid = split(items, begin, end);
+	const node_index left = build_node(items, begin, mid, n);
+	const node_index right = build_node(items, mid, end, n);
 
-	return (id_i != std::end(ids)) && id_i->id == id;
+	nodes[n].id = Identifier{};
+	nodes[n].left = left;
+	nodes[n].right = right;
+	nodes[n].vol = Volume(nodes[left].vol, nodes[right].vol);
+
+	return n;
 }
 
 template <phys::bounding_volume Volume, typename Identifier>
-size_t phys::bvh<Volume, Identifier>::size() const {
-	return ids.size();
+typename phys::bvh<Volume, Identifier>::node_index phys::bvh<Volume, Identifier>::copy_node(
+	const std::vector<node> &old_nodes,
+	node_index old,
+	node_index parent
+) {
+	const node_index n = (node_index)nodes.size();
+
+	nodes.push_back(old_nodes[old]);
+	nodes[n].parent = parent;
+
+	if (old_nodes[old].is_leaf()) {
+		ids.push_back(id_node(nodes[n].id, n));
+		return n;
+	}
+
+	const node_index left = copy_node(old_nodes, old_nodes[old].left, n);
+	const node_index right = copy_node(old_nodes, old_nodes[old].right, n);
+
+	nodes[n].left = left;
+	nodes[n].right = right;
+
+	return n;
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+size_t phys::bvh<Volume, Identifier>::split(std::vector<build_item> &items, size_t begin, size_t end) {
+	using namespace phys::literals;
+
+	const size_t half = begin + (end - begin) / 2;
+	vec3 min = items[begin].centroid;
+	vec3 max = min;
+
+	for (size_t i = begin + 1; i < end; i++) {
+		min = glm::min(min, items[i].centroid);
+		max = glm::max(max, items[i].centroid);
+	}
+
+	const vec3 extent = max - min;
+	int axis = 0;
+
+	if (extent.y > extent[axis]) {
+		axis = 1;
+	}
+
+	if (extent.z > extent[axis]) {
+		axis = 2;
+	}
+
+	// Every centroid is in the same place, so any split is as good as any other
+	if (extent[axis] <= 0.0_r) {
+		return half;
+	}
+
+	struct bin {
+		Volume vol{};
+		size_t count{};
+	};
+
+	std::array<bin, num_bins> bins{};
+	const real scale = (real)num_bins / extent[axis];
+
+	auto bin_of = [&](const build_item &item) {
+		const size_t b = (size_t)((item.centroid[axis] - min[axis]) * scale);
+
+		return std::min(b, num_bins - 1);
+	};
+
+	for (size_t i = begin; i < end; i++) {
+		bin &b = bins[bin_of(items[i])];
+
+		b.vol = b.count ? Volume(b.vol, items[i].vol) : items[i].vol;
+		b.count++;
+	}
+
+	// Surface area and object count of everything right of each split
+	std::array<real, num_bins> right_area{};
+	std::array<size_t, num_bins> right_count{};
+	Volume right_vol{};
+	size_t right_total = 0;
+
+	for (size_t i = num_bins - 1; i > 0; i--) {
+		if (bins[i].count) {
+			right_vol = right_total ? Volume(right_vol, bins[i].vol) : bins[i].vol;
+			right_total += bins[i].count;
+		}
+
+		right_area[i] = right_total ? right_vol.surface_area() : 0.0_r;
+		right_count[i] = right_total;
+	}
+
+	Volume left_vol{};
+	size_t left_total = 0;
+	size_t best_split = 0;
+	real best_cost = infinity;
+
+	// Splitting before bin `i` puts bins [0, i) on the left
+	for (size_t i = 1; i < num_bins; i++) {
+		if (bins[i - 1].count) {
+			left_vol = left_total ? Volume(left_vol, bins[i - 1].vol) : bins[i - 1].vol;
+			left_total += bins[i - 1].count;
+		}
+
+		if (! left_total || ! right_count[i]) {
+			continue;
+		}
+
+		const real cost = left_vol.surface_area() * left_total + right_area[i] * right_count[i];
+
+		if (cost < best_cost) {
+			best_cost = cost;
+			best_split = i;
+		}
+	}
+
+	if (! best_split) {
+		return half;
+	}
+
+	auto mid = std::partition(std::begin(items) + begin, std::begin(items) + end, [&](const build_item &item) {
+		return bin_of(item) < best_split;
+	});
+
+	return (size_t)(mid - std::begin(items));
 }
 
 template <phys::bounding_volume Volume, typename Identifier>
 template <typename Container>
 void phys::bvh<Volume, Identifier>::generate_coarse_collisions(Container &pairs) const {
-	if (! root.get() || root->id) {
+	if (root == null_node || nodes[root].id) {
+		return;
+	}
+
+	std::vector<node_index> pending{};
+	std::vector<node_index> stack{};
+
+	generate_self_collisions(pairs, root, pending, stack);
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+template <typename Container>
+void phys::bvh<Volume, Identifier>::generate_coarse_collisions(Container &pairs, thread_pool &pool) const {
+	if (root == null_node || nodes[root].id) {
+		return;
+	}
+
+	const size_t num_threads = pool.get_num_threads();
+	const std::vector<collision_task> tasks = split_collision_tasks(num_threads * tasks_per_thread);
+	std::vector<std::vector<coarse_collision_pair>> buffers(num_threads);
+	std::atomic<size_t> next_task{ 0 };
+
+	// One chunk per thread, each with its own buffer. The chunks take tasks until there
+	// are none left, so a thread that gets small tasks takes more of them.
+	pool.parallel_for(num_threads, 1, [&](size_t begin, size_t) {
+		std::vector<coarse_collision_pair> &buffer = buffers[begin];
+		std::vector<node_index> pending{};
+		std::vector<node_index> stack{};
+
+		for (;;) {
+			const size_t i = next_task.fetch_add(1, std::memory_order_relaxed);
+
+			if (i >= tasks.size()) {
+				return;
+			}
+
+			const collision_task &task = tasks[i];
+
+			if (task.a == task.b) {
+				generate_self_collisions(buffer, task.a, pending, stack);
+			} else if (nodes[task.a].id && nodes[task.b].id) {
+				buffer.emplace_back(nodes[task.a].vol, nodes[task.b].vol, nodes[task.a].id, nodes[task.b].id);
+			} else {
+				generate_coarse_collisions_with(buffer, task.a, task.b, stack);
+			}
+		}
+	});
+
+	for (const std::vector<coarse_collision_pair> &buffer : buffers) {
+		for (const coarse_collision_pair &pair : buffer) {
+			pairs.insert(std::end(pairs), pair);
+		}
+	}
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+template <typename Container>
+void phys::bvh<Volume, Identifier>::generate_self_collisions(
+	Container &pairs,
+	node_index n,
+	std::vector<node_index> &pending,
+	std::vector<node_index> &stack
+) const {
+	if (nodes[n].id) {
 		return;
 	}
 
-	assert(root->left.get());
-	assert(root->right.get());
+	pending.clear();
+	pending.push_back(n);
 
-	std::stack<node *> nodes{};
-	nodes.push(root.get());
+	while (! pending.empty()) {
+		const node &curr = nodes[pending.back()];
+		pending.pop_back();
 
-	while (! nodes.empty()) {
-		node * n = nodes.top();
-		nodes.pop();
+		const node &left = nodes[curr.left];
+		const node &right = nodes[curr.right];
 
-		node * left = n->left.get();
-		node * right = n->right.get();
+		if (! left.id) {
+			pending.push_back(curr.left);
+		}
 
-		if (! left->id) {
-			nodes.push(left);
+		if (! right.id) {
+			pending.push_back(curr.right);
 		}
 
-		if (! right->id) {
-			nodes.push(right);
+		if (left.vol.overlaps(right.vol)) {
+			if (left.id && right.id) {
+				pairs.insert(std::end(pairs), coarse_collision_pair(left.vol, right.vol, left.id, right.id));
+			} else {
+				generate_coarse_collisions_with(pairs, curr.left, curr.right, stack);
+			}
 		}
+	}
+}
 
-		if (left->vol.overlaps(right->vol)) {
-			if (left->id && right->id) {
-				pairs.insert(std::end(pairs), coarse_collision_pair(left->vol, right->vol, left->id, right->id));
+template <phys::bounding_volume Volume, typename Identifier>
+std::vector<typename phys::bvh<Volume, Identifier>::collision_task> phys::bvh<Volume, Identifier>::split_collision_tasks(size_t count) const {
+	std::vector<collision_task> tasks{ { root, root } };
+	std::vector<collision_task> next{};
+	bool split = true;
+
+	// Splits every task one level down per pass, the same way the serial walk would
+	// descend. Pairs of leaves can't be split and are carried over as they are.
+	while (split && tasks.size() < count) {
+		split = false;
+		next.clear();
+
+		for (const collision_task &task : tasks) {
+			const node &a = nodes[task.a];
+			const node &b = nodes[task.b];
+
+			if (task.a == task.b) {
+				if (a.is_leaf()) {
+					continue;
+				}
+
+				next.push_back({ a.left, a.left });
+				next.push_back({ a.right, a.right });
+
+				if (nodes[a.left].vol.overlaps(nodes[a.right].vol)) {
+					next.push_back({ a.left, a.right });
+				}
+
+				split = true;
+			} else if (! a.is_leaf() || ! b.is_leaf()) {
+				// Splits the internal side, or the larger one if both are internal
+				const bool split_a = b.is_leaf() || (! a.is_leaf() && a.vol.surface_area() >= b.vol.surface_area());
+				const node &parent = split_a ? a : b;
+				const node_index other = split_a ? task.b : task.a;
+
+				for (const node_index child : { parent.left, parent.right }) {
+					if (nodes[child].vol.overlaps(nodes[other].vol)) {
+						next.push_back(split_a ? collision_task{ child, other } : collision_task{ other, child });
+					}
+				}
+
+				split = true;
 			} else {
-				generate_coarse_collisions_with(pairs, left, right);
+				next.push_back(task);
 			}
 		}
+
+		std::swap(tasks, next);
 	}
+
+	return tasks;
 }
 
 template <phys::bounding_volume Volume, typename Identifier>
 template <typename Container>
-void phys::bvh<Volume, Identifier>::generate_coarse_collisions_with(Container &pairs, node * n, node * tree) const {
-	if (! n->id) {
-		node * left = n->left.get();
-		node * right = n->right.get();
+void phys::bvh<Volume, Identifier>::generate_coarse_collisions_with(
+	Container &pairs,
+	node_index n,
+	node_index tree,
+	std::vector<node_index> &stack
+) const {
+	const node &curr = nodes[n];
+
+	if (! curr.id) {
+		if (nodes[curr.left].vol.overlaps(nodes[tree].vol)) {
+			generate_coarse_collisions_with(pairs, curr.left, tree, stack);
+		}
+
+		if (nodes[curr.right].vol.overlaps(nodes[tree].vol)) {
+			generate_coarse_collisions_with(pairs, curr.right, tree, stack);
+		}
+
+		return;
+	}
+
+	stack.clear();
+	stack.push_back(tree);
+
+	while (! stack.empty()) {
+		const node &next = nodes[stack.back()];
+		stack.pop_back();
+
+		if (! curr.vol.overlaps(next.vol)) {
+			continue;
+		}
+
+		if (next.id) {
+			pairs.insert(std::end(pairs), coarse_collision_pair(curr.vol, next.vol, curr.id, next.id));
+		} else {
+			assert(next.left != null_node);
+			assert(next.right != null_node);
+
+			stack.push_back(next.left);
+			stack.push_back(next.right);
+		}
+	}
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+template <typename HitTest>
+typename phys::bvh<Volume, Identifier>::ray_hit phys::bvh<Volume, Identifier>::raycast(const ray &r, HitTest &&hit_test) const {
+	ray_hit out{};
+
+	if (root == null_node) {
+		return out;
+	}
+
+	real closest = infinity;
+	query_stack<ray_entry> stack{};
+	const real root_t = r.intersect(nodes[root].vol);
+
+	if (root_t >= 0) {
+		stack.push({ root, root_t });
+	}
+
+	while (! stack.empty()) {
+		const ray_entry entry = stack.pop();
+
+		// A closer hit was found after this node was pushed
+		if (entry.t > closest) {
+			continue;
+		}
+
+		const node &curr = nodes[entry.n];
+
+		if (curr.is_leaf()) {
+			const real t = hit_test(curr.id);
+
+			if (t >= 0 && t < closest) {
+				closest = t;
+				out = { curr.id, t };
+			}
+
+			continue;
+		}
 
-		if (left->vol.overlaps(tree->vol)) {
-			generate_coarse_collisions_with(pairs, left, tree);
+		ray_entry nearer{ curr.left, r.intersect(nodes[curr.left].vol) };
+		ray_entry farther{ curr.right, r.intersect(nodes[curr.right].vol) };
+
+		if (farther.t >= 0 && nearer.t >= 0 && farther.t < nearer.t) {
+			std::swap(nearer, farther);
+		}
+
+		// The nearer child goes on top, so it is visited first
+		if (farther.t >= 0 && farther.t <= closest) {
+			stack.push(farther);
 		}
 
-		if (right->vol.overlaps(tree->vol)) {
-			generate_coarse_collisions_with(pairs, right, tree);
+		if (nearer.t >= 0 && nearer.t <= closest) {
+			stack.push(nearer);
 		}
+	}
 
+	return out;
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+template <typename HitTest, typename Container>
+void phys::bvh<Volume, Identifier>::raycast_all(const ray &r, HitTest &&hit_test, Container &hits) const {
+	if (root == null_node) {
 		return;
 	}
 
-	std::stack<node *> nodes{};
-	nodes.push(tree);
+	query_stack<node_index> stack{};
+	stack.push(root);
 
-	while (! nodes.empty()) {
-		node * next = nodes.top();
-		nodes.pop();
+	while (! stack.empty()) {
+		const node &curr = nodes[stack.pop()];
 
-		if (! n->vol.overlaps(next->vol)) {
+		if (r.intersect(curr.vol) < 0) {
 			continue;
 		}
 
-		if (next->id) {
-			pairs.insert(std::end(pairs), coarse_collision_pair(n->vol, next->vol, n->id, next->id));
+		if (curr.is_leaf()) {
+			const real t = hit_test(curr.id);
+
+			if (t >= 0) {
+				hits.insert(std::end(hits), ray_hit{ curr.id, t });
+			}
 		} else {
-			assert(! next->id);
-			assert(next->left.get());
-			assert(next->right.get());
+			stack.push(curr.left);
+			stack.push(curr.right);
+		}
+	}
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+template <typename F>
+void phys::bvh<Volume, Identifier>::query_volume(const Volume &vol, F &&f) const {
+	if (root == null_node) {
+		return;
+	}
+
+	query_stack<node_index> stack{};
+	stack.push(root);
 
-			nodes.push(next->left.get());
-			nodes.push(next->right.get());
+	while (! stack.empty()) {
+		const node &curr = nodes[stack.pop()];
+
+		if (! curr.vol.overlaps(vol)) {
+			continue;
+		}
+
+		if (curr.is_leaf()) {
+			f(curr.id);
+		} else {
+			stack.push(curr.left);
+			stack.push(curr.right);
 		}
 	}
 }
+
+template <phys::bounding_volume Volume, typename Identifier>
+template <typename F>
+void phys::bvh<Volume, Identifier>::query_frustum(const frustum &fr, F &&f) const {
+	if (root == null_node) {
+		return;
+	}
+
+	query_stack<frustum_entry> stack{};
+	stack.push({ root, false });
+
+	while (! stack.empty()) {
+		frustum_entry entry = stack.pop();
+		const node &curr = nodes[entry.n];
+
+		if (! entry.inside) {
+			const frustum::containment c = fr.classify(curr.vol);
+
+			if (c == frustum::containment::outside) {
+				continue;
+			}
+
+			entry.inside = c == frustum::containment::inside;
+		}
+
+		if (curr.is_leaf()) {
+			f(curr.id);
+		} else {
+			stack.push({ curr.left, entry.inside });
+			stack.push({ curr.right, entry.inside });
+		}
+	}
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+template <typename T>
+void phys::bvh<Volume, Identifier>::query_stack<T>::push(const T &item) {
+	if (count < items.size()) {
+		items[count++] = item;
+	} else {
+		overflow.push_back(item);
+	}
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+template <typename T>
+T phys::bvh<Volume, Identifier>::query_stack<T>::pop() {
+	if (! overflow.empty()) {
+		const T out = overflow.back();
+		overflow.pop_back();
+
+		return out;
+	}
+
+	return items[--count];
+}
+
+template <phys::bounding_volume Volume, typename Identifier>
+template <typename T>
+bool phys::bvh<Volume, Identifier>::query_stack<T>::empty() const {
+	return count == 0;
+}
\ No newline at end of file
@@ -1,78 +1,160 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
 #include "algorithms.h"
 #include "contact_generator.h"
 
-phys::collision_algorithm::collision_algorithm(
-	int _shape_type_1,
-	int _shape_type_2,
-	const collision_algorithm_func &_algorithm
-) :
-	shape_type_1(_shape_type_1),
-	shape_type_2(_shape_type_2),
-	algorithm(_algorithm)
-{}
-
-phys::contact_generator::contact_generator() {
-	register_collision_algorithm(
-		shape_type::Sphere,
-		shape_type::Sphere,
-		phys::algorithms::sphere_sphere_collision
-	);
+namespace {
+	[[noreturn]] void no_algorithm() {
+		throw std::invalid_argument("No collision algorithm for these shape types");
+	}
+
+	void missing_collision_algorithm(phys::primitive&, phys::primitive&, phys::contact_container&) {
+		no_algorithm();
+	}
+
+	void missing_collision_batch(std::span<const phys::primitive_pair>, phys::contact_container&) {
+		no_algorithm();
+	}
 }
 
+constexpr phys::contact_generator::algorithm_table phys::contact_generator::builtin_algorithms() {
+	algorithm_table out{};
+
+	for (auto &row : out) {
+		row.fill({ missing_collision_algorithm, missing_collision_batch });
+	}
+
+	const auto set = [&](shape_type type_1, shape_type type_2, const collision_algorithm &alg) {
+		out[static_cast<size_t>(type_1)][static_cast<size_t>(type_2)] = alg;
+		out[static_cast<size_t>(type_2)][static_cast<size_t>(type_1)] = alg;
+	};
+
+	set(shape_type::Sphere, shape_type::Sphere, { algorithms::sphere_sphere_collision, algorithms::sphere_sphere_collisions });
+	set(shape_type::Sphere, shape_type::Plane, { algorithms::sphere_plane_collision, algorithms::sphere_plane_collisions });
+	set(shape_type::Sphere, shape_type::Box, { algorithms::sphere_box_collision, algorithms::sphere_box_collisions });
+	set(shape_type::Sphere, shape_type::Capsule, { algorithms::sphere_capsule_collision, algorithms::sphere_capsule_collisions });
+	set(shape_type::Box, shape_type::Plane, { algorithms::box_plane_collision, algorithms::box_plane_collisions });
+	set(shape_type::Box, shape_type::Box, { algorithms::gjk_epa_collision, algorithms::gjk_epa_collisions });
+	set(shape_type::Box, shape_type::Capsule, { algorithms::gjk_epa_collision, algorithms::gjk_epa_collisions });
+	set(shape_type::Capsule, shape_type::Capsule, { algorithms::capsule_capsule_collision, algorithms::capsule_capsule_collisions });
+	set(shape_type::Capsule, shape_type::Plane, { algorithms::capsule_plane_collision, algorithms::capsule_plane_collisions });
+
+	return out;
+}
+
+phys::contact_generator::contact_generator() : algs(builtin_algorithms()) {}
+
 void phys::contact_generator::generate_contacts(
 	primitive &a,
 	primitive &b,
 	contact_container &contacts
 ) const {
-	if (a.type >= max_shapes || b.type >= max_shapes) {
-		// TODO: Errors
-		throw "Invalid shape type";
+	assert(a.type >= 0 && a.type < (int)max_shapes);
+	assert(b.type >= 0 && b.type < (int)max_shapes);
+
+	algs[a.type][b.type].algorithm(a, b, contacts);
+}
+
+void phys::contact_generator::generate_contacts(
+	std::span<primitive_pair> pairs,
+	contact_container &contacts
+) const {
+	static constexpr size_t num_keys = max_shapes * max_shapes;
+	static_assert(num_keys <= 256);
+
+	// A counting sort, so that each primitive is read once to find its shape type. The
+	// scratch space is per thread because many threads can share a generator.
+	thread_local std::vector<uint8_t> keys{};
+	thread_local std::vector<primitive_pair> sorted{};
+	std::array<size_t, num_keys + 1> offsets{};
+
+	keys.resize(pairs.size());
+
+	for (size_t i = 0; i < pairs.size(); i++) {
+		assert(pairs[i].a->type >= 0 && pairs[i].a->type < (int)max_shapes);
+		assert(pairs[i].b->type >= 0 && pairs[i].b->type < (int)max_shapes);
+
+		keys[i] = (uint8_t)(pairs[i].a->type * (int)max_shapes + pairs[i].b->type);
+		offsets[keys[i] + 1]++;
 	}
 
-	int shape_type_1 = std::min(a.type, b.type);
-	int shape_type_2 = std::max(a.type, b.type);
+	for (size_t key = 0; key < num_keys; key++) {
+		offsets[key + 1] += offsets[key];
+	}
+
+	// Pairs that all have the same shape types are already sorted
+	if (! pairs.empty() && offsets[keys[0] + 1] - offsets[keys[0]] != pairs.size()) {
+		std::array<size_t, num_keys> next{};
 
-	const collision_algorithm &alg = algs[shape_type_1][shape_type_2];
+		std::copy(std::begin(offsets), std::end(offsets) - 1, std::begin(next));
+		sorted.resize(pairs.size());
 
-	if (! alg.algorithm) {
-		// TODO: Errors
-		throw "No collision algorithm";
+		for (size_t i = 0; i < pairs.size(); i++) {
+			sorted[next[keys[i]]++] = pairs[i];
+		}
+
+		std::copy(std::begin(sorted), std::end(sorted), std::begin(pairs));
 	}
 
-	alg.algorithm(a, b, contacts);
+	for (size_t key = 0; key < num_keys; key++) {
+		if (offsets[key] == offsets[key + 1]) {
+			continue;
+		}
+
+		const std::span<const primitive_pair> batch = pairs.subspan(offsets[key], offsets[key + 1] - offsets[key]);
+		const collision_algorithm &alg = algs[key / max_shapes][key % max_shapes];
+
+		if (alg.batch) {
+			alg.batch(batch, contacts);
+		} else {
+			for (const primitive_pair &pair : batch) {
+				alg.algorithm(*pair.a, *pair.b, contacts);
+			}
+		}
+	}
 }
 
 void phys::contact_generator::register_collision_algorithm(
 	shape_type shape_type_1,
 	shape_type shape_type_2,
-	const collision_algorithm_func &algorithm
+	collision_algorithm_func algorithm,
+	collision_batch_func batch
 ) {
 	register_collision_algorithm(
 		static_cast<int>(shape_type_1),
 		static_cast<int>(shape_type_2),
-		algorithm
+		algorithm,
+		batch
 	);
 }
 
 void phys::contact_generator::register_collision_algorithm(
 	shape_type shape_type_1,
 	int shape_type_2,
-	const collision_algorithm_func &algorithm
+	collision_algorithm_func algorithm,
+	collision_batch_func batch
 ) {
 	register_collision_algorithm(
 		static_cast<int>(shape_type_1),
-		static_cast<int>(shape_type_2),
-		algorithm
+		shape_type_2,
+		algorithm,
+		batch
 	);
 }
 
 void phys::contact_generator::register_collision_algorithm(
 	int shape_type_1,
 	int shape_type_2,
-	const collision_algorithm_func &algorithm
+	collision_algorithm_func algorithm,
+	collision_batch_func batch
 ) {
-	int type_1 = std::min(shape_type_1, shape_type_2);
-	int type_2 = std::max(shape_type_1, shape_type_2);
+	if (shape_type_1 < 0 || shape_type_1 >= (int)max_shapes || shape_type_2 < 0 || shape_type_2 >= (int)max_shapes) {
+		throw std::out_of_range("Shape type must be less than contact_generator::max_shapes");
+	}
 
-	algs[type_1][type_2] = collision_algorithm(type_1, type_2, algorithm);
+	algs[shape_type_1][shape_type_2] = { algorithm, batch };
+	algs[shape_type_2][shape_type_1] = { algorithm, batch };
 }
\ No newline at end of file
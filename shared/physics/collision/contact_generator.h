@@ -1,25 +1,24 @@
 #pragma once
+#include <array>
+#include <span>
 #include "algorithm.h"
 #include "contact.h"
 #include "primitive.h"
 
 namespace phys {
 	struct collision_algorithm {
-		int shape_type_1{};
-		int shape_type_2{};
 		collision_algorithm_func algorithm{};
-
-		collision_algorithm(
-			int _shape_type_1,
-			int _shape_type_2,
-			const collision_algorithm_func &_algorithm
-		);
-
-		collision_algorithm() = default;
+		// Optional. Without it, a batch calls `algorithm` once per pair.
+		collision_batch_func batch{};
 	};
 
+	// Looks up the collision algorithm for a pair of primitives in a table indexed by both
+	// shape types. Every pair of shape types has an entry: pairs without a registered
+	// algorithm go to one that throws `std::invalid_argument`.
 	class contact_generator {
 	public:
+		static inline constexpr size_t max_shapes = 16;
+
 		contact_generator();
 
 		void generate_contacts(
@@ -28,24 +27,37 @@ namespace phys {
 			contact_container &contacts
 		) const;
 
+		// Sorts `pairs` by their shape types, then runs each algorithm over all of its
+		// pairs at once. Pairs with the same shape types keep their order, but the contacts
+		// are grouped by shape types instead of following the original order of `pairs`.
+		void generate_contacts(
+			std::span<primitive_pair> pairs,
+			contact_container &contacts
+		) const;
+
 		void register_collision_algorithm(
 			shape_type shape_type_1,
 			shape_type shape_type_2,
-			const collision_algorithm_func &algorithm
+			collision_algorithm_func algorithm,
+			collision_batch_func batch = nullptr
 		);
 		void register_collision_algorithm(
 			shape_type shape_type_1,
 			int shape_type_2,
-			const collision_algorithm_func &algorithm
+			collision_algorithm_func algorithm,
+			collision_batch_func batch = nullptr
 		);
 		void register_collision_algorithm(
 			int shape_type_1,
 			int shape_type_2,
-			const collision_algorithm_func &algorithm
+			collision_algorithm_func algorithm,
+			collision_batch_func batch = nullptr
 		);
 	private:
-		static inline constexpr size_t max_shapes = 16;
+		using algorithm_table = std::array<std::array<collision_algorithm, max_shapes>, max_shapes>;
+
+		algorithm_table algs;
 
-		collision_algorithm algs[max_shapes][max_shapes]{};
+		static constexpr algorithm_table builtin_algorithms();
 	};
-}
+}
\ No newline at end of file
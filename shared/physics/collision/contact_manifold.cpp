@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include "contact_manifold.h"
+
+using namespace phys::literals;
+
+namespace {
+	bool less_bodies(
+		const phys::rigid_body * a1,
+		const phys::rigid_body * b1,
+		const phys::rigid_body * a2,
+		const phys::rigid_body * b2
+	) {
+		const std::less<const phys::rigid_body *> less{};
+
+		return less(a1, a2) || (a1 == a2 && less(b1, b2));
+	}
+
+	// Grows with the area spanned by four points: the largest of the squared areas of the
+	// three ways to pick two diagonals from them
+	phys::real area(const phys::vec3 &p0, const phys::vec3 &p1, const phys::vec3 &p2, const phys::vec3 &p3) {
+		const phys::vec3 c1 = phys::cross(p0 - p1, p2 - p3);
+		const phys::vec3 c2 = phys::cross(p0 - p2, p1 - p3);
+		const phys::vec3 c3 = phys::cross(p0 - p3, p1 - p2);
+
+		return std::max({ phys::dot(c1, c1), phys::dot(c2, c2), phys::dot(c3, c3) });
+	}
+}
+
+phys::contact_manifold_cache::contact_manifold_cache(
+	real _position_tolerance,
+	real _rotation_tolerance,
+	real _match_distance
+) :
+	position_tolerance(_position_tolerance),
+	rotation_tolerance(_rotation_tolerance),
+	match_distance(_match_distance)
+{}
+
+size_t phys::contact_manifold_cache::begin_step(std::span<primitive_pair> _pairs) {
+	pairs = _pairs;
+	body_pairs.clear();
+
+	for (size_t i = 0; i < pairs.size(); i++) {
+		assert(std::less<rigid_body *>{}(pairs[i].a->body, pairs[i].b->body));
+
+		if (i == 0 || pairs[i].a->body != pairs[i - 1].a->body || pairs[i].b->body != pairs[i - 1].b->body) {
+			body_pairs.push_back({ i, i + 1 });
+		} else {
+			body_pairs.back().end = i + 1;
+		}
+	}
+
+	next.resize(body_pairs.size());
+	// The dot product of two unit quaternions is the cosine of half the angle between them
+	min_rotation_dot = std::cos(rotation_tolerance * 0.5_r);
+
+	return body_pairs.size();
+}
+
+void phys::contact_manifold_cache::update(size_t begin, size_t end, const contact_generator &collider, contact_container &scratch) {
+	for (size_t i = begin; i < end; i++) {
+		update_manifold(i, collider, scratch);
+	}
+}
+
+void phys::contact_manifold_cache::end_step(contact_container &contacts) {
+	manifolds.swap(next);
+	pairs = {};
+	last_hits = 0;
+	last_misses = 0;
+
+	for (const contact_manifold &m : manifolds) {
+		if (m.reused) {
+			last_hits++;
+		} else {
+			last_misses++;
+		}
+
+		for (size_t i = 0; i < m.count; i++) {
+			const contact_manifold::point &p = m.points[i];
+
+			contacts.insert(std::end(contacts), contact(m.a, m.b, p.position, p.normal, p.penetration));
+		}
+	}
+}
+
+void phys::contact_manifold_cache::forget_body(const rigid_body * body) {
+	std::erase_if(manifolds, [&](const contact_manifold &m) {
+		return m.a == body || m.b == body;
+	});
+}
+
+const std::vector<phys::contact_manifold>& phys::contact_manifold_cache::get_manifolds() const {
+	return manifolds;
+}
+
+size_t phys::contact_manifold_cache::get_last_hits() const {
+	return last_hits;
+}
+
+size_t phys::contact_manifold_cache::get_last_misses() const {
+	return last_misses;
+}
+
+const phys::contact_manifold * phys::contact_manifold_cache::find(const rigid_body * a, const rigid_body * b) const {
+	const auto it = std::lower_bound(std::begin(manifolds), std::end(manifolds), a, [&](const contact_manifold &m, const rigid_body *) {
+		return less_bodies(m.a, m.b, a, b);
+	});
+
+	if (it == std::end(manifolds) || it->a != a || it->b != b) {
+		return nullptr;
+	}
+
+	return &*it;
+}
+
+void phys::contact_manifold_cache::update_manifold(size_t i, const contact_generator &collider, contact_container &scratch) {
+	const body_pair &bp = body_pairs[i];
+	rigid_body * a = pairs[bp.begin].a->body;
+	rigid_body * b = pairs[bp.begin].b->body;
+	const quat inv_rot_a = glm::conjugate(a->rot);
+	const vec3 relative_pos = inv_rot_a * (b->pos - a->pos);
+	const quat relative_rot = inv_rot_a * b->rot;
+	const contact_manifold * old = find(a, b);
+	contact_manifold &m = next[i];
+
+	if (old) {
+		m = *old;
+		refresh(m);
+	} else {
+		m = contact_manifold{};
+		m.a = a;
+		m.b = b;
+	}
+
+	// Each run of the narrowphase can add a point, so a manifold with room for more runs it
+	// every step, even while its bodies barely move. An empty one has found nothing to add
+	// to.
+	if (old && skip_narrowphase && (old->count == 0 || m.count == contact_manifold::max_points)) {
+		const vec3 moved = relative_pos - old->relative_pos;
+		const real turned = std::abs(glm::dot(relative_rot, old->relative_rot));
+
+		if (dot(moved, moved) <= position_tolerance * position_tolerance && turned >= min_rotation_dot) {
+			m.reused = true;
+			return;
+		}
+	}
+
+	m.reused = false;
+	m.relative_pos = relative_pos;
+	m.relative_rot = relative_rot;
+
+	scratch.clear();
+	collider.generate_contacts(pairs.subspan(bp.begin, bp.end - bp.begin), scratch);
+
+	for (const contact &c : scratch) {
+		add_point(m, c);
+	}
+}
+
+void phys::contact_manifold_cache::refresh(contact_manifold &m) const {
+	size_t kept = 0;
+
+	for (size_t i = 0; i < m.count; i++) {
+		contact_manifold::point p = m.points[i];
+		const vec3 on_a = m.a->pos + m.a->rot * p.local_a;
+		const vec3 on_b = m.b->pos + m.b->rot * p.local_b;
+		const vec3 normal = m.a->rot * p.local_normal;
+		const vec3 apart = on_a - on_b;
+		const real along = dot(apart, normal);
+		const vec3 slid = apart - normal * along;
+
+		// Moving `b` towards `a` along the normal moves its copy of the point back, which
+		// deepens the contact
+		p.penetration = p.depth + along;
+
+		if (p.penetration <= 0.0_r || dot(slid, slid) > match_distance * match_distance) {
+			continue;
+		}
+
+		p.position = (on_a + on_b) * 0.5_r;
+		p.normal = normal;
+		m.points[kept++] = p;
+	}
+
+	m.count = kept;
+}
+
+void phys::contact_manifold_cache::add_point(contact_manifold &m, const contact &c) const {
+	const vec3 normal = c.a == m.a ? c.normal : -c.normal;
+	const quat inv_rot_a = glm::conjugate(m.a->rot);
+	const quat inv_rot_b = glm::conjugate(m.b->rot);
+	const contact_manifold::point p{
+		inv_rot_a * (c.point - m.a->pos),
+		inv_rot_b * (c.point - m.b->pos),
+		inv_rot_a * normal,
+		c.penetration,
+		c.point,
+		normal,
+		c.penetration
+	};
+
+	// Replaces the nearest remembered point, if it's close enough. Only the distance
+	// across the normal counts, because points at different depths in the same place
+	// are the same contact.
+	size_t nearest = m.count;
+	real nearest_dist = match_distance * match_distance;
+
+	for (size_t i = 0; i < m.count; i++) {
+		const vec3 d = m.points[i].position - c.point;
+		const vec3 across = d - normal * dot(d, normal);
+		const real dist = dot(across, across);
+
+		if (dist <= nearest_dist) {
+			nearest = i;
+			nearest_dist = dist;
+		}
+	}
+
+	if (nearest < m.count) {
+		m.points[nearest] = p;
+		return;
+	}
+
+	if (m.count < contact_manifold::max_points) {
+		m.points[m.count++] = p;
+		return;
+	}
+
+	// Five points compete for four places. The deepest always stays, and of the others,
+	// the one whose removal leaves the largest area goes.
+	std::array<contact_manifold::point, contact_manifold::max_points + 1> all{};
+
+	std::copy(std::begin(m.points), std::end(m.points), std::begin(all));
+	all.back() = p;
+
+	const auto deepest = std::max_element(std::begin(all), std::end(all), [](const auto &x, const auto &y) {
+		return x.penetration < y.penetration;
+	}) - std::begin(all);
+
+	size_t removed = 0;
+	real largest = -1.0_r;
+
+	for (size_t r = 0; r < all.size(); r++) {
+		if ((ptrdiff_t)r == deepest) {
+			continue;
+		}
+
+		std::array<vec3, contact_manifold::max_points> rest{};
+		size_t n = 0;
+
+		for (size_t j = 0; j < all.size(); j++) {
+			if (j != r) {
+				rest[n++] = all[j].position;
+			}
+		}
+
+		const real spanned = area(rest[0], rest[1], rest[2], rest[3]);
+
+		if (spanned > largest) {
+			removed = r;
+			largest = spanned;
+		}
+	}
+
+	size_t n = 0;
+
+	for (size_t j = 0; j < all.size(); j++) {
+		if (j != removed) {
+			m.points[n++] = all[j];
+		}
+	}
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <array>
+#include <span>
+#include <vector>
+#include "../math.h"
+#include "../rigid_body.h"
+#include "algorithm.h"
+#include "contact_generator.h"
+
+namespace phys {
+	// Up to four contacts between two bodies, kept from step to step. Normals point from
+	// `a` to `b`.
+	struct contact_manifold {
+		static inline constexpr size_t max_points = 4;
+
+		struct point {
+			// Where the contact was found, in the frames of `a` and of `b`. The two drift
+			// apart as the bodies slide against each other.
+			vec3 local_a{};
+			vec3 local_b{};
+			// The normal in the frame of `a`
+			vec3 local_normal{};
+			// Penetration when the contact was found
+			real depth{};
+
+			// The contact as of the last step, in world space
+			vec3 position{};
+			vec3 normal{};
+			real penetration{};
+		};
+
+		rigid_body * a{};
+		rigid_body * b{};
+		std::array<point, max_points> points{};
+		size_t count{};
+		// Where `b` was in the frame of `a` when the narrowphase last ran
+		vec3 relative_pos{};
+		quat relative_rot{ identity<quat>() };
+		// Whether the last step skipped the narrowphase and kept the remembered points
+		bool reused{};
+	};
+
+	// Keeps a contact manifold for each pair of bodies with primitives near each other.
+	// Each step, the remembered points move along with their bodies, and points where the
+	// bodies have separated or slid apart are dropped. While two bodies barely move relative
+	// to each other, their narrowphase is skipped and the remembered points stand in for
+	// it, but only if their manifold is empty or full. Otherwise, each new contact replaces
+	// the remembered point that it matches or is added, and the manifold is cut back to the
+	// four points that span the largest area, always keeping the deepest. Because points
+	// persist, a resolver that remembers its impulses by contact point (like
+	// `sequential_impulse_resolver`) finds them again.
+	//
+	// A step is `begin_step`, then `update` over all of the body pairs, then `end_step`.
+	// Manifolds of body pairs that were not in a step are dropped.
+	class contact_manifold_cache {
+	public:
+		// How far two bodies can move, and how far (in radians) they can turn, relative to
+		// each other before their narrowphase runs again
+		real position_tolerance;
+		real rotation_tolerance;
+		// How close a new contact must be to a remembered point to replace it, and how far
+		// the two bodies can slide apart at a point before it is dropped
+		real match_distance;
+		// With this off, the narrowphase runs for every body pair in every step
+		bool skip_narrowphase{ true };
+
+		contact_manifold_cache(
+			real _position_tolerance = (real)0.005,
+			real _rotation_tolerance = (real)0.005,
+			real _match_distance = (real)0.02
+		);
+
+		// Starts a step and returns how many body pairs it has. The pairs of primitives on
+		// the same two bodies must be next to each other, and the primitive on the body
+		// with the lower address must come first in each pair. `pairs` must outlive the
+		// step.
+		size_t begin_step(std::span<primitive_pair> pairs);
+		// Updates the manifolds of body pairs [begin, end). Disjoint ranges can be updated
+		// in parallel, each with its own `scratch`.
+		void update(size_t begin, size_t end, const contact_generator &collider, contact_container &scratch);
+		// Drops the manifolds of body pairs that were not in the step, and appends the
+		// contacts of the rest to `contacts`, in the order of the body pairs
+		void end_step(contact_container &contacts);
+
+		// Drops the manifolds of a body. Its remembered points are stale once it loses or
+		// gains a primitive.
+		void forget_body(const rigid_body * body);
+
+		const std::vector<contact_manifold>& get_manifolds() const;
+		// Body pairs in the last step that skipped the narrowphase
+		size_t get_last_hits() const;
+		// Body pairs in the last step that ran the narrowphase
+		size_t get_last_misses() const;
+
+	private:
+		struct body_pair {
+			size_t begin{};
+			size_t end{};
+		};
+
+		std::span<primitive_pair> pairs{};
+		std::vector<body_pair> body_pairs{};
+		// Sorted by body addresses
+		std::vector<contact_manifold> manifolds{};
+		std::vector<contact_manifold> next{};
+		// The smallest dot product between two relative rotations within `rotation_tolerance`
+		real min_rotation_dot{};
+		size_t last_hits{};
+		size_t last_misses{};
+
+		const contact_manifold * find(const rigid_body * a, const rigid_body * b) const;
+		void update_manifold(size_t i, const contact_generator &collider, contact_container &scratch);
+		void refresh(contact_manifold &m) const;
+		void add_point(contact_manifold &m, const contact &c) const;
+	};
+}
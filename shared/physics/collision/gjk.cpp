@@ -0,0 +1,394 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <span>
+#include "gjk.h"
+
+using namespace phys::literals;
+
+namespace {
+	constexpr size_t max_gjk_iterations = 64;
+	constexpr size_t max_epa_iterations = 64;
+	constexpr size_t max_epa_vertices = 4 + max_epa_iterations;
+	// A closed triangle mesh with V vertices has 2V - 4 faces
+	constexpr size_t max_epa_faces = 2 * max_epa_vertices - 4;
+	// EPA stops once the depth is known to within this much, or this fraction of itself.
+	// Curved primitives have no faces for the polytope to land on, so they only get there
+	// in the limit, and a fixed tolerance alone could take too many iterations.
+	constexpr phys::real epa_tolerance = 1e-4_r;
+	constexpr phys::real epa_relative_tolerance = 1e-3_r;
+	// Squared lengths below this are treated as zero
+	constexpr phys::real epsilon = 1e-12_r;
+
+	// A point on the boundary of the Minkowski difference `a - b`, with the points on `a`
+	// and `b` that it came from
+	struct support_point {
+		phys::vec3 v{};
+		phys::vec3 a{};
+		phys::vec3 b{};
+	};
+
+	// The newest point is last
+	struct simplex {
+		std::array<support_point, 4> points{};
+		size_t count{};
+	};
+
+	struct epa_face {
+		std::array<size_t, 3> v{};
+		phys::vec3 normal{};
+		phys::real distance{};
+	};
+
+	// A primitive's support function with its frame computed once
+	struct support_mapping {
+		const phys::convex_primitive &p;
+		phys::mat3 rot{};
+		phys::mat3 inv_rot{};
+		phys::vec3 origin{};
+
+		explicit support_mapping(const phys::convex_primitive &_p) :
+			p(_p)
+		{
+			const phys::mat4 frame = p.support_frame();
+
+			rot = phys::truncate(frame);
+			inv_rot = phys::transpose(rot);
+			origin = phys::truncate(frame[3]);
+		}
+
+		phys::vec3 operator()(const phys::vec3 &dir) const {
+			return origin + rot * p.local_support(inv_rot * dir);
+		}
+	};
+
+	support_point support(const support_mapping &a, const support_mapping &b, const phys::vec3 &dir) {
+		const phys::vec3 on_a = a(dir);
+		const phys::vec3 on_b = b(-dir);
+
+		return { on_a - on_b, on_a, on_b };
+	}
+
+	// Any vector perpendicular to `v`
+	phys::vec3 perpendicular(const phys::vec3 &v) {
+		return std::abs(v.x) < 0.5_r ? phys::cross(v, phys::vec3(1.0_r, 0.0_r, 0.0_r)) : phys::cross(v, phys::vec3(0.0_r, 1.0_r, 0.0_r));
+	}
+
+	// Each case keeps the part of the simplex closest to the origin and points `dir` from
+	// there towards the origin. They return true once the simplex contains the origin.
+	bool line_case(simplex &s, phys::vec3 &dir) {
+		const phys::vec3 a = s.points[1].v;
+		const phys::vec3 ab = s.points[0].v - a;
+
+		if (phys::dot(ab, -a) > 0.0_r) {
+			dir = phys::cross(phys::cross(ab, -a), ab);
+
+			// The origin is on the segment
+			if (phys::dot(dir, dir) <= epsilon) {
+				dir = perpendicular(ab);
+			}
+		} else {
+			s.points[0] = s.points[1];
+			s.count = 1;
+			dir = -a;
+		}
+
+		return false;
+	}
+
+	bool triangle_case(simplex &s, phys::vec3 &dir) {
+		const support_point a = s.points[2];
+		const support_point b = s.points[1];
+		const support_point c = s.points[0];
+		const phys::vec3 ab = b.v - a.v;
+		const phys::vec3 ac = c.v - a.v;
+		const phys::vec3 abc = phys::cross(ab, ac);
+
+		if (phys::dot(abc, abc) <= epsilon) {
+			s.points = { b, a };
+			s.count = 2;
+
+			return line_case(s, dir);
+		}
+
+		if (phys::dot(phys::cross(abc, ac), -a.v) > 0.0_r) {
+			s.points = { phys::dot(ac, -a.v) > 0.0_r ? c : b, a };
+			s.count = 2;
+
+			return line_case(s, dir);
+		}
+
+		if (phys::dot(phys::cross(ab, abc), -a.v) > 0.0_r) {
+			s.points = { b, a };
+			s.count = 2;
+
+			return line_case(s, dir);
+		}
+
+		if (phys::dot(abc, -a.v) >= 0.0_r) {
+			dir = abc;
+		} else {
+			s.points = { b, c, a };
+			dir = -abc;
+		}
+
+		return false;
+	}
+
+	bool tetrahedron_case(simplex &s, phys::vec3 &dir) {
+		const support_point a = s.points[3];
+		const support_point b = s.points[2];
+		const support_point c = s.points[1];
+		const support_point d = s.points[0];
+		// Each face that has the newest point, and the point opposite it
+		const std::array<std::array<support_point, 3>, 3> faces{ {
+			{ b, c, d },
+			{ c, d, b },
+			{ d, b, c }
+		} };
+
+		for (const auto &[p, q, opposite] : faces) {
+			phys::vec3 n = phys::cross(p.v - a.v, q.v - a.v);
+
+			if (phys::dot(n, opposite.v - a.v) > 0.0_r) {
+				n = -n;
+			}
+
+			if (phys::dot(n, -a.v) > 0.0_r) {
+				s.points = { q, p, a };
+				s.count = 3;
+
+				return triangle_case(s, dir);
+			}
+		}
+
+		return true;
+	}
+
+	bool update_simplex(simplex &s, phys::vec3 &dir) {
+		switch (s.count) {
+			case 2:
+				return line_case(s, dir);
+			case 3:
+				return triangle_case(s, dir);
+			default:
+				return tetrahedron_case(s, dir);
+		}
+	}
+
+	std::optional<phys::penetration> to_penetration(const epa_face &face, std::span<const support_point> vertices) {
+		if (face.distance <= 0.0_r) {
+			return std::nullopt;
+		}
+
+		// The barycentric coordinates of the point on the face closest to the origin
+		const support_point &p0 = vertices[face.v[0]];
+		const support_point &p1 = vertices[face.v[1]];
+		const support_point &p2 = vertices[face.v[2]];
+		const phys::vec3 e0 = p1.v - p0.v;
+		const phys::vec3 e1 = p2.v - p0.v;
+		const phys::vec3 e2 = face.normal * face.distance - p0.v;
+		const phys::real d00 = phys::dot(e0, e0);
+		const phys::real d01 = phys::dot(e0, e1);
+		const phys::real d11 = phys::dot(e1, e1);
+		const phys::real d20 = phys::dot(e2, e0);
+		const phys::real d21 = phys::dot(e2, e1);
+		const phys::real denom = d00 * d11 - d01 * d01;
+
+		if (denom <= epsilon) {
+			return std::nullopt;
+		}
+
+		const phys::real v = (d11 * d20 - d01 * d21) / denom;
+		const phys::real w = (d00 * d21 - d01 * d20) / denom;
+		const phys::real u = 1.0_r - v - w;
+
+		return phys::penetration{
+			face.normal,
+			face.distance,
+			p0.a * u + p1.a * v + p2.a * w,
+			p0.b * u + p1.b * v + p2.b * w
+		};
+	}
+
+	// How far `b` has to move along `normal` to stop overlapping `a`, with the points of each
+	// that reach furthest into the other along it
+	phys::penetration overlap_along(const support_point &w, const phys::vec3 &normal) {
+		return { normal, phys::dot(w.v, normal), w.a, w.b };
+	}
+
+	// Returns nothing if the polytope can't be grown until its depth is known to within the
+	// tolerance. `fallback` is then the overlap along the direction that overlapped the
+	// least out of the ones tried, which separates the primitives but may not be the
+	// shortest way.
+	std::optional<phys::penetration> epa(const support_mapping &a, const support_mapping &b, const simplex &s, phys::penetration &fallback) {
+		std::array<support_point, max_epa_vertices> vertices{};
+		std::array<epa_face, max_epa_faces> faces{};
+		// The horizon: edges of the faces removed in one iteration that are only on one
+		// removed face
+		std::array<std::array<size_t, 2>, 3 * max_epa_faces> edges{};
+		size_t num_vertices = 4;
+		size_t num_faces = 0;
+		size_t num_edges = 0;
+
+		std::copy(std::begin(s.points), std::end(s.points), std::begin(vertices));
+
+		const auto add_face = [&](size_t i, size_t j, size_t k) {
+			const phys::vec3 n = phys::cross(vertices[j].v - vertices[i].v, vertices[k].v - vertices[i].v);
+			const phys::real len_sq = phys::dot(n, n);
+
+			if (len_sq <= epsilon || num_faces == max_epa_faces) {
+				return false;
+			}
+
+			const phys::vec3 normal = n / std::sqrt(len_sq);
+
+			faces[num_faces++] = { { i, j, k }, normal, phys::dot(normal, vertices[i].v) };
+
+			return true;
+		};
+
+		const auto add_edge = [&](size_t i, size_t j) {
+			for (size_t e = 0; e < num_edges; e++) {
+				if (edges[e][0] == j && edges[e][1] == i) {
+					edges[e] = edges[--num_edges];
+					return;
+				}
+			}
+
+			edges[num_edges++] = { i, j };
+		};
+
+		// Winds each face of the tetrahedron so that its normal points away from the
+		// vertex opposite it
+		const std::array<std::array<size_t, 4>, 4> tetrahedron{ {
+			{ 0, 1, 2, 3 },
+			{ 0, 1, 3, 2 },
+			{ 0, 2, 3, 1 },
+			{ 1, 2, 3, 0 }
+		} };
+
+		for (const auto &[i, j, k, opposite] : tetrahedron) {
+			const phys::vec3 n = phys::cross(vertices[j].v - vertices[i].v, vertices[k].v - vertices[i].v);
+			const bool added = phys::dot(n, vertices[opposite].v - vertices[i].v) > 0.0_r ? add_face(i, k, j) : add_face(i, j, k);
+
+			if (! added) {
+				return std::nullopt;
+			}
+		}
+
+		// The depth is at least the distance to the closest face, and at most the overlap
+		// along any direction
+		phys::real lower = 0.0_r;
+		fallback.depth = phys::infinity;
+
+		for (size_t iteration = 0; ; iteration++) {
+			size_t closest = 0;
+
+			for (size_t f = 1; f < num_faces; f++) {
+				if (faces[f].distance < faces[closest].distance) {
+					closest = f;
+				}
+			}
+
+			const epa_face face = faces[closest];
+			const support_point w = support(a, b, face.normal);
+			const phys::real upper = phys::dot(w.v, face.normal);
+
+			if (upper < fallback.depth) {
+				fallback = overlap_along(w, face.normal);
+			}
+
+			const phys::real tolerance = std::max(epa_tolerance, epa_relative_tolerance * fallback.depth);
+
+			if (upper - face.distance <= tolerance) {
+				return to_penetration(face, vertices);
+			}
+
+			// The closest face is still far from the boundary, but some other direction
+			// already overlaps by little more than it
+			if (fallback.depth - face.distance <= tolerance) {
+				return fallback;
+			}
+
+			// Growing the polytope can only move its closest face away from the origin, unless
+			// rounding has bent it out of shape
+			if (face.distance < lower - epa_tolerance || iteration == max_epa_iterations || num_vertices == max_epa_vertices) {
+				return std::nullopt;
+			}
+
+			lower = std::max(lower, face.distance);
+
+			vertices[num_vertices++] = w;
+			num_edges = 0;
+
+			// Removes the faces that can see the new vertex, and then closes the hole
+			// with faces that have the new vertex
+			for (size_t f = num_faces; f-- > 0;) {
+				if (phys::dot(faces[f].normal, w.v - vertices[faces[f].v[0]].v) > 0.0_r) {
+					add_edge(faces[f].v[0], faces[f].v[1]);
+					add_edge(faces[f].v[1], faces[f].v[2]);
+					add_edge(faces[f].v[2], faces[f].v[0]);
+					faces[f] = faces[--num_faces];
+				}
+			}
+
+			for (size_t e = 0; e < num_edges; e++) {
+				if (! add_face(edges[e][0], edges[e][1], num_vertices - 1)) {
+					return std::nullopt;
+				}
+			}
+		}
+	}
+}
+
+std::optional<phys::penetration> phys::gjk_epa(const convex_primitive &_a, const convex_primitive &_b) {
+	const support_mapping a(_a);
+	const support_mapping b(_b);
+	vec3 dir = a.origin - b.origin;
+
+	if (dot(dir, dir) <= epsilon) {
+		dir = vec3(1.0_r, 0.0_r, 0.0_r);
+	}
+
+	simplex s{};
+
+	s.points[0] = support(a, b, dir);
+	s.count = 1;
+	dir = -s.points[0].v;
+
+	for (size_t i = 0; i < max_gjk_iterations; i++) {
+		// The origin is on a vertex of the Minkowski difference, so the primitives touch
+		if (dot(dir, dir) <= epsilon) {
+			return std::nullopt;
+		}
+
+		const support_point w = support(a, b, dir);
+
+		// The origin is beyond the farthest point towards it, so it's outside
+		if (dot(w.v, dir) <= 0.0_r) {
+			return std::nullopt;
+		}
+
+		s.points[s.count++] = w;
+
+		if (update_simplex(s, dir)) {
+			penetration fallback{};
+			const std::optional<penetration> result = epa(a, b, s, fallback);
+
+			if (result) {
+				return result;
+			}
+
+			// EPA didn't converge, but the primitives overlap along every direction that
+			// it tried
+			if (fallback.depth > 0.0_r && fallback.depth < infinity) {
+				return fallback;
+			}
+
+			return std::nullopt;
+		}
+	}
+
+	return std::nullopt;
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+#include <optional>
+#include "../math.h"
+#include "primitive.h"
+
+namespace phys {
+	struct penetration {
+		// Points from `a` into `b`. Moving `b` by `normal * depth` separates the two.
+		vec3 normal{};
+		real depth{};
+		// The deepest point of `a` inside `b`
+		vec3 point_a{};
+		// The deepest point of `b` inside `a`
+		vec3 point_b{};
+	};
+
+	// Finds whether two convex primitives overlap with GJK, and if they do, finds how far
+	// they overlap with EPA. Touching primitives don't overlap. Gives up and returns
+	// nothing on degenerate input (like a flat box). If EPA can't pin down the depth, the
+	// penetration is the overlap along the direction that overlapped the least out of the
+	// ones that EPA tried. Moving `b` by it still separates the two, but maybe not by the
+	// shortest way.
+	std::optional<penetration> gjk_epa(const convex_primitive &a, const convex_primitive &b);
+}
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "primitive.h"
 
+using namespace phys::literals;
+
 phys::primitive::primitive(
 	shape_type _type,
 	rigid_body * _body,
@@ -14,4 +16,22 @@ phys::primitive::primitive(
 	type(_type),
 	body(_body),
 	offset(_offset)
-{}
\ No newline at end of file
+{}
+
+phys::mat4 phys::primitive::world_transform() const {
+	mat4 body_transform = glm::mat4_cast(body->rot);
+
+	body_transform[3] = vec4(body->pos, 1.0_r);
+
+	return body_transform * offset;
+}
+
+phys::vec3 phys::convex_primitive::support(const vec3 &dir) const {
+	const mat4 frame = support_frame();
+
+	return truncate(frame * vec4(local_support(transpose(truncate(frame)) * dir), 1.0_r));
+}
+
+phys::mat4 phys::convex_primitive::support_frame() const {
+	return world_transform();
+}
\ No newline at end of file
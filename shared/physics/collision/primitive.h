@@ -1,10 +1,15 @@
 #pragma once
+#include <optional>
 #include "../math.h"
 #include "../rigid_body.h"
+#include "bounding_volumes.h"
 
 namespace phys {
 	enum class shape_type {
-		Sphere = 0
+		Sphere = 0,
+		Plane = 1,
+		Box = 2,
+		Capsule = 3
 	};
 
 	class primitive {
@@ -16,6 +21,13 @@ namespace phys {
 
 		virtual ~primitive() = default;
 
+		// The smallest box around the primitive in world space, or nothing if the
+		// primitive is unbounded (like a plane)
+		virtual std::optional<aabb> bounds() const = 0;
+
+		// The body's rotation and position applied to `offset`
+		mat4 world_transform() const;
+
 	protected:
 		primitive(
 			shape_type _type,
@@ -29,4 +41,21 @@ namespace phys {
 			const mat4 &_offset
 		);
 	};
-}
+
+	// A bounded, convex primitive, which any other can collide with through GJK
+	class convex_primitive : public primitive {
+	public:
+		// The point of the primitive that is farthest along `dir`, in world space.
+		// `dir` doesn't have to be normalized.
+		vec3 support(const vec3 &dir) const;
+
+		// The frame that `local_support` works in. Callers that need many support points
+		// can compute it once.
+		virtual mat4 support_frame() const;
+		// The same as `support`, but with `dir` and the point in `support_frame()`
+		virtual vec3 local_support(const vec3 &dir) const = 0;
+
+	protected:
+		using primitive::primitive;
+	};
+}
\ No newline at end of file
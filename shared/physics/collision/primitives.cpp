@@ -1,10 +1,113 @@
+#include <cmath>
 #include "primitives.h"
 
+using namespace phys::literals;
+
+namespace {
+	// `dir` scaled to `length`, or nothing if `dir` is zero
+	phys::vec3 scale_to(const phys::vec3 &dir, phys::real length) {
+		const phys::real len_sq = phys::dot(dir, dir);
+
+		if (len_sq == 0.0_r) {
+			return phys::vec3(0.0_r);
+		}
+
+		return dir * (length / std::sqrt(len_sq));
+	}
+}
+
 phys::sphere::sphere(
 	rigid_body * _body,
 	const mat4 &_offset,
 	real _radius
 ) :
-	primitive(shape_type::Sphere, _body, _offset),
+	convex_primitive(shape_type::Sphere, _body, _offset),
 	radius(_radius)
-{}
\ No newline at end of file
+{}
+
+phys::vec3 phys::sphere::center() const {
+	return body->pos + truncate(offset[3]);
+}
+
+std::optional<phys::aabb> phys::sphere::bounds() const {
+	const vec3 c = center();
+
+	return aabb(c - vec3(radius), c + vec3(radius));
+}
+
+phys::mat4 phys::sphere::support_frame() const {
+	mat4 out = identity<mat4>();
+
+	out[3] = vec4(center(), 1.0_r);
+
+	return out;
+}
+
+phys::vec3 phys::sphere::local_support(const vec3 &dir) const {
+	return scale_to(dir, radius);
+}
+
+phys::plane::plane(
+	rigid_body * _body,
+	const vec3 &_normal,
+	real _distance
+) :
+	primitive(shape_type::Plane, _body, identity<mat4>()),
+	normal(_normal),
+	distance(_distance)
+{}
+
+std::optional<phys::aabb> phys::plane::bounds() const {
+	return std::nullopt;
+}
+
+phys::box::box(
+	rigid_body * _body,
+	const mat4 &_offset,
+	const vec3 &_half_size
+) :
+	convex_primitive(shape_type::Box, _body, _offset),
+	half_size(_half_size)
+{}
+
+std::optional<phys::aabb> phys::box::bounds() const {
+	const mat4 t = world_transform();
+	const vec3 c = truncate(t[3]);
+	const vec3 extent =
+		glm::abs(truncate(t[0])) * half_size.x +
+		glm::abs(truncate(t[1])) * half_size.y +
+		glm::abs(truncate(t[2])) * half_size.z;
+
+	return aabb(c - extent, c + extent);
+}
+
+phys::vec3 phys::box::local_support(const vec3 &dir) const {
+	return vec3(
+		dir.x >= 0.0_r ? half_size.x : -half_size.x,
+		dir.y >= 0.0_r ? half_size.y : -half_size.y,
+		dir.z >= 0.0_r ? half_size.z : -half_size.z
+	);
+}
+
+phys::capsule::capsule(
+	rigid_body * _body,
+	const mat4 &_offset,
+	real _radius,
+	real _half_height
+) :
+	convex_primitive(shape_type::Capsule, _body, _offset),
+	radius(_radius),
+	half_height(_half_height)
+{}
+
+std::optional<phys::aabb> phys::capsule::bounds() const {
+	const mat4 t = world_transform();
+	const vec3 c = truncate(t[3]);
+	const vec3 extent = glm::abs(truncate(t[1])) * half_height + vec3(radius);
+
+	return aabb(c - extent, c + extent);
+}
+
+phys::vec3 phys::capsule::local_support(const vec3 &dir) const {
+	return vec3(0.0_r, dir.y >= 0.0_r ? half_height : -half_height, 0.0_r) + scale_to(dir, radius);
+}
\ No newline at end of file
@@ -2,10 +2,53 @@
 #include "primitive.h"
 
 namespace phys {
-	class sphere : public primitive {
+	class sphere : public convex_primitive {
 	public:
 		real radius;
 
 		sphere(rigid_body * _body, const mat4 &_offset, real _radius);
+
+		vec3 center() const;
+		std::optional<aabb> bounds() const override;
+		// Centered on `center()`, without the body's rotation
+		mat4 support_frame() const override;
+		vec3 local_support(const vec3 &dir) const override;
+	};
+
+	// The half-space behind a plane, in world space. Everything with
+	// `dot(normal, p) < distance` is inside it. Meant for static bodies, so the body's
+	// transform is ignored.
+	class plane : public primitive {
+	public:
+		vec3 normal;
+		real distance;
+
+		plane(rigid_body * _body, const vec3 &_normal, real _distance);
+
+		std::optional<aabb> bounds() const override;
+	};
+
+	// A box centered on the origin of `offset`, with its faces along the axes of `offset`
+	class box : public convex_primitive {
+	public:
+		vec3 half_size;
+
+		box(rigid_body * _body, const mat4 &_offset, const vec3 &_half_size);
+
+		std::optional<aabb> bounds() const override;
+		vec3 local_support(const vec3 &dir) const override;
+	};
+
+	// The points within `radius` of a segment along the y axis of `offset`, which runs
+	// from -`half_height` to `half_height`
+	class capsule : public convex_primitive {
+	public:
+		real radius;
+		real half_height;
+
+		capsule(rigid_body * _body, const mat4 &_offset, real _radius, real _half_height);
+
+		std::optional<aabb> bounds() const override;
+		vec3 local_support(const vec3 &dir) const override;
 	};
-}
+}
\ No newline at end of file
@@ -0,0 +1,195 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "../math.h"
+
+namespace phys {
+	// A uniform grid broadphase for spheres. Objects are inserted every frame (after
+	// calling `clear()`), and each object is binned into every cell that its bounding
+	// box touches. The cells are then sorted so that objects sharing a cell are contiguous,
+	// and only objects within the same cell are tested against each other. With a cell size
+	// close to the diameter of the objects, this scales roughly linearly with the number of
+	// objects. The internal buffers keep their capacity across frames, so steady-state use
+	// does not allocate.
+	template <typename Identifier>
+	class spatial_hash {
+	public:
+		struct collision_pair {
+			Identifier id1;
+			Identifier id2;
+
+			collision_pair(Identifier _id1, Identifier _id2);
+		};
+
+		spatial_hash(real _cell_size);
+
+		void clear();
+		void insert(Identifier id, const vec3 &center, real radius);
+		size_t size() const;
+
+		real get_cell_size() const;
+
+		// Generates every pair of inserted spheres that overlap. Each pair is generated
+		// exactly once.
+		template <typename Container>
+		void generate_collision_pairs(Container &pairs);
+
+	private:
+#ifdef DEBUG
+	public:
+#endif
+		// Cell coordinates are packed into 21 bits each, so the grid covers
+		// 2^21 cells along each axis.
+		static constexpr int64_t cell_bits = 21;
+		static constexpr int64_t cell_offset = int64_t(1) << (cell_bits - 1);
+		static constexpr uint64_t cell_mask = (uint64_t(1) << cell_bits) - 1;
+
+		struct object {
+			Identifier id;
+			vec3 center;
+			real radius;
+			glm::ivec3 min_cell;
+		};
+
+		struct cell_entry {
+			uint64_t key;
+			uint32_t object_index;
+
+			friend bool operator<(const cell_entry &a, const cell_entry &b) {
+				return a.key < b.key || (a.key == b.key && a.object_index < b.object_index);
+			}
+		};
+
+		std::vector<object> objects{};
+		std::vector<cell_entry> cells{};
+		real cell_size;
+		real inv_cell_size;
+
+		glm::ivec3 cell_coords(const vec3 &pos) const;
+		static uint64_t cell_key(const glm::ivec3 &coords);
+		static bool overlaps(const object &a, const object &b);
+	};
+}
+
+template <typename Identifier>
+phys::spatial_hash<Identifier>::collision_pair::collision_pair(Identifier _id1, Identifier _id2) :
+	id1(_id1),
+	id2(_id2)
+{}
+
+template <typename Identifier>
+phys::spatial_hash<Identifier>::spatial_hash(real _cell_size) :
+	cell_size(_cell_size),
+	inv_cell_size((real)1 / _cell_size)
+{}
+
+template <typename Identifier>
+void phys::spatial_hash<Identifier>::clear() {
+	objects.clear();
+	cells.clear();
+}
+
+template <typename Identifier>
+void phys::spatial_hash<Identifier>::insert(Identifier id, const vec3 &center, real radius) {
+	const glm::ivec3 min_cell = cell_coords(center - vec3(radius));
+	const glm::ivec3 max_cell = cell_coords(center + vec3(radius));
+	const uint32_t object_index = (uint32_t)objects.size();
+
+	objects.push_back({
+		.id = id,
+		.center = center,
+		.radius = radius,
+		.min_cell = min_cell
+	});
+
+	for (int x = min_cell.x; x <= max_cell.x; x++) {
+		for (int y = min_cell.y; y <= max_cell.y; y++) {
+			for (int z = min_cell.z; z <= max_cell.z; z++) {
+				cells.push_back({
+					.key = cell_key(glm::ivec3(x, y, z)),
+					.object_index = object_index
+				});
+			}
+		}
+	}
+}
+
+template <typename Identifier>
+size_t phys::spatial_hash<Identifier>::size() const {
+	return objects.size();
+}
+
+template <typename Identifier>
+phys::real phys::spatial_hash<Identifier>::get_cell_size() const {
+	return cell_size;
+}
+
+template <typename Identifier>
+template <typename Container>
+void phys::spatial_hash<Identifier>::generate_collision_pairs(Container &pairs) {
+	std::sort(std::begin(cells), std::end(cells));
+
+	size_t start = 0;
+
+	while (start < cells.size()) {
+		const uint64_t key = cells[start].key;
+		size_t end = start + 1;
+
+		while (end < cells.size() && cells[end].key == key) {
+			end++;
+		}
+
+		for (size_t i = start; i < end; i++) {
+			const object &a = objects[cells[i].object_index];
+
+			for (size_t j = i + 1; j < end; j++) {
+				const object &b = objects[cells[j].object_index];
+
+				if (! overlaps(a, b)) {
+					continue;
+				}
+
+				// Two objects can share more than one cell. To generate the pair only once,
+				// we only accept it in the cell containing the minimum corner of the
+				// intersection of their cell ranges.
+				const glm::ivec3 owner = glm::max(a.min_cell, b.min_cell);
+
+				if (cell_key(owner) != key) {
+					continue;
+				}
+
+				pairs.insert(std::end(pairs), collision_pair(a.id, b.id));
+			}
+		}
+
+		start = end;
+	}
+}
+
+template <typename Identifier>
+glm::ivec3 phys::spatial_hash<Identifier>::cell_coords(const vec3 &pos) const {
+	return glm::ivec3(
+		(int)std::floor(pos.x * inv_cell_size),
+		(int)std::floor(pos.y * inv_cell_size),
+		(int)std::floor(pos.z * inv_cell_size)
+	);
+}
+
+template <typename Identifier>
+uint64_t phys::spatial_hash<Identifier>::cell_key(const glm::ivec3 &coords) {
+	const uint64_t x = (uint64_t)(coords.x + cell_offset) & cell_mask;
+	const uint64_t y = (uint64_t)(coords.y + cell_offset) & cell_mask;
+	const uint64_t z = (uint64_t)(coords.z + cell_offset) & cell_mask;
+
+	return (x << (2 * cell_bits)) | (y << cell_bits) | z;
+}
+
+template <typename Identifier>
+bool phys::spatial_hash<Identifier>::overlaps(const object &a, const object &b) {
+	const vec3 d = b.center - a.center;
+	const real r = a.radius + b.radius;
+
+	return dot(d, d) <= r * r;
+}
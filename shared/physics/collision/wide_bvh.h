@@ -0,0 +1,176 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <vector>
+#include "bounding_volumes.h"
+#include "bvh.h"
+
+namespace phys {
+	// A read-only copy of a `bvh<aabb, Identifier>` with up to four children per node. The
+	// boxes of a node's children are stored together in an `aabb4`, so a query tests all of
+	// them at once and visits about half as many nodes as it would in the binary tree. Copy
+	// the tree again after it changes.
+	template <typename Identifier>
+	class wide_bvh {
+	public:
+		using coarse_collision_pair = typename bvh<aabb, Identifier>::coarse_collision_pair;
+
+		wide_bvh() = default;
+		explicit wide_bvh(const bvh<aabb, Identifier> &tree);
+
+		// Replaces the contents of this tree with the contents of `tree`
+		void copy(const bvh<aabb, Identifier> &tree);
+		size_t size() const;
+
+		template <typename Container>
+		void generate_coarse_collisions(Container &pairs) const;
+
+	private:
+#ifdef DEBUG
+	public:
+#endif
+		using binary_node_index = typename bvh<aabb, Identifier>::node_index;
+
+		// Set in `leaf_mask` if the child is an index into `leaves` instead of `nodes`
+		struct node {
+			aabb4 bounds{};
+			std::array<uint32_t, 4> children{};
+			uint32_t count{};
+			uint32_t leaf_mask{};
+		};
+
+		struct leaf {
+			aabb vol{};
+			Identifier id{};
+		};
+
+		std::vector<node> nodes{};
+		std::vector<leaf> leaves{};
+
+		uint32_t copy_node(const bvh<aabb, Identifier> &tree, binary_node_index n);
+	};
+}
+
+template <typename Identifier>
+phys::wide_bvh<Identifier>::wide_bvh(const bvh<aabb, Identifier> &tree) {
+	copy(tree);
+}
+
+template <typename Identifier>
+void phys::wide_bvh<Identifier>::copy(const bvh<aabb, Identifier> &tree) {
+	nodes.clear();
+	leaves.clear();
+
+	if (tree.root == tree.null_node) {
+		return;
+	}
+
+	if (tree.nodes[tree.root].is_leaf()) {
+		leaves.push_back({ tree.nodes[tree.root].vol, tree.nodes[tree.root].id });
+		return;
+	}
+
+	nodes.reserve(tree.size() / 2);
+	leaves.reserve(tree.size());
+
+	copy_node(tree, tree.root);
+}
+
+template <typename Identifier>
+uint32_t phys::wide_bvh<Identifier>::copy_node(const bvh<aabb, Identifier> &tree, binary_node_index n) {
+	using namespace phys::literals;
+
+	// Opens up the largest internal child until there are four children or only leaves
+	std::array<binary_node_index, 4> children{ tree.nodes[n].left, tree.nodes[n].right };
+	uint32_t count = 2;
+
+	while (count < 4) {
+		int largest = -1;
+		real largest_area = -1.0_r;
+
+		for (uint32_t i = 0; i < count; i++) {
+			const auto &child = tree.nodes[children[i]];
+
+			if (! child.is_leaf() && child.vol.surface_area() > largest_area) {
+				largest = (int)i;
+				largest_area = child.vol.surface_area();
+			}
+		}
+
+		if (largest < 0) {
+			break;
+		}
+
+		const auto &opened = tree.nodes[children[largest]];
+
+		children[largest] = opened.left;
+		children[count++] = opened.right;
+	}
+
+	const uint32_t out = (uint32_t)nodes.size();
+	nodes.emplace_back();
+	nodes[out].count = count;
+
+	for (uint32_t i = 0; i < count; i++) {
+		const auto &child = tree.nodes[children[i]];
+		uint32_t index = 0;
+
+		if (child.is_leaf()) {
+			index = (uint32_t)leaves.size();
+			leaves.push_back({ child.vol, child.id });
+			nodes[out].leaf_mask |= 1u << i;
+		} else {
+			index = copy_node(tree, children[i]);
+		}
+
+		nodes[out].bounds.set(i, child.vol);
+		nodes[out].children[i] = index;
+	}
+
+	return out;
+}
+
+template <typename Identifier>
+size_t phys::wide_bvh<Identifier>::size() const {
+	return leaves.size();
+}
+
+template <typename Identifier>
+template <typename Container>
+void phys::wide_bvh<Identifier>::generate_coarse_collisions(Container &pairs) const {
+	if (nodes.empty()) {
+		return;
+	}
+
+	std::vector<uint32_t> stack{};
+
+	// Each leaf looks for the leaves that overlap it. Only leaves that come later in
+	// `leaves` are reported, so that each pair is reported once.
+	for (uint32_t i = 0; i < (uint32_t)leaves.size(); i++) {
+		const leaf &l = leaves[i];
+
+		stack.clear();
+		stack.push_back(0);
+
+		while (! stack.empty()) {
+			const node &n = nodes[stack.back()];
+			stack.pop_back();
+
+			uint32_t hits = n.bounds.overlaps(l.vol);
+
+			while (hits) {
+				const uint32_t c = (uint32_t)std::countr_zero(hits);
+				const uint32_t child = n.children[c];
+
+				hits &= hits - 1;
+
+				if (! (n.leaf_mask & (1u << c))) {
+					stack.push_back(child);
+				} else if (child > i) {
+					pairs.insert(std::end(pairs), coarse_collision_pair(l.vol, leaves[child].vol, l.id, leaves[child].id));
+				}
+			}
+		}
+	}
+}
@@ -1,3 +1,4 @@
+#include <cmath>
 #include "constraint.h"
 
 phys::constraint::constraint(real _stiffness, constraint_type _type) :
@@ -5,15 +6,21 @@ phys::constraint::constraint(real _stiffness, constraint_type _type) :
 	type(_type)
 {}
 
-bool phys::constraint::is_satisfied() const {
+bool phys::constraint::is_satisfied(const particle_store &store) const {
 	using namespace phys::literals;
 
 	switch (type) {
 		case constraint_type::Equality:
-			return eval_constraint() == 0.0_r;
+			return eval_constraint(store) == 0.0_r;
 		case constraint_type::Inequality:
-			return eval_constraint() >= 0.0_r;
+			return eval_constraint(store) >= 0.0_r;
 	}
 
 	__assume(false);
+}
+
+phys::real phys::pbd_stiffness_factor(real stiffness, real inv_solver_iterations) {
+	using namespace phys::literals;
+
+	return (stiffness == 1.0_r) ? 1.0_r : 1 - std::pow((1 - stiffness), inv_solver_iterations);
 }
\ No newline at end of file
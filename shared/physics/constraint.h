@@ -1,9 +1,11 @@
 #pragma once
 #include <array>
 #include <memory>
+#include <span>
+#include <type_traits>
 #include <vector>
 #include "math.h"
-#include "particle.h"
+#include "particle_store.h"
 
 namespace phys {
 	enum class constraint_type {
@@ -11,114 +13,412 @@ namespace phys {
 		Inequality
 	};
 
+	// How the stiffness of a constraint is applied
+	enum class stiffness_model {
+		// Each projection is scaled by the constraint's `stiffness`, adjusted for the number
+		// of solver iterations. The resulting stiffness still depends on the timestep and
+		// the number of constraints.
+		PBD,
+		// Extended position based dynamics. Each constraint has a `compliance` (inverse
+		// stiffness) and a Lagrange multiplier, which makes its stiffness independent of the
+		// timestep and the number of solver iterations.
+		XPBD
+	};
+
+	struct projection_params {
+		stiffness_model model;
+		real inv_solver_iterations;
+		// 1 / dt^2 for the current (sub)step
+		real inv_dt_sqr;
+	};
+
+	// The fraction of a constraint's error that one PBD projection corrects, chosen so that
+	// the constraint's stiffness doesn't depend on the number of solver iterations
+	real pbd_stiffness_factor(real stiffness, real inv_solver_iterations);
+
 	class constraint {
 	public:
 		real stiffness;
 		constraint_type type;
+		// Inverse stiffness, used instead of `stiffness` by the XPBD model. Zero is
+		// infinitely stiff.
+		real compliance{};
+		// Lagrange multiplier accumulated over the iterations of one (sub)step in the
+		// XPBD model
+		real lambda{};
 
 		constraint(real _stiffness, constraint_type _type);
 		virtual ~constraint() = default;
 
-		virtual real eval_constraint() const = 0;
+		virtual real eval_constraint(const particle_store &store) const = 0;
+		// The particles that this constraint reads and moves
+		virtual std::span<const particle_handle> get_particles() const = 0;
 
-		virtual void project(real inv_solver_iterations) = 0;
-		virtual void update_velocities(real dt) = 0;
+		virtual void project(particle_store &store, const projection_params &params) = 0;
+		// Like `project`, but instead of moving the particles, adds the position changes to
+		// their `p_accum` and increments their `n`. Used by the Jacobi solver.
+		virtual void accumulate_projection(particle_store &store, const projection_params &params) = 0;
+		virtual void update_velocities(particle_store &store, real dt) = 0;
 
-		bool is_satisfied() const;
+		bool is_satisfied(const particle_store &store) const;
 	};
 
+	class constraint_pool;
+
 	class constraint_generator {
 	public:
 		virtual ~constraint_generator() = default;
 
-		virtual void generate_constraints(real dt, std::vector<std::unique_ptr<constraint>> &constraints) = 0;
+		virtual void generate_constraints(const particle_store &store, real dt, constraint_pool &constraints) = 0;
+	};
+
+	// Contiguous storage for constraints of a single type. Clearing the arena keeps its
+	// memory, so an arena that is refilled every frame stops allocating once it has grown
+	// to fit the largest frame. References returned by `emplace` are invalidated by the
+	// next call to `emplace`.
+	//
+	// The arena is also a solver batch: `project` and `accumulate_projection` solve a range
+	// of the constraints without any virtual calls, as long as `T` is a final class.
+	template <typename T>
+	class constraint_arena {
+	public:
+		template <typename... Args>
+		T& emplace(Args&&... args);
+
+		void clear();
+		size_t size() const;
+		size_t capacity() const;
+
+		auto begin();
+		auto end();
+		auto rbegin();
+		auto rend();
+
+		std::span<const particle_handle> get_particles(size_t i) const;
+
+		// Projects the constraints in [begin, end), front to back if `forward` is true and
+		// back to front otherwise. Returns the number of constraints that were not satisfied.
+		size_t project(particle_store &store, const projection_params &params, size_t begin, size_t end, bool forward);
+		// Like `project`, for constraints that don't share any particles
+		size_t project_independent(particle_store &store, const projection_params &params, size_t begin, size_t end);
+		// Like `project`, but for the Jacobi solver
+		size_t accumulate_projection(particle_store &store, const projection_params &params, size_t begin, size_t end);
+		void update_velocities(particle_store &store, real dt);
+
+		// Moves the constraint at `order[i]` to position `i`. `order` must be a permutation.
+		void reorder(std::span<const uint32_t> order);
+
+	private:
+		std::vector<T> items{};
+		std::vector<T> reorder_scratch{};
 	};
 
 	template <const size_t N>
 	class particle_constraint : public constraint {
 	public:
-		std::array<particle *, N> particles;
+		std::array<particle_handle, N> particles;
 
 		particle_constraint(
 			real _stiffness,
 			constraint_type _type,
-			std::array<particle *, N> _particles
+			std::array<particle_handle, N> _particles
 		);
 		virtual ~particle_constraint() = default;
 
-		virtual real eval_constraint() const = 0;
-		virtual vec3 eval_gradient(const particle &p) const = 0;
-		void project(real inv_solver_iterations) override;
-		virtual void update_velocities(real dt) = 0;
+		virtual real eval_constraint(const particle_store &store) const = 0;
+		// Evaluates the gradient of the constraint with respect to the position of
+		// the ith particle
+		virtual vec3 eval_gradient(const particle_store &store, size_t i) const = 0;
+		std::span<const particle_handle> get_particles() const override;
+		void project(particle_store &store, const projection_params &params) override;
+		void accumulate_projection(particle_store &store, const projection_params &params) override;
+		virtual void update_velocities(particle_store &store, real dt) = 0;
 
-		phys::particle * a() requires (N >= 1);
-		phys::particle * b() requires (N >= 2);
+		// `is_satisfied` followed by `project` or `accumulate_projection`, for code that
+		// knows that this constraint is a `T`. If `T` is a final class, its functions are
+		// called directly instead of through the vtable. Returns false if the constraint was
+		// already satisfied.
+		template <typename T>
+		bool project_as(particle_store &store, const projection_params &params);
+		template <typename T>
+		bool accumulate_projection_as(particle_store &store, const projection_params &params);
 
-		const phys::particle * a() const requires (N >= 1);
-		const phys::particle * b() const requires (N >= 2);
+		particle_handle a() const requires (N >= 1);
+		particle_handle b() const requires (N >= 2);
 
 	private:
 		std::array<vec3, N> dps{};
+		// The PBD stiffness factor only changes when the stiffness or the number of
+		// iterations does, so it is cached instead of calling `pow` on every projection
+		real k{ 1 };
+		real k_stiffness{ 1 };
+		real k_inv_solver_iterations{ 1 };
+
+		template <typename T>
+		bool is_satisfied_as(const particle_store &store) const;
+
+		// Computes the position change of each particle into `dps`. Returns false if the
+		// constraint can't move any of its particles.
+		template <typename T>
+		bool eval_position_changes(const particle_store &store, const projection_params &params);
 	};
 }
 
+template <typename T>
+template <typename... Args>
+T& phys::constraint_arena<T>::emplace(Args&&... args) {
+	return items.emplace_back(std::forward<Args>(args)...);
+}
+
+template <typename T>
+void phys::constraint_arena<T>::clear() {
+	items.clear();
+}
+
+template <typename T>
+size_t phys::constraint_arena<T>::size() const {
+	return items.size();
+}
+
+template <typename T>
+size_t phys::constraint_arena<T>::capacity() const {
+	return items.capacity();
+}
+
+template <typename T>
+auto phys::constraint_arena<T>::begin() {
+	return std::begin(items);
+}
+
+template <typename T>
+auto phys::constraint_arena<T>::end() {
+	return std::end(items);
+}
+
+template <typename T>
+auto phys::constraint_arena<T>::rbegin() {
+	return std::rbegin(items);
+}
+
+template <typename T>
+auto phys::constraint_arena<T>::rend() {
+	return std::rend(items);
+}
+
+template <typename T>
+std::span<const phys::particle_handle> phys::constraint_arena<T>::get_particles(size_t i) const {
+	return items[i].particles;
+}
+
+template <typename T>
+size_t phys::constraint_arena<T>::project(
+	particle_store &store,
+	const projection_params &params,
+	size_t begin,
+	size_t end,
+	bool forward
+) {
+	size_t num_projected = 0;
+
+	if (forward) {
+		for (size_t i = begin; i < end; i++) {
+			num_projected += items[i].template project_as<T>(store, params);
+		}
+	} else {
+		for (size_t i = end; i-- > begin;) {
+			num_projected += items[i].template project_as<T>(store, params);
+		}
+	}
+
+	return num_projected;
+}
+
+template <typename T>
+size_t phys::constraint_arena<T>::project_independent(
+	particle_store &store,
+	const projection_params &params,
+	size_t begin,
+	size_t end
+) {
+	return project(store, params, begin, end, true);
+}
+
+template <typename T>
+size_t phys::constraint_arena<T>::accumulate_projection(
+	particle_store &store,
+	const projection_params &params,
+	size_t begin,
+	size_t end
+) {
+	size_t num_projected = 0;
+
+	for (size_t i = begin; i < end; i++) {
+		num_projected += items[i].template accumulate_projection_as<T>(store, params);
+	}
+
+	return num_projected;
+}
+
+template <typename T>
+void phys::constraint_arena<T>::update_velocities(particle_store &store, real dt) {
+	for (T &c : items) {
+		c.update_velocities(store, dt);
+	}
+}
+
+template <typename T>
+void phys::constraint_arena<T>::reorder(std::span<const uint32_t> order) {
+	reorder_scratch.clear();
+
+	for (uint32_t i : order) {
+		reorder_scratch.push_back(std::move(items[i]));
+	}
+
+	std::swap(items, reorder_scratch);
+}
+
 template <const size_t N>
 phys::particle_constraint<N>::particle_constraint(
 	real _stiffness,
 	constraint_type _type,
-	std::array<particle *, N> _particles
+	std::array<particle_handle, N> _particles
 ) :
 	constraint(_stiffness, _type),
 	particles(_particles)
 {}
 
 template <const size_t N>
-void phys::particle_constraint<N>::project(real inv_solver_iterations) {
+void phys::particle_constraint<N>::project(particle_store &store, const projection_params &params) {
+	if (! eval_position_changes<particle_constraint>(store, params)) {
+		return;
+	}
+
+	for (size_t i = 0; i < N; i++) {
+		store.p[particles[i]] += dps[i];
+	}
+}
+
+template <const size_t N>
+void phys::particle_constraint<N>::accumulate_projection(particle_store &store, const projection_params &params) {
+	if (! eval_position_changes<particle_constraint>(store, params)) {
+		return;
+	}
+
+	for (size_t i = 0; i < N; i++) {
+		store.p_accum[particles[i]] += dps[i];
+		store.n[particles[i]]++;
+	}
+}
+
+template <const size_t N>
+template <typename T>
+bool phys::particle_constraint<N>::project_as(particle_store &store, const projection_params &params) {
+	if (is_satisfied_as<T>(store)) {
+		return false;
+	}
+
+	if (eval_position_changes<T>(store, params)) {
+		for (size_t i = 0; i < N; i++) {
+			store.p[particles[i]] += dps[i];
+		}
+	}
+
+	return true;
+}
+
+template <const size_t N>
+template <typename T>
+bool phys::particle_constraint<N>::accumulate_projection_as(particle_store &store, const projection_params &params) {
+	if (is_satisfied_as<T>(store)) {
+		return false;
+	}
+
+	if (eval_position_changes<T>(store, params)) {
+		for (size_t i = 0; i < N; i++) {
+			store.p_accum[particles[i]] += dps[i];
+			store.n[particles[i]]++;
+		}
+	}
+
+	return true;
+}
+
+template <const size_t N>
+template <typename T>
+bool phys::particle_constraint<N>::is_satisfied_as(const particle_store &store) const {
 	using namespace phys::literals;
 
+	const real c = static_cast<const T &>(*this).eval_constraint(store);
+
+	return type == constraint_type::Equality ? c == 0.0_r : c >= 0.0_r;
+}
+
+template <const size_t N>
+template <typename T>
+bool phys::particle_constraint<N>::eval_position_changes(const particle_store &store, const projection_params &params) {
+	using namespace phys::literals;
+
+	static_assert(std::is_base_of_v<particle_constraint, T>);
+
+	const T &self = static_cast<const T &>(*this);
+
 	if constexpr (N == 0) {
-		return;
+		return false;
 	}
 
 	real denom = 0.0_r;
-	real k = (stiffness == 1.0_r) ? 1.0_r : 1 - std::pow((1 - stiffness), inv_solver_iterations);
 
 	for (size_t i = 0; i < N; i++) {
-		particle &p = *particles[i];
-		vec3 grad = eval_gradient(p);
+		const real inv_mass = store.inv_mass[particles[i]];
+		vec3 grad = self.eval_gradient(store, i);
 
-		denom += (p.get_inv_mass() * phys::dot(grad, grad));
-		dps[i] = k * p.get_inv_mass() * grad;
+		denom += (inv_mass * phys::dot(grad, grad));
+		dps[i] = inv_mass * grad;
 	}
 
 	if (denom == 0.0_r) {
-		return;
+		return false;
 	}
 
-	real s = eval_constraint() / denom;
+	if (params.model == stiffness_model::XPBD) {
+		const real alpha = compliance * params.inv_dt_sqr;
+		const real dlambda = (-self.eval_constraint(store) - alpha * lambda) / (denom + alpha);
+
+		lambda += dlambda;
+
+		for (size_t i = 0; i < N; i++) {
+			dps[i] *= dlambda;
+		}
+
+		return true;
+	}
+
+	if (stiffness != k_stiffness || params.inv_solver_iterations != k_inv_solver_iterations) {
+		k = pbd_stiffness_factor(stiffness, params.inv_solver_iterations);
+		k_stiffness = stiffness;
+		k_inv_solver_iterations = params.inv_solver_iterations;
+	}
+
+	real s = k * self.eval_constraint(store) / denom;
 
 	for (size_t i = 0; i < N; i++) {
 		dps[i] *= -s;
-		particles[i]->p += dps[i];
 	}
-}
 
-template <const size_t N>
-phys::particle * phys::particle_constraint<N>::a() requires (N >= 1) {
-	return particles[0];
+	return true;
 }
 
 template <const size_t N>
-phys::particle * phys::particle_constraint<N>::b() requires (N >= 2) {
-	return particles[1];
+std::span<const phys::particle_handle> phys::particle_constraint<N>::get_particles() const {
+	return particles;
 }
 
 template <const size_t N>
-const phys::particle * phys::particle_constraint<N>::a() const requires (N >= 1) {
+phys::particle_handle phys::particle_constraint<N>::a() const requires (N >= 1) {
 	return particles[0];
 }
 
 template <const size_t N>
-const phys::particle * phys::particle_constraint<N>::b() const requires (N >= 2) {
+phys::particle_handle phys::particle_constraint<N>::b() const requires (N >= 2) {
 	return particles[1];
 }
@@ -1,49 +1,63 @@
 #pragma once
+#include <array>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <vector>
 #include "constraint.h"
 
 namespace phys {
-	class distance_constraint : public particle_constraint<2> {
+	class distance_constraint final : public particle_constraint<2> {
 	public:
 		real distance;
 
 		distance_constraint(
-			particle * _a,
-			particle * _b,
+			particle_handle _a,
+			particle_handle _b,
 			real _distance,
 			real _stiffness
 		);
 
-		real eval_constraint() const override;
-		vec3 eval_gradient(const particle &p) const override;
-		void update_velocities(real dt) override;
+		real eval_constraint(const particle_store &store) const override;
+		vec3 eval_gradient(const particle_store &store, size_t i) const override;
+		void update_velocities(particle_store &store, real dt) override;
 	};
 
-	class plane_collision_constraint : public particle_constraint<1> {
+	class plane_collision_constraint final : public particle_constraint<1> {
 	public:
 		vec3 normal;
 		vec3 origin;
 		real restitution;
 		real friction;
+		// Collisions that close more slowly than this don't bounce
+		real min_restitution_speed{};
 
 		plane_collision_constraint(
-			particle * _a,
+			const particle_store &store,
+			particle_handle _a,
 			vec3 _normal,
 			vec3 _origin,
 			real _restitution,
 			real _friction
 		);
 
-		real eval_constraint() const override;
-		vec3 eval_gradient(const particle &p) const override;
-		void update_velocities(real dt) override;
+		real eval_constraint(const particle_store &store) const override;
+		vec3 eval_gradient(const particle_store &store, size_t i) const override;
+		void update_velocities(particle_store &store, real dt) override;
 
 	private:
 		vec3 old_vel;
 	};
 
+	// Generates collisions between a plane and a container of particle handles. Sleeping
+	// particles are skipped.
 	template <typename particle_container>
 	class plane_collision_constraint_generator : public constraint_generator {
 	public:
+		// Collisions that close more slowly than this don't bounce. Without it, a particle
+		// resting on the plane bounces off of it every step and never falls asleep.
+		real min_restitution_speed{};
+
 		plane_collision_constraint_generator(
 			particle_container &_particles,
 			vec3 _normal,
@@ -52,7 +66,7 @@ namespace phys {
 			real _friction
 		);
 
-		void generate_constraints(real dt, std::vector<std::unique_ptr<constraint>> &constraints) override;
+		void generate_constraints(const particle_store &store, real dt, constraint_pool &constraints) override;
 
 	private:
 		particle_container &particles;
@@ -62,21 +76,24 @@ namespace phys {
 		real friction;
 	};
 
-	class particle_collision_constraint : public particle_constraint<2> {
+	class particle_collision_constraint final : public particle_constraint<2> {
 	public:
 		real restitution;
 		real friction;
+		// Collisions that close more slowly than this don't bounce
+		real min_restitution_speed{};
 
 		particle_collision_constraint(
-			particle * _a,
-			particle * _b,
+			const particle_store &store,
+			particle_handle _a,
+			particle_handle _b,
 			real _restitution,
 			real _friction
 		);
 
-		real eval_constraint() const override;
-		vec3 eval_gradient(const particle &p) const override;
-		void update_velocities(real dt) override;
+		real eval_constraint(const particle_store &store) const override;
+		vec3 eval_gradient(const particle_store &store, size_t i) const override;
+		void update_velocities(particle_store &store, real dt) override;
 
 	private:
 		vec3 a_old_vel;
@@ -84,6 +101,149 @@ namespace phys {
 		vec3 a_old_pos;
 		vec3 b_old_pos;
 	};
+
+	// Holds the constraints generated for a single frame. The built-in collision constraints
+	// are stored in typed arenas, so generating them does not allocate once the arenas have
+	// grown to fit a frame, and solving them does not go through a virtual call. Any other
+	// constraint type is heap allocated and solved through the `constraint` interface.
+	class constraint_pool {
+	public:
+		constraint_arena<plane_collision_constraint> plane_collisions{};
+		constraint_arena<particle_collision_constraint> particle_collisions{};
+		std::vector<std::unique_ptr<constraint>> other_constraints{};
+
+		template <typename T, typename... Args>
+		T& emplace(Args&&... args);
+
+		void clear();
+		size_t size() const;
+
+		// Calls `f` on every constraint, with the concrete type of each built-in constraint
+		template <typename F>
+		void for_each(F &&f);
+
+		// Calls `f` on every constraint, in the opposite order of `for_each`
+		template <typename F>
+		void for_each_reverse(F &&f);
+	};
+
+	// Distance constraints copied into flat arrays, so that the solver can project them with
+	// a tight loop that doesn't make virtual calls or follow pointers to each constraint.
+	// The batch is rebuilt from the original constraints before each solve, so changes to
+	// their properties are picked up, but the batch's Lagrange multipliers aren't written
+	// back to them.
+	class distance_constraint_batch {
+	public:
+		void clear();
+		// Adds a copy of `c`. `inv_solver_iterations` is used to precompute the PBD stiffness.
+		void add(distance_constraint &c, real inv_solver_iterations);
+		size_t size() const;
+
+		std::array<particle_handle, 2> get_particles(size_t i) const;
+
+		size_t project(particle_store &store, const projection_params &params, size_t begin, size_t end, bool forward);
+		// Like `project`, for constraints that don't share any particles. These are projected
+		// several at a time with SIMD instructions.
+		size_t project_independent(particle_store &store, const projection_params &params, size_t begin, size_t end);
+		// Projects several constraints at a time with SIMD instructions, whether or not they
+		// share particles
+		size_t accumulate_projection(particle_store &store, const projection_params &params, size_t begin, size_t end);
+		void update_velocities(particle_store &store, real dt);
+
+		void reorder(std::span<const uint32_t> order);
+
+	private:
+		std::vector<particle_handle> a{};
+		std::vector<particle_handle> b{};
+		std::vector<real> distance{};
+		// `pbd_stiffness_factor` of each constraint's stiffness
+		std::vector<real> k{};
+		std::vector<real> compliance{};
+		std::vector<real> lambda{};
+		std::vector<distance_constraint *> sources{};
+		std::vector<particle_handle> handle_scratch{};
+		std::vector<real> real_scratch{};
+		std::vector<distance_constraint *> source_scratch{};
+
+		template <bool accumulate>
+		bool project_one(particle_store &store, const projection_params &params, size_t i);
+		// Projects as many groups of `simd::width` constraints from [begin, end) as will fit,
+		// and leaves the rest to the caller. Returns the number of constraints that were not
+		// satisfied.
+		template <bool accumulate>
+		size_t project_wide(particle_store &store, const projection_params &params, size_t &begin, size_t end);
+	};
+
+	// The solver's fallback for constraint types that don't have a batch of their own. Each
+	// constraint is solved through the `constraint` interface.
+	class polymorphic_constraint_batch {
+	public:
+		void clear();
+		void add(constraint * c);
+		size_t size() const;
+
+		std::span<const particle_handle> get_particles(size_t i) const;
+		void reset_multipliers();
+
+		size_t project(particle_store &store, const projection_params &params, size_t begin, size_t end, bool forward);
+		size_t project_independent(particle_store &store, const projection_params &params, size_t begin, size_t end);
+		size_t accumulate_projection(particle_store &store, const projection_params &params, size_t begin, size_t end);
+		void update_velocities(particle_store &store, real dt);
+
+		void reorder(std::span<const uint32_t> order);
+
+	private:
+		std::vector<constraint *> items{};
+		std::vector<constraint *> reorder_scratch{};
+	};
+}
+
+template <typename T, typename... Args>
+T& phys::constraint_pool::emplace(Args&&... args) {
+	static_assert(std::is_base_of_v<constraint, T>);
+
+	if constexpr (std::is_same_v<T, plane_collision_constraint>) {
+		return plane_collisions.emplace(std::forward<Args>(args)...);
+	} else if constexpr (std::is_same_v<T, particle_collision_constraint>) {
+		return particle_collisions.emplace(std::forward<Args>(args)...);
+	} else {
+		std::unique_ptr<T> c = std::make_unique<T>(std::forward<Args>(args)...);
+		T &out = *c;
+
+		other_constraints.push_back(std::move(c));
+
+		return out;
+	}
+}
+
+template <typename F>
+void phys::constraint_pool::for_each(F &&f) {
+	for (plane_collision_constraint &c : plane_collisions) {
+		f(c);
+	}
+
+	for (particle_collision_constraint &c : particle_collisions) {
+		f(c);
+	}
+
+	for (std::unique_ptr<constraint> &c : other_constraints) {
+		f(*c);
+	}
+}
+
+template <typename F>
+void phys::constraint_pool::for_each_reverse(F &&f) {
+	for (auto c = std::rbegin(other_constraints); c != std::rend(other_constraints); c++) {
+		f(**c);
+	}
+
+	for (auto c = particle_collisions.rbegin(); c != particle_collisions.rend(); c++) {
+		f(*c);
+	}
+
+	for (auto c = plane_collisions.rbegin(); c != plane_collisions.rend(); c++) {
+		f(*c);
+	}
 }
 
 template <typename particle_container>
@@ -103,20 +263,28 @@ phys::plane_collision_constraint_generator<particle_container>::plane_collision_
 
 template <typename particle_container>
 void phys::plane_collision_constraint_generator<particle_container>::generate_constraints(
+	const particle_store &store,
 	real dt,
-	std::vector<std::unique_ptr<constraint>> &constraints
+	constraint_pool &constraints
 ) {
 	using namespace phys::literals;
 
-	for (particle &p : particles) {
-		if (phys::dot(p.p - origin, normal) < 0.0_r) {
-			constraints.push_back(std::make_unique<phys::plane_collision_constraint>(
-				&p,
+	for (particle_handle p : particles) {
+		if (! store.is_alive(p) || store.asleep[p]) {
+			continue;
+		}
+
+		if (phys::dot(store.p[p] - origin, normal) < 0.0_r) {
+			plane_collision_constraint &c = constraints.emplace<plane_collision_constraint>(
+				store,
+				p,
 				normal,
 				origin,
 				restitution,
 				friction
-			));
+			);
+
+			c.min_restitution_speed = min_restitution_speed;
 		}
 	}
 }
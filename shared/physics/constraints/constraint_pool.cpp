@@ -0,0 +1,11 @@
+#include "../constraints.h"
+
+void phys::constraint_pool::clear() {
+	plane_collisions.clear();
+	particle_collisions.clear();
+	other_constraints.clear();
+}
+
+size_t phys::constraint_pool::size() const {
+	return plane_collisions.size() + particle_collisions.size() + other_constraints.size();
+}
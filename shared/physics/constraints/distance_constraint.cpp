@@ -3,8 +3,8 @@
 using namespace phys::literals;
 
 phys::distance_constraint::distance_constraint(
-	particle * _a,
-	particle * _b,
+	particle_handle _a,
+	particle_handle _b,
 	real _distance,
 	real _stiffness
 ) :
@@ -12,28 +12,28 @@ phys::distance_constraint::distance_constraint(
 	distance(_distance)
 {}
 
-phys::real phys::distance_constraint::eval_constraint() const {
-	vec3 dx = a()->p - b()->p;
+phys::real phys::distance_constraint::eval_constraint(const particle_store &store) const {
+	vec3 dx = store.p[a()] - store.p[b()];
 
 	return std::sqrt(phys::dot(dx, dx)) - distance;
 }
 
-phys::vec3 phys::distance_constraint::eval_gradient(const particle &p) const {
-	if (a()->p == b()->p) {
+phys::vec3 phys::distance_constraint::eval_gradient(const particle_store &store, size_t i) const {
+	if (store.p[a()] == store.p[b()]) {
 		return vec3(0.0_r);
 	}
 
-	vec3 n = phys::normalize(a()->p - b()->p);
+	vec3 n = phys::normalize(store.p[a()] - store.p[b()]);
 
-	if (&p == a()) {
+	if (i == 0) {
 		return n;
-	} else if (&p == b()) {
+	} else if (i == 1) {
 		return -n;
 	}
 
 	return vec3(0.0_r);
 }
 
-void phys::distance_constraint::update_velocities(real dt) {
+void phys::distance_constraint::update_velocities(particle_store &store, real dt) {
 	// TODO
 }
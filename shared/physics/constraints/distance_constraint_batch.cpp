@@ -0,0 +1,273 @@
+#include <bit>
+#include <cmath>
+#include "../constraints.h"
+#include "../simd.h"
+
+using namespace phys::literals;
+
+void phys::distance_constraint_batch::clear() {
+	a.clear();
+	b.clear();
+	distance.clear();
+	k.clear();
+	compliance.clear();
+	lambda.clear();
+	sources.clear();
+}
+
+void phys::distance_constraint_batch::add(distance_constraint &c, real inv_solver_iterations) {
+	a.push_back(c.a());
+	b.push_back(c.b());
+	distance.push_back(c.distance);
+	k.push_back(pbd_stiffness_factor(c.stiffness, inv_solver_iterations));
+	compliance.push_back(c.compliance);
+	lambda.push_back(0.0_r);
+	sources.push_back(&c);
+}
+
+size_t phys::distance_constraint_batch::size() const {
+	return a.size();
+}
+
+std::array<phys::particle_handle, 2> phys::distance_constraint_batch::get_particles(size_t i) const {
+	return { a[i], b[i] };
+}
+
+size_t phys::distance_constraint_batch::project(
+	particle_store &store,
+	const projection_params &params,
+	size_t begin,
+	size_t end,
+	bool forward
+) {
+	size_t num_projected = 0;
+
+	if (forward) {
+		for (size_t i = begin; i < end; i++) {
+			num_projected += project_one<false>(store, params, i);
+		}
+	} else {
+		for (size_t i = end; i-- > begin;) {
+			num_projected += project_one<false>(store, params, i);
+		}
+	}
+
+	return num_projected;
+}
+
+size_t phys::distance_constraint_batch::project_independent(
+	particle_store &store,
+	const projection_params &params,
+	size_t begin,
+	size_t end
+) {
+	size_t num_projected = project_wide<false>(store, params, begin, end);
+
+	for (size_t i = begin; i < end; i++) {
+		num_projected += project_one<false>(store, params, i);
+	}
+
+	return num_projected;
+}
+
+size_t phys::distance_constraint_batch::accumulate_projection(
+	particle_store &store,
+	const projection_params &params,
+	size_t begin,
+	size_t end
+) {
+	// Each constraint's changes are added to `p_accum` one lane at a time, so the
+	// constraints in a group can share particles
+	size_t num_projected = project_wide<true>(store, params, begin, end);
+
+	for (size_t i = begin; i < end; i++) {
+		num_projected += project_one<true>(store, params, i);
+	}
+
+	return num_projected;
+}
+
+void phys::distance_constraint_batch::update_velocities(particle_store &store, real dt) {
+	for (distance_constraint * c : sources) {
+		c->update_velocities(store, dt);
+	}
+}
+
+void phys::distance_constraint_batch::reorder(std::span<const uint32_t> order) {
+	const auto permute = [&](auto &items, auto &scratch) {
+		scratch.clear();
+
+		for (uint32_t i : order) {
+			scratch.push_back(items[i]);
+		}
+
+		std::swap(items, scratch);
+	};
+
+	permute(a, handle_scratch);
+	permute(b, handle_scratch);
+	permute(distance, real_scratch);
+	permute(k, real_scratch);
+	permute(compliance, real_scratch);
+	permute(lambda, real_scratch);
+	permute(sources, source_scratch);
+}
+
+template <bool accumulate>
+bool phys::distance_constraint_batch::project_one(particle_store &store, const projection_params &params, size_t i) {
+	vec3 &pa = store.p[a[i]];
+	vec3 &pb = store.p[b[i]];
+	const vec3 dx = pa - pb;
+	const real len = std::sqrt(phys::dot(dx, dx));
+	const real c = len - distance[i];
+
+	if (c == 0.0_r) {
+		return false;
+	}
+
+	const real wa = store.inv_mass[a[i]];
+	const real wb = store.inv_mass[b[i]];
+	const real w = wa + wb;
+
+	// The gradient is zero if the particles are in the same place
+	if (w == 0.0_r || len == 0.0_r) {
+		return true;
+	}
+
+	real s = 0.0_r;
+
+	if (params.model == stiffness_model::XPBD) {
+		const real alpha = compliance[i] * params.inv_dt_sqr;
+		const real dlambda = (-c - alpha * lambda[i]) / (w + alpha);
+
+		lambda[i] += dlambda;
+		s = dlambda;
+	} else {
+		s = -k[i] * c / w;
+	}
+
+	// Dividing by the length normalizes the gradient. This is the same sequence of
+	// operations as `project_wide`, so both give the same results.
+	const real scale = s / len;
+
+	if constexpr (accumulate) {
+		store.p_accum[a[i]] += (scale * wa) * dx;
+		store.p_accum[b[i]] -= (scale * wb) * dx;
+		store.n[a[i]]++;
+		store.n[b[i]]++;
+	} else {
+		pa += (scale * wa) * dx;
+		pb -= (scale * wb) * dx;
+	}
+
+	return true;
+}
+
+template <bool accumulate>
+size_t phys::distance_constraint_batch::project_wide(
+	particle_store &store,
+	const projection_params &params,
+	size_t &begin,
+	size_t end
+) {
+	size_t num_projected = 0;
+
+#ifdef PHYS_SIMD
+	static_assert(std::is_same_v<real, float>);
+
+	constexpr size_t width = simd::width;
+
+	vec3 * const p = store.p.data();
+	const real * const inv_mass = store.inv_mass.data();
+	const simd::floats zero = simd::zero();
+	const simd::floats one = simd::set1(1.0_r);
+	const simd::floats inv_dt_sqr = simd::set1(params.inv_dt_sqr);
+
+	// Particle positions aren't laid out by constraint, so they are gathered into (and
+	// scattered out of) vectors one lane at a time
+	alignas(32) real ax[width];
+	alignas(32) real ay[width];
+	alignas(32) real az[width];
+	alignas(32) real bx[width];
+	alignas(32) real by[width];
+	alignas(32) real bz[width];
+	uint32_t ia[width];
+	uint32_t ib[width];
+
+	for (; begin + width <= end; begin += width) {
+		const size_t i = begin;
+
+		for (size_t j = 0; j < width; j++) {
+			ia[j] = a[i + j].index;
+			ib[j] = b[i + j].index;
+		}
+
+		const simd::floats dx = simd::gather([&](size_t j) { return p[ia[j]].x - p[ib[j]].x; });
+		const simd::floats dy = simd::gather([&](size_t j) { return p[ia[j]].y - p[ib[j]].y; });
+		const simd::floats dz = simd::gather([&](size_t j) { return p[ia[j]].z - p[ib[j]].z; });
+		const simd::floats wa = simd::gather([&](size_t j) { return inv_mass[ia[j]]; });
+		const simd::floats wb = simd::gather([&](size_t j) { return inv_mass[ib[j]]; });
+		const simd::floats w = simd::add(wa, wb);
+		const simd::floats len = simd::sqrt(simd::add(simd::add(simd::mul(dx, dx), simd::mul(dy, dy)), simd::mul(dz, dz)));
+		const simd::floats c = simd::sub(len, simd::loadu(&distance[i]));
+
+		const simd::floats unsatisfied = simd::neq(c, zero);
+		// Same conditions as `project_one`. The other lanes divide by 1 instead of 0, which
+		// would trap if floating point exceptions are enabled.
+		const simd::floats movable = simd::bit_and(unsatisfied, simd::bit_and(simd::neq(w, zero), simd::neq(len, zero)));
+		const simd::floats safe_len = simd::select(movable, len, one);
+		simd::floats s{};
+
+		if (params.model == stiffness_model::XPBD) {
+			const simd::floats alpha = simd::mul(simd::loadu(&compliance[i]), inv_dt_sqr);
+			const simd::floats old_lambda = simd::loadu(&lambda[i]);
+			const simd::floats denom = simd::select(movable, simd::add(w, alpha), one);
+			const simd::floats dlambda = simd::div(simd::sub(simd::sub(zero, c), simd::mul(alpha, old_lambda)), denom);
+
+			s = simd::select(movable, dlambda, zero);
+			simd::storeu(&lambda[i], simd::add(old_lambda, s));
+		} else {
+			const simd::floats denom = simd::select(movable, w, one);
+
+			s = simd::select(movable, simd::sub(zero, simd::div(simd::mul(simd::loadu(&k[i]), c), denom)), zero);
+		}
+
+		// Dividing by the length here normalizes the gradient
+		const simd::floats scale = simd::div(s, safe_len);
+		const simd::floats fa = simd::mul(scale, wa);
+		const simd::floats fb = simd::mul(scale, wb);
+
+		simd::store(ax, simd::mul(fa, dx));
+		simd::store(ay, simd::mul(fa, dy));
+		simd::store(az, simd::mul(fa, dz));
+		simd::store(bx, simd::mul(fb, dx));
+		simd::store(by, simd::mul(fb, dy));
+		simd::store(bz, simd::mul(fb, dz));
+
+		const uint32_t moved = simd::bits(movable);
+
+		for (size_t j = 0; j < width; j++) {
+			if (! (moved & (1u << j))) {
+				continue;
+			}
+
+			const vec3 dpa(ax[j], ay[j], az[j]);
+			const vec3 dpb(bx[j], by[j], bz[j]);
+
+			if constexpr (accumulate) {
+				store.p_accum[a[i + j]] += dpa;
+				store.p_accum[b[i + j]] -= dpb;
+				store.n[a[i + j]]++;
+				store.n[b[i + j]]++;
+			} else {
+				p[a[i + j].index] += dpa;
+				p[b[i + j].index] -= dpb;
+			}
+		}
+
+		num_projected += (size_t)std::popcount(simd::bits(unsatisfied));
+	}
+#endif
+
+	return num_projected;
+}
\ No newline at end of file
@@ -3,68 +3,70 @@
 using namespace phys::literals;
 
 phys::particle_collision_constraint::particle_collision_constraint(
-	particle * _a,
-	particle * _b,
+	const particle_store &store,
+	particle_handle _a,
+	particle_handle _b,
 	real _restitution,
 	real _friction
 ) :
 	particle_constraint<2>(1.0_r, phys::constraint_type::Inequality, { _a, _b }),
 	restitution(_restitution),
 	friction(_friction),
-	a_old_vel(_a->vel),
-	b_old_vel(_b->vel),
-	a_old_pos(_a->p),
-	b_old_pos(_b->p)
+	a_old_vel(store.vel[_a]),
+	b_old_vel(store.vel[_b]),
+	a_old_pos(store.p[_a]),
+	b_old_pos(store.p[_b])
 {}
 
-phys::real phys::particle_collision_constraint::eval_constraint() const {
-	vec3 diff = a()->p - b()->p;
+phys::real phys::particle_collision_constraint::eval_constraint(const particle_store &store) const {
+	vec3 diff = store.p[a()] - store.p[b()];
 
-	return std::sqrt(phys::dot(diff, diff)) - (a()->radius + b()->radius);
+	return std::sqrt(phys::dot(diff, diff)) - (store.radius[a()] + store.radius[b()]);
 }
 
-phys::vec3 phys::particle_collision_constraint::eval_gradient(const particle &p) const {
-	if (a()->p == b()->p) {
+phys::vec3 phys::particle_collision_constraint::eval_gradient(const particle_store &store, size_t i) const {
+	if (store.p[a()] == store.p[b()]) {
 		return vec3(0.0_r);
 	}
 
-	vec3 n = phys::normalize(a()->p - b()->p);
+	vec3 n = phys::normalize(store.p[a()] - store.p[b()]);
 
-	if (&p == a()) {
+	if (i == 0) {
 		return n;
-	} else if (&p == b()) {
+	} else if (i == 1) {
 		return -n;
 	}
 
 	return vec3(0.0_r);
 }
 
-void phys::particle_collision_constraint::update_velocities(real dt) {
+void phys::particle_collision_constraint::update_velocities(particle_store &store, real dt) {
 	if (a_old_pos == b_old_pos) {
 		return;
 	}
 
-	real ma = a()->get_mass();
-	real mb = b()->get_mass();
+	real ma = store.get_mass(a());
+	real mb = store.get_mass(b());
 	real m_total = ma + mb;
-	real e = restitution;
 
-	if (m_total == 0.0_r || (! a()->has_finite_mass() && ! b()->has_finite_mass())) {
+	if (m_total == 0.0_r || (! store.has_finite_mass(a()) && ! store.has_finite_mass(b()))) {
 		return;
 	}
 
 	vec3 n = phys::normalize(b_old_pos - a_old_pos);
 	decomposed_vec3 a_old_parts = decompose_vec3(a_old_vel, n);
 	decomposed_vec3 b_old_parts = decompose_vec3(b_old_vel, n);
-	decomposed_vec3 a_new_parts = decompose_vec3(a()->vel, n);
-	decomposed_vec3 b_new_parts = decompose_vec3(b()->vel, n);
+	decomposed_vec3 a_new_parts = decompose_vec3(store.vel[a()], n);
+	decomposed_vec3 b_new_parts = decompose_vec3(store.vel[b()], n);
+	vec3 closing_vel = a_old_parts.parallel - b_old_parts.parallel;
+	real e = phys::dot(closing_vel, closing_vel) < min_restitution_speed * min_restitution_speed ? 0.0_r : restitution;
 
 	vec3 va{};
 	vec3 vb{};
 
-	if (! a()->has_finite_mass()) {
+	if (! store.has_finite_mass(a())) {
 		vb = -e * b_old_parts.parallel + (1 + e) * a_old_parts.parallel;
-	} else if (! b()->has_finite_mass()) {
+	} else if (! store.has_finite_mass(b())) {
 		va = -e * a_old_parts.parallel + (1 + e) * b_old_parts.parallel;
 	} else {
 		va = ((ma - e * mb) / m_total) * a_old_parts.parallel + ((mb + e * mb) / m_total) * b_old_parts.parallel;
@@ -73,6 +75,6 @@ void phys::particle_collision_constraint::update_velocities(real dt) {
 
 	real f = 1 - friction * dt;
 
-	a()->vel = va + f * a_new_parts.perp;
-	b()->vel = vb + f * b_new_parts.perp;
+	store.vel[a()] = va + f * a_new_parts.perp;
+	store.vel[b()] = vb + f * b_new_parts.perp;
 }
\ No newline at end of file
@@ -3,7 +3,8 @@
 using namespace phys::literals;
 
 phys::plane_collision_constraint::plane_collision_constraint(
-	particle * _a,
+	const particle_store &store,
+	particle_handle _a,
 	vec3 _normal,
 	vec3 _origin,
 	real _restitution,
@@ -14,26 +15,27 @@ phys::plane_collision_constraint::plane_collision_constraint(
 	origin(_origin),
 	restitution(_restitution),
 	friction(_friction),
-	old_vel(_a->vel)
+	old_vel(store.vel[_a])
 {}
 
-phys::real phys::plane_collision_constraint::eval_constraint() const {
-	return phys::dot(a()->p - origin, normal);
+phys::real phys::plane_collision_constraint::eval_constraint(const particle_store &store) const {
+	return phys::dot(store.p[a()] - origin, normal);
 }
 
-phys::vec3 phys::plane_collision_constraint::eval_gradient(const particle &p) const {
-	if (&p != a()) {
+phys::vec3 phys::plane_collision_constraint::eval_gradient(const particle_store &store, size_t i) const {
+	if (i != 0) {
 		return vec3(0.0_r);
 	}
 
 	return normal;
 }
 
-void phys::plane_collision_constraint::update_velocities(real dt) {
+void phys::plane_collision_constraint::update_velocities(particle_store &store, real dt) {
 	decomposed_vec3 old_parts = decompose_vec3(old_vel, normal);
-	decomposed_vec3 new_parts = decompose_vec3(a()->vel, normal);
-	vec3 new_parallel = -old_parts.parallel * restitution;
+	decomposed_vec3 new_parts = decompose_vec3(store.vel[a()], normal);
+	real e = phys::dot(old_parts.parallel, old_parts.parallel) < min_restitution_speed * min_restitution_speed ? 0.0_r : restitution;
+	vec3 new_parallel = -old_parts.parallel * e;
 	real f = 1 - friction * dt;
 
-	a()->vel = new_parallel + f * new_parts.perp;
+	store.vel[a()] = new_parallel + f * new_parts.perp;
 }
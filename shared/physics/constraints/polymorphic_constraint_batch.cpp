@@ -0,0 +1,97 @@
+#include "../constraints.h"
+
+using namespace phys::literals;
+
+void phys::polymorphic_constraint_batch::clear() {
+	items.clear();
+}
+
+void phys::polymorphic_constraint_batch::add(constraint * c) {
+	items.push_back(c);
+}
+
+size_t phys::polymorphic_constraint_batch::size() const {
+	return items.size();
+}
+
+std::span<const phys::particle_handle> phys::polymorphic_constraint_batch::get_particles(size_t i) const {
+	return items[i]->get_particles();
+}
+
+void phys::polymorphic_constraint_batch::reset_multipliers() {
+	for (constraint * c : items) {
+		c->lambda = 0.0_r;
+	}
+}
+
+size_t phys::polymorphic_constraint_batch::project(
+	particle_store &store,
+	const projection_params &params,
+	size_t begin,
+	size_t end,
+	bool forward
+) {
+	size_t num_projected = 0;
+
+	const auto project_one = [&](constraint &c) {
+		if (! c.is_satisfied(store)) {
+			c.project(store, params);
+			num_projected++;
+		}
+	};
+
+	if (forward) {
+		for (size_t i = begin; i < end; i++) {
+			project_one(*items[i]);
+		}
+	} else {
+		for (size_t i = end; i-- > begin;) {
+			project_one(*items[i]);
+		}
+	}
+
+	return num_projected;
+}
+
+size_t phys::polymorphic_constraint_batch::project_independent(
+	particle_store &store,
+	const projection_params &params,
+	size_t begin,
+	size_t end
+) {
+	return project(store, params, begin, end, true);
+}
+
+size_t phys::polymorphic_constraint_batch::accumulate_projection(
+	particle_store &store,
+	const projection_params &params,
+	size_t begin,
+	size_t end
+) {
+	size_t num_projected = 0;
+
+	for (size_t i = begin; i < end; i++) {
+		if (! items[i]->is_satisfied(store)) {
+			items[i]->accumulate_projection(store, params);
+			num_projected++;
+		}
+	}
+
+	return num_projected;
+}
+
+void phys::polymorphic_constraint_batch::update_velocities(particle_store &store, real dt) {
+	for (constraint * c : items) {
+		c->update_velocities(store, dt);
+	}
+}
+
+void phys::polymorphic_constraint_batch::reorder(std::span<const uint32_t> order) {
+	reorder_scratch.clear();
+
+	for (uint32_t i : order) {
+		reorder_scratch.push_back(items[i]);
+	}
+
+	std::swap(items, reorder_scratch);
+}
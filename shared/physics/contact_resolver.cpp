@@ -0,0 +1,13 @@
+#include "contact_resolver.h"
+
+size_t phys::contact_partition::num_islands() const {
+	return island_offsets.empty() ? 0 : island_offsets.size() - 1;
+}
+
+size_t phys::contact_partition::num_colors() const {
+	return color_offsets.empty() ? 0 : color_offsets.size() - 1;
+}
+
+void phys::contact_resolver::resolve_islands(contact_container &contacts, const contact_partition &, thread_pool &, real dt) {
+	resolve_contacts(contacts, dt);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <vector>
+#include "collision/algorithm.h"
+#include "math.h"
+#include "thread_pool.h"
+
+namespace phys {
+	// Contacts sorted into groups that can be resolved at the same time. The contacts of
+	// island `i` are [island_offsets[i], island_offsets[i + 1]), and no body with finite
+	// mass has contacts in two islands. The largest island is sorted again by color: the
+	// contacts of color `k` are [color_offsets[k], color_offsets[k + 1]), and no two
+	// contacts of the same color share a body with finite mass, except in the last color,
+	// which holds the contacts that could not be colored.
+	struct contact_partition {
+		std::vector<size_t> island_offsets{};
+		// The island that is split into colors
+		size_t split_island{};
+		std::vector<size_t> color_offsets{};
+
+		size_t num_islands() const;
+		size_t num_colors() const;
+	};
+
+	class contact_resolver {
+	public:
+		virtual ~contact_resolver() = default;
+
+		// Changes the velocities (and possibly the positions) of the bodies in `contacts`
+		// so that they stop moving into each other. Called after forces have been applied
+		// to the velocities and before the bodies are moved.
+		virtual void resolve_contacts(contact_container &contacts, real dt) = 0;
+		// Like `resolve_contacts`, with `contacts` sorted as described by `partition`.
+		// Resolvers that can use `pool` to resolve islands and colors in parallel override
+		// this. Otherwise, the contacts are resolved all together on the calling thread.
+		virtual void resolve_islands(contact_container &contacts, const contact_partition &partition, thread_pool &pool, real dt);
+	};
+}
@@ -0,0 +1,394 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include "contact_resolvers.h"
+
+using namespace phys::literals;
+
+phys::linear_contact_resolver::linear_contact_resolver(
+	size_t _iterations,
+	real _restitution,
+	real _bounce_speed,
+	real _correction,
+	real _slop
+) :
+	iterations(_iterations),
+	restitution(_restitution),
+	bounce_speed(_bounce_speed),
+	correction(_correction),
+	slop(_slop)
+{}
+
+void phys::linear_contact_resolver::resolve_contacts(contact_container &contacts, real) {
+	for (size_t i = 0; i < iterations; i++) {
+		for (const contact &c : contacts) {
+			const real inv_mass_a = c.a->get_inv_mass();
+			const real inv_mass_b = c.b->get_inv_mass();
+			const real total_inv_mass = inv_mass_a + inv_mass_b;
+
+			if (total_inv_mass == 0.0_r) {
+				continue;
+			}
+
+			// The normal points from `a` to `b`, so this is negative while they approach
+			const real closing_vel = dot(c.b->vel - c.a->vel, c.normal);
+
+			if (closing_vel >= 0.0_r) {
+				continue;
+			}
+
+			const real e = -closing_vel > bounce_speed ? restitution : 0.0_r;
+			const vec3 impulse = c.normal * (-(1.0_r + e) * closing_vel / total_inv_mass);
+
+			c.a->vel -= impulse * inv_mass_a;
+			c.b->vel += impulse * inv_mass_b;
+		}
+	}
+
+	for (const contact &c : contacts) {
+		const real inv_mass_a = c.a->get_inv_mass();
+		const real inv_mass_b = c.b->get_inv_mass();
+		const real total_inv_mass = inv_mass_a + inv_mass_b;
+
+		if (total_inv_mass == 0.0_r) {
+			continue;
+		}
+
+		const vec3 push = c.normal * (std::max(c.penetration - slop, 0.0_r) * correction / total_inv_mass);
+
+		c.a->pos -= push * inv_mass_a;
+		c.b->pos += push * inv_mass_b;
+	}
+}
+
+phys::sequential_impulse_resolver::sequential_impulse_resolver(
+	size_t _max_iterations,
+	real _tolerance,
+	real _friction,
+	real _restitution
+) :
+	max_iterations(_max_iterations),
+	tolerance(_tolerance),
+	friction(_friction),
+	restitution(_restitution),
+	bounce_speed(0.5_r),
+	baumgarte(0.2_r),
+	slop(0.005_r),
+	match_distance(0.05_r)
+{}
+
+namespace {
+	bool body_pair_less(const phys::rigid_body * a1, const phys::rigid_body * b1, const phys::rigid_body * a2, const phys::rigid_body * b2) {
+		const std::less<const phys::rigid_body *> less{};
+
+		return less(a1, a2) || (a1 == a2 && less(b1, b2));
+	}
+
+	// The effective mass of the contact along `dir`: the inverse of how much the relative
+	// velocity along `dir` changes per unit of impulse
+	phys::real effective_mass(
+		const phys::vec3 &dir,
+		const phys::vec3 &ra,
+		const phys::vec3 &rb,
+		phys::real inv_mass_a,
+		phys::real inv_mass_b,
+		const phys::mat3 &inv_inertia_a,
+		const phys::mat3 &inv_inertia_b
+	) {
+		using namespace phys;
+
+		const vec3 ang_a = cross(inv_inertia_a * cross(ra, dir), ra);
+		const vec3 ang_b = cross(inv_inertia_b * cross(rb, dir), rb);
+		const real k = inv_mass_a + inv_mass_b + dot(dir, ang_a + ang_b);
+
+		return k > 0.0_r ? 1.0_r / k : 0.0_r;
+	}
+}
+
+void phys::sequential_impulse_resolver::resolve_contacts(contact_container &contacts, real dt) {
+	states.resize(contacts.size());
+	last_warm_started = 0;
+
+	// Every bounce is measured before any contact is warm started, as in `resolve_islands`
+	for (size_t i = 0; i < contacts.size(); i++) {
+		if (prepare(contacts[i], dt, states[i])) {
+			last_warm_started++;
+		}
+	}
+
+	for (contact_state &s : states) {
+		warm_start(s);
+	}
+
+	last_iterations = 0;
+
+	for (size_t i = 0; i < max_iterations; i++) {
+		real max_change = 0.0_r;
+
+		for (contact_state &s : states) {
+			max_change = std::max(max_change, solve(s));
+		}
+
+		last_iterations = i + 1;
+
+		if (max_change <= tolerance) {
+			break;
+		}
+	}
+
+	remember_impulses();
+}
+
+void phys::sequential_impulse_resolver::resolve_islands(contact_container &contacts, const contact_partition &partition, thread_pool &pool, real dt) {
+	const size_t num_islands = partition.num_islands();
+	std::atomic<size_t> warm_started = 0;
+
+	states.resize(contacts.size());
+
+	// Nothing moves while the contacts are prepared, so they can all be prepared at once
+	pool.parallel_for(contacts.size(), contact_chunk_size, [&](size_t begin, size_t end) {
+		size_t n = 0;
+
+		for (size_t i = begin; i < end; i++) {
+			if (prepare(contacts[i], dt, states[i])) {
+				n++;
+			}
+		}
+
+		warm_started.fetch_add(n, std::memory_order_relaxed);
+	});
+
+	last_warm_started = warm_started.load(std::memory_order_relaxed);
+	island_iterations.assign(num_islands, 0);
+
+	// Every island but the split one is solved by one thread, which iterates until that
+	// island converges
+	pool.parallel_for(num_islands, island_chunk_size, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			if (i != partition.split_island) {
+				island_iterations[i] = solve_island(partition.island_offsets[i], partition.island_offsets[i + 1]);
+			}
+		}
+	});
+
+	last_iterations = 0;
+
+	for (size_t iterations : island_iterations) {
+		last_iterations = std::max(last_iterations, iterations);
+	}
+
+	if (num_islands) {
+		last_iterations = std::max(last_iterations, solve_by_color(partition, pool));
+	}
+
+	remember_impulses();
+}
+
+size_t phys::sequential_impulse_resolver::get_last_iterations() const {
+	return last_iterations;
+}
+
+size_t phys::sequential_impulse_resolver::get_last_warm_started() const {
+	return last_warm_started;
+}
+
+const phys::sequential_impulse_resolver::cached_impulse * phys::sequential_impulse_resolver::find_cached(const contact &c) const {
+	auto first = std::lower_bound(std::begin(cache), std::end(cache), c, [](const cached_impulse &x, const contact &y) {
+		return body_pair_less(x.a, x.b, y.a, y.b);
+	});
+
+	const cached_impulse * out = nullptr;
+	real closest = match_distance * match_distance;
+
+	for (auto it = first; it != std::end(cache) && it->a == c.a && it->b == c.b; it++) {
+		const vec3 d = it->point - c.point;
+		const real dist_sqr = dot(d, d);
+
+		if (dist_sqr <= closest) {
+			closest = dist_sqr;
+			out = &*it;
+		}
+	}
+
+	return out;
+}
+
+bool phys::sequential_impulse_resolver::prepare(const contact &c, real dt, contact_state &s) const {
+	s = contact_state{};
+	s.a = c.a;
+	s.b = c.b;
+	s.inv_mass_a = c.a->get_inv_mass();
+	s.inv_mass_b = c.b->get_inv_mass();
+	s.inv_inertia_a = c.a->has_finite_mass() ? c.a->get_inv_inertia_tensor_world() : mat3(0.0_r);
+	s.inv_inertia_b = c.b->has_finite_mass() ? c.b->get_inv_inertia_tensor_world() : mat3(0.0_r);
+	s.ra = c.point - c.a->pos;
+	s.rb = c.point - c.b->pos;
+	s.normal = c.normal;
+
+	// Any two directions perpendicular to the normal and each other
+	if (std::abs(s.normal.x) > 0.57_r) {
+		s.tangent1 = normalize(vec3(s.normal.y, -s.normal.x, 0.0_r));
+	} else {
+		s.tangent1 = normalize(vec3(0.0_r, s.normal.z, -s.normal.y));
+	}
+
+	s.tangent2 = cross(s.normal, s.tangent1);
+
+	s.normal_mass = effective_mass(s.normal, s.ra, s.rb, s.inv_mass_a, s.inv_mass_b, s.inv_inertia_a, s.inv_inertia_b);
+	s.tangent_mass1 = effective_mass(s.tangent1, s.ra, s.rb, s.inv_mass_a, s.inv_mass_b, s.inv_inertia_a, s.inv_inertia_b);
+	s.tangent_mass2 = effective_mass(s.tangent2, s.ra, s.rb, s.inv_mass_a, s.inv_mass_b, s.inv_inertia_a, s.inv_inertia_b);
+
+	const real normal_vel = dot(relative_velocity(s), s.normal);
+	const real bounce = -normal_vel > bounce_speed ? -normal_vel * restitution : 0.0_r;
+
+	s.bias = std::max(bounce, baumgarte / dt * std::max(c.penetration - slop, 0.0_r));
+
+	const cached_impulse * cached = warm_starting ? find_cached(c) : nullptr;
+
+	if (! cached) {
+		return false;
+	}
+
+	s.normal_impulse = cached->normal_impulse;
+	s.tangent_impulse1 = dot(cached->tangent_impulse, s.tangent1);
+	s.tangent_impulse2 = dot(cached->tangent_impulse, s.tangent2);
+
+	return true;
+}
+
+void phys::sequential_impulse_resolver::warm_start(contact_state &s) {
+	apply_impulse(s, s.normal * s.normal_impulse + s.tangent1 * s.tangent_impulse1 + s.tangent2 * s.tangent_impulse2);
+}
+
+phys::real phys::sequential_impulse_resolver::solve(contact_state &s) const {
+	// Friction first, so that the normal impulse has the last word on whether the
+	// bodies separate
+	const real limit = friction * s.normal_impulse;
+	vec3 vel = relative_velocity(s);
+
+	const real old_t1 = s.tangent_impulse1;
+	s.tangent_impulse1 = std::clamp(old_t1 - dot(vel, s.tangent1) * s.tangent_mass1, -limit, limit);
+
+	const real old_t2 = s.tangent_impulse2;
+	s.tangent_impulse2 = std::clamp(old_t2 - dot(vel, s.tangent2) * s.tangent_mass2, -limit, limit);
+
+	apply_impulse(s, s.tangent1 * (s.tangent_impulse1 - old_t1) + s.tangent2 * (s.tangent_impulse2 - old_t2));
+
+	vel = relative_velocity(s);
+
+	const real old_n = s.normal_impulse;
+	s.normal_impulse = std::max(old_n + (s.bias - dot(vel, s.normal)) * s.normal_mass, 0.0_r);
+
+	apply_impulse(s, s.normal * (s.normal_impulse - old_n));
+
+	return std::max({
+		std::abs(s.normal_impulse - old_n),
+		std::abs(s.tangent_impulse1 - old_t1),
+		std::abs(s.tangent_impulse2 - old_t2)
+	});
+}
+
+size_t phys::sequential_impulse_resolver::solve_island(size_t begin, size_t end) {
+	for (size_t i = begin; i < end; i++) {
+		warm_start(states[i]);
+	}
+
+	for (size_t i = 0; i < max_iterations; i++) {
+		real max_change = 0.0_r;
+
+		for (size_t j = begin; j < end; j++) {
+			max_change = std::max(max_change, solve(states[j]));
+		}
+
+		if (max_change <= tolerance) {
+			return i + 1;
+		}
+	}
+
+	return max_iterations;
+}
+
+size_t phys::sequential_impulse_resolver::solve_by_color(const contact_partition &partition, thread_pool &pool) {
+	const std::vector<size_t> &offsets = partition.color_offsets;
+	const size_t num_colors = partition.num_colors();
+
+	// Calls `f(i)` on each contact of a color. Contacts of the same color share no body
+	// that moves, except in the last color, which runs on the calling thread.
+	const auto for_each_in_color = [&](size_t color, auto &&f) {
+		const size_t first = offsets[color];
+		const auto run = [&](size_t begin, size_t end) {
+			for (size_t i = first + begin; i < first + end; i++) {
+				f(i);
+			}
+		};
+
+		if (color + 1 == num_colors) {
+			run(0, offsets[color + 1] - first);
+		} else {
+			pool.parallel_for(offsets[color + 1] - first, contact_chunk_size, run);
+		}
+	};
+
+	for (size_t color = 0; color < num_colors; color++) {
+		for_each_in_color(color, [&](size_t i) {
+			warm_start(states[i]);
+		});
+	}
+
+	for (size_t i = 0; i < max_iterations; i++) {
+		std::atomic<size_t> num_changed = 0;
+
+		for (size_t color = 0; color < num_colors; color++) {
+			for_each_in_color(color, [&](size_t j) {
+				if (solve(states[j]) > tolerance) {
+					num_changed.fetch_add(1, std::memory_order_relaxed);
+				}
+			});
+		}
+
+		if (! num_changed.load(std::memory_order_relaxed)) {
+			return i + 1;
+		}
+	}
+
+	return max_iterations;
+}
+
+void phys::sequential_impulse_resolver::remember_impulses() {
+	next_cache.clear();
+
+	for (const contact_state &s : states) {
+		next_cache.push_back({
+			s.a,
+			s.b,
+			s.a->pos + s.ra,
+			s.normal_impulse,
+			s.tangent1 * s.tangent_impulse1 + s.tangent2 * s.tangent_impulse2
+		});
+	}
+
+	std::sort(std::begin(next_cache), std::end(next_cache), [](const cached_impulse &x, const cached_impulse &y) {
+		return body_pair_less(x.a, x.b, y.a, y.b);
+	});
+
+	std::swap(cache, next_cache);
+}
+
+void phys::sequential_impulse_resolver::apply_impulse(contact_state &s, const vec3 &impulse) {
+	// Bodies with infinite mass are left alone, so that islands that share one can be
+	// solved in parallel
+	if (s.inv_mass_a != 0.0_r) {
+		s.a->vel -= impulse * s.inv_mass_a;
+		s.a->ang_vel -= s.inv_inertia_a * cross(s.ra, impulse);
+	}
+
+	if (s.inv_mass_b != 0.0_r) {
+		s.b->vel += impulse * s.inv_mass_b;
+		s.b->ang_vel += s.inv_inertia_b * cross(s.rb, impulse);
+	}
+}
+
+phys::vec3 phys::sequential_impulse_resolver::relative_velocity(const contact_state &s) {
+	return s.b->vel + cross(s.b->ang_vel, s.rb) - s.a->vel - cross(s.a->ang_vel, s.ra);
+}
\ No newline at end of file
@@ -0,0 +1,142 @@
+#pragma once
+#include <vector>
+#include "contact_resolver.h"
+
+namespace phys {
+	// Resolves contacts with impulses through the bodies' centers of mass, ignoring
+	// rotation, and then pushes overlapping bodies apart. Cheap, and enough for spheres.
+	class linear_contact_resolver : public contact_resolver {
+	public:
+		size_t iterations;
+		real restitution;
+		// Bodies that approach each other slower than this don't bounce
+		real bounce_speed;
+		// Fraction of the penetration past `slop` that is corrected each step
+		real correction;
+		// Penetration that is left alone, so that resting contacts stay in contact
+		real slop;
+
+		linear_contact_resolver(
+			size_t _iterations,
+			real _restitution,
+			real _bounce_speed = (real)0.5,
+			real _correction = (real)0.8,
+			real _slop = (real)0.01
+		);
+
+		void resolve_contacts(contact_container &contacts, real dt) override;
+	};
+
+	// Solves every contact for the impulse that stops its bodies from approaching each
+	// other, one contact at a time, and repeats until the impulses stop changing (Catto,
+	// "Iterative Dynamics with Temporal Coherence", 2005). The impulses accumulated at
+	// each contact are clamped as a whole, so that later iterations can take back what
+	// earlier ones overdid. Friction is limited by the normal impulse (Coulomb), and
+	// penetration is corrected by biasing the target velocity (Baumgarte).
+	//
+	// The impulses of each contact are remembered for the next step. A new contact
+	// between the same bodies near a remembered one starts from its impulses (warm
+	// starting), so that a resting stack starts each step almost solved.
+	class sequential_impulse_resolver : public contact_resolver {
+	public:
+		size_t max_iterations;
+		// Iterations stop once no impulse changes by more than this
+		real tolerance;
+		real friction;
+		real restitution;
+		// Bodies that approach each other slower than this don't bounce
+		real bounce_speed;
+		// Fraction of the penetration past `slop` that is corrected each step
+		real baumgarte;
+		// Penetration that is left alone, so that resting contacts stay in contact
+		real slop;
+		// How far a contact may move between steps and still be matched with its
+		// remembered impulses
+		real match_distance;
+		bool warm_starting{ true };
+
+		sequential_impulse_resolver(
+			size_t _max_iterations,
+			real _tolerance = (real)1e-4,
+			real _friction = (real)0.5,
+			real _restitution = (real)0.0
+		);
+
+		void resolve_contacts(contact_container &contacts, real dt) override;
+		// Solves each island on its own thread until it converges, and then solves the
+		// split island one color at a time, with the contacts of each color in parallel.
+		void resolve_islands(contact_container &contacts, const contact_partition &partition, thread_pool &pool, real dt) override;
+
+		// Iterations that the last call to `resolve_contacts` took, or that the slowest
+		// island took
+		size_t get_last_iterations() const;
+		// Contacts in the last call that started from remembered impulses
+		size_t get_last_warm_started() const;
+
+	private:
+		// Contacts per parallel chunk
+		static constexpr size_t contact_chunk_size = 64;
+		// Islands per parallel chunk
+		static constexpr size_t island_chunk_size = 4;
+
+		struct contact_state {
+			rigid_body * a{};
+			rigid_body * b{};
+			mat3 inv_inertia_a{};
+			mat3 inv_inertia_b{};
+			real inv_mass_a{};
+			real inv_mass_b{};
+			// Contact point relative to each body's center
+			vec3 ra{};
+			vec3 rb{};
+			vec3 normal{};
+			vec3 tangent1{};
+			vec3 tangent2{};
+			real normal_mass{};
+			real tangent_mass1{};
+			real tangent_mass2{};
+			// Normal velocity that the solver aims for
+			real bias{};
+			real normal_impulse{};
+			real tangent_impulse1{};
+			real tangent_impulse2{};
+		};
+
+		struct cached_impulse {
+			rigid_body * a{};
+			rigid_body * b{};
+			vec3 point{};
+			real normal_impulse{};
+			// Friction impulse in world space, since the tangents are chosen again each step
+			vec3 tangent_impulse{};
+		};
+
+		std::vector<contact_state> states{};
+		// Sorted by body pair
+		std::vector<cached_impulse> cache{};
+		std::vector<cached_impulse> next_cache{};
+		// Iterations that each island took
+		std::vector<size_t> island_iterations{};
+		size_t last_iterations{};
+		size_t last_warm_started{};
+
+		// Finds the remembered impulses of a contact, if there are any
+		const cached_impulse * find_cached(const contact &c) const;
+		// Sets up the state of a contact, and returns whether it starts from remembered
+		// impulses. The bodies are left alone.
+		bool prepare(const contact &c, real dt, contact_state &s) const;
+		// Applies the impulses that a contact starts from
+		static void warm_start(contact_state &s);
+		// Runs one iteration on a contact and returns how much its impulses changed
+		real solve(contact_state &s) const;
+		// Solves the contacts [begin, end) until they converge, and returns how many
+		// iterations that took
+		size_t solve_island(size_t begin, size_t end);
+		size_t solve_by_color(const contact_partition &partition, thread_pool &pool);
+		// Remembers the impulses of every contact for the next step
+		void remember_impulses();
+		static void apply_impulse(contact_state &s, const vec3 &impulse);
+		// Velocity of `b` relative to `a` at the contact point
+		static vec3 relative_velocity(const contact_state &s);
+	};
+}
\ No newline at end of file
@@ -7,10 +7,10 @@ phys::particle_anchored_spring::particle_anchored_spring(const vec3 &_anchor, re
 	rest_length(_rest_length)
 {}
 
-void phys::particle_anchored_spring::update_force(particle &p, real duration) {
-	vec3 d = p.pos - anchor;
+void phys::particle_anchored_spring::update_force(particle_store &store, particle_handle p, real duration) {
+	vec3 d = store.pos[p] - anchor;
 	real d_len = sqrt(phys::dot(d, d));
 
 	vec3 f = -k * (d_len - rest_length) * phys::normalize(d);
-	p.force += f;
+	store.force[p] += f;
 }
\ No newline at end of file
@@ -7,12 +7,13 @@ phys::particle_drag::particle_drag(phys::real _k1, phys::real _k2) :
 	k2(_k2)
 {}
 
-void phys::particle_drag::update_force(phys::particle &p, phys::real duration) {
-	vec3 norm_vel = phys::normalize(p.vel);
-	real speed_sqr = phys::dot(p.vel, p.vel);
+void phys::particle_drag::update_force(phys::particle_store &store, phys::particle_handle p, phys::real duration) {
+	const vec3 &vel = store.vel[p];
+	vec3 norm_vel = phys::normalize(vel);
+	real speed_sqr = phys::dot(vel, vel);
 	real speed = std::sqrt(speed_sqr);
 
 	vec3 f = -norm_vel * (k1 * speed + k2 * speed_sqr);
 
-	p.force += f;
+	store.force[p] += f;
 }
\ No newline at end of file
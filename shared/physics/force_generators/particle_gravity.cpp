@@ -5,10 +5,10 @@ phys::particle_gravity::particle_gravity(const phys::vec3 &_gravity) :
 	gravity(_gravity)
 {}
 
-void phys::particle_gravity::update_force(phys::particle &p, phys::real duration) {
-	if (! p.has_finite_mass()) {
+void phys::particle_gravity::update_force(phys::particle_store &store, phys::particle_handle p, phys::real duration) {
+	if (! store.has_finite_mass(p)) {
 		return;
 	}
 
-	p.force += gravity * p.get_mass();
+	store.force[p] += gravity * store.get_mass(p);
 }
\ No newline at end of file
@@ -1,17 +1,17 @@
 #include "../particle_force_generators.h"
 
-phys::particle_spring::particle_spring(const particle &_other, real _k, real _rest_length) :
+phys::particle_spring::particle_spring(particle_handle _other, real _k, real _rest_length) :
 	particle_force_generator(),
 	other(_other),
 	k(_k),
 	rest_length(_rest_length)
 {}
 
-void phys::particle_spring::update_force(particle &p, real duration) {
-	vec3 disp = p.pos - other.pos;
+void phys::particle_spring::update_force(particle_store &store, particle_handle p, real duration) {
+	vec3 disp = store.pos[p] - store.pos[other];
 	real length = std::sqrt(phys::dot(disp, disp));
 	real dl = length - rest_length;
 	vec3 f = -k * disp * dl;
 
-	p.force += f;
+	store.force[p] += f;
 }
\ No newline at end of file
@@ -20,6 +20,10 @@ phys::mat4 phys::transpose(const mat4 &m) {
 	return glm::transpose(m);
 }
 
+phys::mat3 phys::transpose(const mat3 &m) {
+	return glm::transpose(m);
+}
+
 phys::mat4 phys::inverse(const mat4 &m) {
 	return glm::inverse(m);
 }
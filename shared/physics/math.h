@@ -29,6 +29,7 @@ namespace phys {
 	vec3 normalize(const vec3 &v);
 	quat normalize(const quat &q);
 	mat4 transpose(const mat4 &m);
+	mat3 transpose(const mat3 &m);
 	mat4 inverse(const mat4 &m);
 	mat3 inverse(const mat3 &m);
 
@@ -1,12 +1,12 @@
 #pragma once
 #include "math.h"
-#include "particle.h"
+#include "particle_store.h"
 
 namespace phys {
 	class particle_force_generator {
 	public:
 		virtual ~particle_force_generator() = default;
 
-		virtual void update_force(particle &p, real duration) = 0;
+		virtual void update_force(particle_store &store, particle_handle p, real duration) = 0;
 	};
 }
@@ -8,7 +8,7 @@ namespace phys {
 
 		particle_gravity(const vec3 &_gravity);
 
-		void update_force(particle &p, real duration) override;
+		void update_force(particle_store &store, particle_handle p, real duration) override;
 	};
 
 	class particle_drag : public particle_force_generator {
@@ -18,18 +18,18 @@ namespace phys {
 
 		particle_drag(real _k1, real _k2);
 
-		void update_force(particle &p, real duration) override;
+		void update_force(particle_store &store, particle_handle p, real duration) override;
 	};
 
 	class particle_spring : public particle_force_generator {
 	public:
-		const particle &other;
+		particle_handle other;
 		real k;
 		real rest_length;
 
-		particle_spring(const particle &_other, real _k, real _rest_length);
+		particle_spring(particle_handle _other, real _k, real _rest_length);
 
-		void update_force(particle &p, real duration) override;
+		void update_force(particle_store &store, particle_handle p, real duration) override;
 	};
 
 	class particle_anchored_spring : public particle_force_generator {
@@ -40,6 +40,6 @@ namespace phys {
 
 		particle_anchored_spring(const vec3 &_anchor, real _k, real _rest_length);
 
-		void update_force(particle &p, real duration) override;
+		void update_force(particle_store &store, particle_handle p, real duration) override;
 	};
 }
@@ -4,26 +4,36 @@ bool phys::operator==(const phys::particle_force_registration &a, const phys::pa
 	return (a.p == b.p && a.fg == b.fg);
 }
 
-void phys::particle_force_registry::add(phys::particle * p, phys::particle_force_generator * fg) {
+void phys::particle_force_registry::add(phys::particle_handle p, phys::particle_force_generator * fg) {
 	registrations.push_back({
 		.p = p,
 		.fg = fg
 	});
 }
 
-void phys::particle_force_registry::remove(phys::particle * p, phys::particle_force_generator * fg) {
+void phys::particle_force_registry::remove(phys::particle_handle p, phys::particle_force_generator * fg) {
 	std::erase(registrations, phys::particle_force_registration{
 		.p = p,
 		.fg = fg
 	});
 }
 
+void phys::particle_force_registry::remove(phys::particle_handle p) {
+	std::erase_if(registrations, [p](const phys::particle_force_registration &r) {
+		return r.p == p;
+	});
+}
+
 void phys::particle_force_registry::clear() {
 	registrations.clear();
 }
 
-void phys::particle_force_registry::update_forces(phys::real duration) {
+void phys::particle_force_registry::update_forces(phys::particle_store &store, phys::real duration) {
 	for (auto &[p, fg] : registrations) {
-		fg->update_force(*p, duration);
+		if (store.asleep[p]) {
+			continue;
+		}
+
+		fg->update_force(store, p, duration);
 	}
 }
@@ -1,12 +1,12 @@
 #pragma once
 #include <vector>
 #include "math.h"
-#include "particle.h"
 #include "particle_force_generator.h"
+#include "particle_store.h"
 
 namespace phys {
 	struct particle_force_registration {
-		particle * p;
+		particle_handle p;
 		particle_force_generator * fg;
 
 		friend bool operator==(const particle_force_registration &a, const particle_force_registration &b);
@@ -14,10 +14,13 @@ namespace phys {
 
 	class particle_force_registry {
 	public:
-		void add(particle * p, particle_force_generator * fg);
-		void remove(particle * p, particle_force_generator * fg);
+		void add(particle_handle p, particle_force_generator * fg);
+		void remove(particle_handle p, particle_force_generator * fg);
+		// Removes every registration for the given particle
+		void remove(particle_handle p);
 		void clear();
-		void update_forces(real duration);
+		// Applies every registered force, except to sleeping particles
+		void update_forces(particle_store &store, real duration);
 
 	private:
 		using registry = std::vector<particle_force_registration>;
@@ -0,0 +1,102 @@
+#include <stdexcept>
+#include "particle_store.h"
+
+using namespace phys::literals;
+
+phys::particle_handle::particle_handle(uint32_t _index) :
+	index(_index)
+{}
+
+phys::particle_handle::operator bool() const {
+	return index != invalid_index;
+}
+
+bool phys::operator==(const particle_handle &a, const particle_handle &b) {
+	return a.index == b.index;
+}
+
+phys::particle_handle phys::particle_store::add(const particle &init) {
+	particle_handle h{};
+
+	if (free_slots.empty()) {
+		h = particle_handle((uint32_t)alive.size());
+
+		for_each_array([](auto &items) {
+			items.emplace_back();
+		});
+
+		alive.push_back(true);
+	} else {
+		h = particle_handle(free_slots.back());
+		free_slots.pop_back();
+		alive[h.index] = true;
+	}
+
+	pos[h] = init.pos;
+	vel[h] = init.vel;
+	force[h] = init.force;
+	p[h] = init.pos;
+	p_accum[h] = vec3(0.0_r);
+	n[h] = 0;
+	damping[h] = init.damping;
+	radius[h] = init.radius;
+	inv_mass[h] = init.get_inv_mass();
+	asleep[h] = false;
+
+	return h;
+}
+
+void phys::particle_store::remove(particle_handle h) {
+	if (! is_alive(h)) {
+		return;
+	}
+
+	vel[h] = vec3(0.0_r);
+	force[h] = vec3(0.0_r);
+	p[h] = pos[h];
+	p_accum[h] = vec3(0.0_r);
+	n[h] = 0;
+	radius[h] = 0.0_r;
+	inv_mass[h] = 0.0_r;
+	asleep[h] = false;
+
+	alive[h.index] = false;
+	free_slots.push_back(h.index);
+}
+
+bool phys::particle_store::is_alive(particle_handle h) const {
+	return h.index < alive.size() && alive[h.index];
+}
+
+size_t phys::particle_store::size() const {
+	return alive.size();
+}
+
+size_t phys::particle_store::num_alive() const {
+	return alive.size() - free_slots.size();
+}
+
+void phys::particle_store::set_mass(particle_handle h, real mass) {
+	if (mass == infinity) {
+		inv_mass[h] = 0.0_r;
+		// TODO: epsilon
+	} else if (mass == 0.0_r) {
+		throw std::invalid_argument("Mass must be nonzero");
+	} else {
+		inv_mass[h] = 1.0_r / mass;
+	}
+}
+
+phys::real phys::particle_store::get_mass(particle_handle h) const {
+	// TODO: epsilon
+	if (inv_mass[h] == 0.0_r) {
+		return infinity;
+	}
+
+	return 1.0_r / inv_mass[h];
+}
+
+bool phys::particle_store::has_finite_mass(particle_handle h) const {
+	// TODO: epsilon
+	return inv_mass[h] != 0.0_r;
+}
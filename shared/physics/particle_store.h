@@ -0,0 +1,145 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+#include "math.h"
+#include "particle.h"
+
+namespace phys {
+	// Refers to a particle in a `particle_store`. A handle stays valid until the particle
+	// is removed, no matter how many other particles are added or removed.
+	struct particle_handle {
+		static constexpr uint32_t invalid_index = std::numeric_limits<uint32_t>::max();
+
+		uint32_t index{ invalid_index };
+
+		particle_handle() = default;
+		explicit particle_handle(uint32_t _index);
+
+		// True if the handle refers to a particle, false if it is a null handle
+		explicit operator bool() const;
+
+		friend bool operator==(const particle_handle &a, const particle_handle &b);
+	};
+
+	// One property of every particle in a store, indexed by handle or by slot
+	template <typename T>
+	class particle_array {
+	public:
+		T& operator[](particle_handle h);
+		const T& operator[](particle_handle h) const;
+		T& operator[](size_t i);
+		const T& operator[](size_t i) const;
+
+		T * data();
+		const T * data() const;
+		size_t size() const;
+
+	private:
+		friend class particle_store;
+
+		std::vector<T> items{};
+	};
+
+	// Structure-of-arrays storage for particles. Each property lives in its own contiguous
+	// array, so a loop that only touches a few properties only pulls those properties through
+	// the cache. Particles are never moved: a removed particle's slot is zeroed out and reused
+	// by the next particle that is added. Removed particles have zero inverse mass and
+	// velocity, so loops over every slot can run without checking whether a slot is in use.
+	class particle_store {
+	public:
+		particle_array<vec3> pos{};
+		particle_array<vec3> vel{};
+		particle_array<vec3> force{};
+		// Position estimate
+		particle_array<vec3> p{};
+		// Sum of the position changes made by the Jacobi solver in one iteration, and the
+		// number of constraints that made them
+		particle_array<vec3> p_accum{};
+		particle_array<uint32_t> n{};
+		particle_array<real> damping{};
+		particle_array<real> radius{};
+		particle_array<real> inv_mass{};
+		// Set by `particle_world` when the particle's island goes to sleep. Sleeping
+		// particles have zero velocity and don't receive forces.
+		particle_array<uint8_t> asleep{};
+
+		// Adds a particle with the same state as `init`
+		particle_handle add(const particle &init);
+		void remove(particle_handle h);
+		bool is_alive(particle_handle h) const;
+
+		// Number of slots, including the slots of removed particles
+		size_t size() const;
+		// Number of particles that have not been removed
+		size_t num_alive() const;
+
+		void set_mass(particle_handle h, real mass);
+		real get_mass(particle_handle h) const;
+		bool has_finite_mass(particle_handle h) const;
+
+	private:
+		std::vector<uint8_t> alive{};
+		std::vector<uint32_t> free_slots{};
+
+		template <typename F>
+		void for_each_array(F &&f);
+	};
+}
+
+template <>
+struct std::hash<phys::particle_handle> {
+	size_t operator()(const phys::particle_handle &h) const {
+		return std::hash<uint32_t>()(h.index);
+	}
+};
+
+template <typename T>
+T& phys::particle_array<T>::operator[](particle_handle h) {
+	return items[h.index];
+}
+
+template <typename T>
+const T& phys::particle_array<T>::operator[](particle_handle h) const {
+	return items[h.index];
+}
+
+template <typename T>
+T& phys::particle_array<T>::operator[](size_t i) {
+	return items[i];
+}
+
+template <typename T>
+const T& phys::particle_array<T>::operator[](size_t i) const {
+	return items[i];
+}
+
+template <typename T>
+T * phys::particle_array<T>::data() {
+	return items.data();
+}
+
+template <typename T>
+const T * phys::particle_array<T>::data() const {
+	return items.data();
+}
+
+template <typename T>
+size_t phys::particle_array<T>::size() const {
+	return items.size();
+}
+
+template <typename F>
+void phys::particle_store::for_each_array(F &&f) {
+	f(pos.items);
+	f(vel.items);
+	f(force.items);
+	f(p.items);
+	f(p_accum.items);
+	f(n.items);
+	f(damping.items);
+	f(radius.items);
+	f(inv_mass.items);
+	f(asleep.items);
+}
@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <ranges>
 #include "particle_world.h"
 
@@ -14,10 +16,7 @@ phys::particle_world::particle_world(
 {}
 
 void phys::particle_world::prepare_frame() {
-	for (particle * p : particles) {
-		p->force = phys::vec3(0.0_r);
-		p->acc = phys::vec3(0.0_r);
-	}
+	std::fill_n(particles.force.data(), particles.size(), vec3(0.0_r));
 
 	collision_constraints.clear();
 }
@@ -27,93 +26,384 @@ void phys::particle_world::run_physics(real dt) {
 		return;
 	}
 
-	force_registry.update_forces(dt);
+	force_registry.update_forces(particles, dt);
+
+	step_start_pos.assign(particles.pos.data(), particles.pos.data() + particles.size());
+
+	const real h = dt / (real)substeps;
+
+	for (size_t i = 0; i < substeps; i++) {
+		if (i != 0) {
+			collision_constraints.clear();
+		}
 
-	for (particle * p : particles) {
-		p->vel += (dt * p->get_inv_mass() * p->force * p->damping);
+		substep(h, i + 1 == substeps);
 	}
 
-	for (particle * p : particles) {
-		p->p = p->pos + dt * p->vel;
+	if (sleeping_enabled) {
+		update_sleep(dt);
+	}
+}
+
+void phys::particle_world::substep(real dt, bool last) {
+	// Removed particles have zero inverse mass and velocity, so these loops can run over
+	// every slot without checking which ones are in use.
+	const size_t num_slots = particles.size();
+	vec3 * const pos = particles.pos.data();
+	vec3 * const vel = particles.vel.data();
+	vec3 * const p = particles.p.data();
+	const vec3 * const force = particles.force.data();
+	const real * const damping = particles.damping.data();
+	const real * const inv_mass = particles.inv_mass.data();
+
+	for (size_t i = 0; i < num_slots; i++) {
+		vel[i] += (dt * inv_mass[i] * force[i] * damping[i]);
+		p[i] = pos[i] + dt * vel[i];
 	}
 
 	generate_collision_constraints(dt);
+	wake_touched_islands();
+	gather_constraints();
 	solve_constraints(dt);
 
-	for (particle * p : particles) {
-		const vec3 dp = p->pos - p->p;
-
-		if (phys::dot(dp, dp) <= min_pos_change_sqr) {
-			p->p = p->pos;
-		}
+	const real inv_dt = 1.0_r / dt;
 
-		p->vel = (p->p - p->pos) / dt;
-		p->pos = p->p;
+	for (size_t i = 0; i < num_slots; i++) {
+		vel[i] = (p[i] - pos[i]) * inv_dt;
+		pos[i] = p[i];
 	}
 
-	for (constraint * c : fixed_constraints) {
-		c->update_velocities(dt);
-	}
+	// Particles that barely moved over the whole step stay where they were. Checked after
+	// every substep, this would also throw away the first moves of particles that start
+	// from rest, which shrink with the square of the substep length.
+	if (last) {
+		const vec3 * const start = step_start_pos.data();
+
+		for (size_t i = 0; i < num_slots; i++) {
+			const vec3 dp = start[i] - pos[i];
 
-	for (std::unique_ptr<constraint> &c : collision_constraints) {
-		c->update_velocities(dt);
+			if (phys::dot(dp, dp) <= min_pos_change_sqr) {
+				vel[i] = vec3(0.0_r);
+				pos[i] = start[i];
+				p[i] = start[i];
+			}
+		}
 	}
+
+	for_each_batch([&](auto &batch, size_t) {
+		batch.update_velocities(particles, dt);
+	});
 }
 
 void phys::particle_world::generate_collision_constraints(real dt) {
 	for (constraint_generator * cg : constraint_generators) {
-		cg->generate_constraints(dt, collision_constraints);
+		cg->generate_constraints(particles, dt, collision_constraints);
 	}
 }
 
 void phys::particle_world::solve_constraints(real dt) {
+	const projection_params params{
+		.model = model,
+		.inv_solver_iterations = inv_solver_iterations,
+		.inv_dt_sqr = 1.0_r / (dt * dt)
+	};
+
+	if (model == stiffness_model::XPBD) {
+		// Generated constraints and batched distance constraints start out with no
+		// multiplier, but other fixed constraints carry theirs over from the last step
+		fixed_other_batch.reset_multipliers();
+	}
+
+	if (mode == solver_mode::Jacobi) {
+		solve_constraints_jacobi(params);
+		return;
+	}
+
+	if (pool) {
+		solve_constraints_parallel(params);
+		return;
+	}
+
+	// Coloring the distance constraints lets them be projected several at a time
+	particle_colors.assign(particles.size(), 0);
+	color_batch(fixed_distance_batch, 0);
+
 	for (size_t i = 0; i < solver_iterations; i++) {
 		size_t num_projected = 0;
 
+		const auto project = [&](auto &batch, size_t j) {
+			if (j == 0) {
+				num_projected += project_by_color(batch, j, params, solve_forward);
+			} else {
+				num_projected += batch.project(particles, params, 0, batch.size(), solve_forward);
+			}
+		};
+
 		if (solve_forward) {
-			for (constraint * c : fixed_constraints) {
-				if (! c->is_satisfied()) {
-					c->project(inv_solver_iterations);
-					num_projected++;
+			for_each_batch(project);
+		} else {
+			for_each_batch_reverse(project);
+		}
+
+		solve_forward = ! solve_forward;
+
+		if (! num_projected) {
+			return;
+		}
+	}
+}
+
+void phys::particle_world::solve_constraints_parallel(const projection_params &params) {
+	color_constraints();
+
+	for (size_t i = 0; i < solver_iterations; i++) {
+		std::atomic<size_t> num_projected = 0;
+
+		for (size_t k = 0; k <= max_colors; k++) {
+			const size_t color = solve_forward ? k : max_colors - k;
+
+			if (color == max_colors) {
+				// The constraints that didn't fit in a color share particles, so they are
+				// projected on this thread, in the same direction as the serial solver
+				const auto project_overflow = [&](auto &batch, size_t j) {
+					const size_t n = batch.project(particles, params, color_offsets[j][color], color_offsets[j][color + 1], solve_forward);
+
+					num_projected.fetch_add(n, std::memory_order_relaxed);
+				};
+
+				if (solve_forward) {
+					for_each_batch(project_overflow);
+				} else {
+					for_each_batch_reverse(project_overflow);
 				}
+
+				continue;
 			}
 
-			for (std::unique_ptr<constraint> &c : collision_constraints) {
-				if (! c->is_satisfied()) {
-					c->project(inv_solver_iterations);
-					num_projected++;
+			pool->parallel_for(get_color_size(color), parallel_chunk_size, [&](size_t begin, size_t end) {
+				const size_t n = for_each_in_color(color, begin, end, [&](auto &batch, size_t first, size_t last) {
+					return batch.project_independent(particles, params, first, last);
+				});
+
+				num_projected.fetch_add(n, std::memory_order_relaxed);
+			});
+		}
+
+		solve_forward = ! solve_forward;
+
+		if (! num_projected.load(std::memory_order_relaxed)) {
+			return;
+		}
+	}
+}
+
+void phys::particle_world::solve_constraints_jacobi(const projection_params &params) {
+	// Constraints of the same color don't share particles, so they can accumulate their
+	// changes in parallel without racing
+	if (pool) {
+		color_constraints();
+	}
+
+	const size_t num_slots = particles.size();
+
+	for (size_t i = 0; i < solver_iterations; i++) {
+		std::atomic<size_t> num_projected = 0;
+
+		if (pool) {
+			for (size_t color = 0; color <= max_colors; color++) {
+				const auto accumulate = [&](size_t begin, size_t end) {
+					const size_t n = for_each_in_color(color, begin, end, [&](auto &batch, size_t first, size_t last) {
+						return batch.accumulate_projection(particles, params, first, last);
+					});
+
+					num_projected.fetch_add(n, std::memory_order_relaxed);
+				};
+
+				if (color == max_colors) {
+					accumulate(0, get_color_size(color));
+				} else {
+					pool->parallel_for(get_color_size(color), parallel_chunk_size, accumulate);
 				}
 			}
+
+			pool->parallel_for(num_slots, parallel_chunk_size * 16, [this](size_t begin, size_t end) {
+				apply_accumulated_changes(begin, end);
+			});
 		} else {
-			for (std::unique_ptr<constraint> &c : std::ranges::reverse_view(collision_constraints)) {
-				if (! c->is_satisfied()) {
-					c->project(inv_solver_iterations);
-					num_projected++;
-				}
-			}
+			size_t n = 0;
 
-			for (constraint * c : std::ranges::reverse_view(fixed_constraints)) {
-				if (! c->is_satisfied()) {
-					c->project(inv_solver_iterations);
-					num_projected++;
-				}
+			for_each_batch([&](auto &batch, size_t) {
+				n += batch.accumulate_projection(particles, params, 0, batch.size());
+			});
+
+			apply_accumulated_changes(0, num_slots);
+
+			num_projected = n;
+		}
+
+		if (! num_projected.load(std::memory_order_relaxed)) {
+			return;
+		}
+	}
+}
+
+void phys::particle_world::apply_accumulated_changes(size_t begin, size_t end) {
+	vec3 * const p = particles.p.data();
+	vec3 * const p_accum = particles.p_accum.data();
+	uint32_t * const n = particles.n.data();
+
+	for (size_t i = begin; i < end; i++) {
+		// Particles that no constraint moved have a zero sum, so dividing by 1 leaves
+		// them where they are
+		p[i] += p_accum[i] / (real)std::max(n[i], (uint32_t)1);
+		p_accum[i] = vec3(0.0_r);
+		n[i] = 0;
+	}
+}
+
+void phys::particle_world::color_constraints() {
+	particle_colors.assign(particles.size(), 0);
+
+	// The particle colors are shared by every batch, so constraints of the same color
+	// don't share particles even if they are in different batches
+	for_each_batch([&](auto &batch, size_t j) {
+		color_batch(batch, j);
+	});
+}
+
+template <typename B>
+void phys::particle_world::color_batch(B &batch, size_t j) {
+	std::array<size_t, max_colors + 2> &offsets = color_offsets[j];
+
+	offsets.fill(0);
+	constraint_colors.clear();
+
+	// Greedy coloring: each constraint gets the lowest color that none of its particles
+	// have been given yet
+	for (size_t i = 0; i < batch.size(); i++) {
+		uint64_t used = 0;
+
+		for (particle_handle p : batch.get_particles(i)) {
+			used |= particle_colors[p.index];
+		}
+
+		const size_t color = (size_t)std::countr_one(used);
+
+		if (color < max_colors) {
+			for (particle_handle p : batch.get_particles(i)) {
+				particle_colors[p.index] |= (uint64_t(1) << color);
 			}
 		}
 
-		solve_forward = ! solve_forward;
+		constraint_colors.push_back((uint8_t)color);
+		offsets[color + 1]++;
+	}
 
-		if (! num_projected) {
-			return;
+	for (size_t i = 1; i < offsets.size(); i++) {
+		offsets[i] += offsets[i - 1];
+	}
+
+	// Sort the batch by color, keeping the relative order of the constraints within
+	// a color
+	std::array<size_t, max_colors + 2> next = offsets;
+
+	color_order.resize(batch.size());
+
+	for (size_t i = 0; i < batch.size(); i++) {
+		color_order[next[constraint_colors[i]]++] = (uint32_t)i;
+	}
+
+	batch.reorder(color_order);
+}
+
+template <typename B>
+size_t phys::particle_world::project_by_color(B &batch, size_t j, const projection_params &params, bool forward) {
+	const std::array<size_t, max_colors + 2> &offsets = color_offsets[j];
+	size_t num_projected = 0;
+
+	for (size_t k = 0; k <= max_colors; k++) {
+		const size_t color = forward ? k : max_colors - k;
+
+		if (color == max_colors) {
+			num_projected += batch.project(particles, params, offsets[color], offsets[color + 1], forward);
+		} else {
+			num_projected += batch.project_independent(particles, params, offsets[color], offsets[color + 1]);
+		}
+	}
+
+	return num_projected;
+}
+
+template <typename F>
+void phys::particle_world::for_each_batch(F &&f) {
+	f(fixed_distance_batch, 0);
+	f(fixed_other_batch, 1);
+	f(collision_constraints.plane_collisions, 2);
+	f(collision_constraints.particle_collisions, 3);
+	f(generated_other_batch, 4);
+}
+
+template <typename F>
+void phys::particle_world::for_each_batch_reverse(F &&f) {
+	f(generated_other_batch, 4);
+	f(collision_constraints.particle_collisions, 3);
+	f(collision_constraints.plane_collisions, 2);
+	f(fixed_other_batch, 1);
+	f(fixed_distance_batch, 0);
+}
+
+template <typename F>
+size_t phys::particle_world::for_each_in_color(size_t color, size_t begin, size_t end, F &&f) {
+	size_t out = 0;
+	size_t batch_start = 0;
+
+	for_each_batch([&](auto &batch, size_t j) {
+		const size_t first = color_offsets[j][color];
+		const size_t count = color_offsets[j][color + 1] - first;
+		const size_t lo = std::max(begin, batch_start);
+		const size_t hi = std::min(end, batch_start + count);
+
+		if (lo < hi) {
+			out += f(batch, first + lo - batch_start, first + hi - batch_start);
 		}
+
+		batch_start += count;
+	});
+
+	return out;
+}
+
+size_t phys::particle_world::get_color_size(size_t color) const {
+	size_t out = 0;
+
+	for (const std::array<size_t, max_colors + 2> &offsets : color_offsets) {
+		out += offsets[color + 1] - offsets[color];
 	}
+
+	return out;
 }
 
-void phys::particle_world::add_particle(particle * p) {
-	particles.push_back(p);
+template <typename F>
+void phys::particle_world::for_each_fixed_constraint(F &&f) {
+	for (distance_constraint * c : fixed_distance_constraints) {
+		f(*c);
+	}
+
+	for (constraint * c : fixed_constraints) {
+		f(*c);
+	}
+}
+
+phys::particle_handle phys::particle_world::add_particle(const particle &p) {
+	return particles.add(p);
 }
 
-void phys::particle_world::remove_particle(particle *p) {
-	std::erase(particles, p);
+void phys::particle_world::remove_particle(particle_handle p) {
+	// Island IDs are slot indices, so wake the particle's island before its slot can be
+	// reused by another particle
+	wake(p);
+	force_registry.remove(p);
+	particles.remove(p);
 }
 
 void phys::particle_world::add_constraint_generator(constraint_generator * generator) {
@@ -125,9 +415,257 @@ void phys::particle_world::remove_constraint_generator(constraint_generator * ge
 }
 
 void phys::particle_world::add_fixed_constraint(constraint * c) {
-	fixed_constraints.push_back(c);
+	if (distance_constraint * d = dynamic_cast<distance_constraint *>(c)) {
+		fixed_distance_constraints.push_back(d);
+	} else {
+		fixed_constraints.push_back(c);
+	}
 }
 
 void phys::particle_world::remove_fixed_constraint(constraint * c) {
-	std::erase(fixed_constraints, c);
+	if (distance_constraint * d = dynamic_cast<distance_constraint *>(c)) {
+		std::erase(fixed_distance_constraints, d);
+	} else {
+		std::erase(fixed_constraints, c);
+	}
+}
+
+void phys::particle_world::set_thread_pool(thread_pool * _pool) {
+	pool = _pool;
+}
+
+void phys::particle_world::set_solver_mode(solver_mode _mode) {
+	mode = _mode;
+}
+
+phys::solver_mode phys::particle_world::get_solver_mode() const {
+	return mode;
+}
+
+void phys::particle_world::set_stiffness_model(stiffness_model _model) {
+	model = _model;
+}
+
+phys::stiffness_model phys::particle_world::get_stiffness_model() const {
+	return model;
+}
+
+void phys::particle_world::set_substeps(size_t _substeps) {
+	substeps = std::max(_substeps, (size_t)1);
+}
+
+size_t phys::particle_world::get_substeps() const {
+	return substeps;
+}
+
+void phys::particle_world::set_sleeping(bool _enabled, real _sleep_speed, real _time_to_sleep) {
+	sleeping_enabled = _enabled;
+	sleep_speed_sqr = _sleep_speed * _sleep_speed;
+	time_to_sleep = _time_to_sleep;
+
+	if (! sleeping_enabled) {
+		wake_all();
+	}
+}
+
+void phys::particle_world::wake(particle_handle p) {
+	if (! particles.is_alive(p) || ! particles.asleep[p]) {
+		return;
+	}
+
+	const uint32_t island = sleeping_island[p.index];
+
+	for (size_t i = 0; i < particles.size(); i++) {
+		if (particles.asleep[i] && sleeping_island[i] == island) {
+			wake_particle(i);
+		}
+	}
+}
+
+void phys::particle_world::wake_all() {
+	for (size_t i = 0; i < particles.size(); i++) {
+		if (particles.asleep[i]) {
+			wake_particle(i);
+		}
+	}
+}
+
+size_t phys::particle_world::get_num_asleep() const {
+	return num_asleep;
+}
+
+void phys::particle_world::wake_touched_islands() {
+	if (! num_asleep) {
+		return;
+	}
+
+	wake_flags.assign(particles.size(), false);
+	bool any_woken = false;
+
+	// Particles with infinite mass don't keep an island awake, but one that has been moved,
+	// like a particle held by the player, pushes or pulls on the particles it's constrained
+	// to. A particle that has been added since the last step counts as moved.
+	const auto has_moved = [&](particle_handle p) {
+		return p.index >= step_end_pos.size() || particles.p[p] != step_end_pos[p.index];
+	};
+
+	const auto mark = [&](constraint &c) {
+		bool has_awake = false;
+		bool has_asleep = false;
+
+		for (particle_handle p : c.get_particles()) {
+			if (particles.inv_mass[p] == 0.0_r) {
+				has_awake |= has_moved(p);
+				continue;
+			}
+
+			has_asleep |= (bool)particles.asleep[p];
+			has_awake |= ! particles.asleep[p];
+		}
+
+		if (! has_awake || ! has_asleep) {
+			return;
+		}
+
+		for (particle_handle p : c.get_particles()) {
+			if (particles.asleep[p]) {
+				wake_flags[sleeping_island[p.index]] = true;
+				any_woken = true;
+			}
+		}
+	};
+
+	for_each_fixed_constraint(mark);
+	collision_constraints.for_each(mark);
+
+	if (any_woken) {
+		for (size_t i = 0; i < particles.size(); i++) {
+			if (particles.asleep[i] && wake_flags[sleeping_island[i]]) {
+				wake_particle(i);
+			}
+		}
+	}
+
+}
+
+void phys::particle_world::gather_constraints() {
+	fixed_distance_batch.clear();
+	fixed_other_batch.clear();
+	generated_other_batch.clear();
+
+	const auto is_awake = [&](constraint &c) {
+		if (! num_asleep) {
+			return true;
+		}
+
+		for (particle_handle p : c.get_particles()) {
+			if (particles.inv_mass[p] != 0.0_r && ! particles.asleep[p]) {
+				return true;
+			}
+		}
+
+		return false;
+	};
+
+	for (distance_constraint * c : fixed_distance_constraints) {
+		if (is_awake(*c)) {
+			fixed_distance_batch.add(*c, inv_solver_iterations);
+		}
+	}
+
+	for (constraint * c : fixed_constraints) {
+		if (is_awake(*c)) {
+			fixed_other_batch.add(c);
+		}
+	}
+
+	for (std::unique_ptr<constraint> &c : collision_constraints.other_constraints) {
+		generated_other_batch.add(c.get());
+	}
+}
+
+void phys::particle_world::update_sleep(real dt) {
+	const size_t num_slots = particles.size();
+	const vec3 * const vel = particles.vel.data();
+	const real * const inv_mass = particles.inv_mass.data();
+	uint8_t * const asleep = particles.asleep.data();
+
+	rest_time.resize(num_slots);
+	sleeping_island.resize(num_slots);
+	island_parent.resize(num_slots);
+	island_rest_time.resize(num_slots);
+
+	for (size_t i = 0; i < num_slots; i++) {
+		island_parent[i] = (uint32_t)i;
+		island_rest_time[i] = infinity;
+	}
+
+	const auto join = [&](const auto &constrained) {
+		uint32_t root = particle_handle::invalid_index;
+
+		for (particle_handle p : constrained) {
+			if (inv_mass[p.index] == 0.0_r || asleep[p.index]) {
+				continue;
+			}
+
+			const uint32_t other = find_island(p.index);
+
+			if (root == particle_handle::invalid_index) {
+				root = other;
+			} else if (other != root) {
+				island_parent[other] = root;
+			}
+		}
+	};
+
+	for_each_batch([&](auto &batch, size_t) {
+		for (size_t i = 0; i < batch.size(); i++) {
+			join(batch.get_particles(i));
+		}
+	});
+
+	// An island can only sleep once its most recently moving particle has been at rest
+	// for long enough
+	for (size_t i = 0; i < num_slots; i++) {
+		if (inv_mass[i] == 0.0_r || asleep[i]) {
+			continue;
+		}
+
+		rest_time[i] = phys::dot(vel[i], vel[i]) < sleep_speed_sqr ? rest_time[i] + dt : 0.0_r;
+
+		real &island_time = island_rest_time[find_island((uint32_t)i)];
+		island_time = std::min(island_time, rest_time[i]);
+	}
+
+	for (size_t i = 0; i < num_slots; i++) {
+		if (inv_mass[i] == 0.0_r || asleep[i]) {
+			continue;
+		}
+
+		const uint32_t island = find_island((uint32_t)i);
+
+		if (island_rest_time[island] >= time_to_sleep) {
+			asleep[i] = true;
+			particles.vel[i] = vec3(0.0_r);
+			sleeping_island[i] = island;
+			num_asleep++;
+		}
+	}
+
+	step_end_pos.assign(particles.pos.data(), particles.pos.data() + num_slots);
+}
+
+void phys::particle_world::wake_particle(size_t i) {
+	particles.asleep[i] = false;
+	rest_time[i] = 0.0_r;
+	num_asleep--;
+}
+
+uint32_t phys::particle_world::find_island(uint32_t i) {
+	while (island_parent[i] != i) {
+		island_parent[i] = island_parent[island_parent[i]];
+		i = island_parent[i];
+	}
+
+	return i;
 }
\ No newline at end of file
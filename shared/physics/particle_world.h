@@ -1,14 +1,29 @@
 #pragma once
+#include <array>
 #include <memory>
 #include <vector>
 #include "constraint.h"
+#include "constraints.h"
 #include "particle.h"
+#include "particle_store.h"
 #include "particle_force_registry.h"
+#include "thread_pool.h"
 
 namespace phys {
+	enum class solver_mode {
+		// Constraints are projected one at a time, and each projection sees the
+		// positions moved by the ones before it
+		GaussSeidel,
+		// Every constraint is projected from the same positions, and the changes to
+		// each particle are averaged at the end of each iteration. Converges more slowly,
+		// but the result doesn't depend on the order of the constraints.
+		Jacobi
+	};
+
 	class particle_world {
 	public:
 		particle_force_registry force_registry{};
+		particle_store particles{};
 
 		particle_world(
 			uint64_t _solver_iterations,
@@ -18,26 +33,139 @@ namespace phys {
 		void prepare_frame();
 		void run_physics(real dt);
 
-		void add_particle(particle * p);
-		void remove_particle(particle * p);
+		// Adds a particle with the same state as `p` and returns its handle
+		particle_handle add_particle(const particle &p);
+		// Removes the particle and any forces registered on it
+		void remove_particle(particle_handle p);
 
+		// Distance constraints are copied into a batch and solved with a dedicated kernel.
+		// Other types of constraints are solved through the `constraint` interface.
 		void add_fixed_constraint(constraint * c);
 		void remove_fixed_constraint(constraint * c);
 
 		void add_constraint_generator(constraint_generator * generator);
 		void remove_constraint_generator(constraint_generator * generator);
 
+		// With a thread pool, the solver splits the constraints into colors such that no two
+		// constraints of the same color share a particle, and projects each color in parallel.
+		// Pass null to go back to solving on the calling thread.
+		void set_thread_pool(thread_pool * _pool);
+
+		void set_solver_mode(solver_mode _mode);
+		solver_mode get_solver_mode() const;
+
+		void set_stiffness_model(stiffness_model _model);
+		stiffness_model get_stiffness_model() const;
+
+		// Splits each call to `run_physics` into this many equal steps, each with the full
+		// number of solver iterations. Forces are evaluated once per call. Substeps are
+		// usually a better use of time than extra iterations, especially with XPBD.
+		void set_substeps(size_t _substeps);
+		size_t get_substeps() const;
+
+		// Groups particles into islands (particles connected through constraints), and puts
+		// an island to sleep once all of its particles have moved slower than `_sleep_speed`
+		// for `_time_to_sleep` seconds. Sleeping particles don't receive forces or move, and
+		// constraints between them are skipped. An island wakes up when an awake particle
+		// collides with it or is constrained to it, or when `wake` is called. Particles with
+		// infinite mass never sleep and don't join islands.
+		void set_sleeping(bool _enabled, real _sleep_speed = (real)0.05, real _time_to_sleep = (real)0.5);
+		// Wakes the island that the particle belongs to, if it is asleep
+		void wake(particle_handle p);
+		void wake_all();
+		size_t get_num_asleep() const;
+
 	private:
-		std::vector<particle *> particles{};
+		// Constraints that don't fit in one of these colors are projected serially, after
+		// the others
+		static constexpr size_t max_colors = 64;
+		static constexpr size_t parallel_chunk_size = 256;
+
+		static constexpr size_t num_batches = 5;
+
 		std::vector<constraint_generator *> constraint_generators{};
+		std::vector<distance_constraint *> fixed_distance_constraints{};
 		std::vector<constraint *> fixed_constraints{};
-		std::vector<std::unique_ptr<constraint>> collision_constraints{};
+		constraint_pool collision_constraints{};
 		size_t solver_iterations;
 		real inv_solver_iterations;
 		real min_pos_change_sqr;
 		bool solve_forward{};
+		solver_mode mode{ solver_mode::GaussSeidel };
+		stiffness_model model{ stiffness_model::PBD };
+		size_t substeps{ 1 };
+
+		bool sleeping_enabled{ false };
+		real sleep_speed_sqr{};
+		real time_to_sleep{};
+		size_t num_asleep{};
+		// How long each particle has been moving slower than the sleep speed
+		std::vector<real> rest_time{};
+		// The island that each sleeping particle went to sleep with
+		std::vector<uint32_t> sleeping_island{};
+		// Union-find forest used to build the islands of awake particles
+		std::vector<uint32_t> island_parent{};
+		std::vector<real> island_rest_time{};
+		std::vector<uint8_t> wake_flags{};
+		// Where the particles were at the end of the last step, used to find particles with
+		// infinite mass that have been moved since then
+		std::vector<vec3> step_end_pos{};
+
+		// The constraints that the solver works on in the current substep, grouped by type.
+		// Fixed constraints are only included if they involve an awake particle. Generated
+		// plane and particle collisions are solved in place, in `collision_constraints`.
+		distance_constraint_batch fixed_distance_batch{};
+		polymorphic_constraint_batch fixed_other_batch{};
+		polymorphic_constraint_batch generated_other_batch{};
+
+		// Where the particles were at the start of the current call to `run_physics`
+		std::vector<vec3> step_start_pos{};
+
+		thread_pool * pool{};
+		// Bit `i` is set if the particle is used by a constraint of color `i`
+		std::vector<uint64_t> particle_colors{};
+		std::vector<uint8_t> constraint_colors{};
+		std::vector<uint32_t> color_order{};
+		// Each batch is sorted by color. The constraints of color `i` in batch `j` are in
+		// [color_offsets[j][i], color_offsets[j][i + 1]), and the last color holds the
+		// constraints that could not be colored.
+		std::array<std::array<size_t, max_colors + 2>, num_batches> color_offsets{};
 
+		// `last` is set for the last substep of a call to `run_physics`
+		void substep(real dt, bool last);
 		void generate_collision_constraints(real dt);
 		void solve_constraints(real dt);
+		void solve_constraints_parallel(const projection_params &params);
+		void solve_constraints_jacobi(const projection_params &params);
+		void apply_accumulated_changes(size_t begin, size_t end);
+		void color_constraints();
+		// Colors and sorts one batch. Colors already given to particles by other batches
+		// are kept.
+		template <typename B>
+		void color_batch(B &batch, size_t j);
+		// Projects a colored batch one color at a time
+		template <typename B>
+		size_t project_by_color(B &batch, size_t j, const projection_params &params, bool forward);
+		// Calls `f(batch, i)` on each constraint batch, in the order that a forward
+		// Gauss-Seidel pass solves them
+		template <typename F>
+		void for_each_batch(F &&f);
+		template <typename F>
+		void for_each_batch_reverse(F &&f);
+		// Calls `f(batch, begin, end)` on the constraints of one color that fall in
+		// [begin, end) when the batches are laid end to end, and returns the sum of the results
+		template <typename F>
+		size_t for_each_in_color(size_t color, size_t begin, size_t end, F &&f);
+		size_t get_color_size(size_t color) const;
+		template <typename F>
+		void for_each_fixed_constraint(F &&f);
+		// Wakes any sleeping island that is constrained to an awake particle, or to a particle
+		// with infinite mass that has moved since the last step
+		void wake_touched_islands();
+		// Fills the batches with the constraints that need to be solved in this substep
+		void gather_constraints();
+		void update_sleep(real dt);
+		void wake_particle(size_t i);
+		uint32_t find_island(uint32_t i);
 	};
 }
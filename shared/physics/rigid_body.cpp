@@ -38,7 +38,16 @@ phys::real phys::rigid_body::get_inv_mass() const {
 }
 
 bool phys::rigid_body::has_finite_mass() const {
-	return inv_mass == 0.0_r;
+	return inv_mass != 0.0_r;
+}
+
+void phys::rigid_body::set_inertia_tensor(const mat3 &inertia_tensor) {
+	inv_inertia_tensor = inverse(inertia_tensor);
+	derived = false;
+}
+
+const phys::mat3& phys::rigid_body::get_inv_inertia_tensor_world() const {
+	return inv_inertia_tensor_world;
 }
 
 void phys::rigid_body::setup() {
@@ -65,19 +74,41 @@ void phys::rigid_body::add_force_at_local(const vec3 &f_world, const vec3 &at_lo
 void phys::rigid_body::calculate_derived_data() {
 	calculate_local_to_world();
 	calculate_inv_inertia_tensor_world();
+	derived_rot = rot;
+	derived = true;
+}
+
+void phys::rigid_body::update_derived_data() {
+	if (!derived || rot != derived_rot) {
+		calculate_derived_data();
+		return;
+	}
+
+	local_to_world[3] = vec4(pos, 1.0_r);
 }
 
 void phys::rigid_body::calculate_local_to_world() {
-	local_to_world[0] = rot * vec4(1.0_r, 0.0_r, 0.0_r, 0.0_r);
-	local_to_world[1] = rot * vec4(0.0_r, 1.0_r, 0.0_r, 0.0_r);
-	local_to_world[2] = rot * vec4(0.0_r, 0.0_r, 1.0_r, 0.0_r);
+	local_to_world = mat4(glm::mat3_cast(rot));
 	local_to_world[3] = vec4(pos, 1.0_r);
 }
 
 void phys::rigid_body::calculate_inv_inertia_tensor_world() {
 	mat3 local_to_world_rot = truncate(local_to_world);
 
-	inv_inertia_tensor_world = local_to_world_rot * inv_inertia_tensor * inverse(local_to_world_rot);
+	// The inverse of a rotation is its transpose
+	inv_inertia_tensor_world = local_to_world_rot * inv_inertia_tensor * transpose(local_to_world_rot);
+}
+
+void phys::rigid_body::update_damping_factors(real dt) {
+	if (dt == damping_dt && linear_damping == damped_linear && angular_damping == damped_angular) {
+		return;
+	}
+
+	damping_dt = dt;
+	damped_linear = linear_damping;
+	damped_angular = angular_damping;
+	linear_damping_factor = std::pow(linear_damping, dt);
+	angular_damping_factor = std::pow(angular_damping, dt);
 }
 
 void phys::rigid_body::integrate(real dt) {
@@ -88,9 +119,18 @@ void phys::rigid_body::integrate(real dt) {
 	vel += prev_acc * dt;
 	ang_vel += ang_acc * dt;
 
-	vel *= std::pow(linear_damping, dt);
-	ang_vel *= std::pow(angular_damping, dt);
+	update_damping_factors(dt);
+	vel *= linear_damping_factor;
+	ang_vel *= angular_damping_factor;
 
-	calculate_derived_data();
+	update_derived_data();
 	setup();
 }
+
+void phys::rigid_body::integrate_position(real dt) {
+	pos += vel * dt;
+	rot += quat(0.0_r, ang_vel * dt) * rot * 0.5_r;
+	rot = normalize(rot);
+
+	calculate_derived_data();
+}
\ No newline at end of file
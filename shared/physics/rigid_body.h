@@ -7,7 +7,7 @@ namespace phys {
 		vec3 pos{};
 		vec3 vel{};
 		vec3 acc{};
-		quat rot{};
+		quat rot{ identity<quat>() };
 		vec3 ang_vel{};
 		real linear_damping;
 		real angular_damping;
@@ -18,22 +18,45 @@ namespace phys {
 		real get_mass() const;
 		real get_inv_mass() const;
 		bool has_finite_mass() const;
+		// The inertia tensor in the body's local frame
+		void set_inertia_tensor(const mat3 &inertia_tensor);
+		// The inverse inertia tensor in world space, as of the last call to
+		// `calculate_derived_data`
+		const mat3& get_inv_inertia_tensor_world() const;
 		void setup();
 		void calculate_derived_data();
 		void add_force(const vec3 &f);
 		void add_force_at_world(const vec3 &f_world, const vec3 &at_world);
 		void add_force_at_local(const vec3 &f_world, const vec3 &at_local);
+		// Applies the accumulated forces to the velocities
 		void integrate(real dt);
+		// Moves and rotates the body by its velocities
+		void integrate_position(real dt);
 
 	private:
+		friend class rigid_body_batch;
+
 		mat4 local_to_world;
 		mat3 inv_inertia_tensor;
 		mat3 inv_inertia_tensor_world;
 		vec3 force{};
 		vec3 torque{};
 		real inv_mass;
+		// `pow(damping, dt)` for the damping and time step that they were last computed
+		// with, which rarely change
+		real damping_dt{};
+		real damped_linear{};
+		real damped_angular{};
+		real linear_damping_factor{ 1 };
+		real angular_damping_factor{ 1 };
+		// The rotation that the derived data was last calculated from, if it still holds
+		quat derived_rot{};
+		bool derived{};
 
 		void calculate_local_to_world();
 		void calculate_inv_inertia_tensor_world();
+		void update_damping_factors(real dt);
+		// Calculates the derived data, unless only the position changed since the last time
+		void update_derived_data();
 	};
 }
@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include "rigid_body_batch.h"
+#include "simd.h"
+
+using namespace phys::literals;
+
+namespace {
+	// One body per iteration
+	struct scalar_lanes {
+		using type = phys::real;
+
+		static type load(const phys::real * p) { return *p; }
+		static void store(phys::real * p, type a) { *p = a; }
+		static type set1(phys::real a) { return a; }
+		static type add(type a, type b) { return a + b; }
+		static type sub(type a, type b) { return a - b; }
+		static type mul(type a, type b) { return a * b; }
+		static type div(type a, type b) { return a / b; }
+		static type sqrt(type a) { return std::sqrt(a); }
+	};
+
+#ifdef PHYS_SIMD
+	// One body per SIMD lane
+	struct wide_lanes {
+		using type = phys::simd::floats;
+
+		static inline constexpr size_t width = phys::simd::width;
+
+		static type load(const phys::real * p) { return phys::simd::load(p); }
+		static void store(phys::real * p, type a) { phys::simd::store(p, a); }
+		static type set1(phys::real a) { return phys::simd::set1(a); }
+		static type add(type a, type b) { return phys::simd::add(a, b); }
+		static type sub(type a, type b) { return phys::simd::sub(a, b); }
+		static type mul(type a, type b) { return phys::simd::mul(a, b); }
+		static type div(type a, type b) { return phys::simd::div(a, b); }
+		static type sqrt(type a) { return phys::simd::sqrt(a); }
+	};
+#endif
+}
+
+void phys::rigid_body_batch::integrate(std::span<rigid_body * const> bodies, real dt, size_t begin, size_t end) {
+	assert(end <= bodies.size());
+
+	for (size_t i = begin; i < end; i++) {
+		bodies[i]->integrate(dt);
+	}
+}
+
+void phys::rigid_body_batch::integrate_position(std::span<rigid_body * const> bodies, real dt, size_t begin, size_t end) {
+	assert(end <= bodies.size());
+
+	alignas(32) tile t;
+
+	const auto at = [&](size_t f, size_t j) -> real& {
+		return t[f * tile_size + j];
+	};
+
+	for (size_t first = begin; first < end; first += tile_size) {
+		const size_t n = std::min(tile_size, end - first);
+
+		for (size_t j = 0; j < n; j++) {
+			rigid_body &b = *bodies[first + j];
+
+			b.pos += b.vel * dt;
+
+			at(rot_x, j) = b.rot.x;
+			at(rot_y, j) = b.rot.y;
+			at(rot_z, j) = b.rot.z;
+			at(rot_w, j) = b.rot.w;
+
+			for (size_t k = 0; k < 3; k++) {
+				at(ang_vel_x + k, j) = b.ang_vel[(int)k];
+			}
+
+			for (size_t k = 0; k < 9; k++) {
+				at(inv_inertia + k, j) = b.inv_inertia_tensor[(int)(k / 3)][(int)(k % 3)];
+			}
+		}
+
+		size_t j = 0;
+
+#ifdef PHYS_SIMD
+		for (; j + wide_lanes::width <= n; j += wide_lanes::width) {
+			rotate_lanes<wide_lanes>(t.data(), j, dt);
+		}
+#endif
+
+		for (; j < n; j++) {
+			rotate_lanes<scalar_lanes>(t.data(), j, dt);
+		}
+
+		for (j = 0; j < n; j++) {
+			rigid_body &b = *bodies[first + j];
+
+			b.rot = quat::wxyz(at(rot_w, j), at(rot_x, j), at(rot_y, j), at(rot_z, j));
+
+			for (size_t c = 0; c < 3; c++) {
+				b.local_to_world[(int)c] = vec4(at(rot_matrix + c * 3, j), at(rot_matrix + c * 3 + 1, j), at(rot_matrix + c * 3 + 2, j), 0.0_r);
+
+				for (size_t r = 0; r < 3; r++) {
+					b.inv_inertia_tensor_world[(int)c][(int)r] = at(inv_inertia_world + c * 3 + r, j);
+				}
+			}
+
+			b.local_to_world[3] = vec4(b.pos, 1.0_r);
+			b.derived_rot = b.rot;
+			b.derived = true;
+		}
+	}
+}
+
+template <typename Lanes>
+void phys::rigid_body_batch::rotate_lanes(real * t, size_t i, real dt) {
+	using L = Lanes;
+	using T = typename L::type;
+
+	const auto get = [&](size_t f) {
+		return L::load(t + f * tile_size + i);
+	};
+	const auto put = [&](size_t f, T val) {
+		L::store(t + f * tile_size + i, val);
+	};
+
+	const T step = L::set1(dt);
+	const T half = L::set1(0.5_r);
+
+	// rot += quat(0, ang_vel * dt) * rot * 0.5
+	const T px = L::mul(get(ang_vel_x), step);
+	const T py = L::mul(get(ang_vel_y), step);
+	const T pz = L::mul(get(ang_vel_z), step);
+	const T x = get(rot_x);
+	const T y = get(rot_y);
+	const T z = get(rot_z);
+	const T w = get(rot_w);
+	const T dw = L::sub(L::sub(L::sub(L::set1(0.0_r), L::mul(px, x)), L::mul(py, y)), L::mul(pz, z));
+	const T dx = L::sub(L::add(L::mul(px, w), L::mul(py, z)), L::mul(pz, y));
+	const T dy = L::sub(L::add(L::mul(py, w), L::mul(pz, x)), L::mul(px, z));
+	const T dz = L::sub(L::add(L::mul(pz, w), L::mul(px, y)), L::mul(py, x));
+	const T nx = L::add(x, L::mul(dx, half));
+	const T ny = L::add(y, L::mul(dy, half));
+	const T nz = L::add(z, L::mul(dz, half));
+	const T nw = L::add(w, L::mul(dw, half));
+	const T len = L::sqrt(L::add(L::add(L::mul(nw, nw), L::mul(nx, nx)), L::add(L::mul(ny, ny), L::mul(nz, nz))));
+	const T inv_len = L::div(L::set1(1.0_r), len);
+
+	put(rot_x, L::mul(nx, inv_len));
+	put(rot_y, L::mul(ny, inv_len));
+	put(rot_z, L::mul(nz, inv_len));
+	put(rot_w, L::mul(nw, inv_len));
+
+	derive_lanes<Lanes>(t, i);
+}
+
+template <typename Lanes>
+void phys::rigid_body_batch::derive_lanes(real * t, size_t i) {
+	using L = Lanes;
+	using T = typename L::type;
+
+	const auto get = [&](size_t f) {
+		return L::load(t + f * tile_size + i);
+	};
+	const auto put = [&](size_t f, T val) {
+		L::store(t + f * tile_size + i, val);
+	};
+
+	const T one = L::set1(1.0_r);
+	const T two = L::set1(2.0_r);
+	const T x = get(rot_x);
+	const T y = get(rot_y);
+	const T z = get(rot_z);
+	const T w = get(rot_w);
+	const T xx = L::mul(x, x);
+	const T yy = L::mul(y, y);
+	const T zz = L::mul(z, z);
+	const T xz = L::mul(x, z);
+	const T xy = L::mul(x, y);
+	const T yz = L::mul(y, z);
+	const T wx = L::mul(w, x);
+	const T wy = L::mul(w, y);
+	const T wz = L::mul(w, z);
+
+	// Same as `glm::mat3_cast`
+	const T rot[9] = {
+		L::sub(one, L::mul(two, L::add(yy, zz))),
+		L::mul(two, L::add(xy, wz)),
+		L::mul(two, L::sub(xz, wy)),
+		L::mul(two, L::sub(xy, wz)),
+		L::sub(one, L::mul(two, L::add(xx, zz))),
+		L::mul(two, L::add(yz, wx)),
+		L::mul(two, L::add(xz, wy)),
+		L::mul(two, L::sub(yz, wx)),
+		L::sub(one, L::mul(two, L::add(xx, yy)))
+	};
+
+	for (size_t k = 0; k < 9; k++) {
+		put(rot_matrix + k, rot[k]);
+	}
+
+	// rot * inv_inertia * transpose(rot), where entry (c, r) of a matrix is in column c
+	// and row r
+	T rot_inertia[9]{};
+
+	for (size_t c = 0; c < 3; c++) {
+		for (size_t r = 0; r < 3; r++) {
+			T sum = L::mul(rot[0 * 3 + r], get(inv_inertia + c * 3 + 0));
+
+			sum = L::add(sum, L::mul(rot[1 * 3 + r], get(inv_inertia + c * 3 + 1)));
+			sum = L::add(sum, L::mul(rot[2 * 3 + r], get(inv_inertia + c * 3 + 2)));
+			rot_inertia[c * 3 + r] = sum;
+		}
+	}
+
+	for (size_t c = 0; c < 3; c++) {
+		for (size_t r = 0; r < 3; r++) {
+			T sum = L::mul(rot_inertia[0 * 3 + r], rot[0 * 3 + c]);
+
+			sum = L::add(sum, L::mul(rot_inertia[1 * 3 + r], rot[1 * 3 + c]));
+			sum = L::add(sum, L::mul(rot_inertia[2 * 3 + r], rot[2 * 3 + c]));
+			put(inv_inertia_world + c * 3 + r, sum);
+		}
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <array>
+#include <span>
+#include "math.h"
+#include "rigid_body.h"
+
+namespace phys {
+	// Integrates many rigid bodies at once, like calling `rigid_body::integrate` or
+	// `rigid_body::integrate_position` on each of them. Body `i` of the batch is `bodies[i]`.
+	//
+	// Velocities take a few operations each, and a body only recalculates its derived data
+	// in `integrate` when its rotation changed, so `integrate` goes through the bodies one
+	// at a time. `integrate_position` changes every rotation. It copies the bodies in small
+	// tiles into one array per component (each coordinate of the rotation and angular
+	// velocity, each entry of each matrix), so that each iteration of the loop that rotates
+	// them and recalculates their matrices handles as many bodies as there are SIMD lanes,
+	// and then copies them back. A tile fits in the L1 cache.
+	class rigid_body_batch {
+	public:
+		// Integrates bodies [begin, end). Disjoint ranges can be integrated in parallel.
+		void integrate(std::span<rigid_body * const> bodies, real dt, size_t begin, size_t end);
+		void integrate_position(std::span<rigid_body * const> bodies, real dt, size_t begin, size_t end);
+
+	private:
+		// Bodies per tile, a multiple of every SIMD width
+		static constexpr size_t tile_size = 64;
+
+		// Where each component's array starts in a tile, in multiples of `tile_size`.
+		// Matrices are column-major, like glm.
+		enum field : size_t {
+			rot_x, rot_y, rot_z, rot_w,
+			ang_vel_x, ang_vel_y, ang_vel_z,
+			inv_inertia,
+			inv_inertia_world = inv_inertia + 9,
+			// The rotation as a matrix
+			rot_matrix = inv_inertia_world + 9,
+			num_fields = rot_matrix + 9
+		};
+
+		using tile = std::array<real, num_fields * tile_size>;
+
+		// Integrates the rotation and computes the derived data from it
+		template <typename Lanes>
+		static void rotate_lanes(real * t, size_t i, real dt);
+		// Computes the rotation matrix and world inverse inertia tensor from the rotation
+		template <typename Lanes>
+		static void derive_lanes(real * t, size_t i);
+	};
+}
@@ -0,0 +1,365 @@
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include "rigid_body_world.h"
+
+phys::rigid_body_world::rigid_body_world(real _margin) :
+	tree(_margin)
+{}
+
+void phys::rigid_body_world::add_body(rigid_body * body) {
+	body_indices[body] = (uint32_t)bodies.size();
+	bodies.push_back(body);
+}
+
+void phys::rigid_body_world::remove_body(rigid_body * body) {
+	std::erase(bodies, body);
+	body_indices.clear();
+
+	for (size_t i = 0; i < bodies.size(); i++) {
+		body_indices[bodies[i]] = (uint32_t)i;
+	}
+
+	manifolds.forget_body(body);
+	std::erase_if(forces, [&](const body_force &f) {
+		return f.body == body;
+	});
+}
+
+void phys::rigid_body_world::add_primitive(primitive * p) {
+	const std::optional<aabb> bounds = p->bounds();
+
+	manifolds.forget_body(p->body);
+
+	if (bounds) {
+		bounded.push_back(p);
+		tree.insert(p, *bounds);
+	} else {
+		unbounded.push_back(p);
+	}
+}
+
+void phys::rigid_body_world::remove_primitive(primitive * p) {
+	manifolds.forget_body(p->body);
+
+	if (tree.remove(p)) {
+		std::erase(bounded, p);
+	} else {
+		std::erase(unbounded, p);
+	}
+}
+
+void phys::rigid_body_world::add_force_generator(rigid_body * body, rigid_body_force_generator * generator) {
+	forces.push_back({ body, generator });
+}
+
+void phys::rigid_body_world::remove_force_generator(rigid_body * body, rigid_body_force_generator * generator) {
+	std::erase_if(forces, [&](const body_force &f) {
+		return f.body == body && f.generator == generator;
+	});
+}
+
+void phys::rigid_body_world::set_contact_resolver(contact_resolver * _resolver) {
+	resolver = _resolver;
+}
+
+void phys::rigid_body_world::set_thread_pool(thread_pool * _pool) {
+	pool = _pool;
+}
+
+void phys::rigid_body_world::run_physics(real dt) {
+	for (const body_force &f : forces) {
+		f.generator->update_force(*f.body, dt);
+	}
+
+	integrate(dt);
+	update_broadphase();
+	find_candidate_pairs();
+	generate_contacts();
+
+	if (resolver && pool) {
+		partition_contacts();
+		resolver->resolve_islands(island_contacts, partition, *pool, dt);
+	} else if (resolver) {
+		resolver->resolve_contacts(contacts, dt);
+	}
+
+	integrate_positions(dt);
+}
+
+const phys::contact_container& phys::rigid_body_world::get_contacts() const {
+	return contacts;
+}
+
+const phys::contact_partition& phys::rigid_body_world::get_contact_partition() const {
+	return partition;
+}
+
+const phys::contact_container& phys::rigid_body_world::get_island_contacts() const {
+	return island_contacts;
+}
+
+void phys::rigid_body_world::integrate(real dt) {
+	if (pool) {
+		pool->parallel_for(bodies.size(), integration_chunk_size, [&](size_t begin, size_t end) {
+			batch.integrate(bodies, dt, begin, end);
+		});
+	} else {
+		batch.integrate(bodies, dt, 0, bodies.size());
+	}
+}
+
+void phys::rigid_body_world::integrate_positions(real dt) {
+	if (pool) {
+		pool->parallel_for(bodies.size(), integration_chunk_size, [&](size_t begin, size_t end) {
+			batch.integrate_position(bodies, dt, begin, end);
+		});
+	} else {
+		batch.integrate_position(bodies, dt, 0, bodies.size());
+	}
+}
+
+void phys::rigid_body_world::update_broadphase() {
+	bounds_updates.clear();
+
+	for (primitive * p : bounded) {
+		bounds_updates.push_back({ p, *p->bounds() });
+	}
+
+	tree.update_many(bounds_updates);
+}
+
+void phys::rigid_body_world::find_candidate_pairs() {
+	coarse_pairs.clear();
+	candidates.clear();
+
+	if (pool) {
+		tree.generate_coarse_collisions(coarse_pairs, *pool);
+	} else {
+		tree.generate_coarse_collisions(coarse_pairs);
+	}
+
+	for (const auto &pair : coarse_pairs) {
+		if (can_collide(*pair.id1, *pair.id2)) {
+			candidates.push_back(body_order(pair.id1, pair.id2));
+		}
+	}
+
+	for (primitive * u : unbounded) {
+		for (primitive * p : bounded) {
+			if (can_collide(*p, *u)) {
+				candidates.push_back(body_order(p, u));
+			}
+		}
+	}
+
+	// The broadphase finds pairs in an order that depends on the shape of the tree, and
+	// on timing with a thread pool. Sorting them keeps the contacts in the same order,
+	// and puts the pairs of each pair of bodies next to each other for the manifolds.
+	std::sort(std::begin(candidates), std::end(candidates), [](const primitive_pair &x, const primitive_pair &y) {
+		const std::less<void> less{};
+
+		if (x.a->body != y.a->body) {
+			return less(x.a->body, y.a->body);
+		}
+
+		if (x.b->body != y.b->body) {
+			return less(x.b->body, y.b->body);
+		}
+
+		return less(x.a, y.a) || (x.a == y.a && less(x.b, y.b));
+	});
+}
+
+void phys::rigid_body_world::generate_contacts() {
+	const size_t num_body_pairs = manifolds.begin_step(candidates);
+	const size_t num_chunks = (num_body_pairs + narrowphase_chunk_size - 1) / narrowphase_chunk_size;
+
+	if (chunk_contacts.size() < num_chunks) {
+		chunk_contacts.resize(num_chunks);
+	}
+
+	const auto update_chunk = [&](size_t chunk) {
+		const size_t begin = chunk * narrowphase_chunk_size;
+
+		manifolds.update(begin, std::min(begin + narrowphase_chunk_size, num_body_pairs), collider, chunk_contacts[chunk]);
+	};
+
+	if (pool) {
+		pool->parallel_for(num_chunks, 1, [&](size_t begin, size_t end) {
+			for (size_t chunk = begin; chunk < end; chunk++) {
+				update_chunk(chunk);
+			}
+		});
+	} else {
+		for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+			update_chunk(chunk);
+		}
+	}
+
+	contacts.clear();
+	manifolds.end_step(contacts);
+}
+
+void phys::rigid_body_world::partition_contacts() {
+	const size_t num_bodies = bodies.size();
+
+	island_parent.resize(num_bodies);
+	contact_bodies.clear();
+
+	for (size_t i = 0; i < num_bodies; i++) {
+		island_parent[i] = (uint32_t)i;
+	}
+
+	const auto index_of = [&](const rigid_body * body) {
+		if (! body->has_finite_mass()) {
+			return no_body;
+		}
+
+		const auto it = body_indices.find(body);
+
+		return it == std::end(body_indices) ? no_body : it->second;
+	};
+
+	for (const contact &c : contacts) {
+		const std::array<uint32_t, 2> &ends = contact_bodies.emplace_back(std::array<uint32_t, 2>{ index_of(c.a), index_of(c.b) });
+
+		if (ends[0] != no_body && ends[1] != no_body) {
+			const uint32_t root_a = find_island(ends[0]);
+			const uint32_t root_b = find_island(ends[1]);
+
+			if (root_a != root_b) {
+				island_parent[root_b] = root_a;
+			}
+		}
+	}
+
+	// Each island is named after the body at its root. Contacts between bodies that
+	// don't join islands touch nothing that moves, and go in an island of their own.
+	contact_islands.clear();
+	island_starts.assign(num_bodies + 2, 0);
+
+	for (const std::array<uint32_t, 2> &ends : contact_bodies) {
+		const uint32_t body = ends[0] != no_body ? ends[0] : ends[1];
+		const uint32_t island = body != no_body ? find_island(body) : (uint32_t)num_bodies;
+
+		contact_islands.push_back(island);
+		island_starts[island + 1]++;
+	}
+
+	partition.island_offsets.clear();
+	partition.color_offsets.clear();
+	partition.split_island = 0;
+
+	size_t largest = 0;
+
+	for (size_t i = 0; i <= num_bodies; i++) {
+		const size_t size = island_starts[i + 1];
+
+		if (size) {
+			if (size > largest) {
+				largest = size;
+				partition.split_island = partition.island_offsets.size();
+			}
+
+			partition.island_offsets.push_back(island_starts[i]);
+		}
+
+		island_starts[i + 1] += island_starts[i];
+	}
+
+	partition.island_offsets.push_back(contacts.size());
+
+	// Sort the contacts by island, keeping the relative order of the contacts within an
+	// island
+	island_contacts.assign(std::begin(contacts), std::end(contacts));
+	contact_slots.resize(contacts.size());
+
+	for (size_t i = 0; i < contacts.size(); i++) {
+		const size_t slot = island_starts[contact_islands[i]]++;
+
+		island_contacts[slot] = contacts[i];
+		contact_slots[i] = slot;
+	}
+
+	if (contacts.empty()) {
+		return;
+	}
+
+	// Greedy coloring of the largest island: each contact gets the lowest color that
+	// none of its bodies have been given yet
+	const size_t first = partition.island_offsets[partition.split_island];
+	const size_t last = partition.island_offsets[partition.split_island + 1];
+	std::array<size_t, max_colors + 2> offsets{};
+
+	body_colors.assign(num_bodies, 0);
+	contact_colors.assign(last - first, 0);
+
+	for (size_t i = 0; i < contacts.size(); i++) {
+		const size_t slot = contact_slots[i];
+
+		if (slot < first || slot >= last) {
+			continue;
+		}
+
+		uint64_t used = 0;
+
+		for (uint32_t body : contact_bodies[i]) {
+			if (body != no_body) {
+				used |= body_colors[body];
+			}
+		}
+
+		const size_t color = (size_t)std::countr_one(used);
+
+		if (color < max_colors) {
+			for (uint32_t body : contact_bodies[i]) {
+				if (body != no_body) {
+					body_colors[body] |= (uint64_t(1) << color);
+				}
+			}
+		}
+
+		contact_colors[slot - first] = (uint8_t)color;
+		offsets[color + 1]++;
+	}
+
+	for (size_t i = 1; i < offsets.size(); i++) {
+		offsets[i] += offsets[i - 1];
+	}
+
+	// Sort the largest island by color, keeping the relative order of the contacts
+	// within a color
+	std::array<size_t, max_colors + 2> next = offsets;
+
+	uncolored_contacts.assign(std::begin(island_contacts) + (ptrdiff_t)first, std::begin(island_contacts) + (ptrdiff_t)last);
+
+	for (size_t i = 0; i < uncolored_contacts.size(); i++) {
+		island_contacts[first + next[contact_colors[i]]++] = uncolored_contacts[i];
+	}
+
+	for (size_t offset : offsets) {
+		partition.color_offsets.push_back(first + offset);
+	}
+}
+
+uint32_t phys::rigid_body_world::find_island(uint32_t i) {
+	while (island_parent[i] != i) {
+		island_parent[i] = island_parent[island_parent[i]];
+		i = island_parent[i];
+	}
+
+	return i;
+}
+
+phys::primitive_pair phys::rigid_body_world::body_order(primitive * a, primitive * b) {
+	if (std::less<rigid_body *>{}(b->body, a->body)) {
+		return { b, a };
+	}
+
+	return { a, b };
+}
+
+bool phys::rigid_body_world::can_collide(const primitive &a, const primitive &b) {
+	return a.body != b.body && (a.body->has_finite_mass() || b.body->has_finite_mass());
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+#include "collision/bvh.h"
+#include "collision/contact_generator.h"
+#include "collision/contact_manifold.h"
+#include "contact_resolver.h"
+#include "rigid_body.h"
+#include "rigid_body_batch.h"
+#include "rigid_body_force_generator.h"
+#include "thread_pool.h"
+
+namespace phys {
+	// Steps a set of rigid bodies and the primitives attached to them. Each step applies
+	// forces, finds contacts, hands them to the resolver, and then moves the bodies. The
+	// bodies are integrated together in a `rigid_body_batch`.
+	//
+	// Contacts are found in two phases. The bounds of the primitives are kept in a BVH,
+	// whose overlapping pairs are passed to `collider`. Unbounded primitives (like planes)
+	// are tested against every bounded primitive. Primitives on the same body, or on
+	// two bodies with infinite mass, are never tested against each other. The contacts of
+	// each pair of bodies are kept in `manifolds` from step to step, which skips the
+	// narrowphase for bodies that have barely moved relative to each other.
+	//
+	// The world doesn't own anything that is added to it.
+	class rigid_body_world {
+	public:
+		contact_generator collider{};
+		contact_manifold_cache manifolds{};
+
+		// `_margin` is how far the broadphase bounds of the primitives extend past the
+		// primitives themselves
+		explicit rigid_body_world(real _margin = (real)0.1);
+
+		void add_body(rigid_body * body);
+		// Removes the body and its forces. Its primitives must be removed separately.
+		void remove_body(rigid_body * body);
+
+		void add_primitive(primitive * p);
+		void remove_primitive(primitive * p);
+
+		void add_force_generator(rigid_body * body, rigid_body_force_generator * generator);
+		void remove_force_generator(rigid_body * body, rigid_body_force_generator * generator);
+
+		// Pass null to leave contacts unresolved
+		void set_contact_resolver(contact_resolver * _resolver);
+
+		// With a thread pool, the bodies are integrated in parallel chunks, the broadphase
+		// pairs are found in parallel, and the body pairs are split into chunks whose
+		// manifolds are updated in parallel. Contacts come out in the same order with or
+		// without a pool. Pass null to go back to running on the calling thread.
+		//
+		// The contacts are also split into islands (bodies connected through contacts) for
+		// the resolver, so that it can resolve them in parallel. Bodies with infinite mass
+		// don't join islands. The largest island is split again into colors, such that no
+		// two contacts of the same color share a body with finite mass. Every body with
+		// finite mass that has a contact must have been added to the world.
+		void set_thread_pool(thread_pool * _pool);
+
+		void run_physics(real dt);
+
+		// The contacts found in the last step
+		const contact_container& get_contacts() const;
+		// How the contacts were split up for the resolver in the last step, if it had a
+		// thread pool and a resolver. The offsets are into `get_island_contacts`.
+		const contact_partition& get_contact_partition() const;
+		// The contacts of the last step, sorted as described by `get_contact_partition`
+		const contact_container& get_island_contacts() const;
+
+	private:
+		using broadphase = bvh<aabb, primitive *>;
+
+		// Body pairs per parallel chunk
+		static constexpr size_t narrowphase_chunk_size = 256;
+		// Bodies per parallel chunk
+		static constexpr size_t integration_chunk_size = 1024;
+		// Contacts that don't fit in one of these colors go in one last color, which is
+		// resolved serially
+		static constexpr size_t max_colors = 64;
+		// Stands for bodies that don't join islands
+		static constexpr uint32_t no_body = std::numeric_limits<uint32_t>::max();
+
+		struct body_force {
+			rigid_body * body{};
+			rigid_body_force_generator * generator{};
+		};
+
+		std::vector<rigid_body *> bodies{};
+		// The index of each body in `bodies`
+		std::unordered_map<const rigid_body *, uint32_t> body_indices{};
+		rigid_body_batch batch{};
+		std::vector<body_force> forces{};
+		std::vector<primitive *> bounded{};
+		std::vector<primitive *> unbounded{};
+		contact_resolver * resolver{};
+		thread_pool * pool{};
+
+		broadphase tree;
+		std::vector<typename broadphase::volume_update> bounds_updates{};
+		std::vector<typename broadphase::coarse_collision_pair> coarse_pairs{};
+		std::vector<primitive_pair> candidates{};
+		// Narrowphase scratch space for each chunk of body pairs, kept between steps so
+		// that its storage is reused
+		std::vector<contact_container> chunk_contacts{};
+		contact_container contacts{};
+
+		// Union-find forest used to build the islands of bodies
+		std::vector<uint32_t> island_parent{};
+		// The indices of the two bodies of each contact, the island of each contact, and
+		// where each contact went in `island_contacts`
+		std::vector<std::array<uint32_t, 2>> contact_bodies{};
+		std::vector<uint32_t> contact_islands{};
+		std::vector<size_t> contact_slots{};
+		// The start of each island in `island_contacts`, by the body at its root
+		std::vector<size_t> island_starts{};
+		// Bit `i` is set if the body is in a contact of color `i`
+		std::vector<uint64_t> body_colors{};
+		std::vector<uint8_t> contact_colors{};
+		contact_partition partition{};
+		contact_container island_contacts{};
+		// The largest island before it is sorted by color
+		contact_container uncolored_contacts{};
+
+		void integrate(real dt);
+		void integrate_positions(real dt);
+		void update_broadphase();
+		void find_candidate_pairs();
+		void generate_contacts();
+		// Sorts the contacts into islands and colors for the resolver
+		void partition_contacts();
+		uint32_t find_island(uint32_t i);
+
+		// Puts the primitive on the body with the lower address first
+		static primitive_pair body_order(primitive * a, primitive * b);
+		static bool can_collide(const primitive &a, const primitive &b);
+	};
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Thin wrappers over SSE and AVX intrinsics, so that a kernel can be written once for
+// whichever vector width the build targets. The widest instruction set that the compiler
+// is allowed to use is picked at compile time. MSVC only defines __AVX__ when building with
+// /arch:AVX or higher, and every x64 CPU has SSE2. Without either, `PHYS_SIMD` is not
+// defined and kernels should fall back to scalar code.
+#if defined(__AVX__)
+#define PHYS_SIMD_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PHYS_SIMD_SSE
+#include <emmintrin.h>
+#endif
+
+#if defined(PHYS_SIMD_AVX) || defined(PHYS_SIMD_SSE)
+#define PHYS_SIMD
+#endif
+
+namespace phys::simd {
+#if defined(PHYS_SIMD_AVX)
+	using floats = __m256;
+
+	inline constexpr size_t width = 8;
+
+	inline floats load(const float * p) { return _mm256_load_ps(p); }
+	inline floats loadu(const float * p) { return _mm256_loadu_ps(p); }
+	inline void store(float * p, floats a) { _mm256_store_ps(p, a); }
+	inline void storeu(float * p, floats a) { _mm256_storeu_ps(p, a); }
+	inline floats set1(float a) { return _mm256_set1_ps(a); }
+	inline floats zero() { return _mm256_setzero_ps(); }
+	inline floats add(floats a, floats b) { return _mm256_add_ps(a, b); }
+	inline floats sub(floats a, floats b) { return _mm256_sub_ps(a, b); }
+	inline floats mul(floats a, floats b) { return _mm256_mul_ps(a, b); }
+	inline floats div(floats a, floats b) { return _mm256_div_ps(a, b); }
+	inline floats sqrt(floats a) { return _mm256_sqrt_ps(a); }
+	// Builds a vector from `f(0)` through `f(7)`. Building it in registers avoids the stall
+	// of loading a vector right after writing its lanes to memory one at a time.
+	template <typename F>
+	inline floats gather(F &&f) { return _mm256_setr_ps(f(0), f(1), f(2), f(3), f(4), f(5), f(6), f(7)); }
+	inline floats neq(floats a, floats b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+	inline floats bit_and(floats a, floats b) { return _mm256_and_ps(a, b); }
+	// `a` where `mask` is set, and `b` elsewhere
+	inline floats select(floats mask, floats a, floats b) { return _mm256_blendv_ps(b, a, mask); }
+	// Bit `i` is set if lane `i` of `mask` is set
+	inline uint32_t bits(floats mask) { return (uint32_t)_mm256_movemask_ps(mask); }
+#elif defined(PHYS_SIMD_SSE)
+	using floats = __m128;
+
+	inline constexpr size_t width = 4;
+
+	inline floats load(const float * p) { return _mm_load_ps(p); }
+	inline floats loadu(const float * p) { return _mm_loadu_ps(p); }
+	inline void store(float * p, floats a) { _mm_store_ps(p, a); }
+	inline void storeu(float * p, floats a) { _mm_storeu_ps(p, a); }
+	inline floats set1(float a) { return _mm_set1_ps(a); }
+	inline floats zero() { return _mm_setzero_ps(); }
+	inline floats add(floats a, floats b) { return _mm_add_ps(a, b); }
+	inline floats sub(floats a, floats b) { return _mm_sub_ps(a, b); }
+	inline floats mul(floats a, floats b) { return _mm_mul_ps(a, b); }
+	inline floats div(floats a, floats b) { return _mm_div_ps(a, b); }
+	inline floats sqrt(floats a) { return _mm_sqrt_ps(a); }
+	// Builds a vector from `f(0)` through `f(3)`. Building it in registers avoids the stall
+	// of loading a vector right after writing its lanes to memory one at a time.
+	template <typename F>
+	inline floats gather(F &&f) { return _mm_setr_ps(f(0), f(1), f(2), f(3)); }
+	inline floats neq(floats a, floats b) { return _mm_cmpneq_ps(a, b); }
+	inline floats bit_and(floats a, floats b) { return _mm_and_ps(a, b); }
+	// `a` where `mask` is set, and `b` elsewhere. SSE2 has no blend instruction.
+	inline floats select(floats mask, floats a, floats b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+	// Bit `i` is set if lane `i` of `mask` is set
+	inline uint32_t bits(floats mask) { return (uint32_t)_mm_movemask_ps(mask); }
+#else
+	inline constexpr size_t width = 1;
+#endif
+
+#ifdef PHYS_SIMD
+	// Four lanes, whatever `width` is. For data that comes in fours, like the children of
+	// a 4-wide tree node.
+	using floats4 = __m128;
+
+	inline floats4 load4(const float * p) { return _mm_load_ps(p); }
+	inline floats4 set4(float a) { return _mm_set1_ps(a); }
+	inline floats4 le(floats4 a, floats4 b) { return _mm_cmple_ps(a, b); }
+#endif
+
+#ifdef PHYS_SIMD_AVX
+	// With SSE, `floats4` is `floats` and these are already defined
+	inline floats4 bit_and(floats4 a, floats4 b) { return _mm_and_ps(a, b); }
+	inline uint32_t bits(floats4 mask) { return (uint32_t)_mm_movemask_ps(mask); }
+#endif
+}
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include "thread_pool.h"
+
+phys::thread_pool::thread_pool(size_t _num_threads) {
+	const size_t num_workers = std::max(_num_threads, (size_t)1) - 1;
+
+	workers.reserve(num_workers);
+
+	for (size_t i = 0; i < num_workers; i++) {
+		workers.emplace_back(&thread_pool::worker_loop, this);
+	}
+}
+
+phys::thread_pool::~thread_pool() {
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+	}
+
+	job_ready.notify_all();
+
+	for (std::thread &t : workers) {
+		t.join();
+	}
+}
+
+size_t phys::thread_pool::get_num_threads() const {
+	return workers.size() + 1;
+}
+
+void phys::thread_pool::run(chunk_fn fn, void * ctx, size_t count, size_t chunk_size) {
+	job j{
+		.fn = fn,
+		.ctx = ctx,
+		.count = count,
+		.chunk_size = chunk_size
+	};
+
+	{
+		std::lock_guard lock(mutex);
+		current = j;
+		next_chunk.store(0, std::memory_order_relaxed);
+		busy_workers = workers.size();
+		generation++;
+	}
+
+	job_ready.notify_all();
+
+	run_chunks(j);
+
+	std::unique_lock lock(mutex);
+	job_done.wait(lock, [this]() {
+		return busy_workers == 0;
+	});
+}
+
+void phys::thread_pool::run_chunks(const job &j) {
+	const size_t num_chunks = (j.count + j.chunk_size - 1) / j.chunk_size;
+
+	for (;;) {
+		const size_t chunk = next_chunk.fetch_add(1, std::memory_order_relaxed);
+
+		if (chunk >= num_chunks) {
+			return;
+		}
+
+		const size_t begin = chunk * j.chunk_size;
+		const size_t end = std::min(begin + j.chunk_size, j.count);
+
+		j.fn(j.ctx, begin, end);
+	}
+}
+
+void phys::thread_pool::worker_loop() {
+	uint64_t seen_generation = 0;
+
+	for (;;) {
+		job j{};
+
+		{
+			std::unique_lock lock(mutex);
+			job_ready.wait(lock, [&]() {
+				return stopping || generation != seen_generation;
+			});
+
+			if (stopping) {
+				return;
+			}
+
+			seen_generation = generation;
+			j = current;
+		}
+
+		run_chunks(j);
+
+		bool last = false;
+
+		{
+			std::lock_guard lock(mutex);
+			last = (--busy_workers == 0);
+		}
+
+		if (last) {
+			job_done.notify_one();
+		}
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace phys {
+	// A fixed set of worker threads for data-parallel loops. `parallel_for` splits a range
+	// into chunks that the workers (and the calling thread) take from a shared counter, and
+	// returns once every chunk has run. Only one loop runs at a time, and dispatching a loop
+	// does not allocate.
+	class thread_pool {
+	public:
+		// Creates a pool that runs loops on `_num_threads` threads, including the thread
+		// that calls `parallel_for`. A pool with one thread runs everything inline.
+		thread_pool(size_t _num_threads = std::thread::hardware_concurrency());
+		thread_pool(const thread_pool &other) = delete;
+		thread_pool(thread_pool &&other) = delete;
+		~thread_pool();
+
+		thread_pool& operator=(const thread_pool &other) = delete;
+		thread_pool& operator=(thread_pool &&other) = delete;
+
+		size_t get_num_threads() const;
+
+		// Calls `f(begin, end)` on chunks of at most `chunk_size` items that together cover
+		// [0, count). Chunks may run in any order and on any thread.
+		template <typename F>
+		void parallel_for(size_t count, size_t chunk_size, F &&f);
+
+	private:
+		using chunk_fn = void (*)(void * ctx, size_t begin, size_t end);
+
+		struct job {
+			chunk_fn fn{};
+			void * ctx{};
+			size_t count{};
+			size_t chunk_size{};
+		};
+
+		std::vector<std::thread> workers{};
+		std::mutex mutex{};
+		std::condition_variable job_ready{};
+		std::condition_variable job_done{};
+		job current{};
+		std::atomic<size_t> next_chunk{};
+		size_t busy_workers{};
+		uint64_t generation{};
+		bool stopping{ false };
+
+		void run(chunk_fn fn, void * ctx, size_t count, size_t chunk_size);
+		void run_chunks(const job &j);
+		void worker_loop();
+	};
+}
+
+template <typename F>
+void phys::thread_pool::parallel_for(size_t count, size_t chunk_size, F &&f) {
+	if (! count) {
+		return;
+	}
+
+	if (! chunk_size) {
+		chunk_size = 1;
+	}
+
+	if (workers.empty() || count <= chunk_size) {
+		f((size_t)0, count);
+		return;
+	}
+
+	using fn_type = std::remove_reference_t<F>;
+
+	run([](void * ctx, size_t begin, size_t end) {
+		(*static_cast<fn_type *>(ctx))(begin, end);
+	}, (void *)&f, count, chunk_size);
+}
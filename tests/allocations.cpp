@@ -0,0 +1,45 @@
+#include <cstdlib>
+#include <new>
+#include "allocations.h"
+
+namespace {
+	thread_local size_t num_allocations = 0;
+}
+
+// These replace the global allocation functions for the whole test binary. They live in
+// their own file so that no caller sees `malloc` and `free` behind `new` and `delete`.
+void * operator new(std::size_t size) {
+	num_allocations++;
+
+	if (void * p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+
+	throw std::bad_alloc();
+}
+
+void * operator new[](std::size_t size) {
+	return ::operator new(size);
+}
+
+void operator delete(void * p) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void * p) noexcept {
+	::operator delete(p);
+}
+
+void operator delete(void * p, std::size_t size) noexcept {
+	::operator delete(p);
+}
+
+void operator delete[](void * p, std::size_t size) noexcept {
+	::operator delete(p);
+}
+
+test::allocation_counter::allocation_counter() : start(num_allocations) {}
+
+size_t test::allocation_counter::count() const {
+	return num_allocations - start;
+}
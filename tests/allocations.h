@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+
+namespace test {
+	// Counts the calls to the global `operator new` made on this thread since it was
+	// constructed. Worker threads keep their own counts, so a test that runs work on a
+	// thread pool only sees its own allocations.
+	class allocation_counter {
+	public:
+		allocation_counter();
+
+		size_t count() const;
+
+	private:
+		size_t start;
+	};
+}
@@ -1,12 +1,20 @@
 #define DEBUG
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
 #include <random>
+#include <set>
 #include <stack>
+#include <string>
+#include <vector>
 #include "../shared/physics/collision/bvh.h"
+#include "../shared/physics/collision/wide_bvh.h"
+#include "../shared/physics/thread_pool.h"
 #include "test.h"
 
 using namespace test;
 
 using sphere_bvh = phys::bvh<phys::bounding_sphere, int>;
+using aabb_bvh = phys::bvh<phys::aabb, int>;
 
 namespace {
 	using namespace phys::literals;
@@ -16,61 +24,77 @@ namespace {
 	phys::bounding_sphere s3(phys::vec3(0.5_r), 0.25_r);
 	phys::bounding_sphere s4(phys::vec3(-0.5_r), -0.25_r);
 
+	// Follows a path of 'l' (left) and 'r' (right) steps down from the root
+	template <typename BVH>
+	const typename BVH::node& node_at(const BVH &objects, const std::string &path) {
+		auto n = objects.root;
+
+		for (char c : path) {
+			n = c == 'l' ? objects.nodes[n].left : objects.nodes[n].right;
+		}
+
+		return objects.nodes[n];
+	}
+
 	template <typename BVH>
 	void bvh_checks(const BVH &objects) {
-		using node_t = typename BVH::node;
+		using node_index = typename BVH::node_index;
 
-		if (! objects.root.get()) {
+		if (objects.root == BVH::null_node) {
 			return;
 		}
 
-		std::stack<node_t *> nodes{};
+		std::stack<node_index> nodes{};
 		size_t obj_count = 0;
+		size_t node_count = 0;
 
-		nodes.push(objects.root.get());
+		nodes.push(objects.root);
 
 		while (! nodes.empty()) {
-			node_t * n = nodes.top();
+			node_index i = nodes.top();
+			const auto &n = objects.nodes[i];
 			nodes.pop();
+			node_count++;
 
-			node_t * left = n->left.get();
-			node_t * right = n->right.get();
+			const bool has_left = n.left != BVH::null_node;
+			const bool has_right = n.right != BVH::null_node;
 
-			if (!! left != !! right) {
-				fail_msg("expected node with id " + std::to_string(n->id) + " to have two children or none at all");
+			if (has_left != has_right) {
+				fail_msg("expected node with id " + std::to_string(n.id) + " to have two children or none at all");
 			}
 
-			if (left) {
-				if (n->id) {
-					fail_msg("expected internal node with id " + std::to_string(n->id) + " to have id 0");
+			if (has_left) {
+				if (n.id) {
+					fail_msg("expected internal node with id " + std::to_string(n.id) + " to have id 0");
 				}
 
-				nodes.push(left);
-				nodes.push(right);
+				nodes.push(n.left);
+				nodes.push(n.right);
 			} else {
-				if (! n->id) {
+				if (! n.id) {
 					fail_msg("expected leaf node to have nonzero id");
 				}
 
 				obj_count++;
 			}
 
-			if (n == objects.root.get()) {
-				expect_msg("root node has null parent", ! n->parent);
+			if (i == objects.root) {
+				expect_msg("root node has null parent", n.parent == BVH::null_node);
 			} else {
-				if (! n->parent) {
-					fail_msg("expected non-root node with id " + std::to_string(n->id) + " to have a parent");
+				if (n.parent == BVH::null_node) {
+					fail_msg("expected non-root node with id " + std::to_string(n.id) + " to have a parent");
 				}
 
-				node_t * p = n->parent;
+				const auto &p = objects.nodes[n.parent];
 
-				if (p->left.get() != n && p->right.get() != n) {
-					fail_msg("expected n->parent with id " + std::to_string(p->id) + " to have child n with id " + std::to_string(n->id));
+				if (p.left != i && p.right != i) {
+					fail_msg("expected n->parent with id " + std::to_string(p.id) + " to have child n with id " + std::to_string(n.id));
 				}
 			}
 		}
 
 		expect_msg("object count matches size()", obj_count == objects.size());
+		expect_msg("every node in the pool is in the tree or on the free list", node_count + objects.free_nodes.size() == objects.nodes.size());
 
 		if (objects.ids.size() <= 1) {
 			return;
@@ -84,52 +108,198 @@ namespace {
 				fail_msg("expected ids " + std::to_string(prev_id) + " and " + std::to_string(curr_id) + " to be sorted in ascending order");
 			}
 		}
+
+		for (const auto &id_n : objects.ids) {
+			if (objects.nodes[id_n.n].id != id_n.id) {
+				fail_msg("expected id " + std::to_string(id_n.id) + " to refer to its leaf");
+			}
+		}
 	}
 
 	template <phys::bounding_volume Volume, typename Identifier>
 	void volume_check(const phys::bvh<Volume, Identifier> &objects) {
-		using node_t = typename phys::bvh<Volume, Identifier>::node;
+		using bvh_t = phys::bvh<Volume, Identifier>;
+		using node_index = typename bvh_t::node_index;
 
-		if (! objects.root.get()) {
+		if (objects.root == bvh_t::null_node) {
 			return;
 		}
 
-		std::stack<node_t *> nodes{};
-		nodes.push(objects.root.get());
+		std::stack<node_index> nodes{};
+		nodes.push(objects.root);
 
 		while (! nodes.empty()) {
-			node_t * n = nodes.top();
+			const auto &n = objects.nodes[nodes.top()];
 			nodes.pop();
 
-			node_t * left = n->left.get();
-			node_t * right = n->right.get();
-
-			if (! left || ! right) {
+			if (n.left == bvh_t::null_node || n.right == bvh_t::null_node) {
 				continue;
 			}
 
-			if (n->vol != Volume(left->vol, right->vol)) {
-				fail_msg("expected parent of nodes with ids " + std::to_string(left->id) + " and " + std::to_string(right->id) +
+			const auto &left = objects.nodes[n.left];
+			const auto &right = objects.nodes[n.right];
+
+			if (n.vol != Volume(left.vol, right.vol)) {
+				fail_msg("expected parent of nodes with ids " + std::to_string(left.id) + " and " + std::to_string(right.id) +
 					" to have volume enclosing its children");
 			}
 
-			nodes.push(left);
-			nodes.push(right);
+			nodes.push(n.left);
+			nodes.push(n.right);
 		}
 	}
 
+	template <typename Generator>
+	phys::bounding_sphere random_sphere(
+		Generator &gen,
+		std::uniform_real_distribution<phys::real> &coord_distrib,
+		std::uniform_real_distribution<phys::real> &radius_distrib
+	) {
+		phys::real x = coord_distrib(gen);
+		phys::real y = coord_distrib(gen);
+		phys::real z = coord_distrib(gen);
+		phys::real r = radius_distrib(gen);
+
+		return phys::bounding_sphere(phys::vec3(x, y, z), r);
+	}
+
 	phys::bounding_sphere random_sphere(
 		std::uniform_real_distribution<phys::real> &coord_distrib,
 		std::uniform_real_distribution<phys::real> &radius_distrib
 	) {
 		static std::random_device rand{};
 
-		phys::real x = coord_distrib(rand);
-		phys::real y = coord_distrib(rand);
-		phys::real z = coord_distrib(rand);
-		phys::real r = radius_distrib(rand);
+		return random_sphere(rand, coord_distrib, radius_distrib);
+	}
 
-		return phys::bounding_sphere(phys::vec3(x, y, z), r);
+	template <phys::bounding_volume Volume, typename Identifier>
+	void fat_volume_check(const phys::bvh<Volume, Identifier> &objects, const std::vector<Volume> &volumes) {
+		for (const auto &id_n : objects.ids) {
+			if (! objects.nodes[id_n.n].vol.contains(volumes[id_n.id])) {
+				fail_msg("expected leaf with id " + std::to_string(id_n.id) + " to contain the volume of its object");
+			}
+		}
+	}
+
+	template <typename BVH>
+	std::set<std::pair<int, int>> coarse_collision_set(const BVH &objects) {
+		std::vector<typename BVH::coarse_collision_pair> pairs{};
+		std::set<std::pair<int, int>> out{};
+
+		objects.generate_coarse_collisions(pairs);
+
+		for (const auto &pair : pairs) {
+			out.insert(std::minmax(pair.id1, pair.id2));
+		}
+
+		return out;
+	}
+
+	// Compares each query of a tree of `spheres` with testing every sphere's leaf volume.
+	// `to_volume` turns a sphere into the volume of its leaf.
+	template <typename BVH, typename ToVolume>
+	void query_checks(
+		const BVH &objects,
+		const std::vector<phys::bounding_sphere> &spheres,
+		std::uniform_real_distribution<phys::real> &coord_distrib,
+		ToVolume &&to_volume
+	) {
+		static std::random_device rand{};
+
+		const auto exact_test = [&](phys::ray r) {
+			return [&spheres, r](int id) {
+				return r.intersect(spheres[(size_t)id]);
+			};
+		};
+
+		for (int i = 0; i < 100; i++) {
+			const phys::vec3 origin(coord_distrib(rand), coord_distrib(rand), coord_distrib(rand));
+			const phys::vec3 target(coord_distrib(rand), coord_distrib(rand), coord_distrib(rand));
+			const phys::ray r(origin * 1.5_r, target - origin * 1.5_r);
+
+			typename BVH::ray_hit expected{};
+			std::set<int> expected_all{};
+
+			for (const auto &id_n : objects.ids) {
+				const phys::real t = r.intersect(spheres[(size_t)id_n.id]);
+
+				if (t < 0.0_r) {
+					continue;
+				}
+
+				expected_all.insert(id_n.id);
+
+				if (expected.t < 0.0_r || t < expected.t) {
+					expected = { id_n.id, t };
+				}
+			}
+
+			const typename BVH::ray_hit hit = objects.raycast(r, exact_test(r));
+			// Objects at the same distance tie, like every sphere around the origin of the
+			// ray, and any of them is the nearest
+			const bool same_hit = hit.t == expected.t && (hit.t < 0.0_r || exact_test(r)(hit.id) == hit.t);
+
+			if (! same_hit) {
+				fail_msg("expected raycast to hit " + std::to_string(expected.id) + " at " + std::to_string(expected.t) +
+					", got " + std::to_string(hit.id) + " at " + std::to_string(hit.t));
+			}
+
+			std::vector<typename BVH::ray_hit> hits{};
+			std::set<int> all{};
+
+			objects.raycast_all(r, exact_test(r), hits);
+
+			for (const auto &h : hits) {
+				all.insert(h.id);
+			}
+
+			if (all != expected_all || hits.size() != expected_all.size()) {
+				fail_msg("expected raycast_all to find every object on the ray once");
+			}
+
+			const auto query = to_volume(phys::bounding_sphere(target, 20.0_r));
+			std::set<int> expected_overlaps{};
+			std::set<int> overlaps{};
+
+			for (const auto &id_n : objects.ids) {
+				if (objects.nodes[id_n.n].vol.overlaps(query)) {
+					expected_overlaps.insert(id_n.id);
+				}
+			}
+
+			objects.query_volume(query, [&](int id) {
+				overlaps.insert(id);
+			});
+
+			if (overlaps != expected_overlaps) {
+				fail_msg("expected query_volume to find every overlapping leaf");
+			}
+		}
+
+		const glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 150.0f);
+
+		for (int i = 0; i < 20; i++) {
+			const phys::vec3 eye(coord_distrib(rand), coord_distrib(rand), coord_distrib(rand));
+			const phys::frustum fr(proj * glm::lookAt(eye, phys::vec3(0.0_r), phys::vec3(0.0_r, 1.0_r, 0.0_r)));
+			std::set<int> expected{};
+			std::vector<int> found{};
+
+			for (const auto &id_n : objects.ids) {
+				if (fr.classify(objects.nodes[id_n.n].vol) != phys::frustum::containment::outside) {
+					expected.insert(id_n.id);
+				}
+			}
+
+			objects.query_frustum(fr, [&](int id) {
+				found.push_back(id);
+			});
+
+			// Leaves under a node that is inside the frustum are never tested, and must
+			// be inside too
+			if (std::set<int>(std::begin(found), std::end(found)) != expected || found.size() != expected.size()) {
+				fail_msg("expected query_frustum to find every leaf in the frustum once");
+			}
+		}
 	}
 
 	template <typename Container>
@@ -157,17 +327,17 @@ void setup_bvh_tests() {
 
 			expect_msg("size is 4", objects.size() == 4);
 
-			expect_msg("root is an internal node", ! objects.root->id);
-			expect_msg("root->left is an internal node", ! objects.root->left->id);
-			expect_msg("root->right is an internal node", ! objects.root->right->id);
-			expect_msg("root->left->left is s1 (id)", objects.root->left->left->id == 1);
-			expect_msg("root->left->left is s1 (vol)", objects.root->left->left->vol == s1);
-			expect_msg("root->left->right is s3 (id)", objects.root->left->right->id == 3);
-			expect_msg("root->left->right is s3 (vol)", objects.root->left->right->vol == s3);
-			expect_msg("root->right->left is s2 (id)", objects.root->right->left->id == 2);
-			expect_msg("root->right->left is s2 (vol)", objects.root->right->left->vol == s2);
-			expect_msg("root->right->right is s4 (id)", objects.root->right->right->id == 4);
-			expect_msg("root->right->right is s4 (vol)", objects.root->right->right->vol == s4);
+			expect_msg("root is an internal node", ! node_at(objects, "").id);
+			expect_msg("root->left is an internal node", ! node_at(objects, "l").id);
+			expect_msg("root->right is an internal node", ! node_at(objects, "r").id);
+			expect_msg("root->left->left is s1 (id)", node_at(objects, "ll").id == 1);
+			expect_msg("root->left->left is s1 (vol)", node_at(objects, "ll").vol == s1);
+			expect_msg("root->left->right is s3 (id)", node_at(objects, "lr").id == 3);
+			expect_msg("root->left->right is s3 (vol)", node_at(objects, "lr").vol == s3);
+			expect_msg("root->right->left is s2 (id)", node_at(objects, "rl").id == 2);
+			expect_msg("root->right->left is s2 (vol)", node_at(objects, "rl").vol == s2);
+			expect_msg("root->right->right is s4 (id)", node_at(objects, "rr").id == 4);
+			expect_msg("root->right->right is s4 (vol)", node_at(objects, "rr").vol == s4);
 
 			bvh_checks(objects);
 		});
@@ -270,6 +440,172 @@ void setup_bvh_tests() {
 			volume_check(objects);
 		});
 
+		it("Reuses the nodes of removed objects", []() {
+			std::uniform_real_distribution<phys::real> coord_distrib(-100.0_r, 100.0_r);
+			std::uniform_real_distribution<phys::real> radius_distrib(0.1_r, 2.0_r);
+			sphere_bvh objects{};
+
+			for (int i = 1; i <= 100; i++) {
+				objects.insert(i, random_sphere(coord_distrib, radius_distrib));
+			}
+
+			const size_t pool_size = objects.nodes.size();
+
+			expect_msg("pool holds 199 nodes", pool_size == 199);
+
+			for (int i = 1; i <= 50; i++) {
+				objects.remove(i);
+			}
+
+			bvh_checks(objects);
+
+			for (int i = 101; i <= 150; i++) {
+				objects.insert(i, random_sphere(coord_distrib, radius_distrib));
+			}
+
+			expect_msg("pool did not grow", objects.nodes.size() == pool_size);
+			expect_msg("free list is empty", objects.free_nodes.empty());
+
+			bvh_checks(objects);
+			volume_check(objects);
+		});
+
+		it("Builds a tree from many objects at once", []() {
+			std::uniform_real_distribution<phys::real> coord_distrib(-100.0_r, 100.0_r);
+			std::uniform_real_distribution<phys::real> radius_distrib(0.1_r, 5.0_r);
+			std::vector<sphere_bvh::volume_update> objs{};
+			sphere_bvh built{};
+			sphere_bvh inserted{};
+
+			for (int i = 1; i < 2000; i++) {
+				objs.push_back({ i, random_sphere(coord_distrib, radius_distrib) });
+				inserted.insert(objs.back().id, objs.back().vol);
+			}
+
+			built.build(objs);
+
+			expect_msg("size is 1999", built.size() == 1999);
+			expect_msg("pool holds 3997 nodes", built.nodes.size() == 3997);
+
+			bvh_checks(built);
+			volume_check(built);
+
+			for (int i = 1; i < 2000; i++) {
+				if (! built.has(i)) {
+					fail_msg("object " + std::to_string(i) + " was not present");
+				}
+			}
+
+			// Inserting with branch and bound gives a tree about as good as a binned build
+			expect_msg("built tree has about the same SAH cost", built.sah_cost() < 1.1_r * inserted.sah_cost());
+			expect_msg("built tree finds the same collisions", coarse_collision_set(built) == coarse_collision_set(inserted));
+		});
+
+		it("Builds a tree with one volume per id", []() {
+			std::vector<sphere_bvh::volume_update> objs{
+				{ 1, s1 },
+				{ 2, s2 },
+				{ 1, s3 }
+			};
+			sphere_bvh objects{};
+
+			objects.build(objs);
+
+			expect_msg("size is 2", objects.size() == 2);
+			expect_msg("object 1 keeps its first volume", node_at(objects, "l").vol == s1 || node_at(objects, "r").vol == s1);
+
+			bvh_checks(objects);
+
+			objects.build(std::vector<sphere_bvh::volume_update>{});
+
+			expect_msg("size is 0", objects.size() == 0);
+		});
+
+		it("Rebuilds a tree from its leaves", []() {
+			std::uniform_real_distribution<phys::real> coord_distrib(-100.0_r, 100.0_r);
+			std::uniform_real_distribution<phys::real> radius_distrib(0.1_r, 5.0_r);
+
+			constexpr unsigned int num_trees = 20;
+			unsigned int num_improved = 0;
+
+			// A fresh build is usually cheaper than a tree built by inserts, but not always,
+			// so a few trees are rebuilt
+			for (unsigned int seed = 0; seed < num_trees; seed++) {
+				std::mt19937 gen(seed);
+				sphere_bvh objects(0.5_r);
+
+				for (int i = 1; i < 2000; i++) {
+					objects.insert(i, random_sphere(gen, coord_distrib, radius_distrib));
+				}
+
+				for (int i = 1; i < 2000; i += 2) {
+					objects.remove(i);
+				}
+
+				const auto before = coarse_collision_set(objects);
+				const phys::real cost_before = objects.sah_cost();
+
+				objects.rebuild();
+
+				expect_msg("size is 999", objects.size() == 999);
+				expect_msg("free list is empty", objects.free_nodes.empty());
+				expect_msg("pool holds 1997 nodes", objects.nodes.size() == 1997);
+
+				bvh_checks(objects);
+				volume_check(objects);
+
+				expect_msg("rebuilt tree is no more expensive (seed " + std::to_string(seed) + ")", objects.sah_cost() <= cost_before);
+				expect_msg("rebuilt tree finds the same collisions", coarse_collision_set(objects) == before);
+
+				if (objects.sah_cost() < cost_before) {
+					num_improved++;
+				}
+			}
+
+			expect_msg("most rebuilt trees are cheaper (" + std::to_string(num_improved) + " are)", 2 * num_improved > num_trees);
+		});
+
+		it("Stays balanced over a million random inserts and removes", []() {
+			std::uniform_real_distribution<phys::real> coord_distrib(-100.0_r, 100.0_r);
+			std::uniform_real_distribution<phys::real> radius_distrib(0.1_r, 2.0_r);
+			std::mt19937 gen(12345);
+			std::vector<int> live{};
+			sphere_bvh objects{};
+			int next_id = 1;
+
+			for (size_t op = 1; op <= 1'000'000; op++) {
+				// Hovers around 1000 objects
+				if (live.size() < 1000 || (live.size() < 1100 && gen() % 2)) {
+					objects.insert(next_id, random_sphere(coord_distrib, radius_distrib));
+					live.push_back(next_id++);
+				} else {
+					const size_t i = gen() % live.size();
+
+					objects.remove(live[i]);
+					live[i] = live.back();
+					live.pop_back();
+				}
+
+				if (op % 100'000) {
+					continue;
+				}
+
+				bvh_checks(objects);
+				volume_check(objects);
+
+				sphere_bvh rebuilt = objects;
+				rebuilt.rebuild();
+
+				// Without rotations, the tree ends up about 5 times as deep as a fresh build,
+				// and its SAH cost about 14 times as high. Inserting with a greedy descent
+				// instead of branch and bound left it about 3.4 times as high.
+				const std::string after = " after " + std::to_string(op) + " operations";
+
+				expect_msg("depth is at most 4 more than the depth of a fresh build" + after, objects.depth() <= rebuilt.depth() + 4);
+				expect_msg("SAH cost is at most 1.5 times the cost of a fresh build" + after, objects.sah_cost() <= 1.5_r * rebuilt.sah_cost());
+			}
+		});
+
 		it("Updates objects", []() {
 			sphere_bvh objects{};
 
@@ -279,11 +615,11 @@ void setup_bvh_tests() {
 
 			expect_msg("size is 3", objects.size() == 3);
 
-			expect_msg("root is an internal node", ! objects.root->id);
-			expect_msg("root->left is s1", objects.root->left->vol == s1);
-			expect_msg("root->right is an internal node", ! objects.root->right->id);
-			expect_msg("root->right->left is s2", objects.root->right->left->vol == s2);
-			expect_msg("root->right->right is s4", objects.root->right->right->vol == s4);
+			expect_msg("root is an internal node", ! node_at(objects, "").id);
+			expect_msg("root->left is s1", node_at(objects, "l").vol == s1);
+			expect_msg("root->right is an internal node", ! node_at(objects, "r").id);
+			expect_msg("root->right->left is s2", node_at(objects, "rl").vol == s2);
+			expect_msg("root->right->right is s4", node_at(objects, "rr").vol == s4);
 
 			objects.update(2, s3);
 
@@ -292,12 +628,87 @@ void setup_bvh_tests() {
 			bvh_checks(objects);
 			volume_check(objects);
 
-			expect_msg("root is an internal node", ! objects.root->id);
-			expect_msg("root->left is s1", objects.root->left->vol == s1);
-			expect_msg("root->right is an internal node", ! objects.root->right->id);
-			expect_msg("root->right->left is s4", objects.root->right->left->vol == s4);
-			expect_msg("root->right->right is s3", objects.root->right->right->vol == s3);
-			expect_msg("root->right->right has id 2", objects.root->right->right->id == 2);
+			expect_msg("root is an internal node", ! node_at(objects, "").id);
+			expect_msg("root->left is s1", node_at(objects, "l").vol == s1);
+			expect_msg("root->right is an internal node", ! node_at(objects, "r").id);
+			expect_msg("root->right->left is s4", node_at(objects, "rl").vol == s4);
+			expect_msg("root->right->right is s3", node_at(objects, "rr").vol == s3);
+			expect_msg("root->right->right has id 2", node_at(objects, "rr").id == 2);
+		});
+
+		it("Leaves objects in place while they stay inside their fat volumes", []() {
+			sphere_bvh objects(1.0_r);
+
+			objects.insert(1, s1);
+			objects.insert(2, s2);
+			objects.insert(4, s4);
+
+			const auto leaf = objects.nodes[objects.root].left;
+
+			expect_msg("root->left has id 1", objects.nodes[leaf].id == 1);
+			expect_msg("root->left has a fat volume", objects.nodes[leaf].vol == s1.enlarged(1.0_r));
+
+			objects.update(1, phys::bounding_sphere(s1.center + phys::vec3(0.5_r, 0.0_r, 0.0_r), s1.radius));
+
+			expect_msg("root->left is the same node", objects.nodes[objects.root].left == leaf);
+			expect_msg("root->left has the same volume", objects.nodes[leaf].vol == s1.enlarged(1.0_r));
+
+			bvh_checks(objects);
+			volume_check(objects);
+		});
+
+		it("Reinserts objects that leave their fat volumes", []() {
+			sphere_bvh objects(1.0_r);
+
+			objects.insert(1, s1);
+			objects.insert(2, s2);
+			objects.insert(4, s4);
+
+			const phys::bounding_sphere moved(s2.center + phys::vec3(0.0_r, 5.0_r, 0.0_r), s2.radius);
+
+			objects.update(2, moved);
+
+			expect_msg("size is 3", objects.size() == 3);
+
+			bvh_checks(objects);
+			volume_check(objects);
+
+			auto id_i = std::lower_bound(std::begin(objects.ids), std::end(objects.ids), 2);
+
+			expect_msg("object 2 is present", id_i != std::end(objects.ids) && id_i->id == 2);
+			expect_msg("object 2 has a new fat volume", objects.nodes[id_i->n].vol == moved.enlarged(1.0_r));
+		});
+
+		it("Updates many objects at once", []() {
+			std::uniform_real_distribution<phys::real> coord_distrib(-100.0_r, 100.0_r);
+			std::uniform_real_distribution<phys::real> radius_distrib(0.1_r, 2.0_r);
+			std::uniform_real_distribution<phys::real> step_distrib(-0.5_r, 0.5_r);
+			std::mt19937 gen(12345);
+			std::vector<phys::bounding_sphere> volumes(2000);
+			std::vector<sphere_bvh::volume_update> updates{};
+			sphere_bvh objects(0.5_r);
+
+			for (int i = 1; i < 2000; i++) {
+				volumes[i] = random_sphere(coord_distrib, radius_distrib);
+				objects.insert(i, volumes[i]);
+			}
+
+			for (int frame = 0; frame < 20; frame++) {
+				updates.clear();
+
+				for (int i = 1; i < 2000; i++) {
+					volumes[i].center += phys::vec3(step_distrib(gen), step_distrib(gen), step_distrib(gen));
+					updates.push_back({ i, volumes[i] });
+				}
+
+				objects.update_many(updates);
+			}
+
+			expect_msg("size is 1999", objects.size() == 1999);
+
+			bvh_checks(objects);
+			volume_check(objects);
+			fat_volume_check(objects, volumes);
 		});
 
 		it("Does not delete objects that don't exist", []() {
@@ -328,6 +739,55 @@ void setup_bvh_tests() {
 			expect_msg("object with id 1000 is not present", ! objects.has(1000));
 		});
 
+		it("Generates the same coarse collision pairs in parallel", []() {
+			std::uniform_real_distribution<phys::real> coord_distrib(-100.0_r, 100.0_r);
+			std::uniform_real_distribution<phys::real> radius_distrib(0.1_r, 5.0_r);
+			sphere_bvh inserted{};
+			std::vector<sphere_bvh::volume_update> objs{};
+
+			for (int i = 1; i < 5000; i++) {
+				objs.push_back({ i, random_sphere(coord_distrib, radius_distrib) });
+				inserted.insert(objs.back().id, objs.back().vol);
+			}
+
+			sphere_bvh built{};
+			built.build(objs);
+
+			for (const sphere_bvh * objects : { &inserted, &built }) {
+				std::vector<sphere_bvh::coarse_collision_pair> serial{};
+
+				objects->generate_coarse_collisions(serial);
+
+				for (size_t num_threads : { 1, 3, 8 }) {
+					phys::thread_pool pool(num_threads);
+					std::vector<sphere_bvh::coarse_collision_pair> parallel{};
+					std::set<std::pair<int, int>> parallel_set{};
+
+					objects->generate_coarse_collisions(parallel, pool);
+
+					for (const auto &pair : parallel) {
+						parallel_set.insert(std::minmax(pair.id1, pair.id2));
+					}
+
+					const std::string suffix = " with " + std::to_string(num_threads) + " threads";
+
+					expect_msg("finds as many pairs" + suffix, parallel.size() == serial.size());
+					expect_msg("finds the same pairs" + suffix, parallel_set == coarse_collision_set(*objects));
+				}
+			}
+
+			sphere_bvh small{};
+			phys::thread_pool pool(4);
+			std::vector<sphere_bvh::coarse_collision_pair> pairs{};
+
+			small.generate_coarse_collisions(pairs, pool);
+			expect_msg("finds no pairs in an empty tree", pairs.empty());
+
+			small.insert(1, s1);
+			small.generate_coarse_collisions(pairs, pool);
+			expect_msg("finds no pairs in a tree with one object", pairs.empty());
+		});
+
 		it("Generates coarse collision pairs", []() {
 			phys::bounding_sphere a1(phys::vec3(5.0_r), 1.0_r);
 			phys::bounding_sphere a2(phys::vec3(4.0_r), 2.0_r);
@@ -367,4 +827,205 @@ void setup_bvh_tests() {
 			expect_msg("contains collision between b1 and b3", contains_collision(collision_pairs, 11, 13));
 		});
 	});
+
+	describe("AABB", []() {
+		it("Detects overlapping boxes", []() {
+			const phys::aabb a(phys::vec3(0.0_r), phys::vec3(1.0_r));
+			const phys::aabb b(phys::vec3(0.5_r), phys::vec3(2.0_r));
+			const phys::aabb c(phys::vec3(1.0_r, 0.0_r, 0.0_r), phys::vec3(2.0_r, 1.0_r, 1.0_r));
+			const phys::aabb d(phys::vec3(0.0_r, 1.5_r, 0.0_r), phys::vec3(1.0_r, 2.0_r, 1.0_r));
+
+			expect_msg("a overlaps b", a.overlaps(b) && b.overlaps(a));
+			expect_msg("a touches c", a.overlaps(c) && c.overlaps(a));
+			expect_msg("a does not overlap d", ! a.overlaps(d) && ! d.overlaps(a));
+		});
+
+		it("Merges and grows boxes by surface area", []() {
+			const phys::aabb a(phys::vec3(0.0_r), phys::vec3(1.0_r));
+			const phys::aabb b(phys::vec3(1.0_r, 0.0_r, 0.0_r), phys::vec3(2.0_r, 1.0_r, 1.0_r));
+			const phys::aabb merged(a, b);
+
+			expect_msg("merged box encloses both", merged == phys::aabb(phys::vec3(0.0_r), phys::vec3(2.0_r, 1.0_r, 1.0_r)));
+			expect_msg("merged box contains a", merged.contains(a));
+			expect_msg("a does not contain the merged box", ! a.contains(merged));
+			expect_msg("unit cube has surface area 6", a.surface_area() == 6.0_r);
+			expect_msg("growth is 4", a.growth(b) == 4.0_r);
+			expect_msg("no growth for a contained box", merged.growth(a) == 0.0_r);
+			expect_msg("enlarged box contains a", a.enlarged(0.1_r).contains(a));
+		});
+
+		it("Tests four boxes at once", []() {
+			phys::aabb4 boxes{};
+
+			boxes.set(0, phys::aabb(phys::vec3(0.0_r), phys::vec3(1.0_r)));
+			boxes.set(1, phys::aabb(phys::vec3(5.0_r), phys::vec3(6.0_r)));
+			boxes.set(2, phys::aabb(phys::vec3(0.5_r), phys::vec3(5.5_r)));
+
+			expect_msg("overlaps boxes 0 and 2", boxes.overlaps(phys::aabb(phys::vec3(0.25_r), phys::vec3(0.75_r))) == 0b0101);
+			expect_msg("overlaps boxes 1 and 2", boxes.overlaps(phys::aabb(phys::vec3(5.25_r), phys::vec3(5.75_r))) == 0b0110);
+			expect_msg("empty slot overlaps nothing", boxes.overlaps(phys::aabb(phys::vec3(-100.0_r), phys::vec3(100.0_r))) == 0b0111);
+		});
+
+		it("Works as the volume of a BVH", []() {
+			std::uniform_real_distribution<phys::real> coord_distrib(-100.0_r, 100.0_r);
+			std::uniform_real_distribution<phys::real> radius_distrib(0.1_r, 5.0_r);
+			aabb_bvh objects(0.25_r);
+			std::vector<aabb_bvh::volume_update> objs{};
+
+			for (int i = 1; i < 2000; i++) {
+				objs.push_back({ i, phys::aabb(random_sphere(coord_distrib, radius_distrib)) });
+				objects.insert(objs.back().id, objs.back().vol);
+			}
+
+			for (int i = 1; i < 2000; i += 3) {
+				objects.remove(i);
+			}
+
+			bvh_checks(objects);
+			volume_check(objects);
+
+			const auto pairs = coarse_collision_set(objects);
+			std::set<std::pair<int, int>> expected{};
+
+			for (const auto &a : objs) {
+				for (const auto &b : objs) {
+					if (a.id < b.id && objects.has(a.id) && objects.has(b.id) &&
+						a.vol.enlarged(0.25_r).overlaps(b.vol.enlarged(0.25_r))) {
+						expected.insert({ a.id, b.id });
+					}
+				}
+			}
+
+			expect_msg("finds every overlapping pair", pairs == expected);
+
+			objects.rebuild();
+
+			bvh_checks(objects);
+			volume_check(objects);
+			expect_msg("finds every overlapping pair after a rebuild", coarse_collision_set(objects) == expected);
+		});
+
+		it("Finds the same pairs in a 4-wide copy of a tree", []() {
+			std::uniform_real_distribution<phys::real> coord_distrib(-100.0_r, 100.0_r);
+			std::uniform_real_distribution<phys::real> radius_distrib(0.1_r, 5.0_r);
+			aabb_bvh objects{};
+
+			phys::wide_bvh<int> empty(objects);
+
+			expect_msg("empty copy has no objects", empty.size() == 0);
+
+			for (int i = 1; i < 2000; i++) {
+				objects.insert(i, phys::aabb(random_sphere(coord_distrib, radius_distrib)));
+			}
+
+			phys::wide_bvh<int> wide(objects);
+
+			expect_msg("copy has the same number of objects", wide.size() == objects.size());
+
+			for (const auto &n : wide.nodes) {
+				if (n.count < 2 || n.count > 4) {
+					fail_msg("expected node to have between 2 and 4 children");
+				}
+			}
+
+			expect_msg("finds the same pairs", coarse_collision_set(wide) == coarse_collision_set(objects));
+
+			objects.rebuild();
+			wide.copy(objects);
+
+			expect_msg("finds the same pairs after a rebuild", coarse_collision_set(wide) == coarse_collision_set(objects));
+		});
+	});
+
+	describe("BVH queries", []() {
+		it("Intersects rays with spheres and boxes", []() {
+			const phys::ray r(phys::vec3(0.0_r), phys::vec3(1.0_r, 0.0_r, 0.0_r));
+			const phys::bounding_sphere sphere(phys::vec3(5.0_r, 0.0_r, 0.0_r), 1.0_r);
+			const phys::aabb box(phys::vec3(2.0_r, -1.0_r, -1.0_r), phys::vec3(3.0_r, 1.0_r, 1.0_r));
+
+			expect_msg("hits the sphere at t = 4", r.intersect(sphere) == 4.0_r);
+			expect_msg("hits the box at t = 2", r.intersect(box) == 2.0_r);
+			expect_msg("misses a sphere behind it", r.intersect(phys::bounding_sphere(phys::vec3(-5.0_r, 0.0_r, 0.0_r), 1.0_r)) == -1.0_r);
+			expect_msg("misses a box beside it", r.intersect(phys::aabb(phys::vec3(2.0_r, 2.0_r, -1.0_r), phys::vec3(3.0_r, 3.0_r, 1.0_r))) == -1.0_r);
+			expect_msg("starts inside the sphere", r.intersect(phys::bounding_sphere(phys::vec3(0.5_r), 1.0_r)) == 0.0_r);
+			expect_msg("starts inside the box", r.intersect(phys::aabb(phys::vec3(-1.0_r), phys::vec3(1.0_r))) == 0.0_r);
+
+			const phys::ray half_speed(phys::vec3(0.0_r), phys::vec3(0.5_r, 0.0_r, 0.0_r));
+
+			expect_msg("t is measured in lengths of dir", half_speed.intersect(sphere) == 8.0_r && half_speed.intersect(box) == 4.0_r);
+		});
+
+		it("Classifies volumes against a frustum", []() {
+			const glm::mat4 proj = glm::perspective(glm::radians(90.0f), 1.0f, 1.0f, 100.0f);
+			const glm::mat4 view = glm::lookAt(phys::vec3(0.0_r), phys::vec3(0.0_r, 0.0_r, -1.0_r), phys::vec3(0.0_r, 1.0_r, 0.0_r));
+			const phys::frustum fr(proj * view);
+
+			using containment = phys::frustum::containment;
+
+			const phys::bounding_sphere ahead(phys::vec3(0.0_r, 0.0_r, -50.0_r), 1.0_r);
+			const phys::bounding_sphere behind(phys::vec3(0.0_r, 0.0_r, 50.0_r), 1.0_r);
+			const phys::bounding_sphere on_edge(phys::vec3(50.0_r, 0.0_r, -50.0_r), 1.0_r);
+			const phys::bounding_sphere past_far(phys::vec3(0.0_r, 0.0_r, -200.0_r), 1.0_r);
+
+			expect_msg("sphere ahead is inside", fr.classify(ahead) == containment::inside);
+			expect_msg("sphere behind is outside", fr.classify(behind) == containment::outside);
+			expect_msg("sphere on the right plane intersects", fr.classify(on_edge) == containment::intersects);
+			expect_msg("sphere past the far plane is outside", fr.classify(past_far) == containment::outside);
+			expect_msg("box ahead is inside", fr.classify(phys::aabb(ahead)) == containment::inside);
+			expect_msg("box behind is outside", fr.classify(phys::aabb(behind)) == containment::outside);
+			expect_msg("box on the right plane intersects", fr.classify(phys::aabb(on_edge)) == containment::intersects);
+		});
+
+		it("Finds the same objects as testing every leaf", []() {
+			std::uniform_real_distribution<phys::real> coord_distrib(-100.0_r, 100.0_r);
+			std::uniform_real_distribution<phys::real> radius_distrib(0.1_r, 5.0_r);
+			std::vector<phys::bounding_sphere> spheres{};
+			sphere_bvh sphere_objects(0.25_r);
+			aabb_bvh aabb_objects(0.25_r);
+
+			const auto identity = [](const phys::bounding_sphere &sphere) { return sphere; };
+			const auto to_aabb = [](const phys::bounding_sphere &sphere) { return phys::aabb(sphere); };
+
+			query_checks(sphere_objects, spheres, coord_distrib, identity);
+			expect_msg("empty tree has no hits", sphere_objects.raycast(phys::ray(phys::vec3(0.0_r), phys::vec3(1.0_r)), [](int) { return 0.0_r; }).t < 0.0_r);
+
+			spheres.emplace_back();
+
+			for (int i = 1; i < 2000; i++) {
+				spheres.push_back(random_sphere(coord_distrib, radius_distrib));
+				sphere_objects.insert(i, spheres.back());
+				aabb_objects.insert(i, phys::aabb(spheres.back()));
+			}
+
+			for (int i = 1; i < 2000; i += 5) {
+				sphere_objects.remove(i);
+				aabb_objects.remove(i);
+			}
+
+			query_checks(sphere_objects, spheres, coord_distrib, identity);
+			query_checks(aabb_objects, spheres, coord_distrib, to_aabb);
+
+			sphere_objects.rebuild();
+			aabb_objects.rebuild();
+
+			query_checks(sphere_objects, spheres, coord_distrib, identity);
+			query_checks(aabb_objects, spheres, coord_distrib, to_aabb);
+		});
+
+		it("Spills queries of deep trees onto the heap", []() {
+			sphere_bvh::query_stack<int> stack{};
+
+			for (int i = 0; i < 200; i++) {
+				stack.push(i);
+			}
+
+			for (int i = 199; i >= 0; i--) {
+				if (stack.empty() || stack.pop() != i) {
+					fail_msg("expected stack to pop " + std::to_string(i));
+				}
+			}
+
+			expect_msg("stack is empty", stack.empty());
+		});
+	});
 }
\ No newline at end of file
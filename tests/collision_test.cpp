@@ -1,3 +1,9 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include "../shared/physics/collision/algorithms.h"
 #include "../shared/physics/collision/contact_generator.h"
 #include "../shared/physics/collision/primitives.h"
 #include "test.h"
@@ -10,6 +16,24 @@ std::vector<phys::contact> contacts{};
 phys::rigid_body sphere_body_1{};
 phys::rigid_body sphere_body_2{};
 
+namespace {
+	constexpr int custom_shape_type = 5;
+
+	struct custom_primitive : phys::primitive {
+		explicit custom_primitive(phys::rigid_body * _body) : primitive(custom_shape_type, _body, phys::identity<phys::mat4>()) {}
+
+		std::optional<phys::aabb> bounds() const override {
+			return std::nullopt;
+		}
+	};
+
+	std::vector<std::pair<int, int>> custom_calls{};
+
+	void custom_collision(phys::primitive &a, phys::primitive &b, phys::contact_container&) {
+		custom_calls.emplace_back(a.type, b.type);
+	}
+}
+
 void setup_collision_tests() {
 	describe("Rigid body collisions", []() {
 		after_each([&]() {
@@ -78,5 +102,356 @@ void setup_collision_tests() {
 
 			expect(contacts).to_have_size(0);
 		});
+
+		it("detects a sphere that sinks into a plane", [&]() {
+			sphere_body_1.pos.y = 0.8_r;
+			sphere_body_2.set_mass(phys::infinity);
+
+			phys::sphere s(&sphere_body_1, phys::identity<phys::mat4>(), 1.0_r);
+			phys::plane p(&sphere_body_2, phys::vec3(0.0_r, 1.0_r, 0.0_r), 0.0_r);
+
+			collider.generate_contacts(s, p, contacts);
+			collider.generate_contacts(p, s, contacts);
+
+			expect(contacts).to_have_size(2).annd()
+				.to_have_item(phys::contact(
+					&sphere_body_1,
+					&sphere_body_2,
+					phys::vec3(0.0_r),
+					phys::vec3(0.0_r, -1.0_r, 0.0_r),
+					0.2_r
+				)).annd()
+				.to_have_item(phys::contact(
+					&sphere_body_2,
+					&sphere_body_1,
+					phys::vec3(0.0_r),
+					phys::vec3(0.0_r, 1.0_r, 0.0_r),
+					0.2_r
+				));
+
+			contacts.clear();
+			sphere_body_1.pos.y = 1.5_r;
+			collider.generate_contacts(s, p, contacts);
+
+			expect(contacts).to_have_size(0);
+		});
+	
+		it("detects the corners of a box that sinks into a plane", [&]() {
+			sphere_body_1.pos.y = 0.4_r;
+			sphere_body_2.set_mass(phys::infinity);
+
+			phys::box b(&sphere_body_1, phys::identity<phys::mat4>(), phys::vec3(0.5_r));
+			phys::plane p(&sphere_body_2, phys::vec3(0.0_r, 1.0_r, 0.0_r), 0.0_r);
+
+			collider.generate_contacts(b, p, contacts);
+
+			expect(contacts).to_have_size(4);
+
+			for (const phys::real x : { -0.5_r, 0.5_r }) {
+				for (const phys::real z : { -0.5_r, 0.5_r }) {
+					expect(contacts).to_have_item(phys::contact(
+						&sphere_body_1,
+						&sphere_body_2,
+						phys::vec3(x, 0.0_r, z),
+						phys::vec3(0.0_r, -1.0_r, 0.0_r),
+						0.1_r
+					));
+				}
+			}
+
+			contacts.clear();
+			sphere_body_1.rot = glm::angleAxis(0.3_r, phys::vec3(0.0_r, 0.0_r, 1.0_r));
+			collider.generate_contacts(p, b, contacts);
+
+			expect_msg("a tilted box touches with one edge", contacts.size() == 2);
+			expect_msg("normal points from the plane into the box", contacts[0].a == &sphere_body_2 && contacts[0].normal.y > 0.99_r);
+		});
+
+		it("detects a sphere touching a box's face, edge, and inside", [&]() {
+			phys::box b(&sphere_body_1, phys::identity<phys::mat4>(), phys::vec3(0.5_r));
+			phys::sphere s(&sphere_body_2, phys::identity<phys::mat4>(), 0.5_r);
+			const phys::real edge_d = 0.3_r * std::sqrt(2.0_r);
+			const phys::real edge_n = std::sqrt(0.5_r);
+
+			sphere_body_2.pos = phys::vec3(0.0_r, 0.9_r, 0.0_r);
+			collider.generate_contacts(s, b, contacts);
+			sphere_body_2.pos = phys::vec3(0.8_r, 0.8_r, 0.0_r);
+			collider.generate_contacts(b, s, contacts);
+			sphere_body_2.pos = phys::vec3(0.0_r, 0.3_r, 0.1_r);
+			collider.generate_contacts(s, b, contacts);
+			sphere_body_2.pos = phys::vec3(0.0_r, 1.1_r, 0.0_r);
+			collider.generate_contacts(s, b, contacts);
+
+			expect(contacts).to_have_size(3).annd()
+				.to_have_item(phys::contact(
+					&sphere_body_2,
+					&sphere_body_1,
+					phys::vec3(0.0_r, 0.5_r, 0.0_r),
+					phys::vec3(0.0_r, -1.0_r, 0.0_r),
+					0.1_r
+				)).annd()
+				.to_have_item(phys::contact(
+					&sphere_body_1,
+					&sphere_body_2,
+					phys::vec3(0.5_r, 0.5_r, 0.0_r),
+					phys::vec3(edge_n, edge_n, 0.0_r),
+					0.5_r - edge_d
+				)).annd()
+				.to_have_item(phys::contact(
+					&sphere_body_2,
+					&sphere_body_1,
+					phys::vec3(0.0_r, 0.5_r, 0.1_r),
+					phys::vec3(0.0_r, -1.0_r, 0.0_r),
+					0.7_r
+				));
+		});
+
+		it("detects crossing and parallel capsules", [&]() {
+			phys::capsule a(&sphere_body_1, phys::identity<phys::mat4>(), 0.25_r, 1.0_r);
+			phys::capsule b(&sphere_body_2, phys::identity<phys::mat4>(), 0.25_r, 1.0_r);
+
+			sphere_body_2.pos = phys::vec3(0.0_r, 0.0_r, 0.4_r);
+			sphere_body_2.rot = glm::angleAxis(glm::half_pi<phys::real>(), phys::vec3(0.0_r, 0.0_r, 1.0_r));
+			collider.generate_contacts(a, b, contacts);
+
+			expect(contacts).to_have_size(1).annd()
+				.to_have_item(phys::contact(
+					&sphere_body_1,
+					&sphere_body_2,
+					phys::vec3(0.0_r, 0.0_r, 0.2_r),
+					phys::vec3(0.0_r, 0.0_r, 1.0_r),
+					0.1_r
+				));
+
+			contacts.clear();
+			sphere_body_2.pos = phys::vec3(0.4_r, 0.5_r, 0.0_r);
+			sphere_body_2.rot = phys::identity<phys::quat>();
+			collider.generate_contacts(a, b, contacts);
+
+			expect(contacts).to_have_size(2).annd()
+				.to_have_item(phys::contact(
+					&sphere_body_1,
+					&sphere_body_2,
+					phys::vec3(0.2_r, -0.5_r, 0.0_r),
+					phys::vec3(1.0_r, 0.0_r, 0.0_r),
+					0.1_r
+				)).annd()
+				.to_have_item(phys::contact(
+					&sphere_body_1,
+					&sphere_body_2,
+					phys::vec3(0.2_r, 1.0_r, 0.0_r),
+					phys::vec3(1.0_r, 0.0_r, 0.0_r),
+					0.1_r
+				));
+		});
+
+		it("detects a capsule lying on a plane", [&]() {
+			sphere_body_1.pos.y = 0.2_r;
+			sphere_body_1.rot = glm::angleAxis(glm::half_pi<phys::real>(), phys::vec3(0.0_r, 0.0_r, 1.0_r));
+
+			phys::capsule c(&sphere_body_1, phys::identity<phys::mat4>(), 0.25_r, 1.0_r);
+			phys::plane p(&sphere_body_2, phys::vec3(0.0_r, 1.0_r, 0.0_r), 0.0_r);
+
+			collider.generate_contacts(c, p, contacts);
+
+			expect(contacts).to_have_size(2).annd()
+				.to_have_item(phys::contact(
+					&sphere_body_1,
+					&sphere_body_2,
+					phys::vec3(-1.0_r, 0.0_r, 0.0_r),
+					phys::vec3(0.0_r, -1.0_r, 0.0_r),
+					0.05_r
+				)).annd()
+				.to_have_item(phys::contact(
+					&sphere_body_1,
+					&sphere_body_2,
+					phys::vec3(1.0_r, 0.0_r, 0.0_r),
+					phys::vec3(0.0_r, -1.0_r, 0.0_r),
+					0.05_r
+				));
+		});
+
+		it("detects overlapping boxes with GJK and EPA", [&]() {
+			phys::box a(&sphere_body_1, phys::identity<phys::mat4>(), phys::vec3(0.5_r));
+			phys::box b(&sphere_body_2, phys::identity<phys::mat4>(), phys::vec3(0.5_r));
+
+			sphere_body_2.pos = phys::vec3(0.9_r, 0.2_r, 0.0_r);
+			collider.generate_contacts(a, b, contacts);
+
+			expect_msg("one contact", contacts.size() == 1);
+			expect_msg("normal points from a to b", phys::dot(contacts[0].normal, phys::vec3(1.0_r, 0.0_r, 0.0_r)) > 0.999_r);
+			expect_msg("penetration is the overlap along x", std::abs(contacts[0].penetration - 0.1_r) < 1e-3_r);
+			expect_msg("point is between the boxes", std::abs(contacts[0].point.x - 0.45_r) < 0.01_r);
+
+			contacts.clear();
+			sphere_body_2.pos = phys::vec3(0.0_r, 1.2_r, 0.0_r);
+			sphere_body_2.rot = glm::angleAxis(glm::quarter_pi<phys::real>(), phys::vec3(0.0_r, 0.0_r, 1.0_r));
+			collider.generate_contacts(b, a, contacts);
+
+			const phys::real corner_depth = 0.5_r + std::sqrt(0.5_r) - 1.2_r;
+
+			expect_msg("a box standing on its edge touches another", contacts.size() == 1);
+			expect_msg("normal points from b to a", phys::dot(contacts[0].normal, phys::vec3(0.0_r, -1.0_r, 0.0_r)) > 0.999_r);
+			expect_msg("penetration is the depth of the edge", std::abs(contacts[0].penetration - corner_depth) < 1e-3_r);
+
+			contacts.clear();
+			sphere_body_2.pos = phys::vec3(0.0_r, 1.3_r, 0.0_r);
+			collider.generate_contacts(a, b, contacts);
+
+			expect(contacts).to_have_size(0);
+		});
+
+		it("finds the same contacts with GJK and EPA as with the specialized algorithms", [&]() {
+			phys::contact_generator gjk_collider{};
+
+			gjk_collider.register_collision_algorithm(phys::shape_type::Sphere, phys::shape_type::Box, phys::algorithms::gjk_epa_collision);
+			gjk_collider.register_collision_algorithm(phys::shape_type::Sphere, phys::shape_type::Capsule, phys::algorithms::gjk_epa_collision);
+			gjk_collider.register_collision_algorithm(phys::shape_type::Capsule, phys::shape_type::Capsule, phys::algorithms::gjk_epa_collision);
+
+			phys::sphere s(&sphere_body_1, phys::identity<phys::mat4>(), 0.4_r);
+			phys::capsule c(&sphere_body_1, phys::identity<phys::mat4>(), 0.3_r, 0.5_r);
+			phys::box b(&sphere_body_2, phys::identity<phys::mat4>(), phys::vec3(0.5_r, 0.3_r, 0.4_r));
+			phys::capsule other(&sphere_body_2, phys::identity<phys::mat4>(), 0.2_r, 0.6_r);
+			const std::array<phys::quat, 4> rotations{
+				phys::identity<phys::quat>(),
+				glm::angleAxis(0.7_r, phys::normalize(phys::vec3(1.0_r, 2.0_r, 3.0_r))),
+				glm::angleAxis(2.1_r, phys::normalize(phys::vec3(-2.0_r, 1.0_r, 0.5_r))),
+				glm::angleAxis(glm::half_pi<phys::real>(), phys::vec3(0.0_r, 0.0_r, 1.0_r))
+			};
+			// How far apart the cores are: the sphere's center and the box, or the capsules'
+			// segments. The last few are well inside the other primitive.
+			const std::array<phys::real, 6> distances{ 0.45_r, 0.3_r, 0.15_r, 0.05_r, 0.01_r, -0.1_r };
+			size_t compared = 0;
+
+			// Moves `sphere_body_1` to `pos`, and checks both algorithms against the exact
+			// depth. Some of these are nearly concentric, where a slightly different normal
+			// overlaps by almost as little, so the normal only has to separate the two by
+			// moving `b` that far.
+			const auto check = [&](phys::convex_primitive &pa, phys::convex_primitive &pb, const phys::vec3 &pos, phys::real depth) {
+				sphere_body_1.pos = pos;
+
+				std::vector<phys::contact> expected{};
+				std::vector<phys::contact> actual{};
+
+				collider.generate_contacts(pa, pb, expected);
+				gjk_collider.generate_contacts(pa, pb, actual);
+
+				for (const auto &[name, found] : { std::pair("GJK", &actual), std::pair("specialized", &expected) }) {
+					if (found->size() != 1) {
+						fail_msg(std::string(name) + " finds one contact " + std::to_string(compared));
+						continue;
+					}
+
+					const phys::contact &contact = found->front();
+					const phys::real overlap = phys::dot(pa.support(contact.normal) - pb.support(-contact.normal), contact.normal);
+
+					expect_msg(std::string(name) + " finds the depth " + std::to_string(compared) + " (got " + std::to_string(contact.penetration) + ", expected " + std::to_string(depth) + ")", std::abs(contact.penetration - depth) < 0.001_r);
+					expect_msg(std::string(name) + " finds a normal that overlaps by the depth " + std::to_string(compared) + " (got " + std::to_string(overlap) + ")", std::abs(overlap - depth) < 0.001_r);
+				}
+
+				compared++;
+			};
+
+			for (const phys::quat &rot : rotations) {
+				sphere_body_2.rot = rot;
+
+				const phys::vec3 axis = rot * phys::vec3(0.0_r, 1.0_r, 0.0_r);
+				// Perpendicular to the axis of `other`, and to a face of `b`
+				const phys::vec3 side = rot * phys::vec3(0.0_r, 0.0_r, 1.0_r);
+
+				for (const phys::real d : distances) {
+					sphere_body_1.rot = phys::identity<phys::quat>();
+
+					// The sphere beside the other capsule, and just beyond its end
+					check(s, other, axis * 0.2_r + side * std::abs(d), 0.6_r - std::abs(d));
+					check(s, other, axis * (0.6_r + std::abs(d)), 0.6_r - std::abs(d));
+
+					// The sphere above the top face of the box. Its center is inside the box when
+					// `d` is negative.
+					if (d < 0.4_r) {
+						check(s, b, axis * (0.3_r + d), 0.4_r - d);
+					}
+
+					// `c` crossing the other capsule at right angles
+					sphere_body_1.rot = rot * glm::angleAxis(-glm::half_pi<phys::real>(), phys::vec3(0.0_r, 0.0_r, 1.0_r));
+
+					check(c, other, axis * 0.1_r + side * std::abs(d), 0.5_r - std::abs(d));
+				}
+			}
+		});
+
+		it("generates the same contacts for a batch of pairs as for each pair", [&]() {
+			sphere_body_2.set_mass(phys::infinity);
+
+			std::vector<phys::rigid_body> bodies(20);
+			std::vector<phys::sphere> spheres{};
+			std::vector<phys::primitive_pair> pairs{};
+			phys::plane p(&sphere_body_2, phys::vec3(0.0_r, 1.0_r, 0.0_r), 0.0_r);
+			std::vector<phys::contact> batch_contacts{};
+
+			spheres.reserve(bodies.size());
+
+			for (size_t i = 0; i < bodies.size(); i++) {
+				bodies[i].pos = phys::vec3((phys::real)i * 0.7_r, (phys::real)(i % 3) * 0.5_r, 0.0_r);
+				spheres.emplace_back(&bodies[i], phys::identity<phys::mat4>(), 0.5_r);
+			}
+
+			// Starts with the shape types that sort last
+			for (size_t i = 0; i < spheres.size(); i++) {
+				if (i % 2) {
+					pairs.push_back({ &spheres[i], &p });
+				} else {
+					pairs.push_back({ &p, &spheres[i] });
+				}
+
+				for (size_t j = i + 1; j < spheres.size(); j++) {
+					pairs.push_back({ &spheres[i], &spheres[j] });
+				}
+			}
+
+			for (const phys::primitive_pair &pair : pairs) {
+				collider.generate_contacts(*pair.a, *pair.b, contacts);
+			}
+
+			collider.generate_contacts(pairs, batch_contacts);
+
+			expect_msg("finds contacts", ! contacts.empty());
+			expect_msg("finds as many contacts", contacts.size() == batch_contacts.size());
+
+			for (const phys::contact &c : contacts) {
+				expect_msg("finds each contact", std::find(std::begin(batch_contacts), std::end(batch_contacts), c) != std::end(batch_contacts));
+			}
+		});
+
+		it("throws for shape types without an algorithm", [&]() {
+			phys::plane p1(&sphere_body_1, phys::vec3(0.0_r, 1.0_r, 0.0_r), 0.0_r);
+			phys::plane p2(&sphere_body_2, phys::vec3(1.0_r, 0.0_r, 0.0_r), 0.0_r);
+
+			try {
+				collider.generate_contacts(p1, p2, contacts);
+
+				fail_msg("Expected contact generator to throw");
+			} catch (const std::invalid_argument&) {}
+		});
+
+		it("calls a registered algorithm with the pair in either order", [&]() {
+			phys::contact_generator custom_collider{};
+			custom_primitive c(&sphere_body_1);
+			phys::sphere s(&sphere_body_2, phys::identity<phys::mat4>(), 1.0_r);
+			std::vector<phys::primitive_pair> pairs{ { &s, &c }, { &c, &s }, { &c, &c } };
+
+			custom_calls.clear();
+			custom_collider.register_collision_algorithm(phys::shape_type::Sphere, custom_shape_type, custom_collision);
+			custom_collider.register_collision_algorithm(custom_shape_type, custom_shape_type, custom_collision);
+			custom_collider.generate_contacts(c, s, contacts);
+			custom_collider.generate_contacts(pairs, contacts);
+
+			const int sphere_type = static_cast<int>(phys::shape_type::Sphere);
+
+			expect_msg("called for each pair", custom_calls.size() == 4);
+			expect_msg("called with the custom primitive first", custom_calls[0] == std::make_pair(custom_shape_type, sphere_type));
+			expect_msg("called with the sphere first", std::count(std::begin(custom_calls), std::end(custom_calls), std::make_pair(sphere_type, custom_shape_type)) == 1);
+			expect_msg("called for two custom primitives", std::count(std::begin(custom_calls), std::end(custom_calls), std::make_pair(custom_shape_type, custom_shape_type)) == 1);
+		});
 	});
 }
\ No newline at end of file
@@ -7,6 +7,11 @@ extern void setup_ipaddr_tests();
 extern void setup_uri_tests();
 extern void setup_bvh_tests();
 extern void setup_collision_tests();
+extern void setup_spatial_hash_tests();
+extern void setup_particle_world_tests();
+extern void setup_thread_pool_tests();
+extern void setup_rigid_body_world_tests();
+extern void setup_physical_particle_emitter_tests();
 
 int main(int argc, const char * const * const argv) {
 	#pragma warning(push)
@@ -20,6 +25,11 @@ int main(int argc, const char * const * const argv) {
 	setup_uri_tests();
 	setup_bvh_tests();
 	setup_collision_tests();
+	setup_spatial_hash_tests();
+	setup_particle_world_tests();
+	setup_thread_pool_tests();
+	setup_rigid_body_world_tests();
+	setup_physical_particle_emitter_tests();
 
 	test::run();
 
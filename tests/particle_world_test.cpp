@@ -0,0 +1,936 @@
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cmath>
+#include <random>
+#include "../physics_demo/particle_collision_constraint_generator.h"
+#include "../shared/physics/constraints.h"
+#include "../shared/physics/particle_force_generators.h"
+#include "../shared/physics/particle_world.h"
+#include "../shared/physics/thread_pool.h"
+#include "allocations.h"
+#include "test.h"
+
+using namespace test;
+using namespace phys::literals;
+
+namespace {
+	class test_constraint : public phys::particle_constraint<1> {
+	public:
+		test_constraint(phys::particle_handle _a) :
+			particle_constraint<1>(1.0_r, phys::constraint_type::Inequality, { _a }) {}
+
+		phys::real eval_constraint(const phys::particle_store &store) const override {
+			return 0.0_r;
+		}
+
+		phys::vec3 eval_gradient(const phys::particle_store &store, size_t i) const override {
+			return phys::vec3(0.0_r);
+		}
+
+		void update_velocities(phys::particle_store &store, phys::real dt) override {}
+	};
+
+	// Keeps a particle above the plane y = 0
+	class above_ground_constraint final : public phys::particle_constraint<1> {
+	public:
+		above_ground_constraint(phys::particle_handle _a) :
+			particle_constraint<1>(1.0_r, phys::constraint_type::Inequality, { _a }) {}
+
+		phys::real eval_constraint(const phys::particle_store &store) const override {
+			return store.p[a()].y;
+		}
+
+		phys::vec3 eval_gradient(const phys::particle_store &store, size_t i) const override {
+			return phys::vec3(0.0_r, 1.0_r, 0.0_r);
+		}
+
+		void update_velocities(phys::particle_store &store, phys::real dt) override {}
+	};
+
+	// A chain of particles in random positions, with a distance constraint between each
+	// pair of neighbors that is shorter or longer than the distance between them
+	struct random_chain {
+		phys::particle_store store{};
+		std::vector<phys::particle_handle> particles{};
+		std::vector<phys::distance_constraint> links{};
+
+		random_chain(size_t length) {
+			std::mt19937 gen(1234);
+			std::uniform_real_distribution<phys::real> coord(-1.0_r, 1.0_r);
+			std::uniform_real_distribution<phys::real> dist(0.1_r, 2.0_r);
+
+			for (size_t i = 0; i < length; i++) {
+				phys::particle p{};
+				p.pos = phys::vec3(coord(gen), coord(gen), coord(gen));
+
+				if (i % 7 == 0) {
+					p.set_mass(phys::infinity);
+				} else {
+					p.set_mass(0.5_r + (coord(gen) + 1.0_r));
+				}
+
+				particles.push_back(store.add(p));
+			}
+
+			for (size_t i = 0; i + 1 < length; i++) {
+				links.emplace_back(particles[i], particles[i + 1], dist(gen), i % 3 == 0 ? 0.5_r : 1.0_r);
+				links.back().compliance = (i % 2) * 0.001_r;
+			}
+		}
+	};
+
+	constexpr size_t pile_width = 8;
+	constexpr size_t num_particles = pile_width * pile_width * 2;
+	constexpr phys::real radius = 0.1_r;
+
+	// A few layers of particles resting on a floor, with rods between some of them
+	struct pile_scene {
+		std::array<phys::particle_handle, num_particles> particles{};
+		std::bitset<num_particles> active{};
+		std::vector<phys::distance_constraint> rods{};
+		phys::particle_gravity gravity{ phys::vec3(0.0_r, -9.8_r, 0.0_r) };
+		phys::plane_collision_constraint_generator<std::array<phys::particle_handle, num_particles>> floor;
+		particle_collision_constraint_generator<num_particles> collisions;
+		phys::particle_world world{ 16 };
+
+		pile_scene() :
+			floor(particles, phys::vec3(0.0_r, 1.0_r, 0.0_r), phys::vec3(0.0_r, radius, 0.0_r), 0.9_r, 0.6_r),
+			collisions(particles, active, 2.0_r * radius)
+		{
+			for (size_t i = 0; i < num_particles; i++) {
+				const size_t x = i % pile_width;
+				const size_t z = (i / pile_width) % pile_width;
+				const size_t y = i / (pile_width * pile_width);
+
+				phys::particle p{};
+				p.pos = phys::vec3(x * 0.19_r, radius + y * 0.19_r, z * 0.19_r);
+				p.radius = radius;
+
+				particles[i] = world.add_particle(p);
+				active[i] = true;
+
+				world.force_registry.add(particles[i], &gravity);
+			}
+
+			rods.reserve(pile_width);
+
+			for (size_t i = 0; i < pile_width; i++) {
+				const phys::particle_handle a = particles[i];
+				const phys::particle_handle b = particles[i + pile_width * pile_width];
+				const phys::vec3 r = world.particles.pos[a] - world.particles.pos[b];
+
+				rods.emplace_back(a, b, std::sqrt(phys::dot(r, r)), 1.0_r);
+				world.add_fixed_constraint(&rods.back());
+			}
+
+			world.add_constraint_generator(&floor);
+			world.add_constraint_generator(&collisions);
+		}
+
+		void step(size_t n) {
+			for (size_t i = 0; i < n; i++) {
+				world.prepare_frame();
+				world.run_physics(1.0_r / 60.0_r);
+			}
+		}
+	};
+}
+
+namespace {
+	constexpr size_t cloth_width = 16;
+	constexpr phys::real cloth_spacing = 0.1_r;
+
+	// A square of cloth hanging from its top edge, made of distance constraints between
+	// neighboring particles
+	struct cloth_scene {
+		std::vector<phys::particle_handle> particles{};
+		std::vector<phys::distance_constraint> links{};
+		phys::particle_gravity gravity{ phys::vec3(0.0_r, -9.8_r, 0.0_r) };
+		phys::particle_world world{ 64 };
+
+		cloth_scene(phys::thread_pool * pool) {
+			world.set_thread_pool(pool);
+
+			for (size_t i = 0; i < cloth_width * cloth_width; i++) {
+				const size_t x = i % cloth_width;
+				const size_t y = i / cloth_width;
+
+				phys::particle p{};
+				// The cloth starts out flat, so it swings down from its pinned edge
+				p.pos = phys::vec3(x * cloth_spacing, 0.0_r, y * cloth_spacing);
+
+				if (y == 0) {
+					p.set_mass(phys::infinity);
+				}
+
+				particles.push_back(world.add_particle(p));
+				world.force_registry.add(particles.back(), &gravity);
+			}
+
+			links.reserve(2 * cloth_width * cloth_width);
+
+			for (size_t y = 0; y < cloth_width; y++) {
+				for (size_t x = 0; x < cloth_width; x++) {
+					const phys::particle_handle p = particles[y * cloth_width + x];
+
+					if (x + 1 < cloth_width) {
+						links.emplace_back(p, particles[y * cloth_width + x + 1], cloth_spacing, 1.0_r);
+						world.add_fixed_constraint(&links.back());
+					}
+
+					if (y + 1 < cloth_width) {
+						links.emplace_back(p, particles[(y + 1) * cloth_width + x], cloth_spacing, 1.0_r);
+						world.add_fixed_constraint(&links.back());
+					}
+				}
+			}
+		}
+
+		void step(size_t n) {
+			for (size_t i = 0; i < n; i++) {
+				world.prepare_frame();
+				world.run_physics(1.0_r / 60.0_r);
+			}
+		}
+	};
+
+	// Particles on a sphere around a hub, each tied to the hub and to the next one by rods
+	// that start out stretched or squashed. The hub has more rods than there are colors,
+	// so the last of them can only be projected serially, after the colored ones.
+	struct star_scene {
+		std::vector<phys::particle_handle> particles{};
+		std::vector<phys::distance_constraint> rods{};
+		phys::particle_gravity gravity{ phys::vec3(0.0_r, -9.8_r, 0.0_r) };
+		phys::particle_world world{ 8 };
+
+		star_scene(phys::thread_pool * pool) {
+			constexpr size_t num_spokes = 80;
+			constexpr phys::real golden_angle = 2.39996323_r;
+
+			world.set_thread_pool(pool);
+			particles.push_back(world.add_particle(phys::particle{}));
+			world.force_registry.add(particles[0], &gravity);
+
+			for (size_t i = 0; i < num_spokes; i++) {
+				const phys::real y = 1.0_r - 2.0_r * (i + 0.5_r) / num_spokes;
+				const phys::real r = std::sqrt(1.0_r - y * y);
+
+				phys::particle p{};
+				p.pos = phys::vec3(r * std::cos(golden_angle * i), y, r * std::sin(golden_angle * i));
+				p.set_mass(0.5_r + (i % 5) * 0.25_r);
+
+				particles.push_back(world.add_particle(p));
+				world.force_registry.add(particles.back(), &gravity);
+			}
+
+			rods.reserve(2 * num_spokes);
+
+			for (size_t i = 1; i <= num_spokes; i++) {
+				rods.emplace_back(particles[0], particles[i], 0.8_r + (i % 9) * 0.05_r, 1.0_r);
+				world.add_fixed_constraint(&rods.back());
+			}
+
+			for (size_t i = 1; i < num_spokes; i++) {
+				rods.emplace_back(particles[i], particles[i + 1], 0.1_r, 1.0_r);
+				world.add_fixed_constraint(&rods.back());
+			}
+		}
+
+		void step(size_t n) {
+			for (size_t i = 0; i < n; i++) {
+				world.prepare_frame();
+				world.run_physics(1.0_r / 60.0_r);
+			}
+		}
+	};
+
+	phys::real max_distance(const phys::particle_store &a, const phys::particle_store &b) {
+		phys::real out = 0.0_r;
+
+		for (size_t i = 0; i < a.size(); i++) {
+			const phys::vec3 d = a.pos[i] - b.pos[i];
+			out = std::max(out, std::sqrt(phys::dot(d, d)));
+		}
+
+		return out;
+	}
+
+	// Pairs of particles joined by rods, resting on a floor
+	struct rod_pairs_scene {
+		std::vector<phys::particle_handle> particles{};
+		std::vector<phys::distance_constraint> rods{};
+		phys::particle_gravity gravity{ phys::vec3(0.0_r, -9.8_r, 0.0_r) };
+		phys::plane_collision_constraint_generator<std::vector<phys::particle_handle>> floor;
+		phys::particle_world world{ 8 };
+
+		rod_pairs_scene(size_t num_pairs) :
+			floor(particles, phys::vec3(0.0_r, 1.0_r, 0.0_r), phys::vec3(0.0_r), 0.0_r, 0.6_r)
+		{
+			rods.reserve(num_pairs + 1);
+
+			for (size_t i = 0; i < num_pairs; i++) {
+				const phys::particle_handle a = add(phys::vec3(i * 10.0_r, 0.0_r, 0.0_r));
+				const phys::particle_handle b = add(phys::vec3(i * 10.0_r + 1.0_r, 0.0_r, 0.0_r));
+
+				connect(a, b);
+			}
+
+			world.add_constraint_generator(&floor);
+			world.set_sleeping(true);
+		}
+
+		phys::particle_handle add(const phys::vec3 &pos) {
+			phys::particle p{};
+			p.pos = pos;
+
+			particles.push_back(world.add_particle(p));
+			world.force_registry.add(particles.back(), &gravity);
+
+			return particles.back();
+		}
+
+		void connect(phys::particle_handle a, phys::particle_handle b) {
+			const phys::vec3 r = world.particles.pos[a] - world.particles.pos[b];
+
+			rods.emplace_back(a, b, std::sqrt(phys::dot(r, r)), 1.0_r);
+			world.add_fixed_constraint(&rods.back());
+		}
+
+		void step(size_t n) {
+			for (size_t i = 0; i < n; i++) {
+				world.prepare_frame();
+				world.run_physics(1.0_r / 60.0_r);
+			}
+		}
+	};
+
+	// Steps two scenes from the same states along the path of the first scene, and returns
+	// the largest distance between their particles after a step. Differences in rounding
+	// or in the order that constraints are solved add up over time as the cloth swings,
+	// so comparing single steps is much stricter than comparing whole runs.
+	phys::real max_step_distance(cloth_scene &a, cloth_scene &b) {
+		phys::real out = 0.0_r;
+
+		for (size_t i = 0; i < 12; i++) {
+			a.step(10);
+			b.world.particles = a.world.particles;
+
+			a.step(1);
+			b.step(1);
+
+			out = std::max(out, max_distance(a.world.particles, b.world.particles));
+		}
+
+		return out;
+	}
+}
+
+void setup_particle_world_tests() {
+	describe("Constraint pool", []() {
+		it("Stores built-in collision constraints in typed arenas", []() {
+			phys::particle_store store{};
+			const phys::particle_handle a = store.add(phys::particle());
+			const phys::particle_handle b = store.add(phys::particle());
+			phys::constraint_pool pool{};
+
+			pool.emplace<phys::plane_collision_constraint>(store, a, phys::vec3(0.0_r, 1.0_r, 0.0_r), phys::vec3(0.0_r), 0.9_r, 0.6_r);
+			pool.emplace<phys::particle_collision_constraint>(store, a, b, 0.9_r, 0.1_r);
+			pool.emplace<phys::particle_collision_constraint>(store, b, a, 0.9_r, 0.1_r);
+			pool.emplace<test_constraint>(a);
+
+			expect_msg("size is 4", pool.size() == 4);
+			expect_msg("one plane collision", pool.plane_collisions.size() == 1);
+			expect_msg("two particle collisions", pool.particle_collisions.size() == 2);
+			expect_msg("one other constraint", pool.other_constraints.size() == 1);
+		});
+
+		it("Visits constraints in opposite orders", []() {
+			phys::particle_store store{};
+			const phys::particle_handle a = store.add(phys::particle());
+			const phys::particle_handle b = store.add(phys::particle());
+			phys::constraint_pool pool{};
+			std::vector<phys::constraint *> forward{};
+			std::vector<phys::constraint *> reverse{};
+
+			pool.emplace<phys::particle_collision_constraint>(store, a, b, 0.9_r, 0.1_r);
+			pool.emplace<test_constraint>(a);
+			pool.emplace<phys::plane_collision_constraint>(store, a, phys::vec3(0.0_r, 1.0_r, 0.0_r), phys::vec3(0.0_r), 0.9_r, 0.6_r);
+			pool.emplace<phys::particle_collision_constraint>(store, b, a, 0.9_r, 0.1_r);
+
+			pool.for_each([&](phys::constraint &c) {
+				forward.push_back(&c);
+			});
+
+			pool.for_each_reverse([&](phys::constraint &c) {
+				reverse.push_back(&c);
+			});
+
+			expect(forward).to_have_size(4);
+			expect(reverse).to_have_size(4);
+
+			for (size_t i = 0; i < forward.size(); i++) {
+				expect_msg("reverse order is the opposite of forward order", forward[i] == reverse[reverse.size() - i - 1]);
+			}
+		});
+
+		it("Keeps its memory when cleared", []() {
+			phys::particle_store store{};
+			const phys::particle_handle a = store.add(phys::particle());
+			phys::constraint_pool pool{};
+
+			for (size_t i = 0; i < 100; i++) {
+				pool.emplace<phys::plane_collision_constraint>(store, a, phys::vec3(0.0_r, 1.0_r, 0.0_r), phys::vec3(0.0_r), 0.9_r, 0.6_r);
+			}
+
+			size_t capacity = pool.plane_collisions.capacity();
+			pool.clear();
+
+			expect_msg("size is 0", pool.size() == 0);
+			expect_msg("capacity is unchanged", pool.plane_collisions.capacity() == capacity);
+
+			allocation_counter allocs{};
+
+			for (size_t i = 0; i < 100; i++) {
+				pool.emplace<phys::plane_collision_constraint>(store, a, phys::vec3(0.0_r, 1.0_r, 0.0_r), phys::vec3(0.0_r), 0.9_r, 0.6_r);
+			}
+
+			expect_msg("refilling the pool does not allocate", allocs.count() == 0);
+		});
+	});
+
+	describe("Constraint batches", []() {
+		it("Projects distance constraints like the constraints themselves", []() {
+			for (phys::stiffness_model model : { phys::stiffness_model::PBD, phys::stiffness_model::XPBD }) {
+				random_chain chain(100);
+				phys::particle_store store = chain.store;
+				phys::distance_constraint_batch batch{};
+				const phys::projection_params params{
+					.model = model,
+					.inv_solver_iterations = 0.25_r,
+					.inv_dt_sqr = 3600.0_r
+				};
+
+				for (phys::distance_constraint &link : chain.links) {
+					batch.add(link, params.inv_solver_iterations);
+				}
+
+				for (size_t i = 0; i < 4; i++) {
+					const bool forward = i % 2 == 0;
+
+					for (size_t j = 0; j < chain.links.size(); j++) {
+						phys::distance_constraint &link = chain.links[forward ? j : chain.links.size() - j - 1];
+
+						if (! link.is_satisfied(chain.store)) {
+							link.project(chain.store, params);
+						}
+					}
+
+					batch.project(store, params, 0, batch.size(), forward);
+				}
+
+				for (phys::particle_handle h : chain.particles) {
+					const phys::vec3 d = store.p[h] - chain.store.p[h];
+
+					expect_msg("positions are the same", std::sqrt(phys::dot(d, d)) < 1e-5_r);
+				}
+			}
+		});
+
+		it("Projects independent distance constraints like the scalar kernel", []() {
+			for (phys::stiffness_model model : { phys::stiffness_model::PBD, phys::stiffness_model::XPBD }) {
+				random_chain chain(101);
+				phys::particle_store store = chain.store;
+				phys::distance_constraint_batch scalar{};
+				phys::distance_constraint_batch wide{};
+				const phys::projection_params params{
+					.model = model,
+					.inv_solver_iterations = 0.25_r,
+					.inv_dt_sqr = 3600.0_r
+				};
+
+				// Neighboring links share a particle, so the even links don't share any
+				// particles with each other, and neither do the odd links
+				for (size_t parity = 0; parity < 2; parity++) {
+					for (size_t i = parity; i < chain.links.size(); i += 2) {
+						scalar.add(chain.links[i], params.inv_solver_iterations);
+						wide.add(chain.links[i], params.inv_solver_iterations);
+					}
+				}
+
+				const size_t num_even = (chain.links.size() + 1) / 2;
+
+				for (size_t i = 0; i < 4; i++) {
+					scalar.project(chain.store, params, 0, num_even, true);
+					scalar.project(chain.store, params, num_even, scalar.size(), true);
+
+					const size_t num_projected = wide.project_independent(store, params, 0, num_even) +
+						wide.project_independent(store, params, num_even, wide.size());
+
+					expect_msg("every constraint was projected", num_projected == chain.links.size());
+				}
+
+				for (phys::particle_handle h : chain.particles) {
+					const phys::vec3 d = store.p[h] - chain.store.p[h];
+
+					expect_msg("positions are the same", std::sqrt(phys::dot(d, d)) < 1e-5_r);
+				}
+			}
+		});
+
+		it("Accumulates changes like the constraints themselves", []() {
+			random_chain chain(101);
+			phys::particle_store store = chain.store;
+			phys::distance_constraint_batch batch{};
+			const phys::projection_params params{
+				.model = phys::stiffness_model::PBD,
+				.inv_solver_iterations = 0.25_r,
+				.inv_dt_sqr = 3600.0_r
+			};
+
+			for (phys::distance_constraint &link : chain.links) {
+				batch.add(link, params.inv_solver_iterations);
+				link.accumulate_projection(chain.store, params);
+			}
+
+			batch.accumulate_projection(store, params, 0, batch.size());
+
+			for (phys::particle_handle h : chain.particles) {
+				const phys::vec3 d = store.p_accum[h] - chain.store.p_accum[h];
+
+				expect_msg("changes are the same", std::sqrt(phys::dot(d, d)) < 1e-5_r);
+				expect_msg("counts are the same", store.n[h] == chain.store.n[h]);
+			}
+		});
+
+		it("Keeps each constraint with its own properties when reordered", []() {
+			random_chain chain(10);
+			phys::particle_store store = chain.store;
+			phys::distance_constraint_batch batch{};
+			std::vector<uint32_t> order{};
+			const phys::projection_params params{
+				.model = phys::stiffness_model::PBD,
+				.inv_solver_iterations = 1.0_r,
+				.inv_dt_sqr = 3600.0_r
+			};
+
+			for (phys::distance_constraint &link : chain.links) {
+				batch.add(link, params.inv_solver_iterations);
+				order.insert(std::begin(order), (uint32_t)order.size());
+			}
+
+			batch.reorder(order);
+
+			for (size_t i = 0; i < batch.size(); i++) {
+				expect_msg("particles were reordered", batch.get_particles(i)[0] == chain.links[order[i]].a());
+			}
+
+			// Reversed, so a forward pass over the batch is a backward pass over the links
+			batch.project(store, params, 0, batch.size(), true);
+
+			for (size_t i = chain.links.size(); i-- > 0;) {
+				chain.links[i].project(chain.store, params);
+			}
+
+			for (phys::particle_handle h : chain.particles) {
+				const phys::vec3 d = store.p[h] - chain.store.p[h];
+
+				expect_msg("positions are the same", std::sqrt(phys::dot(d, d)) < 1e-5_r);
+			}
+		});
+
+		it("Solves other types of constraints through the fallback batch", []() {
+			phys::particle_world world(4);
+			phys::particle_gravity gravity(phys::vec3(0.0_r, -9.8_r, 0.0_r));
+			phys::particle p{};
+			p.pos = phys::vec3(0.0_r, 1.0_r, 0.0_r);
+
+			const phys::particle_handle h = world.add_particle(p);
+			above_ground_constraint ground(h);
+
+			world.force_registry.add(h, &gravity);
+			world.add_fixed_constraint(&ground);
+
+			for (size_t i = 0; i < 120; i++) {
+				world.prepare_frame();
+				world.run_physics(1.0_r / 60.0_r);
+			}
+
+			expect_msg("particle is on the ground", std::abs(world.particles.pos[h].y) < 1e-3_r);
+		});
+	});
+
+	describe("Particle store", []() {
+		it("Reuses the slots of removed particles", []() {
+			phys::particle_store store{};
+			phys::particle init{};
+
+			const phys::particle_handle a = store.add(init);
+			const phys::particle_handle b = store.add(init);
+
+			store.remove(a);
+
+			expect_msg("a is not alive", ! store.is_alive(a));
+			expect_msg("b is alive", store.is_alive(b));
+			expect_msg("one particle is alive", store.num_alive() == 1);
+
+			init.pos = phys::vec3(1.0_r, 2.0_r, 3.0_r);
+			const phys::particle_handle c = store.add(init);
+
+			expect_msg("c reuses a's slot", c == a);
+			expect_msg("no new slot was added", store.size() == 2);
+			expect_msg("c has the new position", store.pos[c] == init.pos);
+		});
+
+		it("Zeroes the inverse mass and velocity of removed particles", []() {
+			phys::particle_store store{};
+			phys::particle init{};
+			init.vel = phys::vec3(1.0_r);
+			init.set_mass(2.0_r);
+
+			const phys::particle_handle a = store.add(init);
+
+			expect_msg("a has finite mass", store.has_finite_mass(a));
+
+			store.remove(a);
+
+			expect_msg("inverse mass is 0", store.inv_mass[a] == 0.0_r);
+			expect_msg("velocity is 0", store.vel[a] == phys::vec3(0.0_r));
+		});
+	});
+
+	describe("Particle world", []() {
+		it("Keeps handles valid when other particles are removed", []() {
+			phys::particle_world world{ 4 };
+			phys::particle_gravity gravity{ phys::vec3(0.0_r, -9.8_r, 0.0_r) };
+			phys::particle init{};
+
+			const phys::particle_handle a = world.add_particle(init);
+			init.pos = phys::vec3(5.0_r, 0.0_r, 0.0_r);
+			const phys::particle_handle b = world.add_particle(init);
+
+			world.force_registry.add(a, &gravity);
+			world.force_registry.add(b, &gravity);
+			world.remove_particle(a);
+
+			world.prepare_frame();
+			world.run_physics(1.0_r / 60.0_r);
+
+			expect_msg("b is still at x = 5", world.particles.pos[b].x == 5.0_r);
+			expect_msg("b is falling", world.particles.vel[b].y < 0.0_r);
+			expect_msg("a does not move", world.particles.pos[a] == phys::vec3(0.0_r));
+		});
+
+		it("Does not allocate in a steady-state physics step", []() {
+			std::unique_ptr<pile_scene> scene = std::make_unique<pile_scene>();
+
+			// Let the arenas and the broadphase grow to fit the scene
+			scene->step(120);
+
+			allocation_counter allocs{};
+
+			scene->step(60);
+
+			expect_msg("no allocations (got " + std::to_string(allocs.count()) + ")", allocs.count() == 0);
+		});
+	});
+
+	describe("Parallel constraint solver", []() {
+		it("Gives the same results as the serial solver", []() {
+			// The serial solver also projects distance constraints one color at a time, in
+			// the same order, so the two only differ by rounding
+			phys::thread_pool pool(4);
+			std::unique_ptr<star_scene> serial = std::make_unique<star_scene>(nullptr);
+			std::unique_ptr<star_scene> parallel = std::make_unique<star_scene>(&pool);
+
+			serial->step(60);
+			parallel->step(60);
+
+			const phys::real dist = max_distance(serial->world.particles, parallel->world.particles);
+
+			expect_msg("positions are within 0.001 mm (got " + std::to_string(dist) + ")", dist < 0.000001_r);
+		});
+
+		it("Does not depend on the number of threads", []() {
+			phys::thread_pool one_thread(1);
+			phys::thread_pool four_threads(4);
+			std::unique_ptr<pile_scene> a = std::make_unique<pile_scene>();
+			std::unique_ptr<pile_scene> b = std::make_unique<pile_scene>();
+
+			a->world.set_thread_pool(&one_thread);
+			b->world.set_thread_pool(&four_threads);
+
+			a->step(120);
+			b->step(120);
+
+			expect_msg("positions are identical", max_distance(a->world.particles, b->world.particles) == 0.0_r);
+		});
+	});
+
+	describe("Jacobi solver", []() {
+		it("Does not depend on the order of the constraints", []() {
+			std::unique_ptr<cloth_scene> a = std::make_unique<cloth_scene>(nullptr);
+			std::unique_ptr<cloth_scene> b = std::make_unique<cloth_scene>(nullptr);
+
+			a->world.set_solver_mode(phys::solver_mode::Jacobi);
+			b->world.set_solver_mode(phys::solver_mode::Jacobi);
+
+			for (phys::distance_constraint &link : b->links) {
+				b->world.remove_fixed_constraint(&link);
+			}
+
+			for (auto link = std::rbegin(b->links); link != std::rend(b->links); link++) {
+				b->world.add_fixed_constraint(&*link);
+			}
+
+			const phys::real dist = max_step_distance(*a, *b);
+
+			expect_msg("positions are within 0.01 mm (got " + std::to_string(dist) + ")", dist < 0.00001_r);
+		});
+
+		it("Gives the same results with a thread pool", []() {
+			phys::thread_pool pool(4);
+			std::unique_ptr<cloth_scene> serial = std::make_unique<cloth_scene>(nullptr);
+			std::unique_ptr<cloth_scene> parallel = std::make_unique<cloth_scene>(&pool);
+
+			serial->world.set_solver_mode(phys::solver_mode::Jacobi);
+			parallel->world.set_solver_mode(phys::solver_mode::Jacobi);
+
+			const phys::real dist = max_step_distance(*serial, *parallel);
+
+			expect_msg("positions are within 0.01 mm (got " + std::to_string(dist) + ")", dist < 0.00001_r);
+		});
+	});
+
+	describe("XPBD", []() {
+		it("Holds a compliant rod at its rest stretch with any step size", []() {
+			constexpr phys::real mass = 2.0_r;
+			constexpr phys::real compliance = 0.01_r;
+			const phys::vec3 g(0.0_r, -9.8_r, 0.0_r);
+			// The rod stretches until its force balances gravity
+			const phys::real stretched_length = 1.0_r + mass * 9.8_r * compliance;
+
+			struct step_config {
+				size_t iterations;
+				size_t substeps;
+				phys::real dt;
+			};
+
+			const std::array<step_config, 4> configs{ {
+				{ 16, 1, 1.0_r / 60.0_r },
+				{ 4, 4, 1.0_r / 60.0_r },
+				{ 1, 8, 1.0_r / 60.0_r },
+				{ 2, 2, 1.0_r / 240.0_r }
+			} };
+
+			for (const step_config &config : configs) {
+				phys::particle_world world(config.iterations);
+				phys::particle_gravity gravity(g);
+
+				world.set_stiffness_model(phys::stiffness_model::XPBD);
+				world.set_substeps(config.substeps);
+
+				phys::particle init{};
+				init.damping = 1.0_r;
+				init.set_mass(phys::infinity);
+				const phys::particle_handle anchor = world.add_particle(init);
+
+				init.pos = phys::vec3(0.0_r, -stretched_length, 0.0_r);
+				init.set_mass(mass);
+				const phys::particle_handle bob = world.add_particle(init);
+
+				phys::distance_constraint rod(anchor, bob, 1.0_r, 1.0_r);
+				rod.compliance = compliance;
+
+				world.add_fixed_constraint(&rod);
+				world.force_registry.add(bob, &gravity);
+
+				for (size_t i = 0; i < 60; i++) {
+					world.prepare_frame();
+					world.run_physics(config.dt);
+				}
+
+				const phys::real error = std::abs(world.particles.pos[bob].y + stretched_length);
+
+				expect_msg(
+					"rod stays stretched with " + std::to_string(config.iterations) + " iterations and " +
+						std::to_string(config.substeps) + " substeps (error " + std::to_string(error) + ")",
+					error < 0.0001_r
+				);
+			}
+		});
+
+		it("Splits a step into substeps", []() {
+			constexpr phys::real dt = 1.0_r / 60.0_r;
+			constexpr phys::real h = dt / 4.0_r;
+			phys::particle_world world(4);
+			phys::particle_gravity gravity(phys::vec3(0.0_r, -9.8_r, 0.0_r));
+
+			world.set_substeps(4);
+
+			phys::particle init{};
+			init.damping = 1.0_r;
+			const phys::particle_handle p = world.add_particle(init);
+			world.force_registry.add(p, &gravity);
+
+			world.prepare_frame();
+			world.run_physics(dt);
+
+			// Each substep adds g * h to the velocity before moving the particle
+			const phys::real expected_y = -9.8_r * h * h * (1.0_r + 2.0_r + 3.0_r + 4.0_r);
+
+			expect_msg("particle fell for four substeps", std::abs(world.particles.pos[p].y - expected_y) < 0.000001_r);
+			expect_msg("velocity covers the whole step", std::abs(world.particles.vel[p].y + 9.8_r * dt) < 0.0001_r);
+		});
+
+		it("Lets particles fall from rest with many substeps", []() {
+			constexpr size_t substep_counts[] = { 8, 16, 64 };
+
+			for (size_t substeps : substep_counts) {
+				phys::particle_world world(1);
+				phys::particle_gravity gravity(phys::vec3(0.0_r, -9.8_r, 0.0_r));
+
+				world.set_substeps(substeps);
+
+				phys::particle init{};
+				init.damping = 1.0_r;
+				const phys::particle_handle p = world.add_particle(init);
+				world.force_registry.add(p, &gravity);
+
+				for (size_t i = 0; i < 60; i++) {
+					world.prepare_frame();
+					world.run_physics(1.0_r / 60.0_r);
+				}
+
+				// A substep moves a particle at rest by g * h^2, which is less than the
+				// minimum position change
+				expect_msg(
+					"particle fell about 4.9 m in a second with " + std::to_string(substeps) + " substeps (y = " +
+						std::to_string(world.particles.pos[p].y) + ")",
+					std::abs(world.particles.pos[p].y + 4.9_r) < 0.1_r
+				);
+			}
+		});
+	});
+
+	describe("Sleeping islands", []() {
+		it("Puts resting particles to sleep", []() {
+			rod_pairs_scene scene(2);
+
+			scene.step(60);
+
+			expect_msg(
+				"every particle is asleep (" + std::to_string(scene.world.get_num_asleep()) + " are)",
+				scene.world.get_num_asleep() == 4
+			);
+
+			const phys::vec3 pos = scene.world.particles.pos[scene.particles[0]];
+			scene.step(60);
+
+			expect_msg("sleeping particles don't move", scene.world.particles.pos[scene.particles[0]] == pos);
+		});
+
+		it("Doesn't change how awake particles move", []() {
+			std::unique_ptr<pile_scene> with_sleeping = std::make_unique<pile_scene>();
+			std::unique_ptr<pile_scene> without_sleeping = std::make_unique<pile_scene>();
+			with_sleeping->world.set_sleeping(true);
+
+			with_sleeping->step(120);
+			without_sleeping->step(120);
+
+			expect_msg("nothing fell asleep", with_sleeping->world.get_num_asleep() == 0);
+
+			for (size_t i = 0; i < num_particles; i++) {
+				expect_msg(
+					"positions are the same",
+					with_sleeping->world.particles.pos[with_sleeping->particles[i]] ==
+						without_sleeping->world.particles.pos[without_sleeping->particles[i]]
+				);
+			}
+		});
+
+		it("Wakes only the island of a particle", []() {
+			rod_pairs_scene scene(2);
+
+			scene.step(60);
+
+			expect_msg("both islands are asleep", scene.world.get_num_asleep() == 4);
+
+			scene.world.wake(scene.particles[1]);
+
+			expect_msg("first island is awake", ! scene.world.particles.asleep[scene.particles[0]]);
+			expect_msg("first island is awake", ! scene.world.particles.asleep[scene.particles[1]]);
+			expect_msg("second island is asleep", scene.world.particles.asleep[scene.particles[2]]);
+			expect_msg("second island is asleep", scene.world.particles.asleep[scene.particles[3]]);
+		});
+
+		it("Wakes an island when an awake particle is constrained to it", []() {
+			rod_pairs_scene scene(1);
+
+			scene.step(60);
+
+			expect_msg("the island is asleep", scene.world.get_num_asleep() == 2);
+
+			const phys::particle_handle c = scene.add(phys::vec3(0.0_r, 1.0_r, 0.0_r));
+			scene.connect(scene.particles[0], c);
+			scene.step(1);
+
+			expect_msg("the island is awake", scene.world.get_num_asleep() == 0);
+		});
+
+		it("Bounces slow collisions unless given a minimum restitution speed", []() {
+			// Dropped 5 mm onto a bouncy floor, so that it lands at about 0.3 m/s
+			const auto bounce_speed = [](phys::real min_restitution_speed) {
+				std::vector<phys::particle_handle> particles{};
+				phys::particle_gravity gravity(phys::vec3(0.0_r, -9.8_r, 0.0_r));
+				phys::plane_collision_constraint_generator<std::vector<phys::particle_handle>> floor(
+					particles,
+					phys::vec3(0.0_r, 1.0_r, 0.0_r),
+					phys::vec3(0.0_r),
+					0.9_r,
+					0.6_r
+				);
+				phys::particle_world world(8);
+				phys::real out = 0.0_r;
+
+				phys::particle init{};
+				init.pos = phys::vec3(0.0_r, 0.005_r, 0.0_r);
+				particles.push_back(world.add_particle(init));
+				world.force_registry.add(particles[0], &gravity);
+				world.add_constraint_generator(&floor);
+				floor.min_restitution_speed = min_restitution_speed;
+
+				for (size_t i = 0; i < 30; i++) {
+					world.prepare_frame();
+					world.run_physics(1.0_r / 60.0_r);
+					out = std::max(out, world.particles.vel[particles[0]].y);
+				}
+
+				return out;
+			};
+
+			expect_msg("the particle bounces by default", bounce_speed(0.0_r) > 0.1_r);
+			expect_msg("the particle doesn't bounce below the minimum speed", bounce_speed(0.5_r) == 0.0_r);
+		});
+
+		it("Wakes an island when a particle with infinite mass moves it", []() {
+			rod_pairs_scene scene(1);
+			const phys::particle_handle held = scene.add(phys::vec3(0.0_r, 1.0_r, 0.0_r));
+
+			scene.world.particles.set_mass(held, phys::infinity);
+			scene.connect(scene.particles[0], held);
+			scene.step(60);
+
+			expect_msg("the island is asleep", scene.world.get_num_asleep() == 2);
+
+			scene.step(60);
+
+			expect_msg("a particle with infinite mass that stays put doesn't wake the island", scene.world.get_num_asleep() == 2);
+
+			scene.world.particles.pos[held] += phys::vec3(0.0_r, 0.5_r, 0.0_r);
+			scene.step(1);
+
+			expect_msg("the island is awake", scene.world.get_num_asleep() == 0);
+		});
+	});
+}
\ No newline at end of file
@@ -0,0 +1,264 @@
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <string>
+#include <vector>
+#include "../shared/physical_particle_emitter.h"
+#include "../shared/physics/particle.h"
+#include "test.h"
+
+using namespace phys::literals;
+using namespace std::literals::chrono_literals;
+using namespace test;
+
+namespace {
+	using time_point = physical_particle_emitter::time_point;
+	using duration = physical_particle_emitter::duration;
+
+	constexpr float frame_millis = 16.0f;
+	constexpr duration frame_time(16);
+	const glm::vec4 start_color(1.0f, 1.0f, 1.0f, 1.0f);
+	const glm::vec4 end_color(0.0f, 0.5f, 0.25f, 0.0f);
+
+	// Particles spawn exactly at the emitter with its base velocity, so that the tests
+	// know where each one should be
+	physical_particle_emitter make_emitter(size_t max_particles, size_t new_particles_per_frame, duration expiry_time) {
+		return physical_particle_emitter(
+			phys::vec3(1.0_r, 2.0_r, 3.0_r),
+			phys::vec3(0.3_r, 1.0_r, -0.2_r),
+			0.0_r,
+			0.0_r,
+			max_particles,
+			new_particles_per_frame,
+			0,
+			0.7_r,
+			0.9_r,
+			phys::vec3(0.0_r, -9.8_r, 0.0_r),
+			expiry_time,
+			start_color,
+			end_color,
+			8.0f
+		);
+	}
+
+	// `count` particles of the same age, for `expect_ages`
+	std::vector<float> ages(size_t count, float age) {
+		return std::vector<float>(count, age);
+	}
+
+	std::vector<float> operator+(std::vector<float> a, const std::vector<float> &b) {
+		a.insert(std::end(a), std::begin(b), std::end(b));
+
+		return a;
+	}
+
+	// Checks that the live particles, from oldest to newest, have the given ages, through
+	// the colors that they fade to
+	void expect_ages(const physical_particle_emitter &emitter, const std::vector<float> &expected) {
+		const std::vector<glm::vec4> &colors = emitter.get_colors();
+
+		expect_msg(
+			std::to_string(expected.size()) + " particles are alive (" + std::to_string(emitter.get_num_alive()) + " are)",
+			emitter.get_num_alive() == expected.size() && colors.size() == expected.size()
+		);
+
+		for (size_t i = 0; i < expected.size(); i++) {
+			const glm::vec4 color = start_color + (end_color - start_color) * (expected[i] / (float)emitter.expiry_time.count());
+
+			for (glm::length_t j = 0; j < 4; j++) {
+				if (std::abs(colors[i][j] - color[j]) > 0.000001f) {
+					fail_msg("particle " + std::to_string(i) + " is " + std::to_string(expected[i]) + " ms old");
+				}
+			}
+		}
+	}
+}
+
+void setup_physical_particle_emitter_tests() {
+	describe("Physical particle emitter", []() {
+		it("Expires particles in the order they were spawned", []() {
+			physical_particle_emitter emitter = make_emitter(100, 10, 50ms);
+			time_point now = physical_particle_emitter::clock::now();
+
+			emitter.start_simulation(now);
+
+			for (size_t i = 0; i < 3; i++) {
+				now += frame_time;
+				emitter.simulate(frame_millis, now);
+			}
+
+			expect_ages(emitter, ages(10, 32.0f) + ages(10, 16.0f) + ages(10, 0.0f));
+
+			now += frame_time;
+			emitter.simulate(frame_millis, now);
+
+			expect_ages(emitter, ages(10, 48.0f) + ages(10, 32.0f) + ages(10, 16.0f) + ages(10, 0.0f));
+
+			// The oldest particles are now 64 ms old
+			now += frame_time;
+			emitter.simulate(frame_millis, now);
+
+			expect_ages(emitter, ages(10, 48.0f) + ages(10, 32.0f) + ages(10, 16.0f) + ages(10, 0.0f));
+
+			// A long frame expires all but the newest particles
+			now += 40ms;
+			emitter.simulate(frame_millis, now);
+
+			expect_ages(emitter, ages(10, 40.0f) + ages(10, 0.0f));
+		});
+
+		it("Reuses the slots of expired particles around the ring", []() {
+			// 30 particles are alive at a time, so each frame starts 10 slots further along a
+			// ring of 35
+			physical_particle_emitter emitter = make_emitter(35, 10, 40ms);
+			time_point now = physical_particle_emitter::clock::now();
+
+			emitter.start_simulation(now);
+
+			for (size_t i = 0; i < 20; i++) {
+				now += frame_time;
+				emitter.simulate(frame_millis, now);
+
+				if (i >= 2) {
+					expect_ages(emitter, ages(10, 32.0f) + ages(10, 16.0f) + ages(10, 0.0f));
+				}
+			}
+		});
+
+		it("Stops spawning while the buffer is full", []() {
+			physical_particle_emitter emitter = make_emitter(25, 10, 60ms);
+			time_point now = physical_particle_emitter::clock::now();
+
+			emitter.start_simulation(now);
+
+			for (size_t i = 0; i < 3; i++) {
+				now += frame_time;
+				emitter.simulate(frame_millis, now);
+			}
+
+			expect_ages(emitter, ages(10, 32.0f) + ages(10, 16.0f) + ages(5, 0.0f));
+
+			now += frame_time;
+			emitter.simulate(frame_millis, now);
+
+			expect_ages(emitter, ages(10, 48.0f) + ages(10, 32.0f) + ages(5, 16.0f));
+
+			// The oldest 10 expire and make room for 10 more
+			now += frame_time;
+			emitter.simulate(frame_millis, now);
+
+			expect_ages(emitter, ages(10, 48.0f) + ages(5, 32.0f) + ages(10, 0.0f));
+		});
+
+		it("Frees every particle when stopped", []() {
+			physical_particle_emitter emitter = make_emitter(100, 10, 1000ms);
+			time_point now = physical_particle_emitter::clock::now();
+
+			emitter.start_simulation(now);
+
+			for (size_t i = 0; i < 3; i++) {
+				now += frame_time;
+				emitter.simulate(frame_millis, now);
+			}
+
+			emitter.stop();
+
+			expect_msg("no particles are alive", emitter.get_num_alive() == 0);
+			expect_msg("the emitter is done", emitter.is_done());
+
+			now += frame_time;
+			emitter.simulate(frame_millis, now);
+
+			expect_ages(emitter, ages(10, 0.0f));
+		});
+
+		it("Moves particles like phys::particle", []() {
+			// 27 particles are alive at a time, which is not a multiple of the SIMD width, and
+			// each frame starts 9 slots further along a ring of 37
+			constexpr size_t max_particles = 37;
+			constexpr size_t new_particles_per_frame = 9;
+			physical_particle_emitter emitter = make_emitter(max_particles, new_particles_per_frame, 40ms);
+			time_point now = physical_particle_emitter::clock::now();
+
+			struct expected_particle {
+				phys::particle physics;
+				float age;
+			};
+
+			std::deque<expected_particle> expected{};
+
+			emitter.start_simulation(now);
+
+			for (size_t frame = 0; frame < 30; frame++) {
+				now += frame_time;
+				emitter.simulate(frame_millis, now);
+
+				while (! expected.empty() && expected.front().age + frame_millis > (float)emitter.expiry_time.count()) {
+					expected.pop_front();
+				}
+
+				for (expected_particle &p : expected) {
+					p.age += frame_millis;
+				}
+
+				for (size_t i = 0; i < new_particles_per_frame && expected.size() < max_particles; i++) {
+					expected_particle &p = expected.emplace_back();
+					p.physics.pos = emitter.pos;
+					p.physics.vel = emitter.base_vel;
+					p.physics.force = emitter.gravity;
+					p.physics.damping = emitter.damping;
+					p.physics.set_mass(emitter.particle_mass);
+					p.age = 0.0f;
+				}
+
+				const std::vector<glm::vec3> &positions = emitter.get_positions();
+				const std::vector<glm::vec4> &colors = emitter.get_colors();
+
+				expect_msg("the same number of particles are alive", positions.size() == expected.size());
+
+				for (size_t i = 0; i < expected.size(); i++) {
+					expected_particle &p = expected[i];
+					p.physics.acc = phys::vec3(0.0_r);
+					p.physics.integrate(frame_millis / 1000);
+
+					const glm::vec4 color = start_color + (end_color - start_color) * (p.age / (float)emitter.expiry_time.count());
+
+					for (glm::length_t j = 0; j < 3; j++) {
+						if (std::abs(positions[i][j] - p.physics.pos[j]) > 0.00001f) {
+							fail_msg("particle " + std::to_string(i) + " is in the wrong place in frame " + std::to_string(frame));
+						}
+					}
+
+					for (glm::length_t j = 0; j < 4; j++) {
+						if (std::abs(colors[i][j] - color[j]) > 0.000001f) {
+							fail_msg("particle " + std::to_string(i) + " is the wrong color in frame " + std::to_string(frame));
+						}
+					}
+				}
+			}
+		});
+
+		it("Is done once its newest particle has expired", []() {
+			// `is_done` reads the clock, so these frames are run well before and well after now
+			physical_particle_emitter past = make_emitter(100, 10, 1000ms);
+			physical_particle_emitter future = make_emitter(100, 10, 1000ms);
+			time_point past_now = physical_particle_emitter::clock::now() - 1h;
+			time_point future_now = physical_particle_emitter::clock::now() + 1h;
+
+			expect_msg("an emitter with no particles is done", past.is_done());
+
+			past.start_simulation(past_now);
+			future.start_simulation(future_now);
+
+			for (size_t i = 0; i < 3; i++) {
+				past_now += frame_time;
+				past.simulate(frame_millis, past_now);
+				future_now += frame_time;
+				future.simulate(frame_millis, future_now);
+			}
+
+			expect_msg("particles from an hour ago have expired", past.is_done());
+			expect_msg("particles from the last frame are alive", ! future.is_done());
+		});
+	});
+}
@@ -0,0 +1,799 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+#include "../shared/physics/collision/primitives.h"
+#include "../shared/physics/contact_resolvers.h"
+#include "../shared/physics/rigid_body_batch.h"
+#include "../shared/physics/rigid_body_force_generators.h"
+#include "../shared/physics/rigid_body_world.h"
+#include "../shared/physics/thread_pool.h"
+#include "test.h"
+
+using namespace test;
+using namespace phys::literals;
+
+namespace {
+	constexpr phys::real dt = 1.0_r / 60.0_r;
+
+	// Spheres with a static ground plane at y = 0
+	struct sphere_scene {
+		phys::rigid_body ground_body{};
+		phys::plane ground;
+		phys::rigid_body_gravity gravity;
+		phys::linear_contact_resolver resolver;
+		std::vector<std::unique_ptr<phys::rigid_body>> bodies{};
+		std::vector<std::unique_ptr<phys::sphere>> spheres{};
+		phys::rigid_body_world world{};
+
+		sphere_scene() :
+			ground(&ground_body, phys::vec3(0.0_r, 1.0_r, 0.0_r), 0.0_r),
+			gravity(phys::vec3(0.0_r, -9.8_r, 0.0_r)),
+			resolver(4, 0.0_r)
+		{
+			ground_body.set_mass(phys::infinity);
+
+			world.add_body(&ground_body);
+			world.add_primitive(&ground);
+			world.set_contact_resolver(&resolver);
+		}
+
+		phys::rigid_body& add_sphere(const phys::vec3 &pos, phys::real radius) {
+			bodies.push_back(std::make_unique<phys::rigid_body>());
+			bodies.back()->pos = pos;
+			bodies.back()->set_mass(1.0_r);
+			bodies.back()->set_inertia_tensor(phys::mat3(0.4_r * radius * radius));
+
+			spheres.push_back(std::make_unique<phys::sphere>(bodies.back().get(), phys::identity<phys::mat4>(), radius));
+
+			world.add_body(bodies.back().get());
+			world.add_primitive(spheres.back().get());
+			world.add_force_generator(bodies.back().get(), &gravity);
+
+			return *bodies.back();
+		}
+
+		// A column of touching spheres standing on the plane
+		void add_stack(size_t height, phys::real radius) {
+			for (size_t i = 0; i < height; i++) {
+				add_sphere(phys::vec3(0.0_r, (2 * i + 1) * radius, 0.0_r), radius);
+			}
+		}
+
+		// Largest distance of a sphere in a stack from where it should rest
+		phys::real stack_error(phys::real radius) const {
+			phys::real out = 0.0_r;
+
+			for (size_t i = 0; i < bodies.size(); i++) {
+				const phys::vec3 expected(0.0_r, (2 * i + 1) * radius, 0.0_r);
+				const phys::vec3 d = bodies[i]->pos - expected;
+
+				out = std::max(out, std::sqrt(phys::dot(d, d)));
+			}
+
+			return out;
+		}
+
+		void run(size_t steps) {
+			for (size_t i = 0; i < steps; i++) {
+				world.run_physics(dt);
+			}
+		}
+	};
+
+	struct scripted_point {
+		// From the first body's center
+		phys::vec3 offset{};
+		phys::real penetration{};
+	};
+
+	// What `scripted_collision` reports for every pair, with normals that point from the
+	// first body's center to the second's
+	std::vector<scripted_point> script{};
+
+	void scripted_collision(phys::primitive &a, phys::primitive &b, phys::contact_container &contacts) {
+		const phys::vec3 normal = phys::normalize(b.body->pos - a.body->pos);
+
+		for (const scripted_point &p : script) {
+			contacts.push_back(phys::contact(a.body, b.body, a.body->pos + p.offset, normal, p.penetration));
+		}
+	}
+
+	// Two overlapping spheres without gravity or a resolver, so that they only move when
+	// a test moves them. Sphere pairs get their contacts from `script`.
+	struct scripted_scene {
+		phys::rigid_body first{};
+		phys::rigid_body second{};
+		phys::sphere first_sphere;
+		phys::sphere second_sphere;
+		phys::rigid_body_world world{};
+
+		scripted_scene() :
+			first_sphere(&first, phys::identity<phys::mat4>(), 0.5_r),
+			second_sphere(&second, phys::identity<phys::mat4>(), 0.5_r)
+		{
+			second.pos = phys::vec3(0.9_r, 0.0_r, 0.0_r);
+			script.clear();
+
+			world.collider.register_collision_algorithm(phys::shape_type::Sphere, phys::shape_type::Sphere, scripted_collision);
+			world.add_body(&first);
+			world.add_body(&second);
+			world.add_primitive(&first_sphere);
+			world.add_primitive(&second_sphere);
+		}
+
+		// The body that comes first in the manifold, which the normals point away from
+		phys::rigid_body& lower() {
+			return std::less<phys::rigid_body *>{}(&first, &second) ? first : second;
+		}
+
+		phys::rigid_body& upper() {
+			return &lower() == &first ? second : first;
+		}
+	};
+}
+
+void setup_rigid_body_world_tests() {
+	describe("Rigid body world", []() {
+		it("Rests a sphere on a plane", []() {
+			sphere_scene scene{};
+			phys::rigid_body &body = scene.add_sphere(phys::vec3(0.0_r, 3.0_r, 0.0_r), 0.5_r);
+
+			scene.run(300);
+
+			expect_msg("sphere rests on the plane", std::abs(body.pos.y - 0.5_r) < 0.02_r);
+			expect_msg("sphere has stopped", std::abs(body.vel.y) < 0.2_r);
+			expect_msg("sphere touches the plane", scene.world.get_contacts().size() == 1);
+		});
+
+		it("Stacks spheres on top of each other", []() {
+			sphere_scene scene{};
+			phys::rigid_body &bottom = scene.add_sphere(phys::vec3(0.0_r, 0.5_r, 0.0_r), 0.5_r);
+			phys::rigid_body &top = scene.add_sphere(phys::vec3(0.0_r, 2.0_r, 0.0_r), 0.5_r);
+
+			scene.run(300);
+
+			expect_msg("bottom sphere rests on the plane", std::abs(bottom.pos.y - 0.5_r) < 0.05_r);
+			expect_msg("top sphere rests on the bottom sphere", std::abs(top.pos.y - 1.5_r) < 0.1_r);
+		});
+
+		it("Rests a box flat on a plane", []() {
+			sphere_scene scene{};
+			phys::sequential_impulse_resolver resolver(20);
+			phys::rigid_body body{};
+			phys::box b(&body, phys::identity<phys::mat4>(), phys::vec3(0.5_r));
+
+			body.pos = phys::vec3(0.0_r, 1.0_r, 0.0_r);
+			body.rot = glm::angleAxis(0.2_r, phys::normalize(phys::vec3(1.0_r, 0.0_r, 1.0_r)));
+			body.set_inertia_tensor(phys::mat3(1.0_r / 6.0_r));
+
+			scene.world.set_contact_resolver(&resolver);
+			scene.world.add_body(&body);
+			scene.world.add_primitive(&b);
+			scene.world.add_force_generator(&body, &scene.gravity);
+			scene.run(300);
+
+			const phys::mat4 t = b.world_transform();
+			const phys::real upright = std::max({ std::abs(t[0].y), std::abs(t[1].y), std::abs(t[2].y) });
+
+			expect_msg("box rests on the plane", std::abs(body.pos.y - 0.5_r) < 0.02_r);
+			expect_msg("box lands on a face", upright > 0.999_r);
+			expect_msg("box touches with four corners", scene.world.get_contacts().size() == 4);
+
+			scene.world.remove_primitive(&b);
+			scene.world.remove_body(&body);
+		});
+
+		it("Does not collide primitives on the same body", []() {
+			sphere_scene scene{};
+			phys::rigid_body &body = scene.add_sphere(phys::vec3(0.0_r, 5.0_r, 0.0_r), 0.5_r);
+			phys::sphere other(&body, phys::identity<phys::mat4>(), 0.25_r);
+
+			scene.world.add_primitive(&other);
+			scene.run(1);
+
+			expect_msg("no contacts", scene.world.get_contacts().empty());
+
+			scene.world.remove_primitive(&other);
+		});
+
+		it("Generates the same contacts with a thread pool", []() {
+			std::mt19937 gen(4321);
+			std::uniform_real_distribution<phys::real> coord_distrib(0.0_r, 10.0_r);
+			sphere_scene scene{};
+			std::vector<phys::vec3> start{};
+			phys::thread_pool pool(4);
+
+			for (int i = 0; i < 2000; i++) {
+				start.emplace_back(coord_distrib(gen), coord_distrib(gen) * 0.5_r, coord_distrib(gen));
+				scene.add_sphere(start.back(), 0.3_r);
+			}
+
+			scene.world.set_contact_resolver(nullptr);
+			scene.run(1);
+
+			const phys::contact_container serial = scene.world.get_contacts();
+
+			for (size_t i = 0; i < start.size(); i++) {
+				scene.bodies[i]->pos = start[i];
+				scene.bodies[i]->vel = phys::vec3(0.0_r);
+			}
+
+			scene.world.set_thread_pool(&pool);
+			scene.run(1);
+
+			const phys::contact_container &parallel = scene.world.get_contacts();
+
+			expect_msg("finds contacts", serial.size() > start.size() / 10);
+			expect_msg("finds the same contacts in the same order", serial == parallel);
+		});
+	});
+
+	describe("Rigid body derived data", []() {
+		it("Is recalculated after the rotation or inertia tensor changes", []() {
+			phys::rigid_body body{};
+
+			body.set_inertia_tensor(phys::mat3(
+				phys::vec3(1.0_r, 0.0_r, 0.0_r),
+				phys::vec3(0.0_r, 2.0_r, 0.0_r),
+				phys::vec3(0.0_r, 0.0_r, 3.0_r)
+			));
+			body.integrate(dt);
+
+			const auto matches_fresh = [&]() {
+				phys::rigid_body fresh = body;
+
+				fresh.calculate_derived_data();
+
+				return fresh.get_inv_inertia_tensor_world() == body.get_inv_inertia_tensor_world();
+			};
+
+			expect_msg("derived data is calculated on the first step", matches_fresh());
+
+			body.rot = phys::quat::wxyz(std::cos(0.5_r), std::sin(0.5_r), 0.0_r, 0.0_r);
+			body.integrate(dt);
+
+			expect_msg("derived data follows a new rotation", matches_fresh());
+
+			body.set_inertia_tensor(phys::mat3(5.0_r));
+			body.integrate(dt);
+
+			expect_msg("derived data follows a new inertia tensor", matches_fresh());
+		});
+	});
+
+	describe("Rigid body batch", []() {
+		it("Integrates like each body on its own", []() {
+			std::mt19937 gen(99);
+			std::uniform_real_distribution<phys::real> unit(-1.0_r, 1.0_r);
+			std::uniform_real_distribution<phys::real> positive(0.5_r, 2.0_r);
+			// Not a multiple of any SIMD width, so that some bodies take the scalar path
+			constexpr size_t count = 37;
+			std::vector<phys::rigid_body> single(count);
+			std::vector<phys::rigid_body> batched(count);
+			std::vector<phys::rigid_body *> pointers{};
+			phys::rigid_body_batch batch{};
+
+			const auto random_vec3 = [&]() {
+				return phys::vec3(unit(gen), unit(gen), unit(gen));
+			};
+
+			for (size_t i = 0; i < count; i++) {
+				phys::rigid_body &body = single[i];
+
+				body.pos = random_vec3();
+				body.vel = random_vec3();
+				body.acc = random_vec3();
+				body.ang_vel = random_vec3();
+				body.rot = phys::normalize(phys::quat(unit(gen), unit(gen), unit(gen), unit(gen)));
+				body.linear_damping = 0.9_r + 0.1_r * positive(gen) / 2.0_r;
+				body.set_mass(positive(gen));
+				body.set_inertia_tensor(phys::mat3(
+					phys::vec3(positive(gen), 0.0_r, 0.0_r),
+					phys::vec3(0.0_r, positive(gen), 0.0_r),
+					phys::vec3(0.0_r, 0.0_r, positive(gen))
+				));
+				body.calculate_derived_data();
+
+				batched[i] = body;
+				pointers.push_back(&batched[i]);
+			}
+
+			phys::real max_error = 0.0_r;
+
+			const auto track = [&](const phys::vec3 &a, const phys::vec3 &b) {
+				max_error = std::max({ max_error, std::abs(a.x - b.x), std::abs(a.y - b.y), std::abs(a.z - b.z) });
+			};
+
+			for (size_t step = 0; step < 5; step++) {
+				// The batch must notice when the damping changes
+				if (step == 3) {
+					for (size_t i = 0; i < count; i += 2) {
+						single[i].angular_damping = 0.5_r;
+						batched[i].angular_damping = 0.5_r;
+					}
+				}
+
+				for (size_t i = 0; i < count; i++) {
+					const phys::vec3 f = random_vec3();
+					const phys::vec3 at = single[i].pos + random_vec3();
+
+					single[i].add_force_at_world(f, at);
+					batched[i].add_force_at_world(f, at);
+				}
+
+				for (phys::rigid_body &body : single) {
+					body.integrate(dt);
+				}
+
+				batch.integrate(pointers, dt, 0, count);
+
+				for (size_t i = 0; i < count; i++) {
+					track(single[i].vel, batched[i].vel);
+					track(single[i].ang_vel, batched[i].ang_vel);
+
+					for (int c = 0; c < 3; c++) {
+						track(single[i].get_inv_inertia_tensor_world()[c], batched[i].get_inv_inertia_tensor_world()[c]);
+					}
+				}
+
+				for (phys::rigid_body &body : single) {
+					body.integrate_position(dt);
+				}
+
+				batch.integrate_position(pointers, dt, 0, count);
+
+				for (size_t i = 0; i < count; i++) {
+					const phys::quat &a = single[i].rot;
+					const phys::quat &b = batched[i].rot;
+
+					track(single[i].pos, batched[i].pos);
+					track(phys::vec3(a.x, a.y, a.z), phys::vec3(b.x, b.y, b.z));
+					track(phys::vec3(a.w), phys::vec3(b.w));
+
+					for (int c = 0; c < 3; c++) {
+						track(single[i].get_inv_inertia_tensor_world()[c], batched[i].get_inv_inertia_tensor_world()[c]);
+					}
+				}
+			}
+
+			expect_msg("batched bodies match bodies integrated one at a time", max_error < 1e-5_r);
+		});
+	});
+
+	describe("Contact manifold cache", []() {
+		it("Skips the narrowphase while a body rests", []() {
+			sphere_scene scene{};
+			phys::sequential_impulse_resolver resolver(20);
+			phys::rigid_body body{};
+			phys::box b(&body, phys::identity<phys::mat4>(), phys::vec3(0.5_r));
+
+			body.pos = phys::vec3(0.0_r, 0.6_r, 0.0_r);
+			body.set_inertia_tensor(phys::mat3(1.0_r / 6.0_r));
+
+			scene.world.set_contact_resolver(&resolver);
+			scene.world.add_body(&body);
+			scene.world.add_primitive(&b);
+			scene.world.add_force_generator(&body, &scene.gravity);
+			scene.run(300);
+
+			size_t hits = 0;
+
+			for (size_t i = 0; i < 60; i++) {
+				scene.run(1);
+				hits += scene.world.manifolds.get_last_hits();
+			}
+
+			expect_msg("narrowphase is skipped in most steps", hits > 50);
+			expect_msg("box still touches the plane with four corners", scene.world.get_contacts().size() == 4);
+
+			scene.world.remove_primitive(&b);
+			scene.world.remove_body(&body);
+		});
+
+		it("Runs the narrowphase again once bodies move", []() {
+			scripted_scene scene{};
+
+			script = {
+				{ phys::vec3(0.45_r, 0.1_r, 0.1_r), 0.1_r },
+				{ phys::vec3(0.45_r, 0.1_r, -0.1_r), 0.1_r },
+				{ phys::vec3(0.45_r, -0.1_r, 0.1_r), 0.1_r },
+				{ phys::vec3(0.45_r, -0.1_r, -0.1_r), 0.1_r }
+			};
+
+			scene.world.run_physics(dt);
+			expect_msg("first step runs the narrowphase", scene.world.manifolds.get_last_misses() == 1);
+
+			scene.world.run_physics(dt);
+			expect_msg("narrowphase is skipped for bodies that haven't moved", scene.world.manifolds.get_last_hits() == 1);
+			expect_msg("remembered contacts stand in", scene.world.get_contacts().size() == 4);
+
+			scene.second.pos.y += 0.01_r;
+			scene.world.run_physics(dt);
+			expect_msg("narrowphase runs for bodies that have moved", scene.world.manifolds.get_last_misses() == 1);
+
+			scene.second.rot = glm::angleAxis(0.01_r, phys::vec3(0.0_r, 0.0_r, 1.0_r));
+			scene.world.run_physics(dt);
+			expect_msg("narrowphase runs for bodies that have turned", scene.world.manifolds.get_last_misses() == 1);
+		});
+
+		it("Runs the narrowphase for a manifold with room for more points", []() {
+			scripted_scene scene{};
+
+			script = { { phys::vec3(0.45_r, 0.0_r, 0.0_r), 0.1_r } };
+			scene.world.run_physics(dt);
+			scene.world.run_physics(dt);
+			expect_msg("narrowphase runs for bodies that haven't moved", scene.world.manifolds.get_last_misses() == 1);
+
+
+			scripted_scene apart{};
+
+			apart.world.run_physics(dt);
+			apart.world.run_physics(dt);
+			expect_msg("narrowphase is skipped for bodies that don't touch", apart.world.manifolds.get_last_hits() == 1);
+		});
+
+		it("Finds about the same contacts whether it skips the narrowphase or not", []() {
+			constexpr size_t side = 5;
+			constexpr phys::real spacing = 0.95_r;
+			constexpr phys::real amplitude = 0.02_r;
+			phys::contact_generator collider{};
+
+			for (const phys::real speed : { 0.01_r, 0.1_r }) {
+				std::array<size_t, 2> contact_counts{};
+				size_t hits = 0;
+				size_t body_pairs = 0;
+
+				for (const bool skip : { false, true }) {
+					// A lattice of boxes and spheres that overlap their neighbours, each swaying
+					// around its place
+					std::vector<phys::rigid_body> bodies(side * side * side);
+					std::vector<std::unique_ptr<phys::primitive>> primitives{};
+					std::vector<phys::primitive_pair> pairs{};
+					phys::contact_manifold_cache cache{};
+					phys::contact_container scratch{};
+					phys::contact_container contacts{};
+					const auto home = [&](size_t i) {
+						return phys::vec3((phys::real)(i / (side * side)), (phys::real)(i / side % side), (phys::real)(i % side)) * spacing;
+					};
+
+					for (size_t i = 0; i < bodies.size(); i++) {
+						if ((i / (side * side) + i / side + i) % 2) {
+							primitives.push_back(std::make_unique<phys::box>(&bodies[i], phys::identity<phys::mat4>(), phys::vec3(0.5_r)));
+						} else {
+							primitives.push_back(std::make_unique<phys::sphere>(&bodies[i], phys::identity<phys::mat4>(), 0.5_r));
+						}
+					}
+
+					for (size_t i = 0; i < bodies.size(); i++) {
+						for (size_t j = i + 1; j < bodies.size(); j++) {
+							const phys::vec3 d = home(j) - home(i);
+
+							if (std::max({ std::abs(d.x), std::abs(d.y), std::abs(d.z) }) < 1.5_r * spacing) {
+								pairs.push_back({ primitives[i].get(), primitives[j].get() });
+							}
+						}
+					}
+
+					cache.skip_narrowphase = skip;
+
+					for (size_t frame = 0; frame < 120; frame++) {
+						for (size_t i = 0; i < bodies.size(); i++) {
+							const phys::real x = (phys::real)i;
+							const phys::vec3 dir = phys::normalize(phys::vec3(std::sin(x * 1.7_r), std::cos(x * 2.3_r), std::sin(x * 0.9_r + 1.0_r)));
+							const phys::real s = std::sin((phys::real)frame * dt * speed / amplitude + x * 0.77_r);
+
+							bodies[i].pos = home(i) + dir * (amplitude * s);
+							bodies[i].rot = glm::angleAxis(amplitude * s, dir);
+						}
+
+						contacts.clear();
+						cache.update(0, cache.begin_step(pairs), collider, scratch);
+						cache.end_step(contacts);
+
+						if (skip && frame > 0) {
+							hits += cache.get_last_hits();
+							body_pairs += cache.get_last_hits() + cache.get_last_misses();
+						}
+					}
+
+					contact_counts[skip] = contacts.size();
+				}
+
+				const std::string suffix = " at top speed " + std::to_string(speed).substr(0, 4);
+				const phys::real difference = std::abs((phys::real)contact_counts[1] - (phys::real)contact_counts[0]);
+
+				expect_msg("narrowphase is skipped for some pairs" + suffix, hits * 5 > body_pairs);
+				expect_msg("contact counts agree within 1%" + suffix + " (" + std::to_string(contact_counts[0]) + " uncached, " + std::to_string(contact_counts[1]) + " cached)", difference <= 0.01_r * (phys::real)contact_counts[0]);
+			}
+		});
+
+		it("Moves remembered points with their bodies", []() {
+			scripted_scene scene{};
+
+			scene.world.manifolds.skip_narrowphase = false;
+			script = { { phys::vec3(0.45_r, 0.0_r, 0.0_r), 0.1_r } };
+			scene.world.run_physics(dt);
+			script.clear();
+
+			const phys::vec3 normal = scene.world.get_contacts()[0].normal;
+
+			scene.upper().pos -= normal * 0.05_r;
+			scene.world.run_physics(dt);
+
+			expect_msg("point is kept", scene.world.get_contacts().size() == 1);
+			expect_msg("penetration grows as the bodies approach", std::abs(scene.world.get_contacts()[0].penetration - 0.15_r) < 1e-4_r);
+
+			scene.upper().pos += normal * 0.1_r;
+			scene.world.run_physics(dt);
+
+			expect_msg("point is kept while the bodies overlap there", scene.world.get_contacts().size() == 1);
+			expect_msg("penetration shrinks as the bodies separate", std::abs(scene.world.get_contacts()[0].penetration - 0.05_r) < 1e-4_r);
+
+			scene.upper().pos.z += 0.05_r;
+			scene.world.run_physics(dt);
+
+			expect_msg("point is dropped once the bodies slide apart", scene.world.get_contacts().empty());
+		});
+
+		it("Replaces matching points and keeps the four that span the most area", []() {
+			scripted_scene scene{};
+
+			scene.world.manifolds.skip_narrowphase = false;
+			script = {
+				{ phys::vec3(0.45_r, 0.3_r, 0.3_r), 0.01_r },
+				{ phys::vec3(0.45_r, 0.0_r, 0.1_r), 0.01_r },
+				{ phys::vec3(0.45_r, 0.3_r, -0.3_r), 0.01_r },
+				{ phys::vec3(0.45_r, 0.0_r, 0.0_r), 0.05_r },
+				{ phys::vec3(0.45_r, -0.3_r, 0.3_r), 0.01_r },
+				{ phys::vec3(0.45_r, -0.3_r, -0.3_r), 0.01_r }
+			};
+			scene.world.run_physics(dt);
+
+			const phys::contact_container &contacts = scene.world.get_contacts();
+			const auto has_point = [&](const phys::vec3 &offset) {
+				return std::any_of(std::begin(contacts), std::end(contacts), [&](const phys::contact &c) {
+					const phys::vec3 d = c.point - (scene.lower().pos + offset);
+
+					return phys::dot(d, d) < 1e-6_r;
+				});
+			};
+
+			expect_msg("keeps four points", contacts.size() == 4);
+			expect_msg("keeps the deepest point", has_point(phys::vec3(0.45_r, 0.0_r, 0.0_r)));
+			expect_msg("drops the point in the middle", ! has_point(phys::vec3(0.45_r, 0.0_r, 0.1_r)));
+
+			for (scripted_point &p : script) {
+				p.offset.y += 0.005_r;
+			}
+
+			scene.world.run_physics(dt);
+
+			expect_msg("new points replace the points they match", contacts.size() == 4);
+			expect_msg("replaced points move", has_point(phys::vec3(0.45_r, 0.005_r, 0.0_r)));
+		});
+
+		it("Drops the manifolds of bodies that move apart", []() {
+			scripted_scene scene{};
+
+			script = { { phys::vec3(0.45_r, 0.0_r, 0.0_r), 0.1_r } };
+			scene.world.run_physics(dt);
+			expect_msg("keeps a manifold for the pair", scene.world.manifolds.get_manifolds().size() == 1);
+
+			scene.second.pos.x = 10.0_r;
+			scene.world.run_physics(dt);
+			expect_msg("drops the manifold", scene.world.manifolds.get_manifolds().empty());
+			expect_msg("no contacts", scene.world.get_contacts().empty());
+		});
+	});
+
+	describe("Sequential impulse resolver", []() {
+		it("Holds up a stack of spheres", []() {
+			sphere_scene scene{};
+			phys::sequential_impulse_resolver resolver(50);
+
+			scene.world.set_contact_resolver(&resolver);
+			scene.add_stack(10, 0.5_r);
+			scene.run(300);
+
+			// Each of the ten contacts under the top sphere settles `slop` deep
+			expect_msg("stack stays in place", scene.stack_error(0.5_r) < 10 * resolver.slop + 0.01_r);
+			expect_msg("every contact is warm started", resolver.get_last_warm_started() == scene.world.get_contacts().size());
+		});
+
+		it("Converges in fewer iterations with warm starting", []() {
+			sphere_scene warm_scene{};
+			sphere_scene cold_scene{};
+			phys::sequential_impulse_resolver warm(100);
+			phys::sequential_impulse_resolver cold(100);
+
+			cold.warm_starting = false;
+
+			warm_scene.world.set_contact_resolver(&warm);
+			cold_scene.world.set_contact_resolver(&cold);
+			warm_scene.add_stack(10, 0.5_r);
+			cold_scene.add_stack(10, 0.5_r);
+
+			size_t warm_iterations = 0;
+			size_t cold_iterations = 0;
+
+			for (size_t i = 0; i < 300; i++) {
+				warm_scene.run(1);
+				cold_scene.run(1);
+
+				if (i >= 200) {
+					warm_iterations += warm.get_last_iterations();
+					cold_iterations += cold.get_last_iterations();
+				}
+			}
+
+			expect_msg("warm started stack takes fewer iterations", warm_iterations * 2 < cold_iterations);
+			expect_msg("warm started stack stays in place", warm_scene.stack_error(0.5_r) < 10 * warm.slop + 0.01_r);
+		});
+
+		it("Makes a sliding sphere roll with friction", []() {
+			sphere_scene scene{};
+			phys::sequential_impulse_resolver resolver(20);
+			phys::rigid_body &body = scene.add_sphere(phys::vec3(0.0_r, 0.5_r, 0.0_r), 0.5_r);
+
+			scene.world.set_contact_resolver(&resolver);
+			body.vel.x = 2.0_r;
+			scene.run(120);
+
+			// A solid sphere keeps 5/7 of its speed once it rolls without slipping
+			expect_msg("sphere keeps 5/7 of its speed", std::abs(body.vel.x - 2.0_r * 5.0_r / 7.0_r) < 0.05_r);
+			expect_msg("sphere rolls without slipping", std::abs(body.ang_vel.z * 0.5_r + body.vel.x) < 0.05_r);
+		});
+	});
+
+	describe("Contact islands", []() {
+		it("Puts bodies that touch through contacts in the same island", []() {
+			sphere_scene scene{};
+			phys::sequential_impulse_resolver resolver(20);
+			phys::thread_pool pool(4);
+
+			scene.world.set_contact_resolver(&resolver);
+			scene.world.set_thread_pool(&pool);
+
+			// Two stacks of three, and one sphere on its own
+			for (size_t i = 0; i < 3; i++) {
+				scene.add_sphere(phys::vec3(0.0_r, 0.5_r + i * 1.0_r, 0.0_r), 0.5_r);
+				scene.add_sphere(phys::vec3(3.0_r, 0.5_r + i * 1.0_r, 0.0_r), 0.5_r);
+			}
+
+			scene.add_sphere(phys::vec3(-3.0_r, 0.5_r, 0.0_r), 0.5_r);
+			scene.run(30);
+
+			const phys::contact_partition &partition = scene.world.get_contact_partition();
+			const phys::contact_container &contacts = scene.world.get_island_contacts();
+			std::vector<std::pair<const phys::rigid_body *, size_t>> body_islands{};
+
+			for (size_t i = 0; i < partition.num_islands(); i++) {
+				for (size_t j = partition.island_offsets[i]; j < partition.island_offsets[i + 1]; j++) {
+					for (const phys::rigid_body * body : { contacts[j].a, contacts[j].b }) {
+						if (body->has_finite_mass()) {
+							body_islands.push_back({ body, i });
+						}
+					}
+				}
+			}
+
+			std::sort(std::begin(body_islands), std::end(body_islands));
+			body_islands.erase(std::unique(std::begin(body_islands), std::end(body_islands)), std::end(body_islands));
+
+			const bool one_island_each = std::adjacent_find(std::begin(body_islands), std::end(body_islands), [](const auto &x, const auto &y) {
+				return x.first == y.first;
+			}) == std::end(body_islands);
+
+			expect_msg("every contact is in an island", contacts.size() == scene.world.get_contacts().size());
+			expect_msg("one island for each stack and one for the lone sphere", partition.num_islands() == 3);
+			expect_msg("no body is in two islands", one_island_each && body_islands.size() == 7);
+		});
+
+		it("Colors the largest island so that contacts of a color share no moving body", []() {
+			sphere_scene scene{};
+			phys::sequential_impulse_resolver resolver(20);
+			phys::thread_pool pool(4);
+
+			scene.world.set_contact_resolver(&resolver);
+			scene.world.set_thread_pool(&pool);
+
+			// A pyramid of spheres, each resting on the four below it
+			for (size_t y = 0; y < 4; y++) {
+				for (size_t x = 0; x < 4 - y; x++) {
+					for (size_t z = 0; z < 4 - y; z++) {
+						const phys::real offset = (phys::real)y * 0.5_r;
+
+						scene.add_sphere(phys::vec3(x + offset, 0.5_r + y * 0.71_r, z + offset), 0.5_r);
+					}
+				}
+			}
+
+			scene.run(10);
+
+			const phys::contact_partition &partition = scene.world.get_contact_partition();
+			const phys::contact_container &contacts = scene.world.get_island_contacts();
+			const size_t island = partition.split_island;
+			bool disjoint = true;
+
+			for (size_t k = 0; k + 1 < partition.num_colors(); k++) {
+				std::vector<const phys::rigid_body *> used{};
+
+				for (size_t j = partition.color_offsets[k]; j < partition.color_offsets[k + 1]; j++) {
+					for (const phys::rigid_body * body : { contacts[j].a, contacts[j].b }) {
+						if (body->has_finite_mass()) {
+							used.push_back(body);
+						}
+					}
+				}
+
+				std::sort(std::begin(used), std::end(used));
+				disjoint &= std::adjacent_find(std::begin(used), std::end(used)) == std::end(used);
+			}
+
+			expect_msg("the pyramid is one island", partition.num_islands() == 1);
+			expect_msg("the colors cover the island", partition.color_offsets.front() == partition.island_offsets[island] && partition.color_offsets.back() == partition.island_offsets[island + 1]);
+			expect_msg("several colors are used", partition.color_offsets[1] < partition.color_offsets.back());
+			expect_msg("contacts of a color share no moving body", disjoint);
+		});
+
+		it("Bounces the same way with and without a thread pool", []() {
+			phys::thread_pool pool(4);
+			phys::real max_diff = 0.0_r;
+			phys::real max_speed = 0.0_r;
+
+			// A sphere falls onto one that rests on the ground, whose contact with the ground
+			// is warm started when the two meet
+			const auto drop = [&](phys::thread_pool * p) {
+				std::unique_ptr<sphere_scene> scene = std::make_unique<sphere_scene>();
+				phys::sequential_impulse_resolver resolver(50, 1e-6_r, 0.5_r, 0.5_r);
+
+				scene->world.set_contact_resolver(&resolver);
+				scene->world.set_thread_pool(p);
+				scene->add_sphere(phys::vec3(0.0_r, 0.5_r, 0.0_r), 0.5_r);
+				scene->add_sphere(phys::vec3(0.0_r, 2.5_r, 0.0_r), 0.5_r);
+
+				std::vector<phys::vec3> vels{};
+
+				for (size_t i = 0; i < 60; i++) {
+					scene->run(1);
+					vels.push_back(scene->bodies[1]->vel);
+				}
+
+				return vels;
+			};
+
+			const std::vector<phys::vec3> serial = drop(nullptr);
+			const std::vector<phys::vec3> parallel = drop(&pool);
+
+			for (size_t i = 0; i < serial.size(); i++) {
+				const phys::vec3 d = serial[i] - parallel[i];
+
+				max_diff = std::max(max_diff, std::sqrt(phys::dot(d, d)));
+				max_speed = std::max(max_speed, serial[i].y);
+			}
+
+			expect_msg("the top sphere bounces", max_speed > 1.0_r);
+			expect_msg("velocities are within 0.1 mm/s (got " + std::to_string(max_diff) + ")", max_diff < 0.0001_r);
+		});
+
+		it("Holds up a stack of spheres with a thread pool", []() {
+			sphere_scene scene{};
+			phys::sequential_impulse_resolver resolver(50);
+			phys::thread_pool pool(4);
+
+			scene.world.set_contact_resolver(&resolver);
+			scene.world.set_thread_pool(&pool);
+			scene.add_stack(10, 0.5_r);
+			scene.run(300);
+
+			// Each of the ten contacts under the top sphere settles `slop` deep
+			expect_msg("stack stays in place", scene.stack_error(0.5_r) < 10 * resolver.slop + 0.01_r);
+			expect_msg("every contact is warm started", resolver.get_last_warm_started() == scene.world.get_contacts().size());
+		});
+	});
+}
\ No newline at end of file
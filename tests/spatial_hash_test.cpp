@@ -0,0 +1,111 @@
+#include <random>
+#include "../shared/physics/collision/spatial_hash.h"
+#include "test.h"
+
+using namespace test;
+using namespace phys::literals;
+
+using grid_t = phys::spatial_hash<int>;
+
+namespace {
+	template <typename Container>
+	size_t count_collisions(const Container &c, int id1, int id2) {
+		size_t out = 0;
+
+		for (const auto &pair : c) {
+			if (pair.id1 == id1 && pair.id2 == id2 ||
+				pair.id1 == id2 && pair.id2 == id1) {
+				out++;
+			}
+		}
+
+		return out;
+	}
+}
+
+void setup_spatial_hash_tests() {
+	describe("Spatial hash", []() {
+		it("Generates pairs of overlapping spheres", []() {
+			grid_t grid(1.0_r);
+			std::vector<grid_t::collision_pair> pairs{};
+
+			grid.insert(1, phys::vec3(0.5_r), 0.3_r);
+			grid.insert(2, phys::vec3(0.9_r, 0.5_r, 0.5_r), 0.3_r);
+			grid.insert(3, phys::vec3(5.0_r), 0.3_r);
+			grid.insert(4, phys::vec3(5.2_r, 5.0_r, 5.0_r), 0.1_r);
+
+			grid.generate_collision_pairs(pairs);
+
+			expect(pairs).to_have_size(2);
+			expect_msg("contains collision between 1 and 2", count_collisions(pairs, 1, 2) == 1);
+			expect_msg("contains collision between 3 and 4", count_collisions(pairs, 3, 4) == 1);
+		});
+
+		it("Generates a pair only once when spheres share several cells", []() {
+			grid_t grid(0.5_r);
+			std::vector<grid_t::collision_pair> pairs{};
+
+			// Both spheres straddle the cell boundaries at the origin on every axis
+			grid.insert(1, phys::vec3(0.0_r), 0.4_r);
+			grid.insert(2, phys::vec3(0.1_r, -0.1_r, 0.05_r), 0.4_r);
+
+			grid.generate_collision_pairs(pairs);
+
+			expect(pairs).to_have_size(1);
+			expect_msg("contains collision between 1 and 2", count_collisions(pairs, 1, 2) == 1);
+		});
+
+		it("Does not keep objects from a previous frame", []() {
+			grid_t grid(1.0_r);
+			std::vector<grid_t::collision_pair> pairs{};
+
+			grid.insert(1, phys::vec3(0.0_r), 0.5_r);
+			grid.insert(2, phys::vec3(0.1_r), 0.5_r);
+			grid.clear();
+
+			expect_msg("size is 0", grid.size() == 0);
+
+			grid.insert(3, phys::vec3(0.0_r), 0.5_r);
+			grid.generate_collision_pairs(pairs);
+
+			expect(pairs).to_have_size(0);
+		});
+
+		it("Generates the same pairs as a brute force search", []() {
+			std::mt19937 gen(42);
+			std::uniform_real_distribution<phys::real> coord_distrib(-10.0_r, 10.0_r);
+			std::uniform_real_distribution<phys::real> radius_distrib(0.05_r, 0.6_r);
+			std::vector<phys::vec3> centers{};
+			std::vector<phys::real> radii{};
+			std::vector<grid_t::collision_pair> pairs{};
+			grid_t grid(0.5_r);
+
+			for (int i = 0; i < 1500; i++) {
+				centers.push_back(phys::vec3(coord_distrib(gen), coord_distrib(gen), coord_distrib(gen)));
+				radii.push_back(radius_distrib(gen));
+				grid.insert(i, centers[i], radii[i]);
+			}
+
+			grid.generate_collision_pairs(pairs);
+
+			size_t expected_pairs = 0;
+
+			for (int i = 0; i < (int)centers.size(); i++) {
+				for (int j = i + 1; j < (int)centers.size(); j++) {
+					const phys::vec3 d = centers[j] - centers[i];
+					const phys::real r = radii[i] + radii[j];
+
+					if (phys::dot(d, d) <= r * r) {
+						expected_pairs++;
+
+						if (count_collisions(pairs, i, j) != 1) {
+							fail_msg("expected exactly one collision between " + std::to_string(i) + " and " + std::to_string(j));
+						}
+					}
+				}
+			}
+
+			expect(pairs).to_have_size(expected_pairs);
+		});
+	});
+}
@@ -0,0 +1,52 @@
+#include <atomic>
+#include <vector>
+#include "../shared/physics/thread_pool.h"
+#include "test.h"
+
+using namespace test;
+
+void setup_thread_pool_tests() {
+	describe("Thread pool", []() {
+		it("Runs every index of a parallel loop exactly once", []() {
+			phys::thread_pool pool(4);
+			std::vector<std::atomic<int>> visits(10'000);
+
+			pool.parallel_for(visits.size(), 64, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++) {
+					visits[i]++;
+				}
+			});
+
+			for (size_t i = 0; i < visits.size(); i++) {
+				if (visits[i] != 1) {
+					fail_msg("index " + std::to_string(i) + " was visited " + std::to_string(visits[i]) + " times");
+				}
+			}
+		});
+
+		it("Can run many loops in a row", []() {
+			phys::thread_pool pool(4);
+			std::atomic<size_t> total = 0;
+
+			for (size_t i = 0; i < 1000; i++) {
+				pool.parallel_for(100, 10, [&](size_t begin, size_t end) {
+					total += (end - begin);
+				});
+			}
+
+			expect_msg("100000 items were visited", total == 100'000);
+		});
+
+		it("Runs loops inline with one thread", []() {
+			phys::thread_pool pool(1);
+			size_t count = 0;
+
+			pool.parallel_for(1000, 10, [&](size_t begin, size_t end) {
+				count += (end - begin);
+			});
+
+			expect_msg("pool has one thread", pool.get_num_threads() == 1);
+			expect_msg("1000 items were visited", count == 1000);
+		});
+	});
+}